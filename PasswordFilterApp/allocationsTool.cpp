@@ -0,0 +1,249 @@
+#include "pch.h"
+#include <cmath>
+#include "passwordFilter.h"
+#include "allocationAccounting.h"
+#include "allocationsTool.h"
+#include "mockIdm.h"
+#include "textCodec.h"
+
+
+namespace
+{
+   struct AllocationsOptions
+   {
+      uint32_t mCalls = 200;
+      uint16_t mPort = 18083;
+      ut::string_t mTemplate; // filter configuration template, see MockIdm::writeConfig
+      ut::string_t mBudget;   // e.g. Resources\PasswordFilterAllocationBudget.json
+      ut::string_t mRecord;   // the budget file written from this measurement
+      uint32_t mMarginPct = 10;
+   };
+
+   struct Budget
+   {
+      bool mRecorded = false; // both figures are present
+      double mAllocationsPerCall = 0;
+      double mCopiesPerCall = 0;
+   };
+
+   void printAllocationsUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp allocations [--calls <count>] [--port <port>] [--template <cfg file>] [--budget <json file>]" << std::endl
+         << "         [--record <json file>] [--margin <percent>]" << std::endl
+         << "  Makes <count> PasswordFilter and <count> PasswordChangeNotify calls against a mock IdM listening on 127.0.0.1:<port>" << std::endl
+         << "  and reports the heap allocations and the string copies per call and phase. It needs the allocation accounting" << std::endl
+         << "  build of the DLL (msbuild /p:Configuration=Debug /p:PwfAllocAccounting=true). With --budget it fails with the exit" << std::endl
+         << "  code 2 when the allocations or the copies per call of an entry point exceed the budget, or the budget has no figures," << std::endl
+         << "  e.g. Resources\\PasswordFilterAllocationBudget.json. --record writes the measured figures plus <percent> (10 by default)" << std::endl
+         << "  as the budget file to commit." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], AllocationsOptions& options)
+   {
+      for (int i = 0; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         std::string value(argv[i + 1]);
+         if (name == "--calls")
+            options.mCalls = static_cast<uint32_t>(std::stoul(value));
+         else if (name == "--port")
+            options.mPort = static_cast<uint16_t>(std::stoul(value));
+         else if (name == "--template")
+            options.mTemplate = ut::conversions::to_string_t(value);
+         else if (name == "--budget")
+            options.mBudget = ut::conversions::to_string_t(value);
+         else if (name == "--record")
+            options.mRecord = ut::conversions::to_string_t(value);
+         else if (name == "--margin")
+            options.mMarginPct = static_cast<uint32_t>(std::stoul(value));
+         else
+            return false;
+      }
+      return argc % 2 == 0 && options.mCalls > 0;
+   }
+
+   Budget readBudget(const wj::value& budgetObj, const ut::string_t& entryPoint)
+   {
+      Budget budget;
+      if (!budgetObj.has_object_field(entryPoint))
+         return budget;
+      const wj::value& entryObj = budgetObj.at(entryPoint);
+      if (!entryObj.has_number_field(U("allocationsPerCall")) || !entryObj.has_number_field(U("copiesPerCall")))
+         return budget;
+      budget.mAllocationsPerCall = entryObj.at(U("allocationsPerCall")).as_double();
+      budget.mCopiesPerCall = entryObj.at(U("copiesPerCall")).as_double();
+      budget.mRecorded = true;
+      return budget;
+   }
+
+   /**
+   * The recorded figures are whole numbers rounded up after the margin is added.
+   */
+   wj::value recordBudget(const Budget& measured, uint32_t marginPct)
+   {
+      wj::value entryObj = wj::value::object();
+      entryObj[U("allocationsPerCall")] = wj::value::number(std::ceil(measured.mAllocationsPerCall * (100 + marginPct) / 100.0));
+      entryObj[U("copiesPerCall")] = wj::value::number(std::ceil(measured.mCopiesPerCall * (100 + marginPct) / 100.0));
+      return entryObj;
+   }
+
+   UNICODE_STRING toUnicodeString(std::wstring& str)
+   {
+      UNICODE_STRING uniStr;
+      uniStr.Buffer = str.data();
+      uniStr.Length = static_cast<USHORT>(str.size() * sizeof(wchar_t));
+      uniStr.MaximumLength = uniStr.Length;
+      return uniStr;
+   }
+
+   void makeCalls(uint32_t first, uint32_t count)
+   {
+      for (uint32_t i = first; i < first + count; ++i)
+      {
+         std::wstring account = L"allocations" + std::to_wstring(i); // a new account every time, so no cache answers
+         std::wstring fullName = account;
+         std::wstring password = L"Allocation-Report-1";
+         UNICODE_STRING uAccount = toUnicodeString(account);
+         UNICODE_STRING uFullName = toUnicodeString(fullName);
+         UNICODE_STRING uPassword = toUnicodeString(password);
+         PasswordFilter(&uAccount, &uFullName, &uPassword, FALSE);
+         PasswordChangeNotify(&uAccount, i, &uPassword);
+      }
+   }
+
+   /**
+   * printReport prints the stats of the entry point and returns the figures per call.
+   */
+   Budget printReport(const char* entryPoint, const AllocationStats& stats)
+   {
+      const double calls = static_cast<double>(std::max<uint64_t>(stats.mCalls, 1));
+      uint64_t allocations = 0;
+      uint64_t copies = 0;
+      std::cout << entryPoint << ": " << stats.mCalls << " calls" << std::endl
+         << "  phase          allocations/call   bytes/call   copies/call   copied bytes/call" << std::endl;
+      for (int phase = 0; phase < AllocationStats::PHASE_COUNT; ++phase)
+      {
+         allocations += stats.mAllocations[phase];
+         copies += stats.mCopies[phase];
+         std::cout << "  " << std::left << std::setw(13) << AllocationStats::getPhaseName(phase) << std::right
+            << std::setw(18) << stats.mAllocations[phase] / calls << "   " << std::setw(10) << stats.mBytes[phase] / calls << "   "
+            << std::setw(11) << stats.mCopies[phase] / calls << "   " << std::setw(17) << stats.mCopyBytes[phase] / calls << std::endl;
+      }
+      Budget measured;
+      measured.mRecorded = true;
+      measured.mAllocationsPerCall = allocations / calls;
+      measured.mCopiesPerCall = copies / calls;
+      std::cout << "  " << std::left << std::setw(13) << "total" << std::right << std::setw(18) << measured.mAllocationsPerCall << "   "
+         << std::setw(10) << "" << "   " << std::setw(11) << measured.mCopiesPerCall << std::endl
+         << "  the most allocations of one call: " << stats.mMaxCallAllocations << std::endl;
+      return measured;
+   }
+
+   /**
+   * checkBudget returns false when the figures are over the budget or the budget has none.
+   */
+   bool checkBudget(const Budget& measured, const Budget& budget)
+   {
+      if (!budget.mRecorded)
+      {
+         std::cout << "  NO BUDGET: the figures of the entry point are not recorded, record them by --record" << std::endl;
+         return false;
+      }
+      bool withinBudget = true;
+      if (measured.mAllocationsPerCall > budget.mAllocationsPerCall)
+      {
+         std::cout << "  OVER BUDGET: " << measured.mAllocationsPerCall << " allocations per call, the budget is " << budget.mAllocationsPerCall << std::endl;
+         withinBudget = false;
+      }
+      if (measured.mCopiesPerCall > budget.mCopiesPerCall)
+      {
+         std::cout << "  OVER BUDGET: " << measured.mCopiesPerCall << " string copies per call, the budget is " << budget.mCopiesPerCall << std::endl;
+         withinBudget = false;
+      }
+      return withinBudget;
+   }
+}
+
+int runAllocations(int argc, char* argv[])
+{
+   AllocationsOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printAllocationsUsage();
+      return 1;
+   }
+
+   AllocationStats stats;
+   if (!GetAllocationStats(AllocationStats::KIND_PASSWORD_FILTER, &stats, TRUE))
+   {
+      std::cerr << "The DLL is not the allocation accounting build, rebuild it by msbuild /p:Configuration=Debug /p:PwfAllocAccounting=true" << std::endl;
+      return 1;
+   }
+
+   wj::value budgetObj = wj::value::object();
+   if (!options.mBudget.empty())
+   {
+      std::ifstream in(options.mBudget);
+      if (in.fail())
+      {
+         std::cerr << "The budget file can't be opened" << std::endl;
+         return 1;
+      }
+      try
+      {
+         budgetObj = wj::value::parse(in);
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "The budget file is not valid: " << e.what() << std::endl;
+         return 1;
+      }
+   }
+
+   MockIdm mock(options.mPort, 1, [](size_t, const ut::string_t&, const wj::value&) { return MockIdmResponse(); });
+   try
+   {
+      mock.start();
+      std::filesystem::path cfgPath = std::filesystem::temp_directory_path() / "PasswordFilterAllocations.cfg";
+      mock.writeConfig(options.mTemplate, cfgPath.native(), 1);
+      _putenv_s("BCV_PWF_CONFIG_FILE_PATH", cfgPath.string().c_str()); // read by the filter on its lazy init
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "The mock IdM can't be started: " << e.what() << std::endl;
+      return 1;
+   }
+   InitializeChangeNotify();
+   makeCalls(0, 10); // warms up the lazy initialization, the token and the connections
+   GetAllocationStats(AllocationStats::KIND_PASSWORD_FILTER, &stats, TRUE);
+   GetAllocationStats(AllocationStats::KIND_PASSWORD_CHANGE_NOTIFY, &stats, TRUE);
+
+   makeCalls(10, options.mCalls);
+   mock.stop();
+
+   std::cout << std::fixed << std::setprecision(1);
+   GetAllocationStats(AllocationStats::KIND_PASSWORD_FILTER, &stats, FALSE);
+   Budget filterFigures = printReport("PasswordFilter", stats);
+   GetAllocationStats(AllocationStats::KIND_PASSWORD_CHANGE_NOTIFY, &stats, FALSE);
+   Budget notifyFigures = printReport("PasswordChangeNotify", stats);
+
+   if (!options.mRecord.empty())
+   {
+      wj::value recordObj = wj::value::object();
+      recordObj[U("passwordFilter")] = recordBudget(filterFigures, options.mMarginPct);
+      recordObj[U("passwordChangeNotify")] = recordBudget(notifyFigures, options.mMarginPct);
+      std::ofstream out(options.mRecord, std::ios::binary | std::ios::trunc);
+      out << TextCodec::toUtf8(recordObj.serialize()) << std::endl;
+      if (out.fail())
+      {
+         std::cerr << "The budget file can't be written" << std::endl;
+         return 1;
+      }
+      std::cout << "The budget with a margin of " << options.mMarginPct << " % is recorded" << std::endl;
+   }
+   if (options.mBudget.empty())
+      return 0;
+   bool withinBudget = checkBudget(filterFigures, readBudget(budgetObj, U("passwordFilter")));
+   withinBudget &= checkBudget(notifyFigures, readBudget(budgetObj, U("passwordChangeNotify")));
+   return withinBudget ? 0 : 2;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "allocations" command of PasswordFilterApp.
+* Reports the heap allocations and the string copies per call and per phase of the allocation accounting build
+* of the DLL and checks them against a committed budget.
+*/
+int runAllocations(int argc, char* argv[]);
@@ -0,0 +1,224 @@
+#include "pch.h"
+#include <random>
+#include "codecTool.h"
+#include "textCodec.h"
+
+
+namespace
+{
+   struct CodecOptions
+   {
+      uint32_t mIterations = 200000;
+      uint32_t mSeed = 1;
+   };
+
+   void printCodecUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp codec [--iterations <count>] [--seed <seed>]" << std::endl
+         << "  Round trips every code point and <count> random strings through every SIMD level available" << std::endl
+         << "  on this CPU, then benchmarks the conversion of typical request content." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], CodecOptions& options)
+   {
+      for (int i = 0; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--iterations")
+            options.mIterations = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else if (name == "--seed")
+            options.mSeed = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else
+            return false;
+      }
+      return argc % 2 == 0;
+   }
+
+   std::vector<TextCodec::simdLevel> getAvailableLevels()
+   {
+      std::vector<TextCodec::simdLevel> levels{ TextCodec::SIMD_NONE };
+      for (TextCodec::simdLevel level : { TextCodec::SIMD_SSE2, TextCodec::SIMD_AVX2 })
+      {
+         if (level <= TextCodec::getSimdLevel())
+            levels.push_back(level);
+      }
+      return levels;
+   }
+
+   std::u16string encodeCodePoint(uint32_t cp)
+   {
+      std::u16string out;
+      if (cp < 0x10000)
+      {
+         out.push_back(static_cast<char16_t>(cp));
+      }
+      else
+      {
+         cp -= 0x10000;
+         out.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+         out.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+      }
+      return out;
+   }
+
+   std::string toUtf8(const std::u16string& str, TextCodec::simdLevel level)
+   {
+      std::string out(TextCodec::getMaxUtf8Size(str.size()), '\0');
+      out.resize(TextCodec::utf16ToUtf8(str.data(), str.size(), &out[0], level));
+      return out;
+   }
+
+   std::u16string toUtf16(const std::string& str, TextCodec::simdLevel level)
+   {
+      std::u16string out(TextCodec::getMaxUtf16Size(str.size()), u'\0');
+      out.resize(TextCodec::utf8ToUtf16(str.data(), str.size(), &out[0], level));
+      return out;
+   }
+
+   /**
+   * Every scalar value encodes to the expected number of bytes and decodes back to itself.
+   */
+   size_t checkAllCodePoints(const std::vector<TextCodec::simdLevel>& levels)
+   {
+      size_t failures = 0;
+      for (uint32_t cp = 0; cp <= 0x10FFFF; ++cp)
+      {
+         if (cp >= 0xD800 && cp <= 0xDFFF)
+            continue;
+         std::u16string str = encodeCodePoint(cp);
+         size_t expectedSize = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+         for (TextCodec::simdLevel level : levels)
+         {
+            std::string utf8 = toUtf8(str, level);
+            if (utf8.size() != expectedSize || toUtf16(utf8, level) != str)
+            {
+               if (failures++ < 10)
+                  std::cout << "  code point U+" << std::hex << cp << std::dec << " fails at " << TextCodec::getSimdLevelName(level) << std::endl;
+            }
+         }
+      }
+      return failures;
+   }
+
+   /**
+   * Random strings, mostly ASCII with runs of 2 and 3 byte characters, surrogate pairs and unpaired surrogates,
+   * have to give the same result at every SIMD level as the scalar path.
+   */
+   size_t checkRandomStrings(const std::vector<TextCodec::simdLevel>& levels, const CodecOptions& options)
+   {
+      std::mt19937 rng(options.mSeed);
+      size_t failures = 0;
+      for (uint32_t it = 0; it < options.mIterations; ++it)
+      {
+         size_t length = rng() % 100;
+         std::u16string str;
+         for (size_t i = 0; i < length; ++i)
+         {
+            uint32_t kind = rng() % 100;
+            if (kind < 85)
+               str.push_back(static_cast<char16_t>(0x20 + rng() % 95));
+            else if (kind < 93)
+               str.push_back(static_cast<char16_t>(0x80 + rng() % 0x700));
+            else if (kind < 97)
+               str.push_back(static_cast<char16_t>(0xE000 + rng() % 0x1000));
+            else
+            {
+               str.push_back(static_cast<char16_t>(0xD800 + rng() % 0x400));
+               if (rng() % 4 != 0)
+                  str.push_back(static_cast<char16_t>(0xDC00 + rng() % 0x400));
+            }
+         }
+
+         std::string expectedUtf8 = toUtf8(str, TextCodec::SIMD_NONE);
+         std::u16string expectedUtf16 = toUtf16(expectedUtf8, TextCodec::SIMD_NONE);
+         for (TextCodec::simdLevel level : levels)
+         {
+            std::string utf8 = toUtf8(str, level);
+            if (utf8 != expectedUtf8 || toUtf16(utf8, level) != expectedUtf16)
+            {
+               if (failures++ < 10)
+                  std::cout << "  random string " << it << " of length " << length << " fails at " << TextCodec::getSimdLevelName(level) << std::endl;
+            }
+         }
+      }
+      return failures;
+   }
+
+   template <typename Function>
+   double measureMBps(size_t bytesPerRun, Function function)
+   {
+      const auto minDuration = std::chrono::milliseconds(300);
+      size_t runs = 0;
+      auto start = std::chrono::steady_clock::now();
+      auto elapsed = std::chrono::steady_clock::duration::zero();
+      while (elapsed < minDuration)
+      {
+         for (int i = 0; i < 100; ++i)
+            function();
+         runs += 100;
+         elapsed = std::chrono::steady_clock::now() - start;
+      }
+      return bytesPerRun * runs / 1e6 / std::chrono::duration<double>(elapsed).count();
+   }
+
+   void benchmark(const std::vector<TextCodec::simdLevel>& levels)
+   {
+      ut::string_t request;
+      for (int i = 0; i < 8; ++i)
+         request += U("{\"username\":\"jnovak") + ut::conversions::to_string_t(std::to_string(i)) + U("\",\"password\":\"Xy12-abcdefgh\",\"resource\":\"AD-PROD\",\"logIdentifier\":\"1234567890\"}");
+      const std::vector<std::pair<std::string, ut::string_t>> samples{
+         { "account name", U("jnovak.admin") },
+         { "request body", request },
+         { "czech text", U("Příliš žluťoučký kůň úpěl ďábelské ódy") }
+      };
+
+      std::cout << std::left << std::setw(14) << "sample" << std::setw(12) << "direction" << std::setw(12) << "cpprest";
+      for (TextCodec::simdLevel level : levels)
+         std::cout << std::setw(12) << TextCodec::getSimdLevelName(level);
+      std::cout << "(MB/s of UTF-8)" << std::endl;
+
+      for (const auto& sample : samples)
+      {
+         const ut::string_t& wide = sample.second;
+         const std::string utf8 = TextCodec::toUtf8(wide);
+         const std::u16string utf16(reinterpret_cast<const char16_t*>(wide.data()), wide.size());
+         std::string utf8Buffer(TextCodec::getMaxUtf8Size(utf16.size()), '\0');
+         std::u16string utf16Buffer(TextCodec::getMaxUtf16Size(utf8.size()), u'\0');
+         volatile size_t sink = 0;
+
+         std::cout << std::setw(14) << sample.first << std::setw(12) << "to UTF-8" << std::setw(12) << std::fixed << std::setprecision(0)
+            << measureMBps(utf8.size(), [&]() { sink = ut::conversions::utf16_to_utf8(ut::conversions::to_utf16string(wide)).size(); });
+         for (TextCodec::simdLevel level : levels)
+            std::cout << std::setw(12) << measureMBps(utf8.size(), [&]() { sink = TextCodec::utf16ToUtf8(utf16.data(), utf16.size(), &utf8Buffer[0], level); });
+         std::cout << std::endl;
+
+         std::cout << std::setw(14) << sample.first << std::setw(12) << "to UTF-16" << std::setw(12)
+            << measureMBps(utf8.size(), [&]() { sink = ut::conversions::utf8_to_utf16(utf8).size(); });
+         for (TextCodec::simdLevel level : levels)
+            std::cout << std::setw(12) << measureMBps(utf8.size(), [&]() { sink = TextCodec::utf8ToUtf16(utf8.data(), utf8.size(), &utf16Buffer[0], level); });
+         std::cout << std::endl;
+      }
+   }
+}
+
+int runCodec(int argc, char* argv[])
+{
+   CodecOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printCodecUsage();
+      return 1;
+   }
+
+   std::vector<TextCodec::simdLevel> levels = getAvailableLevels();
+   std::cout << "Detected SIMD level: " << TextCodec::getSimdLevelName(TextCodec::getSimdLevel()) << std::endl;
+
+   size_t failures = checkAllCodePoints(levels);
+   std::cout << "All code points round trip: " << (failures == 0 ? "OK" : "FAILED") << std::endl;
+   size_t randomFailures = checkRandomStrings(levels, options);
+   std::cout << options.mIterations << " random strings: " << (randomFailures == 0 ? "OK" : "FAILED") << std::endl;
+   failures += randomFailures;
+
+   benchmark(levels);
+   return failures == 0 ? 0 : 2;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "codec" command of PasswordFilterApp.
+* Checks the UTF-16/UTF-8 transcoding of the filter (see TextCodec) against its scalar path for every
+* Unicode code point and for random mixed strings, then compares its throughput with the cpprest conversions.
+*/
+int runCodec(int argc, char* argv[]);
@@ -0,0 +1,77 @@
+#include "pch.h"
+#include <iostream>
+#include "controlTool.h"
+
+
+namespace
+{
+   const wchar_t* sDefaultPipeName = L"\\\\.\\pipe\\CzechIdMPasswordFilter";
+   const DWORD sBufferSize = 64 * 1024;
+   const DWORD sConnectTimeoutMs = 5000;
+
+   void printControlUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp control <command> [--pipe <pipe name>]" << std::endl
+         << "  Commands: status, inflight, endpoints, config, reload, flush, drain" << std::endl
+         << "  The control channel has to be enabled in the configuration (controlChannel.enabled)" << std::endl
+         << "  and the tool has to run as an administrator." << std::endl;
+   }
+}
+
+int runControl(int argc, char* argv[])
+{
+   if (argc < 1)
+   {
+      printControlUsage();
+      return 1;
+   }
+
+   std::string command(argv[0]);
+   std::wstring pipeName(sDefaultPipeName);
+   for (int i = 1; i + 1 < argc; i += 2)
+   {
+      if (std::string(argv[i]) == "--pipe")
+         pipeName = ut::conversions::to_string_t(std::string(argv[i + 1]));
+   }
+
+   if (!WaitNamedPipeW(pipeName.c_str(), sConnectTimeoutMs))
+   {
+      std::cerr << "The control channel isn't available, error " << GetLastError() << std::endl;
+      return 2;
+   }
+   HANDLE pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+   if (pipe == INVALID_HANDLE_VALUE)
+   {
+      std::cerr << "The control channel can't be opened, error " << GetLastError() << std::endl;
+      return 2;
+   }
+
+   DWORD mode = PIPE_READMODE_MESSAGE;
+   SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+   int result = 0;
+   DWORD written = 0;
+   if (!WriteFile(pipe, command.data(), static_cast<DWORD>(command.size()), &written, nullptr))
+   {
+      std::cerr << "The command can't be sent, error " << GetLastError() << std::endl;
+      result = 2;
+   }
+   else
+   {
+      std::vector<char> buffer(sBufferSize);
+      std::string response;
+      while (true)
+      {
+         DWORD read = 0;
+         BOOL ok = ReadFile(pipe, buffer.data(), sBufferSize, &read, nullptr);
+         response.append(buffer.data(), read);
+         if (ok || GetLastError() != ERROR_MORE_DATA)
+            break;
+      }
+      std::cout << response;
+      if (response.rfind("ERROR", 0) == 0)
+         result = 1;
+   }
+   CloseHandle(pipe);
+   return result;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "control" command of PasswordFilterApp.
+* Sends one command to the control channel of the filter running in LSASS (see ControlChannel)
+* and prints the response.
+*/
+int runControl(int argc, char* argv[]);
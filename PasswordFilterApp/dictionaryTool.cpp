@@ -0,0 +1,305 @@
+#include "pch.h"
+#include <deque>
+#include <map>
+#include <set>
+#include "dictionaryTool.h"
+#include "forbiddenDictionary.h"
+#include "textCodec.h"
+
+namespace fs = std::filesystem;
+
+
+namespace
+{
+   struct DictionaryOptions
+   {
+      std::string mAction;
+      std::string mInputPath;
+      std::string mOutputPath;
+      ut::string_t mPassword;
+      uint32_t mMinLength = 4;
+   };
+
+   /**
+   * TrieNode is the build time representation of one automaton state.
+   */
+   struct TrieNode
+   {
+      std::map<uint8_t, uint32_t> mChildren; // ordered, so the edges are written sorted by the symbol
+      uint32_t mFailure = 0;
+      uint32_t mDepth = 0;
+      uint32_t mMatchLength = 0;
+   };
+
+   void printDictionaryUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp dictionary build <wordlist> <output> [--minLength <length>]" << std::endl
+         << "  Builds the forbidden word dictionary from a UTF-8 word list (one or more words per line)." << std::endl
+         << "  Words shorter than <length> normalized characters (4 by default) are skipped." << std::endl
+         << "  The output is replaced atomically, a running filter picks it up within the configuration check period." << std::endl
+         << "       PasswordFilterApp dictionary check <dictionary> <password> [--minLength <length>]" << std::endl
+         << "  Checks the password against the dictionary the same way as PasswordFilter." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], DictionaryOptions& options)
+   {
+      if (argc < 3)
+         return false;
+      options.mAction = argv[0];
+      options.mInputPath = argv[1];
+      if (options.mAction == "build")
+         options.mOutputPath = argv[2];
+      else if (options.mAction == "check")
+         options.mPassword = TextCodec::toUtf16(std::string(argv[2]));
+      else
+         return false;
+
+      for (int i = 3; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--minLength")
+            options.mMinLength = static_cast<uint32_t>(std::max(1ul, std::stoul(argv[i + 1])));
+         else
+            return false;
+      }
+      return true;
+   }
+
+   /**
+   * readWords splits the word list into normalized words; a separator (any character out of the alphabet) ends a word.
+   */
+   std::set<std::vector<uint8_t>> readWords(std::istream& input, uint32_t minLength)
+   {
+      std::set<std::vector<uint8_t>> words;
+      std::string line;
+      std::vector<uint8_t> word;
+      auto flush = [&]()
+      {
+         if (word.size() >= minLength && word.size() <= UINT8_MAX)
+            words.insert(word);
+         word.clear();
+      };
+
+      while (std::getline(input, line))
+      {
+         for (ut::char_t ch : TextCodec::toUtf16(line))
+         {
+            uint8_t symbol = ForbiddenDictionary::normalize(ch);
+            if (symbol == ForbiddenDictionary::sSeparator)
+               flush();
+            else
+               word.push_back(symbol);
+         }
+         flush();
+      }
+      return words;
+   }
+
+   /**
+   * buildAutomaton creates the trie, computes the failure links and renumbers the states in the breadth first order
+   * the file format requires.
+   */
+   std::vector<TrieNode> buildAutomaton(const std::set<std::vector<uint8_t>>& words)
+   {
+      std::vector<TrieNode> trie(1);
+      for (const auto& word : words)
+      {
+         uint32_t state = 0;
+         for (uint8_t symbol : word)
+         {
+            auto it = trie[state].mChildren.find(symbol);
+            if (it == trie[state].mChildren.end())
+            {
+               trie.emplace_back();
+               trie.back().mDepth = trie[state].mDepth + 1;
+               it = trie[state].mChildren.emplace(symbol, static_cast<uint32_t>(trie.size() - 1)).first;
+            }
+            state = it->second;
+         }
+         trie[state].mMatchLength = static_cast<uint32_t>(word.size());
+      }
+
+      // breadth first numbering
+      std::vector<uint32_t> order; // new index -> old index
+      std::vector<uint32_t> newIndex(trie.size());
+      order.reserve(trie.size());
+      order.push_back(0);
+      for (size_t i = 0; i < order.size(); ++i)
+      {
+         newIndex[order[i]] = static_cast<uint32_t>(i);
+         for (const auto& child : trie[order[i]].mChildren)
+            order.push_back(child.second);
+      }
+
+      std::vector<TrieNode> automaton(trie.size());
+      for (size_t i = 0; i < order.size(); ++i)
+      {
+         automaton[i] = trie[order[i]];
+         for (auto& child : automaton[i].mChildren)
+            child.second = newIndex[child.second];
+      }
+
+      // failure links, the parents are always processed before their children
+      for (uint32_t i = 0; i < automaton.size(); ++i)
+      {
+         for (const auto& child : automaton[i].mChildren)
+         {
+            uint32_t failure = 0;
+            if (i != 0)
+            {
+               uint32_t state = automaton[i].mFailure;
+               while (true)
+               {
+                  auto it = automaton[state].mChildren.find(child.first);
+                  if (it != automaton[state].mChildren.end())
+                  {
+                     failure = it->second;
+                     break;
+                  }
+                  if (state == 0)
+                     break;
+                  state = automaton[state].mFailure;
+               }
+            }
+            TrieNode& target = automaton[child.second];
+            target.mFailure = failure;
+            target.mMatchLength = std::max(target.mMatchLength, automaton[failure].mMatchLength);
+         }
+      }
+      return automaton;
+   }
+
+   void writeDictionary(std::ostream& output, const std::vector<TrieNode>& automaton, size_t wordCount)
+   {
+      ForbiddenDictionary::Header header{};
+      memcpy(header.mMagic, ForbiddenDictionary::sMagic, sizeof(header.mMagic));
+      header.mStateCount = static_cast<uint32_t>(automaton.size());
+      header.mWordCount = static_cast<uint32_t>(wordCount);
+      std::vector<ForbiddenDictionary::State> states(automaton.size());
+      std::vector<ForbiddenDictionary::Edge> edges;
+      for (size_t i = 0; i < automaton.size(); ++i)
+      {
+         states[i].mFirstEdge = static_cast<uint32_t>(edges.size());
+         states[i].mFailure = automaton[i].mFailure;
+         states[i].mEdgeCount = static_cast<uint8_t>(automaton[i].mChildren.size());
+         states[i].mMatchLength = static_cast<uint8_t>(automaton[i].mMatchLength);
+         for (const auto& child : automaton[i].mChildren)
+         {
+            ForbiddenDictionary::Edge edge{};
+            edge.mSymbol = child.first;
+            edge.mTarget = child.second;
+            edges.push_back(edge);
+         }
+      }
+      header.mEdgeCount = static_cast<uint32_t>(edges.size());
+
+      output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      output.write(reinterpret_cast<const char*>(states.data()), states.size() * sizeof(ForbiddenDictionary::State));
+      output.write(reinterpret_cast<const char*>(edges.data()), edges.size() * sizeof(ForbiddenDictionary::Edge));
+   }
+
+   /**
+   * publish moves the new dictionary over the old one. The running filter keeps the old file mapped,
+   * it was opened with FILE_SHARE_DELETE, so it can be renamed away when it can't be replaced directly.
+   */
+   bool publish(const fs::path& tmpPath, const fs::path& outputPath)
+   {
+      if (MoveFileExW(tmpPath.c_str(), outputPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+         return true;
+
+      for (uint32_t i = 0; i < 100; ++i)
+      {
+         fs::path oldPath = outputPath;
+         oldPath += L"." + std::to_wstring(i) + L".old";
+         DeleteFileW(oldPath.c_str()); // best effort, an old file still mapped by the filter can't be deleted
+         if (MoveFileExW(outputPath.c_str(), oldPath.c_str(), 0))
+            return MoveFileExW(tmpPath.c_str(), outputPath.c_str(), 0) != FALSE;
+      }
+      return false;
+   }
+
+   int build(const DictionaryOptions& options)
+   {
+      std::ifstream input(options.mInputPath, std::ios_base::binary);
+      if (input.fail())
+      {
+         std::cerr << "The word list " << options.mInputPath << " can't be opened" << std::endl;
+         return 1;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      std::set<std::vector<uint8_t>> words = readWords(input, options.mMinLength);
+      std::vector<TrieNode> automaton = buildAutomaton(words);
+
+      fs::path outputPath = TextCodec::toUtf16(options.mOutputPath);
+      fs::path tmpPath = outputPath;
+      tmpPath += L".tmp";
+      {
+         std::ofstream output(tmpPath, std::ios_base::binary | std::ios_base::trunc);
+         writeDictionary(output, automaton, words.size());
+         output.close();
+         if (output.fail())
+         {
+            std::cerr << "The dictionary can't be written to " << tmpPath.string() << std::endl;
+            return 1;
+         }
+      }
+      try
+      {
+         ForbiddenDictionary::open(tmpPath.native()); // never publish a file the filter would refuse
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "The built dictionary is not valid: " << e.what() << std::endl;
+         return 1;
+      }
+      if (!publish(tmpPath, outputPath))
+      {
+         std::cerr << "The dictionary can't be moved to " << options.mOutputPath << ", error " << GetLastError() << std::endl;
+         return 1;
+      }
+
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      std::cout << "Built " << options.mOutputPath << ": " << words.size() << " word(s), " << automaton.size() << " state(s) in "
+         << elapsed.count() << " ms" << std::endl;
+      return 0;
+   }
+
+   int check(const DictionaryOptions& options)
+   {
+      std::shared_ptr<const ForbiddenDictionary> dictionary;
+      try
+      {
+         dictionary = ForbiddenDictionary::open(TextCodec::toUtf16(options.mInputPath));
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "The dictionary " << options.mInputPath << " can't be loaded: " << e.what() << std::endl;
+         return 1;
+      }
+
+      std::cout << "Loaded " << dictionary->getWordCount() << " word(s), " << dictionary->getStateCount() << " state(s)" << std::endl;
+      uint32_t matchLength = dictionary->findMatch(options.mPassword, options.mMinLength);
+      if (matchLength == 0)
+      {
+         std::cout << "Result: APPROVED" << std::endl;
+         return 0;
+      }
+      std::cout << "Result: DISAPPROVED, a forbidden word of " << matchLength << " characters found" << std::endl;
+      return 2;
+   }
+}
+
+int runDictionary(int argc, char* argv[])
+{
+   DictionaryOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printDictionaryUsage();
+      return 1;
+   }
+
+   if (options.mAction == "build")
+      return build(options);
+   return check(options);
+}
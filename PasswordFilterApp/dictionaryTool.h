@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "dictionary" command of PasswordFilterApp.
+* Builds the forbidden word dictionary file (see ForbiddenDictionary) from a plain text word list
+* and checks passwords against a built dictionary.
+*/
+int runDictionary(int argc, char* argv[]);
@@ -0,0 +1,178 @@
+#include "pch.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include "workerChannel.h"
+#include "ipcTool.h"
+
+
+namespace
+{
+   struct IpcOptions
+   {
+      uint32_t mCalls = 20000;
+      std::vector<size_t> mThreads{ 1, 4, 16 };
+      std::string mServe; // channel name, set in the child process
+   };
+
+   constexpr size_t sServerThreads = 16;
+   constexpr std::chrono::milliseconds sDeadline{ 1000 };
+   constexpr std::chrono::seconds sStartTimeout{ 10 };
+
+   void printIpcUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp ipc [--calls <count>] [--threads <n,n,...>]" << std::endl
+         << "  Starts an echo worker in a child process and for every <n> makes <count> calls to it through the shared memory" << std::endl
+         << "  channel of the network worker from n threads. It reports the round trip, which is the overhead the split mode" << std::endl
+         << "  adds to every call made in LSASS. The requests carry a password of a usual length." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], IpcOptions& options)
+   {
+      for (int i = 0; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--calls")
+            options.mCalls = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else if (name == "--threads")
+         {
+            options.mThreads.clear();
+            std::istringstream list(argv[i + 1]);
+            std::string item;
+            while (std::getline(list, item, ','))
+               options.mThreads.push_back(std::stoul(item));
+         }
+         else if (name == "--serve")
+            options.mServe = argv[i + 1];
+         else
+            return false;
+      }
+      return argc % 2 == 0 && options.mCalls > 0 && !options.mThreads.empty() &&
+         std::find(options.mThreads.begin(), options.mThreads.end(), 0) == options.mThreads.end();
+   }
+
+   double percentile(std::vector<double> values, double pct)
+   {
+      if (values.empty())
+         return 0;
+      std::sort(values.begin(), values.end());
+      size_t idx = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+      return values[std::min(idx, values.size() - 1)];
+   }
+
+   /**
+   * The child process answers every request at once until it's terminated by the parent.
+   */
+   int serveEcho(const std::wstring& name)
+   {
+      try
+      {
+         WorkerChannel::Server server(name, false);
+         HANDLE never = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+         server.run(never, sServerThreads, [](const WorkerRequest&, WorkerResponse& response) { response.mDecision = 1; });
+         CloseHandle(never);
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "The echo worker can't be started: " << e.what() << std::endl;
+         return 1;
+      }
+      return 0;
+   }
+
+   WorkerRequest makeRequest()
+   {
+      WorkerRequest request;
+      request.mKind = WorkerRequest::KIND_ECHO;
+      std::wstring account = L"ipc.benchmark";
+      std::wstring password = L"Ipc-Benchmark-Pass-1";
+      std::copy(account.begin(), account.end(), request.mAccountName);
+      request.mAccountLength = static_cast<uint16_t>(account.size());
+      std::copy(password.begin(), password.end(), request.mPassword);
+      request.mPasswordLength = static_cast<uint16_t>(password.size());
+      return request;
+   }
+}
+
+int runIpc(int argc, char* argv[])
+{
+   IpcOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printIpcUsage();
+      return 1;
+   }
+   if (!options.mServe.empty())
+      return serveEcho(std::wstring(options.mServe.begin(), options.mServe.end()));
+
+   std::string name = "Local\\PasswordFilterIpc." + std::to_string(GetCurrentProcessId());
+   wchar_t exePath[MAX_PATH];
+   GetModuleFileNameW(nullptr, exePath, MAX_PATH);
+   std::wstring commandLine = L"\"" + std::wstring(exePath) + L"\" ipc --serve " + std::wstring(name.begin(), name.end());
+   STARTUPINFOW startup{};
+   startup.cb = sizeof(startup);
+   PROCESS_INFORMATION child{};
+   if (!CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &child))
+   {
+      std::cerr << "The echo worker can't be started, error " << GetLastError() << std::endl;
+      return 1;
+   }
+
+   WorkerChannel::Client client(std::wstring(name.begin(), name.end()), false); // the benchmark runs as the user
+   const WorkerRequest request = makeRequest();
+   WorkerResponse response;
+   auto startLimit = std::chrono::steady_clock::now() + sStartTimeout;
+   while (client.call(request, response, sDeadline) != WorkerChannel::RESULT_OK)
+   {
+      if (std::chrono::steady_clock::now() > startLimit || WaitForSingleObject(child.hProcess, 0) == WAIT_OBJECT_0)
+      {
+         std::cerr << "The echo worker doesn't answer" << std::endl;
+         TerminateProcess(child.hProcess, 1);
+         CloseHandle(child.hThread);
+         CloseHandle(child.hProcess);
+         return 1;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+   }
+
+   std::cout << "Echo worker in process " << child.dwProcessId << ", " << options.mCalls << " calls per run" << std::endl
+      << "threads   calls/s    p50 [us]   p99 [us]   max [us]   failed" << std::endl;
+   for (size_t threads : options.mThreads)
+   {
+      std::vector<std::vector<double>> latencies(threads);
+      std::atomic<uint32_t> failed = 0;
+      std::vector<std::thread> callers;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t t = 0; t < threads; ++t)
+      {
+         uint32_t calls = options.mCalls / static_cast<uint32_t>(threads) + (t < options.mCalls % threads ? 1 : 0);
+         callers.emplace_back([&, t, calls]()
+            {
+               latencies[t].reserve(calls);
+               WorkerResponse threadResponse;
+               for (uint32_t i = 0; i < calls; ++i)
+               {
+                  auto callStart = std::chrono::steady_clock::now();
+                  if (client.call(request, threadResponse, sDeadline) != WorkerChannel::RESULT_OK)
+                     ++failed;
+                  latencies[t].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - callStart).count());
+               }
+            });
+      }
+      for (std::thread& caller : callers)
+         caller.join();
+      double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::vector<double> all;
+      for (const std::vector<double>& threadLatencies : latencies)
+         all.insert(all.end(), threadLatencies.begin(), threadLatencies.end());
+      std::cout << std::fixed << std::setprecision(1) << std::setw(7) << threads << "   " << std::setw(8) << options.mCalls / elapsedSec << "   "
+         << std::setw(8) << percentile(all, 50) << "   " << std::setw(8) << percentile(all, 99) << "   " << std::setw(8) << percentile(all, 100)
+         << "   " << std::setw(6) << failed.load() << std::endl;
+   }
+
+   TerminateProcess(child.hProcess, 0);
+   CloseHandle(child.hThread);
+   CloseHandle(child.hProcess);
+   return 0;
+}
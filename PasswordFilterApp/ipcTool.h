@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+* "ipc" command of PasswordFilterApp.
+* Measures the round trip of the shared memory channel between the filter and the network worker.
+*/
+int runIpc(int argc, char* argv[]);
@@ -0,0 +1,164 @@
+#include "pch.h"
+#include <deque>
+#include <thread>
+#include "logTool.h"
+#include "logSegment.h"
+
+namespace fs = std::filesystem;
+
+
+namespace
+{
+   struct LogsOptions
+   {
+      fs::path mFolder;
+      std::string mSessionFilter; // "SessionId: 0000012345 ", empty = all
+      size_t mTail = 0; // 0 = all lines
+      bool mFollow = false;
+      std::wstring mBaseName = L"PasswordFilterLog";
+   };
+
+   void printLogsUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp logs <folder> [--session <id>] [--tail <lines>] [--follow] [--baseName <name>]" << std::endl
+         << "  Prints the segmented log storage (logStorage.segmented) of the folder in the order it was written," << std::endl
+         << "  compressed segments included. --session keeps only the lines of one SessionId, --tail prints only" << std::endl
+         << "  the last lines and --follow keeps printing new lines until the App is stopped. --baseName selects the segments" << std::endl
+         << "  of another process, e.g. PasswordFilterLog.Worker for the network worker (PasswordFilterLog = LSASS)." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], LogsOptions& options)
+   {
+      if (argc < 1)
+         return false;
+      options.mFolder = argv[0];
+      for (int i = 1; i < argc; ++i)
+      {
+         std::string name(argv[i]);
+         if (name == "--follow")
+            options.mFollow = true;
+         else if (name == "--session" && i + 1 < argc)
+         {
+            char sessionId[32];
+            snprintf(sessionId, sizeof(sessionId), "SessionId: %010lu ", std::stoul(argv[++i]));
+            options.mSessionFilter = sessionId;
+         }
+         else if (name == "--tail" && i + 1 < argc)
+            options.mTail = static_cast<size_t>(std::stoul(argv[++i]));
+         else if (name == "--baseName" && i + 1 < argc)
+         {
+            std::string baseName(argv[++i]);
+            options.mBaseName.assign(baseName.begin(), baseName.end());
+         }
+         else
+            return false;
+      }
+      return true;
+   }
+
+   /**
+   * LinePrinter splits the decoded text into lines, filters them and keeps the last ones when tailing.
+   */
+   class LinePrinter
+   {
+   private:
+      const LogsOptions& mOptions;
+      std::deque<std::string> mTail;
+      std::string mPartial;
+      bool mBuffering;
+
+   public:
+      LinePrinter(const LogsOptions& options) : mOptions(options), mBuffering(options.mTail > 0) {}
+
+      void feed(const std::string& text)
+      {
+         size_t start = 0;
+         while (true)
+         {
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos)
+            {
+               mPartial.append(text, start, std::string::npos);
+               return;
+            }
+            mPartial.append(text, start, end - start);
+            print(mPartial);
+            mPartial.clear();
+            start = end + 1;
+         }
+      }
+
+      void print(const std::string& line)
+      {
+         if (!mOptions.mSessionFilter.empty() && line.find(mOptions.mSessionFilter) == std::string::npos)
+            return;
+         if (!mBuffering)
+         {
+            std::cout << line << "\n";
+            return;
+         }
+         mTail.push_back(line);
+         if (mTail.size() > mOptions.mTail)
+            mTail.pop_front();
+      }
+
+      void endOfHistory()
+      {
+         for (const std::string& line : mTail)
+            std::cout << line << "\n";
+         mTail.clear();
+         mBuffering = false;
+         std::cout.flush();
+      }
+   };
+}
+
+int runLogs(int argc, char* argv[])
+{
+   LogsOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printLogsUsage();
+      return 1;
+   }
+
+   LinePrinter printer(options);
+   uint64_t sequence = 0; // the segment read last
+   uint64_t offset = 0; // the bytes of the segment read already
+   bool first = true;
+   while (true)
+   {
+      std::vector<LogSegment::FileInfo> segments = LogSegment::list(options.mFolder, options.mBaseName);
+      if (first && segments.empty())
+      {
+         std::cerr << "There are no log segments in " << options.mFolder.string() << std::endl;
+         return 1;
+      }
+      for (const LogSegment::FileInfo& info : segments)
+      {
+         if (!first && info.mSequence < sequence)
+            continue;
+         try
+         {
+            std::string text = LogSegment::read(info, info.mSequence == sequence ? offset : 0);
+            if (info.mSequence != sequence)
+               offset = 0;
+            sequence = info.mSequence;
+            offset += text.size();
+            printer.feed(text);
+         }
+         catch (const std::exception& e)
+         {
+            // the segment may be compressed and removed between the listing and the reading
+            std::cerr << "The segment " << info.mPath.string() << " can't be read: " << e.what() << std::endl;
+         }
+      }
+      if (first)
+         printer.endOfHistory();
+      first = false;
+      if (!options.mFollow)
+         return 0;
+      std::cout.flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+   }
+}
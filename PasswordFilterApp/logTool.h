@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+* "logs" command of PasswordFilterApp.
+* Decodes the segmented log storage (see LogSegment), optionally filtered by a session id, and tails it.
+*/
+int runLogs(int argc, char* argv[]);
@@ -1,10 +1,71 @@
 #include "pch.h" // precompiled headers - hast to be the first include
 #include <iostream>
 #include "passwordFilter.h"
+#include "replayTool.h"
+#include "controlTool.h"
+#include "codecTool.h"
+#include "rulesTool.h"
+#include "dictionaryTool.h"
+#include "logTool.h"
+#include "pipelineTool.h"
+#include "transportTool.h"
+#include "allocationsTool.h"
+#include "workerTool.h"
+#include "ipcTool.h"
+#include "precheckTool.h"
+
+static void printUsage()
+{
+   std::cout << "Usage: PasswordFilterApp <command> [options]" << std::endl
+      << "Commands:" << std::endl
+      << "  replay     replays a traffic recording against a mock IdM" << std::endl
+      << "  control    sends a command to the control channel of the running filter" << std::endl
+      << "  codec      checks and benchmarks the UTF-16/UTF-8 transcoding" << std::endl
+      << "  rules      evaluates a password against the local rules of a configuration" << std::endl
+      << "  dictionary builds and checks the forbidden word dictionary" << std::endl
+      << "  logs       decodes, filters and tails the segmented log storage" << std::endl
+      << "  pipeline   measures threads and memory against the number of calls in flight" << std::endl
+      << "  transport  compares the IdM transport backends" << std::endl
+      << "  allocations reports the allocations per call of the accounting build against a budget" << std::endl
+      << "  worker     serves the calls forwarded by the filter in LSASS (networkWorker)" << std::endl
+      << "  ipc        measures the round trip of the channel to the network worker" << std::endl
+      << "  precheck   checks candidate passwords of many accounts by the full decision of the filter" << std::endl;
+}
 
 int main(int argc, char* argv[], char* envp[])
 {
+   if (argc < 2)
+   {
+      printUsage();
+      return 1;
+   }
 
-   return 0;
-}
+   std::string command(argv[1]);
+   if (command == "replay")
+      return runReplay(argc - 2, argv + 2);
+   if (command == "control")
+      return runControl(argc - 2, argv + 2);
+   if (command == "codec")
+      return runCodec(argc - 2, argv + 2);
+   if (command == "rules")
+      return runRules(argc - 2, argv + 2);
+   if (command == "dictionary")
+      return runDictionary(argc - 2, argv + 2);
+   if (command == "logs")
+      return runLogs(argc - 2, argv + 2);
+   if (command == "pipeline")
+      return runPipeline(argc - 2, argv + 2);
+   if (command == "transport")
+      return runTransport(argc - 2, argv + 2);
+   if (command == "allocations")
+      return runAllocations(argc - 2, argv + 2);
+   if (command == "worker")
+      return runWorker(argc - 2, argv + 2);
+   if (command == "ipc")
+      return runIpc(argc - 2, argv + 2);
+   if (command == "precheck")
+      return runPrecheck(argc - 2, argv + 2);
 
+   printUsage();
+   return 1;
+}
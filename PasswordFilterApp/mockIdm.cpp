@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "mockIdm.h"
+#include "asyncDelay.h"
+
+namespace wl = web::http::experimental::listener;
+
+
+MockIdm::MockIdm(uint16_t port, size_t endpointCount, responder responder, bool tls)
+   : mPort(port), mEndpointCount(endpointCount == 0 ? 1 : endpointCount), mResponder(std::move(responder)), mTls(tls)
+{
+}
+
+MockIdm::~MockIdm()
+{
+   try
+   {
+      stop();
+   }
+   catch (const std::exception&)
+   {
+   }
+}
+
+void MockIdm::start()
+{
+   if (mTls && !mTlsBinding)
+      mTlsBinding = std::make_unique<MockTlsBinding>(mPort);
+   mListener = std::make_unique<wl::http_listener>(getRootUrl());
+   mListener->support([this](wh::http_request request) { handle(request); });
+   mListener->open().wait();
+}
+
+void MockIdm::stop()
+{
+   if (mListener)
+   {
+      mListener->close().wait();
+      mListener.reset();
+   }
+   mTlsBinding.reset();
+}
+
+ut::string_t MockIdm::getRootUrl() const
+{
+   return (mTls ? U("https://127.0.0.1:") : U("http://127.0.0.1:")) + ut::conversions::to_string_t(std::to_string(mPort)) + U("/");
+}
+
+std::vector<ut::string_t> MockIdm::getBaseUrls() const
+{
+   std::vector<ut::string_t> urls;
+   for (size_t i = 0; i < mEndpointCount; ++i)
+      urls.push_back(getRootUrl() + U("e") + ut::conversions::to_string_t(std::to_string(i)) + U("/"));
+   return urls;
+}
+
+/**
+* writeConfig writes the filter configuration pointing to the mock.
+* The tuning items (attempts, timeouts, retry policy, ...) are taken from the template when it is given,
+* the connection items are always replaced.
+*/
+ut::string_t MockIdm::writeConfig(const ut::string_t& templatePath, const ut::string_t& outputPath, uint32_t connectionAttempts) const
+{
+   wj::value cfg = wj::value::object();
+   if (!templatePath.empty())
+   {
+      std::ifstream in(templatePath);
+      if (in.fail())
+         throw std::runtime_error("The configuration template can't be opened");
+      cfg = wj::value::parse(in);
+   }
+   else
+   {
+      cfg[U("connectionAttempts")] = wj::value::number(connectionAttempts);
+      cfg[U("connectionTimeoutMs")] = wj::value::number(30000);
+      cfg[U("allowChangeByDefault")] = wj::value::boolean(true);
+      cfg[U("logLevel")] = wj::value::string(U("info"));
+   }
+
+   std::vector<wj::value> urls;
+   for (const ut::string_t& url : getBaseUrls())
+      urls.push_back(wj::value::string(url));
+   cfg[U("restBaseUrl")] = wj::value::array(urls);
+   cfg[U("restCheckUrl")] = wj::value::string(U("validate"));
+   cfg[U("restNotifyUrl")] = wj::value::string(U("change"));
+   cfg[U("token")] = wj::value::string(U("mock"));
+   cfg[U("ignoreCertificate")] = wj::value::boolean(true);
+   cfg[U("systemId")] = wj::value::string(U("mock"));
+   cfg[U("skippedAccPrefix")] = wj::value::array();
+   cfg[U("passwordFilterEnabled")] = wj::value::boolean(true);
+   cfg[U("routing")] = wj::value::object();
+   cfg[U("routing")][U("defaultBalancing")] = wj::value::string(U("failover"));
+   cfg[U("trafficRecorder")] = wj::value::object();
+   cfg[U("trafficRecorder")][U("enabled")] = wj::value::boolean(false);
+
+   std::ofstream out(outputPath, std::ios_base::out | std::ios_base::trunc);
+   out << ut::conversions::to_utf8string(cfg.serialize());
+   if (out.fail())
+      throw std::runtime_error("The mock configuration can't be written");
+   return outputPath;
+}
+
+void MockIdm::handle(wh::http_request request)
+{
+   // path: /e<idx>/<operation>
+   std::vector<ut::string_t> segments = wh::uri::split_path(wh::uri::decode(request.relative_uri().path()));
+   size_t endpointIdx = 0;
+   ut::string_t operation;
+   if (segments.size() >= 1 && segments[0].size() > 1 && segments[0][0] == U('e'))
+      endpointIdx = std::stoul(segments[0].substr(1));
+   if (segments.size() >= 2)
+      operation = segments[1];
+
+   request.extract_json(true).then([this, request, endpointIdx, operation](pplx::task<wj::value> bodyTask)
+      {
+         wj::value body;
+         try
+         {
+            body = bodyTask.get();
+         }
+         catch (const std::exception&)
+         {
+         }
+         MockIdmResponse response;
+         try
+         {
+            response = mResponder(endpointIdx, operation, body);
+         }
+         catch (const std::exception&)
+         {
+            // answered by the default response, an unanswered request would cost the caller its whole timeout
+         }
+         // the latency is a timer, so the mock doesn't add a thread per pending request to the measured process
+         AsyncDelay::after(response.mDelay).then([request, response]()
+            {
+               if (response.mStatus == wh::status_codes::OK)
+                  request.reply(response.mStatus);
+               else
+                  request.reply(response.mStatus, createErrorBody(response.mStatus));
+            });
+      });
+}
+
+wj::value MockIdm::createErrorBody(wh::status_code status)
+{
+   const wchar_t* statusEnum = U("INTERNAL_SERVER_ERROR");
+   if (status == wh::status_codes::BadRequest)
+      statusEnum = U("PASSWORD_DOES_NOT_MEET_POLICY");
+   else if (status == wh::status_codes::NotFound)
+      statusEnum = U("PASSWORD_FILTER_IDENTITY_NOT_FOUND");
+
+   wj::value error;
+   error[U("statusEnum")] = wj::value::string(statusEnum);
+   wj::value body;
+   body[U("_errors")] = wj::value::array({ error });
+   return body;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+#include "mockTlsBinding.h"
+
+namespace wh = web::http;
+namespace wj = web::json;
+namespace ut = utility;
+
+
+/**
+* MockIdmResponse is what the mock answers to one request and how long it waits before the answer.
+*/
+struct MockIdmResponse
+{
+   wh::status_code mStatus = wh::status_codes::OK;
+   std::chrono::microseconds mDelay{ 0 };
+};
+
+/**
+* MockIdm is a local stand-in for the IdM password filter REST API used by the tools of PasswordFilterApp.
+* It serves endpointCount endpoints on http://127.0.0.1:port/e<idx>/ and answers both
+* the validation and the notification requests by the supplied responder.
+* With tls it serves https instead (see MockTlsBinding), http.sys negotiates HTTP/2 with the clients offering it.
+* Error statuses get the IdM error body, so the filter interprets them as IdM would send them.
+*/
+class MockIdm
+{
+public:
+   using responder = std::function<MockIdmResponse(size_t endpointIdx, const ut::string_t& operation, const wj::value& body)>;
+
+private:
+   uint16_t mPort;
+   size_t mEndpointCount;
+   responder mResponder;
+   bool mTls;
+   std::unique_ptr<MockTlsBinding> mTlsBinding;
+   std::unique_ptr<wh::experimental::listener::http_listener> mListener;
+
+   ut::string_t getRootUrl() const;
+
+   void handle(wh::http_request request);
+   static wj::value createErrorBody(wh::status_code status);
+
+public:
+   MockIdm(uint16_t port, size_t endpointCount, responder responder, bool tls = false);
+   ~MockIdm();
+   void start(); // throws std::runtime_error when the tls binding fails
+   void stop();
+   std::vector<ut::string_t> getBaseUrls() const;
+   ut::string_t writeConfig(const ut::string_t& templatePath, const ut::string_t& outputPath, uint32_t connectionAttempts) const;
+};
@@ -0,0 +1,199 @@
+#include "pch.h"
+#include <stdexcept>
+#include <winsock2.h>
+#include <wincrypt.h>
+#include <ncrypt.h>
+#include <http.h>
+#include "mockTlsBinding.h"
+
+#pragma comment(lib, "Crypt32.lib")
+#pragma comment(lib, "Ncrypt.lib")
+#pragma comment(lib, "Httpapi.lib")
+
+
+namespace
+{
+   // {5b0e3f1c-7a42-4d8e-9c61-2f4a8b7d0e93}, identifies the bindings made by the App
+   const GUID sAppId = { 0x5b0e3f1c, 0x7a42, 0x4d8e, { 0x9c, 0x61, 0x2f, 0x4a, 0x8b, 0x7d, 0x0e, 0x93 } };
+
+   std::runtime_error error(const std::string& what, DWORD code)
+   {
+      return std::runtime_error(what + ", error " + std::to_string(code));
+   }
+
+   sockaddr_in getAddress(uint16_t port)
+   {
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      return address;
+   }
+
+   HCERTSTORE openMachineStore()
+   {
+      HCERTSTORE store = CertOpenStore(CERT_STORE_PROV_SYSTEM_W, 0, 0, CERT_SYSTEM_STORE_LOCAL_MACHINE, L"MY");
+      if (store == nullptr)
+         throw error("The LocalMachine\\My certificate store can't be opened", GetLastError());
+      return store;
+   }
+}
+
+MockTlsBinding::MockTlsBinding(uint16_t port)
+   : mPort(port)
+{
+   ULONG result = HttpInitialize(HTTPAPI_VERSION_1, HTTP_INITIALIZE_CONFIG, nullptr);
+   if (result != NO_ERROR)
+      throw error("The HTTP Server API can't be initialized", result);
+   try
+   {
+      createCertificate();
+      bind();
+   }
+   catch (const std::exception&)
+   {
+      release();
+      throw;
+   }
+}
+
+MockTlsBinding::~MockTlsBinding()
+{
+   release();
+}
+
+/**
+* release removes the binding, the certificate and its key, whatever of them has been created.
+*/
+void MockTlsBinding::release()
+{
+   if (mBound)
+   {
+      sockaddr_in address = getAddress(mPort);
+      HTTP_SERVICE_CONFIG_SSL_SET binding{};
+      binding.KeyDesc.pIpPort = reinterpret_cast<PSOCKADDR>(&address);
+      HttpDeleteServiceConfiguration(nullptr, HttpServiceConfigSSLCertInfo, &binding, sizeof(binding), nullptr);
+      mBound = false;
+   }
+   if (!mCertificateHash.empty())
+   {
+      HCERTSTORE store = CertOpenStore(CERT_STORE_PROV_SYSTEM_W, 0, 0, CERT_SYSTEM_STORE_LOCAL_MACHINE, L"MY");
+      if (store != nullptr)
+      {
+         CRYPT_HASH_BLOB hash{ static_cast<DWORD>(mCertificateHash.size()), mCertificateHash.data() };
+         PCCERT_CONTEXT certificate = CertFindCertificateInStore(store, X509_ASN_ENCODING, 0, CERT_FIND_SHA1_HASH, &hash, nullptr);
+         if (certificate != nullptr)
+            CertDeleteCertificateFromStore(certificate); // frees the context
+         CertCloseStore(store, 0);
+      }
+      mCertificateHash.clear();
+   }
+   NCRYPT_PROV_HANDLE provider = 0;
+   NCRYPT_KEY_HANDLE key = 0;
+   if (NCryptOpenStorageProvider(&provider, MS_KEY_STORAGE_PROVIDER, 0) == ERROR_SUCCESS)
+   {
+      if (NCryptOpenKey(provider, &key, sKeyName, 0, NCRYPT_MACHINE_KEY_FLAG) == ERROR_SUCCESS)
+         NCryptDeleteKey(key, 0); // frees the handle
+      NCryptFreeObject(provider);
+   }
+   HttpTerminate(HTTP_INITIALIZE_CONFIG, nullptr);
+}
+
+/**
+* createCertificate makes a self-signed certificate valid for a day, its key is a persisted machine key,
+* so http.sys can use it.
+*/
+void MockTlsBinding::createCertificate()
+{
+   NCRYPT_PROV_HANDLE provider = 0;
+   SECURITY_STATUS status = NCryptOpenStorageProvider(&provider, MS_KEY_STORAGE_PROVIDER, 0);
+   if (status != ERROR_SUCCESS)
+      throw error("The key storage provider can't be opened", status);
+   NCRYPT_KEY_HANDLE key = 0;
+   status = NCryptCreatePersistedKey(provider, &key, BCRYPT_RSA_ALGORITHM, sKeyName, 0, NCRYPT_MACHINE_KEY_FLAG | NCRYPT_OVERWRITE_KEY_FLAG);
+   DWORD keyLength = 2048;
+   if (status == ERROR_SUCCESS)
+      status = NCryptSetProperty(key, NCRYPT_LENGTH_PROPERTY, reinterpret_cast<PBYTE>(&keyLength), sizeof(keyLength), 0);
+   if (status == ERROR_SUCCESS)
+      status = NCryptFinalizeKey(key, 0);
+   NCryptFreeObject(provider);
+   if (status != ERROR_SUCCESS)
+   {
+      if (key != 0)
+         NCryptFreeObject(key);
+      throw error("The key of the mock certificate can't be created", status);
+   }
+
+   BYTE subject[128];
+   DWORD subjectSize = sizeof(subject);
+   if (!CertStrToNameW(X509_ASN_ENCODING, L"CN=127.0.0.1", CERT_X500_NAME_STR, nullptr, subject, &subjectSize, nullptr))
+   {
+      NCryptFreeObject(key);
+      throw error("The subject of the mock certificate can't be encoded", GetLastError());
+   }
+   CERT_NAME_BLOB subjectBlob{ subjectSize, subject };
+   CRYPT_KEY_PROV_INFO keyInfo{};
+   keyInfo.pwszContainerName = const_cast<LPWSTR>(sKeyName);
+   keyInfo.pwszProvName = const_cast<LPWSTR>(MS_KEY_STORAGE_PROVIDER);
+   keyInfo.dwFlags = NCRYPT_MACHINE_KEY_FLAG;
+   SYSTEMTIME start;
+   GetSystemTime(&start);
+   FILETIME time;
+   SystemTimeToFileTime(&start, &time);
+   ULARGE_INTEGER endTime{ time.dwLowDateTime, time.dwHighDateTime };
+   endTime.QuadPart += 24ull * 3600 * 10000000; // 100 ns units
+   time = FILETIME{ endTime.LowPart, endTime.HighPart };
+   SYSTEMTIME end;
+   FileTimeToSystemTime(&time, &end);
+   PCCERT_CONTEXT certificate = CertCreateSelfSignCertificate(key, &subjectBlob, 0, &keyInfo, nullptr, &start, &end, nullptr);
+   DWORD certificateError = GetLastError();
+   NCryptFreeObject(key);
+   if (certificate == nullptr)
+      throw error("The mock certificate can't be created", certificateError);
+
+   HCERTSTORE store = nullptr;
+   try
+   {
+      store = openMachineStore();
+   }
+   catch (const std::exception&)
+   {
+      CertFreeCertificateContext(certificate);
+      throw;
+   }
+   BOOL added = CertAddCertificateContextToStore(store, certificate, CERT_STORE_ADD_REPLACE_EXISTING, nullptr);
+   DWORD addError = GetLastError();
+   BYTE hash[20];
+   DWORD hashSize = sizeof(hash);
+   BOOL hashed = CertGetCertificateContextProperty(certificate, CERT_HASH_PROP_ID, hash, &hashSize);
+   CertFreeCertificateContext(certificate);
+   CertCloseStore(store, 0);
+   if (!added)
+      throw error("The mock certificate can't be added to LocalMachine\\My", addError);
+   if (!hashed)
+      throw error("The hash of the mock certificate can't be read", GetLastError());
+   mCertificateHash.assign(hash, hash + hashSize);
+}
+
+/**
+* bind assigns the certificate to 127.0.0.1:port in http.sys, a binding left by a previous run is replaced.
+*/
+void MockTlsBinding::bind()
+{
+   sockaddr_in address = getAddress(mPort);
+   HTTP_SERVICE_CONFIG_SSL_SET binding{};
+   binding.KeyDesc.pIpPort = reinterpret_cast<PSOCKADDR>(&address);
+   binding.ParamDesc.SslHashLength = static_cast<ULONG>(mCertificateHash.size());
+   binding.ParamDesc.pSslHash = mCertificateHash.data();
+   binding.ParamDesc.AppId = sAppId;
+   binding.ParamDesc.pSslCertStoreName = const_cast<PWSTR>(L"MY");
+   ULONG result = HttpSetServiceConfiguration(nullptr, HttpServiceConfigSSLCertInfo, &binding, sizeof(binding), nullptr);
+   if (result == ERROR_ALREADY_EXISTS)
+   {
+      HttpDeleteServiceConfiguration(nullptr, HttpServiceConfigSSLCertInfo, &binding, sizeof(binding), nullptr);
+      result = HttpSetServiceConfiguration(nullptr, HttpServiceConfigSSLCertInfo, &binding, sizeof(binding), nullptr);
+   }
+   if (result != NO_ERROR)
+      throw error("The mock certificate can't be bound to the port (an elevated process is needed)", result);
+   mBound = true;
+}
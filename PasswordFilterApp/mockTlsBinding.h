@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/**
+* MockTlsBinding lets the mock IdM serve https on 127.0.0.1:port, which is where http.sys negotiates HTTP/2 (ALPN).
+* It creates a self-signed certificate for 127.0.0.1 with a machine key, puts it into the LocalMachine\My store
+* and binds it to the port in http.sys; the destructor removes all of it. It needs an elevated process.
+* The certificate is not trusted, the clients of the mock skip the certificate validation.
+*/
+class MockTlsBinding
+{
+private:
+   static constexpr const wchar_t* sKeyName = L"PasswordFilterMockIdm";
+
+   uint16_t mPort;
+   std::vector<unsigned char> mCertificateHash; // SHA-1, empty until the certificate is in the store
+   bool mBound = false;
+
+   void createCertificate();
+   void bind();
+   void release();
+
+public:
+   explicit MockTlsBinding(uint16_t port); // throws std::runtime_error
+   ~MockTlsBinding();
+   MockTlsBinding(const MockTlsBinding&) = delete;
+   MockTlsBinding& operator=(const MockTlsBinding&) = delete;
+};
@@ -0,0 +1,211 @@
+#include "pch.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <psapi.h>
+#include <tlhelp32.h>
+#include "passwordFilter.h"
+#include "pipelineTool.h"
+#include "mockIdm.h"
+
+#pragma comment(lib, "Psapi.lib")
+
+
+namespace
+{
+   struct PipelineOptions
+   {
+      std::vector<size_t> mInFlight{ 1, 16, 64, 256 };
+      uint32_t mLatencyMs = 500;
+      uint16_t mPort = 18081;
+   };
+
+   struct ProcessSample
+   {
+      size_t mThreads = 0;
+      size_t mWorkingSet = 0;
+      size_t mPrivateBytes = 0;
+   };
+
+   void printPipelineUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp pipeline [--inFlight <n,n,...>] [--latencyMs <ms>] [--port <port>]" << std::endl
+         << "  For every <n> runs n concurrent PasswordFilter calls against a mock IdM listening on 127.0.0.1:<port>" << std::endl
+         << "  which answers after <latencyMs>, and reports the peak threads and memory of the process." << std::endl
+         << "  \"pipeline threads\" are the threads above the baseline and the n calling threads, which stand for the LSA threads." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], PipelineOptions& options)
+   {
+      for (int i = 0; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--inFlight")
+         {
+            options.mInFlight.clear();
+            std::istringstream list(argv[i + 1]);
+            std::string item;
+            while (std::getline(list, item, ','))
+               options.mInFlight.push_back(std::stoul(item));
+         }
+         else if (name == "--latencyMs")
+            options.mLatencyMs = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else if (name == "--port")
+            options.mPort = static_cast<uint16_t>(std::stoul(argv[i + 1]));
+         else
+            return false;
+      }
+      return argc % 2 == 0 && !options.mInFlight.empty() &&
+         std::find(options.mInFlight.begin(), options.mInFlight.end(), 0) == options.mInFlight.end();
+   }
+
+   ProcessSample sampleProcess()
+   {
+      ProcessSample sample;
+      DWORD pid = GetCurrentProcessId();
+      HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+      if (snapshot != INVALID_HANDLE_VALUE)
+      {
+         THREADENTRY32 entry{};
+         entry.dwSize = sizeof(entry);
+         for (BOOL ok = Thread32First(snapshot, &entry); ok; ok = Thread32Next(snapshot, &entry))
+         {
+            if (entry.th32OwnerProcessID == pid)
+               ++sample.mThreads;
+         }
+         CloseHandle(snapshot);
+      }
+
+      PROCESS_MEMORY_COUNTERS_EX counters{};
+      if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)))
+      {
+         sample.mWorkingSet = counters.WorkingSetSize;
+         sample.mPrivateBytes = counters.PrivateUsage;
+      }
+      return sample;
+   }
+
+   double percentile(std::vector<double> values, double pct)
+   {
+      if (values.empty())
+         return 0;
+      std::sort(values.begin(), values.end());
+      size_t idx = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+      return values[std::min(idx, values.size() - 1)];
+   }
+
+   UNICODE_STRING toUnicodeString(std::wstring& str)
+   {
+      UNICODE_STRING uniStr;
+      uniStr.Buffer = str.data();
+      uniStr.Length = static_cast<USHORT>(str.size() * sizeof(wchar_t));
+      uniStr.MaximumLength = uniStr.Length;
+      return uniStr;
+   }
+
+   double callPasswordFilter(size_t idx)
+   {
+      std::wstring account = L"pipeline" + std::to_wstring(idx);
+      std::wstring fullName = account;
+      std::wstring password = L"Pipeline-Benchmark-1";
+      UNICODE_STRING uAccount = toUnicodeString(account);
+      UNICODE_STRING uFullName = toUnicodeString(fullName);
+      UNICODE_STRING uPassword = toUnicodeString(password);
+      auto start = std::chrono::steady_clock::now();
+      PasswordFilter(&uAccount, &uFullName, &uPassword, FALSE);
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   }
+}
+
+int runPipeline(int argc, char* argv[])
+{
+   PipelineOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printPipelineUsage();
+      return 1;
+   }
+
+   const auto latency = std::chrono::milliseconds(options.mLatencyMs);
+   MockIdm mock(options.mPort, 1, [latency](size_t, const ut::string_t&, const wj::value&) -> MockIdmResponse
+      {
+         MockIdmResponse response;
+         response.mDelay = latency;
+         return response;
+      });
+
+   try
+   {
+      mock.start();
+      std::filesystem::path cfgPath = std::filesystem::temp_directory_path() / "PasswordFilterPipeline.cfg";
+      mock.writeConfig(ut::string_t(), cfgPath.native(), 1);
+      _putenv_s("BCV_PWF_CONFIG_FILE_PATH", cfgPath.string().c_str()); // read by the filter on its lazy init
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "The mock IdM can't be started: " << e.what() << std::endl;
+      return 1;
+   }
+   InitializeChangeNotify();
+   callPasswordFilter(0); // warms up the filter, the http client and the thread pool
+
+   const ProcessSample baseline = sampleProcess();
+   std::cout << "Mock IdM latency " << options.mLatencyMs << " ms, baseline " << baseline.mThreads << " threads, "
+      << std::fixed << std::setprecision(1) << baseline.mPrivateBytes / 1048576.0 << " MB private" << std::endl
+      << "in flight   threads   pipeline threads   working set [MB]   private [MB]   private/call [KB]   p50 [ms]   max [ms]" << std::endl;
+
+   for (size_t inFlight : options.mInFlight)
+   {
+      std::mutex mutex;
+      std::condition_variable startCondition;
+      bool started = false;
+      std::vector<double> durations(inFlight);
+      std::vector<std::thread> callers;
+      callers.reserve(inFlight);
+      for (size_t i = 0; i < inFlight; ++i)
+      {
+         callers.emplace_back([&, i]()
+            {
+               {
+                  std::unique_lock<std::mutex> lock(mutex);
+                  startCondition.wait(lock, [&]() { return started; });
+               }
+               durations[i] = callPasswordFilter(i + 1);
+            });
+      }
+
+      std::atomic<bool> running = true;
+      ProcessSample peak;
+      std::thread sampler([&]()
+         {
+            while (running.load())
+            {
+               ProcessSample sample = sampleProcess();
+               peak.mThreads = std::max(peak.mThreads, sample.mThreads);
+               peak.mWorkingSet = std::max(peak.mWorkingSet, sample.mWorkingSet);
+               peak.mPrivateBytes = std::max(peak.mPrivateBytes, sample.mPrivateBytes);
+               std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+         });
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         started = true;
+      }
+      startCondition.notify_all();
+      for (std::thread& caller : callers)
+         caller.join();
+      running.store(false);
+      sampler.join();
+
+      // the sampler thread itself is not counted
+      long long pipelineThreads = static_cast<long long>(peak.mThreads) - 1 - static_cast<long long>(baseline.mThreads) - static_cast<long long>(inFlight);
+      double privatePerCallKb = peak.mPrivateBytes > baseline.mPrivateBytes ? (peak.mPrivateBytes - baseline.mPrivateBytes) / 1024.0 / inFlight : 0;
+      std::cout << std::setw(9) << inFlight << "   " << std::setw(7) << peak.mThreads - 1 << "   " << std::setw(16) << pipelineThreads << "   "
+         << std::setw(16) << peak.mWorkingSet / 1048576.0 << "   " << std::setw(12) << peak.mPrivateBytes / 1048576.0 << "   "
+         << std::setw(17) << privatePerCallKb << "   " << std::setw(8) << percentile(durations, 50) << "   " << std::setw(8) << percentile(durations, 100) << std::endl;
+   }
+   mock.stop();
+   return 0;
+}
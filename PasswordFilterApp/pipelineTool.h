@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "pipeline" command of PasswordFilterApp.
+* Measures how the threads and the memory of the process scale with the number of PasswordFilter calls
+* in flight against a slow local mock IdM.
+*/
+int runPipeline(int argc, char* argv[]);
@@ -0,0 +1,318 @@
+#include "pch.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "passwordFilter.h"
+#include "processRole.h"
+#include "textCodec.h"
+#include "precheckTool.h"
+
+
+namespace
+{
+   struct PrecheckOptions
+   {
+      std::string mConfigPath;
+      std::string mInput = "-"; // stdin
+      uint32_t mInFlight = 16;
+      uint32_t mColumns = 2; // 3 = the full name follows the password
+   };
+
+   struct Item
+   {
+      size_t mIdx = 0;
+      ut::string_t mAccountName;
+      ut::string_t mFullName;
+      ut::string_t mPassword;
+      bool mValid = true;
+   };
+
+   struct Result
+   {
+      std::string mAccountName;
+      const char* mDecision = "INVALID";
+      const char* mReason = "format";
+      double mDurationMs = 0;
+   };
+
+   constexpr size_t sWindowPerCall = 64; // results kept for the ordering per call in flight
+   // the decision was given without the rules of IdM (e.g. by allowChangeByDefault), it says nothing about the password
+   const char* const sUnverifiedReasons[] = { "idmUnresolved", "offline", "workerUnavailable", "notConfigured", "disabled" };
+   constexpr std::chrono::seconds sProgressInterval{ 5 };
+
+   void printPrecheckUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp precheck <cfg> [--input <file>|-] [--inFlight <count>] [--columns 2|3]" << std::endl
+         << "  Checks candidate passwords by the full decision of PasswordFilter (a password set) with the configuration <cfg>:" << std::endl
+         << "  reserved prefixes, local rules, the forbidden dictionary and IdM, with at most <count> calls in flight." << std::endl
+         << "  The input (stdin by default) has one \"account<TAB>password\" per line in UTF-8. The results go to stdout in the" << std::endl
+         << "  input order as \"line<TAB>account<TAB>APPROVED|DISAPPROVED|UNVERIFIED|INVALID<TAB>reason\", the statistics go" << std::endl
+         << "  to stderr. UNVERIFIED means the policy of IdM couldn't be checked (IdM unreachable, the filter not configured)." << std::endl
+         << "  With --columns 3 the lines are \"account<TAB>password<TAB>fullName\" and the full name is checked by the local rule" << std::endl
+         << "  notContainFullName, otherwise the full name is empty and that rule passes." << std::endl
+         << "  The precheck decides every password in this process: the network worker and the offline mode are not used." << std::endl
+         << "  The passwords are never written anywhere. Exit code 0 = all approved, 2 = some disapproved or invalid," << std::endl
+         << "  3 = the others approved but some unverified." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], PrecheckOptions& options)
+   {
+      if (argc < 1 || argc % 2 == 0)
+         return false;
+      options.mConfigPath = argv[0];
+      for (int i = 1; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--input")
+            options.mInput = argv[i + 1];
+         else if (name == "--inFlight")
+            options.mInFlight = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else if (name == "--columns")
+            options.mColumns = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else
+            return false;
+      }
+      return options.mInFlight > 0 && (options.mColumns == 2 || options.mColumns == 3);
+   }
+
+   double percentile(std::vector<double> values, double pct)
+   {
+      if (values.empty())
+         return 0;
+      std::sort(values.begin(), values.end());
+      size_t idx = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+      return values[std::min(idx, values.size() - 1)];
+   }
+
+   void wipe(std::string& str)
+   {
+      SecureZeroMemory(&str[0], str.size());
+      str.clear();
+   }
+
+   void wipe(ut::string_t& str)
+   {
+      SecureZeroMemory(&str[0], str.size() * sizeof(ut::string_t::value_type));
+      str.clear();
+   }
+
+   /**
+   * Splits the line at the first tab and with three columns also at the last one, the password may contain
+   * more of them. The line is wiped.
+   */
+   Item parseLine(size_t idx, std::string& line, uint32_t columns)
+   {
+      Item item;
+      item.mIdx = idx;
+      if (!line.empty() && line.back() == '\r')
+         line.pop_back();
+      size_t tab = line.find('\t');
+      size_t passwordEnd = columns == 3 ? line.rfind('\t') : line.size();
+      if (tab == std::string::npos || tab == 0 || passwordEnd == std::string::npos || passwordEnd <= tab + 1)
+         item.mValid = false;
+      else
+      {
+         item.mAccountName = TextCodec::toUtf16(line.data(), tab);
+         item.mPassword = TextCodec::toUtf16(line.data() + tab + 1, passwordEnd - tab - 1);
+         if (passwordEnd < line.size())
+            item.mFullName = TextCodec::toUtf16(line.data() + passwordEnd + 1, line.size() - passwordEnd - 1);
+      }
+      wipe(line);
+      return item;
+   }
+
+   UNICODE_STRING toUnicodeString(ut::string_t& str)
+   {
+      UNICODE_STRING uniStr;
+      uniStr.Buffer = str.data();
+      uniStr.Length = static_cast<USHORT>(str.size() * sizeof(wchar_t));
+      uniStr.MaximumLength = uniStr.Length;
+      return uniStr;
+   }
+
+   Result check(Item& item)
+   {
+      Result result;
+      if (!item.mValid)
+         return result;
+
+      result.mAccountName = TextCodec::toUtf8(item.mAccountName);
+      UNICODE_STRING uAccount = toUnicodeString(item.mAccountName);
+      UNICODE_STRING uFullName = toUnicodeString(item.mFullName);
+      UNICODE_STRING uPassword = toUnicodeString(item.mPassword);
+      auto start = std::chrono::steady_clock::now();
+      BOOLEAN approved = PasswordFilter(&uAccount, &uFullName, &uPassword, TRUE);
+      result.mDurationMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      wipe(item.mPassword);
+      result.mReason = GetLastDecisionReason();
+      bool unverified = std::any_of(std::begin(sUnverifiedReasons), std::end(sUnverifiedReasons),
+         [&result](const char* reason) { return strcmp(reason, result.mReason) == 0; });
+      result.mDecision = unverified ? "UNVERIFIED" : approved ? "APPROVED" : "DISAPPROVED";
+      return result;
+   }
+
+   /**
+   * Precheck hands the lines over to the calling threads and writes the results in the input order.
+   */
+   class Precheck
+   {
+   private:
+      std::mutex mMutex; // guards everything below
+      std::condition_variable mCondition;
+      std::deque<Item> mPending;
+      std::map<size_t, Result> mDone; // finished out of order
+      size_t mNextIdx = 0;   // of the next line read
+      size_t mNextPrint = 0; // of the next result written
+      bool mEndOfInput = false;
+      size_t mWindow;
+      uint32_t mColumns;
+
+      std::chrono::steady_clock::time_point mStart = std::chrono::steady_clock::now();
+      std::chrono::steady_clock::time_point mLastProgress = mStart;
+      std::vector<double> mDurationsMs;
+      std::map<std::string, size_t> mReasons;
+      size_t mApproved = 0;
+      size_t mDisapproved = 0;
+      size_t mUnverified = 0;
+      size_t mInvalid = 0;
+
+      void printReady()
+      {
+         for (auto it = mDone.find(mNextPrint); it != mDone.end(); it = mDone.find(mNextPrint))
+         {
+            const Result& result = it->second;
+            std::cout << mNextPrint + 1 << '\t' << result.mAccountName << '\t' << result.mDecision << '\t' << result.mReason << '\n';
+            if (result.mDecision[0] == 'A')
+               ++mApproved;
+            else if (result.mDecision[0] == 'D')
+               ++mDisapproved;
+            else if (result.mDecision[0] == 'U')
+               ++mUnverified;
+            else
+               ++mInvalid;
+            if (result.mDecision[0] != 'I')
+               mDurationsMs.push_back(result.mDurationMs);
+            ++mReasons[result.mReason];
+            mDone.erase(it);
+            ++mNextPrint;
+         }
+         auto now = std::chrono::steady_clock::now();
+         if (now - mLastProgress >= sProgressInterval)
+         {
+            mLastProgress = now;
+            std::cout.flush();
+            std::cerr << mNextPrint << " checked, " << std::fixed << std::setprecision(1)
+               << mNextPrint / std::chrono::duration<double>(now - mStart).count() << " per second" << std::endl;
+         }
+      }
+
+   public:
+      Precheck(uint32_t inFlight, uint32_t columns) : mWindow(inFlight * sWindowPerCall), mColumns(columns) {}
+
+      void add(std::string& line)
+      {
+         std::unique_lock<std::mutex> lock(mMutex);
+         mCondition.wait(lock, [this]() { return mNextIdx - mNextPrint < mWindow; });
+         mPending.push_back(parseLine(mNextIdx++, line, mColumns));
+         mCondition.notify_all();
+      }
+
+      void endOfInput()
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         mEndOfInput = true;
+         mCondition.notify_all();
+      }
+
+      void runCaller()
+      {
+         while (true)
+         {
+            Item item;
+            {
+               std::unique_lock<std::mutex> lock(mMutex);
+               mCondition.wait(lock, [this]() { return mEndOfInput || !mPending.empty(); });
+               if (mPending.empty())
+                  return;
+               item = std::move(mPending.front());
+               mPending.pop_front();
+            }
+            Result result = check(item);
+            std::lock_guard<std::mutex> lock(mMutex);
+            mDone.emplace(item.mIdx, std::move(result));
+            printReady();
+            mCondition.notify_all();
+         }
+      }
+
+      /**
+      * printSummary returns the exit code.
+      */
+      int printSummary()
+      {
+         std::cout.flush();
+         double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+         std::cerr << std::fixed << std::setprecision(1) << mNextPrint << " lines in " << elapsedSec << " s, "
+            << (elapsedSec > 0 ? mNextPrint / elapsedSec : 0) << " per second: " << mApproved << " approved, "
+            << mDisapproved << " disapproved, " << mUnverified << " unverified, " << mInvalid << " invalid" << std::endl
+            << "decision time p50 " << percentile(mDurationsMs, 50) << " ms, p99 " << percentile(mDurationsMs, 99)
+            << " ms, max " << percentile(mDurationsMs, 100) << " ms" << std::endl;
+         for (const auto& reason : mReasons)
+            std::cerr << "  " << std::setw(18) << std::left << reason.first << std::right << " " << reason.second << std::endl;
+         if (mDisapproved > 0 || mInvalid > 0)
+            return 2;
+         return mUnverified > 0 ? 3 : 0;
+      }
+   };
+}
+
+int runPrecheck(int argc, char* argv[])
+{
+   PrecheckOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printPrecheckUsage();
+      return 1;
+   }
+
+   std::ifstream file;
+   if (options.mInput != "-")
+   {
+      file.open(options.mInput, std::ios::binary);
+      if (file.fail())
+      {
+         std::cerr << "The input file can't be opened" << std::endl;
+         return 1;
+      }
+   }
+   std::istream& in = options.mInput != "-" ? static_cast<std::istream&>(file) : std::cin;
+
+   _putenv_s("BCV_PWF_CONFIG_FILE_PATH", options.mConfigPath.c_str()); // read by the filter on its lazy init
+   SetProcessRole(ProcessRole::ROLE_PRECHECK); // own log files, no worker, no offline mode
+   InitializeChangeNotify();
+
+   Precheck precheck(options.mInFlight, options.mColumns);
+   std::vector<std::thread> callers;
+   for (uint32_t i = 0; i < options.mInFlight; ++i)
+      callers.emplace_back([&precheck]() { precheck.runCaller(); });
+
+   std::string line;
+   bool first = true;
+   while (std::getline(in, line))
+   {
+      if (first && line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+         line.erase(0, 3); // UTF-8 BOM
+      first = false;
+      precheck.add(line);
+   }
+   wipe(line);
+   precheck.endOfInput();
+   for (std::thread& caller : callers)
+      caller.join();
+
+   return precheck.printSummary();
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+* "precheck" command of PasswordFilterApp.
+* Checks a stream of candidate passwords of accounts by the full decision of the filter, several calls in parallel.
+*/
+int runPrecheck(int argc, char* argv[]);
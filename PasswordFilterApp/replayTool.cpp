@@ -0,0 +1,232 @@
+#include "pch.h"
+#include <algorithm>
+#include <thread>
+#include "passwordFilter.h"
+#include "trafficRecord.h"
+#include "replayTool.h"
+#include "mockIdm.h"
+
+
+namespace
+{
+   struct ReplayOptions
+   {
+      std::string mRecordingPath;
+      ut::string_t mConfigTemplatePath;
+      uint16_t mPort = 18080;
+      double mSpeed = 1.0;
+      uint32_t mWorkers = 64;
+   };
+
+   void printReplayUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp replay <recording> [--config <template cfg>] [--port <port>] [--speed <factor>] [--workers <count>]" << std::endl
+         << "  Replays the recorded calls against a mock IdM listening on 127.0.0.1:<port>, at most <count> (64) of them at once." << std::endl
+         << "  A call that finds all workers busy starts late, the largest delay is reported." << std::endl
+         << "  The mock answers every attempt with the recorded status after the recorded latency," << std::endl
+         << "  failed connections are answered by 504. Tuning items are taken from the template configuration." << std::endl
+         << "  The calls decided without IdM (reserved prefix, local rules, dictionary, negative cache, offline) are skipped." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], ReplayOptions& options)
+   {
+      if (argc < 1)
+         return false;
+      options.mRecordingPath = argv[0];
+      for (int i = 1; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         if (name == "--config")
+            options.mConfigTemplatePath = ut::conversions::to_string_t(std::string(argv[i + 1]));
+         else if (name == "--port")
+            options.mPort = static_cast<uint16_t>(std::stoul(argv[i + 1]));
+         else if (name == "--speed")
+            options.mSpeed = std::stod(argv[i + 1]);
+         else if (name == "--workers")
+            options.mWorkers = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+         else
+            return false;
+      }
+      return options.mSpeed > 0 && options.mWorkers > 0;
+   }
+
+   double percentile(std::vector<double> values, double pct)
+   {
+      if (values.empty())
+         return 0;
+      std::sort(values.begin(), values.end());
+      size_t idx = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+      return values[std::min(idx, values.size() - 1)];
+   }
+
+   /**
+   * The replayed calls use the account names "replay<idx>", false for any other name.
+   */
+   bool parseRecordIdx(const ut::string_t& account, size_t& idx)
+   {
+      const ut::string_t prefix = U("replay");
+      if (account.size() <= prefix.size() || account.size() > prefix.size() + 9 || account.compare(0, prefix.size(), prefix) != 0)
+         return false;
+      idx = 0;
+      for (size_t i = prefix.size(); i < account.size(); ++i)
+      {
+         if (account[i] < U('0') || account[i] > U('9'))
+            return false;
+         idx = idx * 10 + (account[i] - U('0'));
+      }
+      return true;
+   }
+
+   UNICODE_STRING toUnicodeString(std::wstring& str)
+   {
+      UNICODE_STRING uniStr;
+      uniStr.Buffer = str.data();
+      uniStr.Length = static_cast<USHORT>(str.size() * sizeof(wchar_t));
+      uniStr.MaximumLength = uniStr.Length;
+      return uniStr;
+   }
+}
+
+int runReplay(int argc, char* argv[])
+{
+   ReplayOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printReplayUsage();
+      return 1;
+   }
+
+   std::ifstream in(options.mRecordingPath, std::ios_base::in | std::ios_base::binary);
+   if (in.fail() || !TrafficRecord::readMagic(in))
+   {
+      std::cerr << "The file " << options.mRecordingPath << " is not a traffic recording" << std::endl;
+      return 1;
+   }
+   // the calls decided without IdM (reserved prefix, local rules, dictionary, cache, offline) have no attempts to replay
+   std::vector<TrafficRecord> records;
+   size_t decidedLocally = 0;
+   TrafficRecord record;
+   while (record.read(in))
+   {
+      if (record.mOrigin == TrafficRecord::ORIGIN_IDM || record.mOrigin == TrafficRecord::ORIGIN_IDM_UNRESOLVED)
+         records.push_back(record);
+      else
+         ++decidedLocally;
+   }
+   if (records.empty())
+   {
+      std::cerr << "The recording contains no calls decided by IdM" << std::endl;
+      return 1;
+   }
+   std::stable_sort(records.begin(), records.end(), [](const TrafficRecord& a, const TrafficRecord& b) { return a.mStartUs < b.mStartUs; });
+
+   size_t endpointCount = 1;
+   uint32_t maxAttempts = 1;
+   for (const TrafficRecord& rec : records)
+   {
+      for (const TrafficAttempt& attempt : rec.mAttempts)
+         endpointCount = std::max<size_t>(endpointCount, attempt.mEndpointIdx + 1);
+      maxAttempts = std::max<uint32_t>(maxAttempts, static_cast<uint32_t>(rec.mAttempts.size()));
+   }
+
+   // the mock finds the record by the synthetic account name and answers its attempts in order
+   std::unique_ptr<std::atomic<size_t>[]> attemptCounters = std::make_unique<std::atomic<size_t>[]>(records.size());
+   for (size_t i = 0; i < records.size(); ++i)
+      attemptCounters[i].store(0);
+   MockIdm mock(options.mPort, endpointCount, [&](size_t, const ut::string_t&, const wj::value& body) -> MockIdmResponse
+      {
+         MockIdmResponse response;
+         if (!body.has_string_field(U("username")))
+            return response;
+         size_t idx = 0;
+         if (!parseRecordIdx(body.at(U("username")).as_string(), idx) || idx >= records.size())
+            return response;
+         size_t attemptNo = attemptCounters[idx].fetch_add(1);
+         const auto& attempts = records[idx].mAttempts;
+         if (attemptNo >= attempts.size())
+            return response;
+         const TrafficAttempt& attempt = attempts[attemptNo];
+         response.mDelay = std::chrono::microseconds(static_cast<int64_t>(attempt.mLatencyUs / options.mSpeed));
+         response.mStatus = attempt.mOutcome == TrafficAttempt::OUTCOME_RESPONSE ? attempt.mStatus : wh::status_codes::GatewayTimeout;
+         return response;
+      });
+
+   try
+   {
+      mock.start();
+      std::filesystem::path cfgPath = std::filesystem::temp_directory_path() / "PasswordFilterReplay.cfg";
+      mock.writeConfig(options.mConfigTemplatePath, cfgPath.native(), maxAttempts);
+      _putenv_s("BCV_PWF_CONFIG_FILE_PATH", cfgPath.string().c_str()); // read by the filter on its lazy init
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "The mock IdM can't be started: " << e.what() << std::endl;
+      return 1;
+   }
+   InitializeChangeNotify();
+
+   std::cout << "Replaying " << records.size() << " calls against " << endpointCount << " mock endpoint(s), speed " << options.mSpeed << "x, "
+      << options.mWorkers << " workers, " << decidedLocally << " calls decided without IdM are skipped" << std::endl;
+   std::vector<double> replayedMs(records.size());
+   std::vector<double> lateMs(records.size());
+   std::vector<std::chrono::steady_clock::time_point> starts(records.size()), ends(records.size());
+   std::atomic<size_t> nextRecord = 0;
+   const auto replayStart = std::chrono::steady_clock::now();
+   // a free worker takes the next record in the order of the start times and waits for its start
+   auto replayCalls = [&]()
+   {
+      for (size_t i = nextRecord.fetch_add(1); i < records.size(); i = nextRecord.fetch_add(1))
+      {
+         const TrafficRecord& rec = records[i];
+         auto due = replayStart + std::chrono::microseconds(static_cast<int64_t>((rec.mStartUs - records[0].mStartUs) / options.mSpeed));
+         std::this_thread::sleep_until(due);
+         std::wstring account = L"replay" + std::to_wstring(i);
+         std::wstring fullName = account;
+         std::wstring password(TrafficRecord::getPasswordLengthFromClass(rec.mPasswordLengthClass), L'x');
+         UNICODE_STRING uAccount = toUnicodeString(account);
+         UNICODE_STRING uFullName = toUnicodeString(fullName);
+         UNICODE_STRING uPassword = toUnicodeString(password);
+
+         starts[i] = std::chrono::steady_clock::now();
+         lateMs[i] = std::chrono::duration<double, std::milli>(starts[i] - due).count();
+         if (rec.mKind == TrafficRecord::KIND_PASSWORD_CHANGE_NOTIFY)
+            PasswordChangeNotify(&uAccount, 0, &uPassword);
+         else
+            PasswordFilter(&uAccount, &uFullName, &uPassword, rec.mSetOperation != 0);
+         ends[i] = std::chrono::steady_clock::now();
+         replayedMs[i] = std::chrono::duration<double, std::milli>(ends[i] - starts[i]).count();
+      }
+   };
+   std::vector<std::thread> workers;
+   for (uint32_t i = 0; i < std::min<size_t>(options.mWorkers, records.size()); ++i)
+      workers.emplace_back(replayCalls);
+   for (std::thread& worker : workers)
+      worker.join();
+   mock.stop();
+
+   // peak concurrency of the replay
+   std::vector<std::pair<std::chrono::steady_clock::time_point, int>> events;
+   for (size_t i = 0; i < records.size(); ++i)
+   {
+      events.emplace_back(starts[i], 1);
+      events.emplace_back(ends[i], -1);
+   }
+   std::sort(events.begin(), events.end());
+   int concurrency = 0, peakConcurrency = 0;
+   for (const auto& event : events)
+      peakConcurrency = std::max(peakConcurrency, concurrency += event.second);
+
+   std::vector<double> recordedMs;
+   for (const TrafficRecord& rec : records)
+      recordedMs.push_back(rec.mDurationUs / 1000.0 / options.mSpeed);
+
+   std::cout << std::fixed << std::setprecision(1)
+      << "            p50       p95       p99       max   [ms]" << std::endl
+      << "recorded  " << std::setw(7) << percentile(recordedMs, 50) << "   " << std::setw(7) << percentile(recordedMs, 95) << "   "
+      << std::setw(7) << percentile(recordedMs, 99) << "   " << std::setw(7) << percentile(recordedMs, 100) << std::endl
+      << "replayed  " << std::setw(7) << percentile(replayedMs, 50) << "   " << std::setw(7) << percentile(replayedMs, 95) << "   "
+      << std::setw(7) << percentile(replayedMs, 99) << "   " << std::setw(7) << percentile(replayedMs, 100) << std::endl
+      << "peak concurrency of the replay: " << peakConcurrency << std::endl
+      << "largest delay of a start: " << percentile(lateMs, 100) << " ms" << std::endl;
+   return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "replay" command of PasswordFilterApp.
+* Re-drives a traffic recording made by the filter (see TrafficRecorder) against a local mock IdM
+* with the recorded arrival pattern, so tuning changes can be tested with the real traffic shape.
+*/
+int runReplay(int argc, char* argv[]);
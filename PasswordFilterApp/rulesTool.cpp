@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "rulesTool.h"
+#include "passwordRules.h"
+
+
+namespace
+{
+   struct RulesOptions
+   {
+      std::string mConfigPath;
+      ut::string_t mAccountName;
+      ut::string_t mFullName;
+      ut::string_t mPassword;
+      uint32_t mIterations = 1000000;
+   };
+
+   void printRulesUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp rules <cfg> --password <password> [--account <account>] [--fullName <full name>] [--iterations <count>]" << std::endl
+         << "  Evaluates the password against the localRules of the configuration file the same way as PasswordFilter" << std::endl
+         << "  and prints the rule which fired and the average evaluation time." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], RulesOptions& options)
+   {
+      if (argc < 1)
+         return false;
+      options.mConfigPath = argv[0];
+      bool hasPassword = false;
+      for (int i = 1; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         ut::string_t value = ut::conversions::to_string_t(std::string(argv[i + 1]));
+         if (name == "--password")
+         {
+            options.mPassword = value;
+            hasPassword = true;
+         }
+         else if (name == "--account")
+            options.mAccountName = value;
+         else if (name == "--fullName")
+            options.mFullName = value;
+         else if (name == "--iterations")
+            options.mIterations = static_cast<uint32_t>(std::max(1ul, std::stoul(argv[i + 1])));
+         else
+            return false;
+      }
+      return hasPassword;
+   }
+}
+
+int runRules(int argc, char* argv[])
+{
+   RulesOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printRulesUsage();
+      return 1;
+   }
+
+   std::shared_ptr<const PasswordRules> rules;
+   try
+   {
+      std::ifstream cfgFile(options.mConfigPath);
+      if (cfgFile.fail())
+      {
+         std::cerr << "The configuration file " << options.mConfigPath << " can't be opened" << std::endl;
+         return 1;
+      }
+      wj::value rootObj = wj::value::parse(cfgFile);
+      const ut::string_t localRulesKey = U("localRules");
+      rules = PasswordRules::create(rootObj.has_object_field(localRulesKey) ? &rootObj.at(localRulesKey) : nullptr);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "The local rules can't be compiled: " << e.what() << std::endl;
+      return 1;
+   }
+
+   std::cout << "Compiled " << rules->getRuleCount() << " rule(s), enabled: " << (rules->getEnabled() ? "true" : "false") << std::endl;
+   for (size_t i = 0; i < rules->getRuleCount(); ++i)
+      std::cout << "  " << rules->getRuleName(i) << " - " << rules->getRuleDescription(i) << std::endl;
+
+   int result = rules->evaluate(options.mPassword.data(), options.mPassword.size(), options.mAccountName.data(), options.mAccountName.size(),
+      options.mFullName.data(), options.mFullName.size());
+   if (result == PasswordRules::sPassed)
+      std::cout << "Result: APPROVED" << std::endl;
+   else
+      std::cout << "Result: DISAPPROVED by the rule \"" << rules->getRuleName(result) << "\"" << std::endl;
+
+   volatile int sink = 0;
+   auto start = std::chrono::steady_clock::now();
+   for (uint32_t i = 0; i < options.mIterations; ++i)
+      sink = rules->evaluate(options.mPassword.data(), options.mPassword.size(), options.mAccountName.data(), options.mAccountName.size(),
+         options.mFullName.data(), options.mFullName.size());
+   auto elapsed = std::chrono::steady_clock::now() - start;
+   std::cout << "Evaluation: " << std::chrono::duration<double, std::nano>(elapsed).count() / options.mIterations << " ns on average over "
+      << options.mIterations << " iterations" << std::endl;
+   return result == PasswordRules::sPassed ? 0 : 2;
+}
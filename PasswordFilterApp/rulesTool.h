@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* "rules" command of PasswordFilterApp.
+* Compiles the local rules of a configuration file (see PasswordRules), evaluates a password against them
+* and measures the evaluation time.
+*/
+int runRules(int argc, char* argv[]);
@@ -0,0 +1,222 @@
+#include "pch.h"
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <winsock2.h>
+#include <iphlpapi.h>
+#include "idmTransport.h"
+#include "transportTool.h"
+#include "mockIdm.h"
+
+#pragma comment(lib, "Iphlpapi.lib")
+
+
+namespace
+{
+   struct TransportOptions
+   {
+      uint32_t mRequests = 2000;
+      uint32_t mConcurrency = 32;
+      uint32_t mLatencyMs = 5;
+      uint16_t mPort = 18082;
+      ut::string_t mUrl; // an external server instead of the mock
+      bool mTls = true; // of the mock
+      bool mIgnoreCertificate = false;
+   };
+
+   struct Variant
+   {
+      const char* mName;
+      const wchar_t* mBackend;
+      bool mHttp2;
+   };
+
+   void printTransportUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp transport [--requests <count>] [--concurrency <count>] [--latencyMs <ms>] [--port <port>]" << std::endl
+         << "                                   [--tls <true|false>] [--url <base url>] [--ignoreCertificate <true|false>]" << std::endl
+         << "  Sends <count> validation requests, <concurrency> at a time, by every transport backend and reports" << std::endl
+         << "  the throughput, the latencies and the TCP connections used. Without --url the requests go to a local" << std::endl
+         << "  mock IdM on 127.0.0.1:<port> answering after <latencyMs>. The mock serves https with a temporary self-signed" << std::endl
+         << "  certificate, so HTTP/2 is negotiated (it needs an elevated prompt); --tls false serves plain HTTP/1.1." << std::endl
+         << "  --url sends the requests to another server instead." << std::endl;
+   }
+
+   bool parseOptions(int argc, char* argv[], TransportOptions& options)
+   {
+      for (int i = 0; i + 1 < argc; i += 2)
+      {
+         std::string name(argv[i]);
+         std::string value(argv[i + 1]);
+         if (name == "--requests")
+            options.mRequests = static_cast<uint32_t>(std::stoul(value));
+         else if (name == "--concurrency")
+            options.mConcurrency = static_cast<uint32_t>(std::stoul(value));
+         else if (name == "--latencyMs")
+            options.mLatencyMs = static_cast<uint32_t>(std::stoul(value));
+         else if (name == "--port")
+            options.mPort = static_cast<uint16_t>(std::stoul(value));
+         else if (name == "--url")
+            options.mUrl = ut::conversions::to_string_t(value);
+         else if (name == "--tls")
+            options.mTls = value == "true";
+         else if (name == "--ignoreCertificate")
+            options.mIgnoreCertificate = value == "true";
+         else
+            return false;
+      }
+      return argc % 2 == 0 && options.mRequests > 0 && options.mConcurrency > 0;
+   }
+
+   /**
+   * Local ports of the established connections of this process to the remote port.
+   */
+   std::vector<DWORD> getConnections(uint16_t remotePort)
+   {
+      std::vector<DWORD> ports;
+      ULONG size = 0;
+      GetExtendedTcpTable(nullptr, &size, FALSE, AF_INET, TCP_TABLE_OWNER_PID_CONNECTIONS, 0);
+      std::vector<unsigned char> buffer(size);
+      if (GetExtendedTcpTable(buffer.data(), &size, FALSE, AF_INET, TCP_TABLE_OWNER_PID_CONNECTIONS, 0) != NO_ERROR)
+         return ports;
+
+      const auto* table = reinterpret_cast<const MIB_TCPTABLE_OWNER_PID*>(buffer.data());
+      const DWORD pid = GetCurrentProcessId();
+      for (DWORD i = 0; i < table->dwNumEntries; ++i)
+      {
+         const MIB_TCPROW_OWNER_PID& row = table->table[i];
+         uint16_t port = static_cast<uint16_t>(((row.dwRemotePort & 0xFF) << 8) | ((row.dwRemotePort >> 8) & 0xFF)); // network order
+         if (row.dwOwningPid == pid && row.dwState == MIB_TCP_STATE_ESTAB && port == remotePort)
+            ports.push_back(row.dwLocalPort);
+      }
+      return ports;
+   }
+
+   double percentile(std::vector<double> values, double pct)
+   {
+      if (values.empty())
+         return 0;
+      std::sort(values.begin(), values.end());
+      size_t idx = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+      return values[std::min(idx, values.size() - 1)];
+   }
+
+   void runVariant(const Variant& variant, const TransportOptions& options, const wh::uri& checkUrl)
+   {
+      wj::value transportObj;
+      transportObj[U("backend")] = wj::value::string(variant.mBackend);
+      transportObj[U("http2")] = wj::value::boolean(variant.mHttp2);
+      auto transport = IdmTransport::create(&transportObj, 30000, !options.mIgnoreCertificate);
+
+      std::vector<double> latencies(options.mRequests);
+      std::atomic<uint32_t> nextRequest = 0;
+      std::atomic<uint32_t> failures = 0;
+      std::atomic<bool> running = true;
+      const uint16_t remotePort = static_cast<uint16_t>(checkUrl.port() > 0 ? checkUrl.port() : (checkUrl.scheme() == U("https") ? 443 : 80));
+      std::set<DWORD> seenConnections;
+      size_t peakConnections = 0;
+      std::thread sampler([&]()
+         {
+            while (running.load())
+            {
+               std::vector<DWORD> connections = getConnections(remotePort);
+               peakConnections = std::max(peakConnections, connections.size());
+               seenConnections.insert(connections.begin(), connections.end());
+               std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+         });
+
+      const auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> clients;
+      for (uint32_t c = 0; c < options.mConcurrency; ++c)
+      {
+         clients.emplace_back([&]()
+            {
+               for (uint32_t i = nextRequest.fetch_add(1); i < options.mRequests; i = nextRequest.fetch_add(1))
+               {
+                  wj::value body;
+                  body[U("username")] = wj::value::string(U("transport") + ut::conversions::to_string_t(std::to_string(i)));
+                  body[U("password")] = wj::value::string(U("Transport-Benchmark-1"));
+                  body[U("resource")] = wj::value::string(U("mock"));
+                  wh::http_request request(wh::methods::PUT);
+                  request.set_body(body);
+                  auto requestStart = std::chrono::steady_clock::now();
+                  try
+                  {
+                     wh::http_response response = transport->send(checkUrl, request).get();
+                     response.extract_vector().wait();
+                  }
+                  catch (const std::exception&)
+                  {
+                     failures.fetch_add(1);
+                  }
+                  latencies[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requestStart).count();
+               }
+            });
+      }
+      for (std::thread& client : clients)
+         client.join();
+      double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      running.store(false);
+      sampler.join();
+
+      std::cout << std::left << std::setw(16) << variant.mName << std::right << std::fixed << std::setprecision(1)
+         << std::setw(10) << options.mRequests / elapsedSec << "   " << std::setw(8) << percentile(latencies, 50) << "   "
+         << std::setw(8) << percentile(latencies, 99) << "   " << std::setw(11) << peakConnections << "   "
+         << std::setw(11) << seenConnections.size() << "   " << std::setw(8) << failures.load() << std::endl;
+   }
+}
+
+int runTransport(int argc, char* argv[])
+{
+   TransportOptions options;
+   if (!parseOptions(argc, argv, options))
+   {
+      printTransportUsage();
+      return 1;
+   }
+
+   const auto latency = std::chrono::milliseconds(options.mLatencyMs);
+   MockIdm mock(options.mPort, 1, [latency](size_t, const ut::string_t&, const wj::value&) -> MockIdmResponse
+      {
+         MockIdmResponse response;
+         response.mDelay = latency;
+         return response;
+      }, options.mTls);
+
+   ut::string_t baseUrl = options.mUrl;
+   try
+   {
+      if (baseUrl.empty())
+      {
+         mock.start();
+         baseUrl = mock.getBaseUrls().front();
+         options.mIgnoreCertificate = true; // the certificate of the mock is self-signed
+      }
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "The mock IdM can't be started: " << e.what() << std::endl;
+      if (options.mTls)
+         std::cerr << "Run it from an elevated prompt or with --tls false (HTTP/1.1 only)" << std::endl;
+      return 1;
+   }
+
+   wh::uri_builder urlBuild(baseUrl);
+   urlBuild.append(U("validate"));
+   const wh::uri checkUrl = urlBuild.to_uri();
+   std::cout << options.mRequests << " requests, " << options.mConcurrency << " concurrent, target " << ut::conversions::to_utf8string(checkUrl.to_string()) << std::endl
+      << "transport          req/s   p50 [ms]   p99 [ms]   peak conns   conns seen   failures" << std::endl;
+
+   const Variant variants[] = {
+      { "cpprest", U("cpprest"), false },
+      { "shared HTTP/1.1", U("shared"), false },
+      { "shared HTTP/2", U("shared"), true }
+   };
+   for (const Variant& variant : variants)
+      runVariant(variant, options, checkUrl);
+
+   mock.stop();
+   return 0;
+}
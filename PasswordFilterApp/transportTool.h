@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+* "transport" command of PasswordFilterApp.
+* Compares the IdM transport backends (see IdmTransport) by throughput, latency and the connections they open.
+*/
+int runTransport(int argc, char* argv[]);
@@ -0,0 +1,44 @@
+#include "pch.h"
+#include "passwordFilter.h"
+#include "workerTool.h"
+
+
+namespace
+{
+   HANDLE sStopEvent = nullptr;
+
+   BOOL WINAPI onConsoleControl(DWORD)
+   {
+      SetEvent(sStopEvent);
+      return TRUE;
+   }
+
+   void printWorkerUsage()
+   {
+      std::cout << "Usage: PasswordFilterApp worker" << std::endl
+         << "  Serves the calls forwarded by the filter in LSASS when \"networkWorker\" is enabled in the configuration." << std::endl
+         << "  It has to run as LocalSystem (e.g. a service or a scheduled task at startup) with the configuration file" << std::endl
+         << "  of the filter. Ctrl+C or closing the console stops it, the filter falls back to allowChangeByDefault then." << std::endl;
+   }
+}
+
+int runWorker(int argc, char* argv[])
+{
+   if (argc != 0)
+   {
+      printWorkerUsage();
+      return 1;
+   }
+
+   sStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+   if (sStopEvent == nullptr)
+   {
+      std::cerr << "The stop event can't be created, error " << GetLastError() << std::endl;
+      return 1;
+   }
+   SetConsoleCtrlHandler(onConsoleControl, TRUE);
+   std::cout << "Serving the calls forwarded from LSASS, see PasswordFilterLog.Worker.log in the log folder of the filter" << std::endl;
+   DWORD result = RunNetworkWorker(sStopEvent);
+   CloseHandle(sStopEvent);
+   return result == ERROR_SUCCESS ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+* "worker" command of PasswordFilterApp.
+* Runs the network worker which serves the calls forwarded by the filter in LSASS, see NetworkWorker.
+*/
+int runWorker(int argc, char* argv[]);
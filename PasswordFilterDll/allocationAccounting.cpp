@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "passwordFilter.h"
+#include "allocationAccounting.h"
+
+#ifdef PWF_ALLOC_ACCOUNTING
+
+#ifndef _DEBUG
+#error The allocation accounting build needs the debug CRT (Configuration=Debug), its allocation hook sees all the modules
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <crtdbg.h>
+
+
+namespace
+{
+   struct CallCounters
+   {
+      std::atomic<uint64_t> mCallNo = 0; // 0 = free
+      std::atomic<uint64_t> mAllocations[AllocationStats::PHASE_COUNT] = {};
+      std::atomic<uint64_t> mBytes[AllocationStats::PHASE_COUNT] = {};
+      std::atomic<uint64_t> mCopies[AllocationStats::PHASE_COUNT] = {};
+      std::atomic<uint64_t> mCopyBytes[AllocationStats::PHASE_COUNT] = {};
+   };
+
+   constexpr size_t sCallSlots = 1024; // a power of two, more calls in flight share the slots and lose their counts
+   CallCounters sCalls[sCallSlots];
+   std::atomic<uint64_t> sNextCallNo = 1;
+   std::mutex sStatsMutex;
+   AllocationStats sStats[AllocationStats::KIND_COUNT];
+
+   thread_local uint64_t tCallNo = 0;
+   thread_local AllocationStats::phase tPhase = AllocationStats::PHASE_ENTRY;
+
+   CallCounters* getCurrentCounters()
+   {
+      if (tCallNo == 0)
+         return nullptr;
+      CallCounters& counters = sCalls[tCallNo & (sCallSlots - 1)];
+      return counters.mCallNo.load(std::memory_order_relaxed) == tCallNo ? &counters : nullptr;
+   }
+}
+
+///////////////// AllocationAccounting //////////////////////////////
+
+AllocationAccounting::CallScope::CallScope(AllocationStats::kind kind)
+   : mKind(kind), mCallNo(sNextCallNo.fetch_add(1, std::memory_order_relaxed))
+{
+   CallCounters& counters = sCalls[mCallNo & (sCallSlots - 1)];
+   for (int phase = 0; phase < AllocationStats::PHASE_COUNT; ++phase)
+   {
+      counters.mAllocations[phase].store(0, std::memory_order_relaxed);
+      counters.mBytes[phase].store(0, std::memory_order_relaxed);
+      counters.mCopies[phase].store(0, std::memory_order_relaxed);
+      counters.mCopyBytes[phase].store(0, std::memory_order_relaxed);
+   }
+   counters.mCallNo.store(mCallNo, std::memory_order_relaxed);
+   tCallNo = mCallNo;
+   tPhase = AllocationStats::PHASE_ENTRY;
+}
+
+AllocationAccounting::CallScope::~CallScope()
+{
+   CallCounters& counters = sCalls[mCallNo & (sCallSlots - 1)];
+   tCallNo = 0;
+   if (counters.mCallNo.load(std::memory_order_relaxed) != mCallNo)
+      return; // the slot has been taken by a newer call
+
+   std::lock_guard<std::mutex> lock(sStatsMutex);
+   AllocationStats& stats = sStats[mKind];
+   uint64_t callAllocations = 0;
+   for (int phase = 0; phase < AllocationStats::PHASE_COUNT; ++phase)
+   {
+      uint64_t allocations = counters.mAllocations[phase].load(std::memory_order_relaxed);
+      callAllocations += allocations;
+      stats.mAllocations[phase] += allocations;
+      stats.mBytes[phase] += counters.mBytes[phase].load(std::memory_order_relaxed);
+      stats.mCopies[phase] += counters.mCopies[phase].load(std::memory_order_relaxed);
+      stats.mCopyBytes[phase] += counters.mCopyBytes[phase].load(std::memory_order_relaxed);
+   }
+   ++stats.mCalls;
+   stats.mMaxCallAllocations = std::max(stats.mMaxCallAllocations, callAllocations);
+   counters.mCallNo.store(0, std::memory_order_relaxed);
+}
+
+AllocationAccounting::PhaseScope::PhaseScope(AllocationStats::phase phase)
+   : mPrevious(tPhase)
+{
+   tPhase = phase;
+}
+
+AllocationAccounting::PhaseScope::~PhaseScope()
+{
+   tPhase = mPrevious;
+}
+
+void AllocationAccounting::setPhase(AllocationStats::phase phase)
+{
+   tPhase = phase;
+}
+
+uint64_t AllocationAccounting::getCurrentCall()
+{
+   return tCallNo;
+}
+
+void AllocationAccounting::resume(uint64_t callNo, AllocationStats::phase phase)
+{
+   tCallNo = callNo;
+   tPhase = phase;
+}
+
+void AllocationAccounting::countAllocation(size_t size)
+{
+   CallCounters* counters = getCurrentCounters();
+   if (counters == nullptr)
+      return;
+   counters->mAllocations[tPhase].fetch_add(1, std::memory_order_relaxed);
+   counters->mBytes[tPhase].fetch_add(size, std::memory_order_relaxed);
+}
+
+void AllocationAccounting::countCopy(size_t bytes)
+{
+   CallCounters* counters = getCurrentCounters();
+   if (counters == nullptr)
+      return;
+   counters->mCopies[tPhase].fetch_add(1, std::memory_order_relaxed);
+   counters->mCopyBytes[tPhase].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+bool AllocationAccounting::getStats(AllocationStats::kind kind, AllocationStats& stats, bool reset)
+{
+   std::lock_guard<std::mutex> lock(sStatsMutex);
+   stats = sStats[kind];
+   if (reset)
+      sStats[kind] = AllocationStats();
+   return true;
+}
+
+///////////////// CRT allocation hook //////////////////////////////
+// Installed while the DLL is loaded, the previous hook (of the App, a debugger) keeps being called.
+
+namespace
+{
+   _CRT_ALLOC_HOOK sPreviousHook = nullptr;
+
+   int __cdecl countAllocations(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* fileName, int lineNumber)
+   {
+      if ((allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) && blockType != _CRT_BLOCK) // not the internal blocks of the CRT
+         AllocationAccounting::countAllocation(size);
+      return sPreviousHook != nullptr ? sPreviousHook(allocType, userData, size, blockType, requestNumber, fileName, lineNumber) : TRUE;
+   }
+
+   struct HookInstaller
+   {
+      HookInstaller() { sPreviousHook = _CrtSetAllocHook(countAllocations); }
+      ~HookInstaller() { _CrtSetAllocHook(sPreviousHook); } // the DLL may be unloaded before the CRT
+   } sHookInstaller;
+}
+
+#endif
+
+BOOLEAN __stdcall GetAllocationStats(ULONG kind, AllocationStats* stats, BOOLEAN reset)
+{
+#ifdef PWF_ALLOC_ACCOUNTING
+   if (stats == nullptr || kind >= AllocationStats::KIND_COUNT)
+      return FALSE;
+   return AllocationAccounting::getStats(static_cast<AllocationStats::kind>(kind), *stats, reset != FALSE);
+#else
+   (void)kind;
+   (void)stats;
+   (void)reset;
+   return FALSE;
+#endif
+}
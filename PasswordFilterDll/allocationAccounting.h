@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+* AllocationStats are the heap allocations and the string copies of the filter calls of one entry point,
+* summed per phase of the call. It crosses the DLL boundary, see GetAllocationStats in passwordFilter.h.
+*/
+struct AllocationStats
+{
+   enum kind
+   {
+      KIND_PASSWORD_FILTER,
+      KIND_PASSWORD_CHANGE_NOTIFY,
+      KIND_COUNT
+   };
+
+   enum phase
+   {
+      PHASE_ENTRY,        // before the request is prepared and after the decision
+      PHASE_PREPARE,      // request container, routing, the conversions of the UNICODE_STRINGs
+      PHASE_LOCAL_RULES,
+      PHASE_DICTIONARY,
+      PHASE_IDM_REQUEST,  // JSON body, url, http request and client
+      PHASE_IDM_RESPONSE, // continuations: response body, parsing, retries
+      PHASE_LOGGING,      // message formatting and the log4cpp calls, whatever phase they are made in
+      PHASE_COUNT
+   };
+
+   uint64_t mCalls = 0;
+   uint64_t mMaxCallAllocations = 0; // the most allocations made by one call
+   uint64_t mAllocations[PHASE_COUNT] = {};
+   uint64_t mBytes[PHASE_COUNT] = {};
+   uint64_t mCopies[PHASE_COUNT] = {};
+   uint64_t mCopyBytes[PHASE_COUNT] = {};
+
+   static const char* getPhaseName(int phase)
+   {
+      static const char* names[PHASE_COUNT] = { "entry", "prepare", "localRules", "dictionary", "idmRequest", "idmResponse", "logging" };
+      return phase >= 0 && phase < PHASE_COUNT ? names[phase] : "unknown";
+   }
+};
+
+#ifdef PWF_ALLOC_ACCOUNTING
+
+/**
+* AllocationAccounting exists in the instrumentation build only (msbuild /p:Configuration=Debug /p:PwfAllocAccounting=true
+* defines PWF_ALLOC_ACCOUNTING). The allocations are counted by the allocation hook of the debug CRT, which is shared by
+* all the modules of the process linked to it: the DLL, cpprest, log4cpp and the CRT itself are all seen, on the thread
+* which allocates. The string conversions report their copies. A call is identified by its number, the counters of the
+* running calls are in a fixed table indexed by it, so a pool thread which still refers to an ended call counts nothing
+* rather than touching freed memory. The memory WinHTTP and the system take by HeapAlloc directly is not counted.
+*/
+class AllocationAccounting
+{
+public:
+   /**
+   * CallScope accounts one entry point call on the calling thread and adds it to the stats of its kind at its end.
+   */
+   class CallScope
+   {
+   private:
+      AllocationStats::kind mKind;
+      uint64_t mCallNo;
+
+   public:
+      CallScope(AllocationStats::kind kind);
+      ~CallScope();
+      CallScope(const CallScope&) = delete;
+      CallScope& operator=(const CallScope&) = delete;
+   };
+
+   /**
+   * PhaseScope switches the phase of the current call and restores the previous one at its end.
+   */
+   class PhaseScope
+   {
+   private:
+      AllocationStats::phase mPrevious;
+
+   public:
+      PhaseScope(AllocationStats::phase phase);
+      ~PhaseScope();
+      PhaseScope(const PhaseScope&) = delete;
+      PhaseScope& operator=(const PhaseScope&) = delete;
+   };
+
+   static void setPhase(AllocationStats::phase phase);
+   static uint64_t getCurrentCall();
+   static void resume(uint64_t callNo, AllocationStats::phase phase); // a continuation adopts the call it serves
+   static void countAllocation(size_t size);
+   static void countCopy(size_t bytes);
+   static bool getStats(AllocationStats::kind kind, AllocationStats& stats, bool reset);
+};
+
+#define PWF_ALLOC_CALL(kind) AllocationAccounting::CallScope pwfAllocCall(kind)
+#define PWF_ALLOC_PHASE(phase) AllocationAccounting::setPhase(phase)
+#define PWF_ALLOC_PHASE_SCOPE(phase) AllocationAccounting::PhaseScope pwfAllocPhase(phase)
+#define PWF_ALLOC_COPY(bytes) AllocationAccounting::countCopy(bytes)
+#define PWF_ALLOC_CURRENT_CALL() AllocationAccounting::getCurrentCall()
+#define PWF_ALLOC_RESUME(callNo, phase) AllocationAccounting::resume(callNo, phase)
+
+#else
+
+#define PWF_ALLOC_CALL(kind) ((void)0)
+#define PWF_ALLOC_PHASE(phase) ((void)0)
+#define PWF_ALLOC_PHASE_SCOPE(phase) ((void)0)
+#define PWF_ALLOC_COPY(bytes) ((void)0)
+#define PWF_ALLOC_CURRENT_CALL() (uint64_t(0))
+#define PWF_ALLOC_RESUME(callNo, phase) ((void)0)
+
+#endif
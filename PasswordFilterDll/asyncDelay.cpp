@@ -0,0 +1,41 @@
+#include "pch.h"
+#include <thread>
+#include "asyncDelay.h"
+
+
+namespace
+{
+   /**
+   * The timer owns the completion event until it fires, then closes itself.
+   */
+   void CALLBACK onTimer(PTP_CALLBACK_INSTANCE, PVOID context, PTP_TIMER timer)
+   {
+      auto* event = static_cast<pplx::task_completion_event<void>*>(context);
+      event->set();
+      delete event;
+      CloseThreadpoolTimer(timer);
+   }
+}
+
+pplx::task<void> AsyncDelay::after(std::chrono::microseconds delay)
+{
+   if (delay.count() <= 0)
+      return pplx::task_from_result();
+
+   auto* event = new pplx::task_completion_event<void>();
+   PTP_TIMER timer = CreateThreadpoolTimer(onTimer, event, nullptr);
+   if (timer == nullptr)
+   {  // no timer available, the pause is spent on a worker thread rather than skipped
+      delete event;
+      return pplx::create_task([delay]() { std::this_thread::sleep_for(delay); });
+   }
+
+   pplx::task<void> done = pplx::create_task(*event);
+   ULARGE_INTEGER due;
+   due.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(delay.count() * 10)); // relative time in 100 ns units
+   FILETIME dueTime;
+   dueTime.dwLowDateTime = due.LowPart;
+   dueTime.dwHighDateTime = due.HighPart;
+   SetThreadpoolTimer(timer, &dueTime, 0, 0);
+   return done;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <chrono>
+#include <pplx/pplxtasks.h>
+
+
+/**
+* AsyncDelay completes a task after the given time by a thread pool timer, so a pause between
+* asynchronous steps (a retry backoff, the latency of the mock IdM) doesn't hold any thread.
+* It doesn't depend on the logger, the App compiles it too.
+*/
+class AsyncDelay
+{
+public:
+   static pplx::task<void> after(std::chrono::microseconds delay);
+};
@@ -2,14 +2,37 @@
 #include "version.h"
 #include "configuration.h"
 #include "logger.h"
+#include "trafficRecorder.h"
+#include "controlChannel.h"
+#include "negativeCache.h"
+#include "dictionaryMonitor.h"
+#include "tokenProvider.h"
+#include "tracing.h"
+#include "flightRecorder.h"
+#include "housekeeper.h"
+#include "networkWorker.h"
+#include "processRole.h"
 
 
 
 extern Logger gLogger;
+extern TrafficRecorder gTrafficRecorder;
+extern ControlChannel gControlChannel;
+extern NegativeCache gNegativeCache;
+extern DictionaryMonitor gDictionaryMonitor;
+extern TokenProvider gTokenProvider;
+extern FlightRecorder gFlightRecorder;
+extern ProcessRole gProcessRole;
+extern Housekeeper gHousekeeper;
+extern NetworkWorker gNetworkWorker;
 
 std::mutex Configuration::sMutex; // static def
 
-Configuration::Configuration()
+/**
+* Reads the configuration file and starts its monitoring.
+* It has to be called once after the logger is initialized.
+*/
+void Configuration::init()
 {
    try
    {
@@ -32,7 +55,7 @@ bool Configuration::proveKeyPresence(const wj::value& obj, const ut::string_t& k
    if (!(obj.*hasMethod)(key))
    {
       std::string msg = Logger::formatMessage("Requested JSON object \"%s\" was not found", Logger::w2s(key).c_str());
-      gLogger.log(Logger::WARN(), msg.c_str());
+      gLogger.log(Logger::WARN(), "%s", msg.c_str());
       if (willThrow)
          throw wj::json_exception(msg.c_str());
       return false;
@@ -43,6 +66,8 @@ bool Configuration::proveKeyPresence(const wj::value& obj, const ut::string_t& k
 
 void Configuration::initConfigFile()
 {
+   std::lock_guard<std::mutex> lock(sMutex); // the monitor and the control channel may reload at the same time
+   auto start = Tracing::isEnabled() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
    try
    {
       std::vector<ut::string_t> multivalueStringBuf;
@@ -70,8 +95,11 @@ void Configuration::initConfigFile()
       proveKeyPresence(rootObj, mRestNotifyUrlKey, &wj::value::has_string_field, true);
       mRestNotifyUrl = rootObj[mRestNotifyUrlKey].as_string();
 
-      proveKeyPresence(rootObj, mTokenKey, &wj::value::has_string_field, true);
-      mToken = rootObj[mTokenKey].as_string();
+      // the static token is not needed when short-lived tokens are obtained from the auth endpoint
+      const wj::value* tokenAuthenticationObj = rootObj.has_object_field(mTokenAuthenticationKey) ? &rootObj.at(mTokenAuthenticationKey) : nullptr;
+      auto tokenSettings = TokenSettings::create(tokenAuthenticationObj);
+      proveKeyPresence(rootObj, mTokenKey, &wj::value::has_string_field, !tokenSettings->getEnabled());
+      mToken = rootObj.has_string_field(mTokenKey) ? rootObj.at(mTokenKey).as_string() : ut::string_t();
 
       proveKeyPresence(rootObj, mIgnoreCertificateKey, &wj::value::has_boolean_field, true);
       mIgnoreCertificate = rootObj[mIgnoreCertificateKey].as_bool();
@@ -104,10 +132,43 @@ void Configuration::initConfigFile()
       proveKeyPresence(rootObj, mPasswordFilterEnabledKey, &wj::value::has_boolean_field, true);
       mPasswordFilterEnabled = rootObj[mPasswordFilterEnabledKey].as_bool();
 
+      // routing is optional, without it all accounts go to the top level restBaseUrl and systemId
+      const wj::value* routingObj = rootObj.has_object_field(mRoutingKey) ? &rootObj.at(mRoutingKey) : nullptr;
+      std::atomic_store(&mRoutingTable, RoutingTable::create(routingObj, mSystemId, mRestBaseUrlVec));
+
+      const wj::value* retryPolicyObj = rootObj.has_object_field(mRetryPolicyKey) ? &rootObj.at(mRetryPolicyKey) : nullptr;
+      std::atomic_store(&mRetryPolicy, RetryPolicy::create(retryPolicyObj));
+
+      // the transport keeps the timeout and certificate validation in its clients
+      const wj::value* transportObj = rootObj.has_object_field(mTransportKey) ? &rootObj.at(mTransportKey) : nullptr;
+      std::atomic_store(&mTransport, IdmTransport::create(transportObj, mConnectionTimeoutMs, !mIgnoreCertificate));
+
+      const wj::value* offlineModeObj = rootObj.has_object_field(mOfflineModeKey) && !gProcessRole.isLocalOnly() ? &rootObj.at(mOfflineModeKey) : nullptr;
+      std::atomic_store(&mOfflineModeSettings, OfflineModeSettings::create(offlineModeObj, mAllowChangeByDefault));
+
+      // local rules are compiled here, an invalid rule refuses the whole configuration
+      const wj::value* localRulesObj = rootObj.has_object_field(mLocalRulesKey) ? &rootObj.at(mLocalRulesKey) : nullptr;
+      std::atomic_store(&mPasswordRules, PasswordRules::create(localRulesObj));
+
+      std::atomic_store(&mTokenSettings, tokenSettings);
+      gTokenProvider.reconfigure(tokenSettings);
+
+      readTrafficRecorder(rootObj);
+      readControlChannel(rootObj);
+      readNegativeCache(rootObj); // drops the cached entries, the reload may change the routing and systemIds
+      readForbiddenDictionary(rootObj);
+      readFlightRecorder(rootObj);
+      readNetworkWorker(rootObj);
+
       mConfigurationInitialized.store(true);
 
       // special workaroud how to reinit logger level from default value
       gLogger.reconfigurePriority(mLogLevel);
+      readLogRateLimit(rootObj);
+      readLogStorage(rootObj);
+      readDebugSampling(rootObj);
+      gTrafficRecorder.reconfigure(mTrafficRecorderEnabled, mTrafficRecorderFile, mTrafficRecorderSalt);
+      storeEffectiveConfig(rootObj);
 
       gLogger.log(Logger::INFO(), "Configuration has been successfully initialized from the file: \"%s\"", mConfigFilePath.c_str());
    }
@@ -116,35 +177,239 @@ void Configuration::initConfigFile()
       gLogger.log(Logger::ERROR(), "Parser of the configuration file \"%s\" encountered the following exception: %s", mConfigFilePath.c_str(), ex.what());
    }
    printLogFileContent();
+   PWF_TRACE("ConfigurationReload",
+      TraceLoggingString(mConfigFilePath.c_str(), "File"),
+      TraceLoggingBoolean(mConfigurationInitialized.load(), "Success"),
+      TraceLoggingUInt32(Tracing::elapsedUs(start), "DurationUs"));
+}
+
+void Configuration::readTrafficRecorder(const wj::value& rootObj)
+{
+   mTrafficRecorderEnabled = false;
+   if (!rootObj.has_object_field(mTrafficRecorderKey))
+      return;
+
+   const wj::value& recorderObj = rootObj.at(mTrafficRecorderKey);
+   if (recorderObj.has_boolean_field(mTrafficRecorderEnabledKey))
+      mTrafficRecorderEnabled = recorderObj.at(mTrafficRecorderEnabledKey).as_bool();
+   mTrafficRecorderFile = gProcessRole.decoratePath(recorderObj.has_string_field(mTrafficRecorderFileKey) ? Logger::w2s(recorderObj.at(mTrafficRecorderFileKey).as_string()) : sTrafficRecorderFilePath);
+   mTrafficRecorderSalt = recorderObj.has_string_field(mTrafficRecorderSaltKey) ? recorderObj.at(mTrafficRecorderSaltKey).as_string() : ut::string_t();
+}
+
+/**
+* readLogRateLimit reconfigures the logger budgets, missing items keep the logger defaults.
+*/
+void Configuration::readLogRateLimit(const wj::value& rootObj)
+{
+   uint32_t windowSec = Logger::sDefaultRateLimitWindowSec;
+   uint32_t fileBurst = Logger::sDefaultFileBurst;
+   uint32_t eventLogBurst = Logger::sDefaultEventLogBurst;
+   if (rootObj.has_object_field(mLogRateLimitKey))
+   {
+      const wj::value& limitObj = rootObj.at(mLogRateLimitKey);
+      if (limitObj.has_integer_field(mLogRateLimitWindowSecKey))
+         windowSec = limitObj.at(mLogRateLimitWindowSecKey).as_number().to_uint32();
+      if (limitObj.has_integer_field(mLogRateLimitFileBurstKey))
+         fileBurst = limitObj.at(mLogRateLimitFileBurstKey).as_number().to_uint32();
+      if (limitObj.has_integer_field(mLogRateLimitEventLogBurstKey))
+         eventLogBurst = limitObj.at(mLogRateLimitEventLogBurstKey).as_number().to_uint32();
+   }
+   gLogger.reconfigureRateLimit(windowSec, fileBurst, eventLogBurst);
+}
+
+/**
+* readLogStorage selects the storage of the log file lines, the rolling text file is the default.
+*/
+void Configuration::readLogStorage(const wj::value& rootObj)
+{
+   bool segmented = false;
+   uint32_t segmentSizeMb = 16;
+   uint32_t maxTotalMb = 1024;
+   uint32_t maxAgeDays = 30;
+   if (rootObj.has_object_field(mLogStorageKey))
+   {
+      const wj::value& storageObj = rootObj.at(mLogStorageKey);
+      if (storageObj.has_boolean_field(mLogStorageSegmentedKey))
+         segmented = storageObj.at(mLogStorageSegmentedKey).as_bool();
+      if (storageObj.has_integer_field(mLogStorageSegmentSizeMbKey))
+         segmentSizeMb = storageObj.at(mLogStorageSegmentSizeMbKey).as_number().to_uint32();
+      if (storageObj.has_integer_field(mLogStorageMaxTotalMbKey))
+         maxTotalMb = storageObj.at(mLogStorageMaxTotalMbKey).as_number().to_uint32();
+      if (storageObj.has_integer_field(mLogStorageMaxAgeDaysKey))
+         maxAgeDays = storageObj.at(mLogStorageMaxAgeDaysKey).as_number().to_uint32();
+   }
+   gLogger.reconfigureStorage(segmented, segmentSizeMb, maxTotalMb, maxAgeDays);
+   gLogger.log(Logger::DEBUG(), "%s: segmented: %s, segmentSizeMb: %u, maxTotalMb: %u, maxAgeDays: %u", Logger::w2s(mLogStorageKey).c_str(),
+      segmented ? "true" : "false", segmentSizeMb, maxTotalMb, maxAgeDays);
+}
+
+void Configuration::readNegativeCache(const wj::value& rootObj)
+{
+   bool enabled = false;
+   uint32_t ttlSec = 300;
+   uint32_t maxEntries = 50000;
+   if (rootObj.has_object_field(mNegativeCacheKey))
+   {
+      const wj::value& cacheObj = rootObj.at(mNegativeCacheKey);
+      if (cacheObj.has_boolean_field(mNegativeCacheEnabledKey))
+         enabled = cacheObj.at(mNegativeCacheEnabledKey).as_bool();
+      if (cacheObj.has_integer_field(mNegativeCacheTtlSecKey))
+         ttlSec = cacheObj.at(mNegativeCacheTtlSecKey).as_number().to_uint32();
+      if (cacheObj.has_integer_field(mNegativeCacheMaxEntriesKey))
+         maxEntries = cacheObj.at(mNegativeCacheMaxEntriesKey).as_number().to_uint32();
+   }
+   gNegativeCache.reconfigure(enabled, ttlSec, maxEntries);
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s, ttlSec: %u, maxEntries: %u", Logger::w2s(mNegativeCacheKey).c_str(), enabled ? "true" : "false", ttlSec, maxEntries);
+}
+
+void Configuration::readForbiddenDictionary(const wj::value& rootObj)
+{
+   bool enabled = false;
+   ut::string_t file = sForbiddenDictionaryFilePath;
+   uint32_t minMatchLength = 4;
+   if (rootObj.has_object_field(mForbiddenDictionaryKey))
+   {
+      const wj::value& dictionaryObj = rootObj.at(mForbiddenDictionaryKey);
+      if (dictionaryObj.has_boolean_field(mForbiddenDictionaryEnabledKey))
+         enabled = dictionaryObj.at(mForbiddenDictionaryEnabledKey).as_bool();
+      if (dictionaryObj.has_string_field(mForbiddenDictionaryFileKey))
+         file = dictionaryObj.at(mForbiddenDictionaryFileKey).as_string();
+      if (dictionaryObj.has_integer_field(mForbiddenDictionaryMinMatchLengthKey))
+         minMatchLength = dictionaryObj.at(mForbiddenDictionaryMinMatchLengthKey).as_number().to_uint32();
+   }
+   gDictionaryMonitor.reconfigure(enabled, file, minMatchLength);
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s, file: %s, minMatchLength: %u", Logger::w2s(mForbiddenDictionaryKey).c_str(), enabled ? "true" : "false", Logger::w2s(file).c_str(), minMatchLength);
+}
+
+/**
+* readNetworkWorker decides whether the entry points are forwarded to the network worker, they are not by default.
+*/
+void Configuration::readNetworkWorker(const wj::value& rootObj)
+{
+   bool enabled = false;
+   ut::string_t name = NetworkWorker::sDefaultName;
+   uint32_t deadlineMs = 3000;
+   uint32_t threads = 16;
+   if (rootObj.has_object_field(mNetworkWorkerKey))
+   {
+      const wj::value& workerObj = rootObj.at(mNetworkWorkerKey);
+      if (workerObj.has_boolean_field(mNetworkWorkerEnabledKey))
+         enabled = workerObj.at(mNetworkWorkerEnabledKey).as_bool();
+      if (workerObj.has_string_field(mNetworkWorkerNameKey))
+         name = workerObj.at(mNetworkWorkerNameKey).as_string();
+      if (workerObj.has_integer_field(mNetworkWorkerDeadlineMsKey))
+         deadlineMs = workerObj.at(mNetworkWorkerDeadlineMsKey).as_number().to_uint32();
+      if (workerObj.has_integer_field(mNetworkWorkerThreadsKey))
+         threads = workerObj.at(mNetworkWorkerThreadsKey).as_number().to_uint32();
+   }
+   enabled = enabled && !gProcessRole.isLocalOnly();
+   gNetworkWorker.reconfigure(enabled, name, deadlineMs, threads);
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s, name: %s, deadlineMs: %u, threads: %u", Logger::w2s(mNetworkWorkerKey).c_str(),
+      enabled ? "true" : "false", Logger::w2s(name).c_str(), deadlineMs, threads);
+}
+
+/**
+* readDebugSampling selects the sessions which log below logLevel, none by default.
+* An invalid object is refused with the whole configuration, the sessions already running keep their decision.
+*/
+void Configuration::readDebugSampling(const wj::value& rootObj)
+{
+   const wj::value* samplingObj = rootObj.has_object_field(mDebugSamplingKey) ? &rootObj.at(mDebugSamplingKey) : nullptr;
+   std::shared_ptr<const DebugSampling> sampling = DebugSampling::create(samplingObj);
+   gLogger.reconfigureSampling(sampling);
+   gLogger.log(Logger::DEBUG(), "%s: %s", Logger::w2s(mDebugSamplingKey).c_str(), sampling->describe().c_str());
+}
+
+/**
+* readFlightRecorder reconfigures the flight recorder, it is enabled unless the configuration says otherwise.
+* The dumps go to the log folder by default.
+*/
+void Configuration::readFlightRecorder(const wj::value& rootObj)
+{
+   bool enabled = true;
+   uint32_t thresholdMs = 5000;
+   uint32_t windowSec = 30;
+   uint32_t minDumpIntervalSec = 300;
+   std::string folder = gLogger.getLogFileFolder();
+   if (rootObj.has_object_field(mFlightRecorderKey))
+   {
+      const wj::value& recorderObj = rootObj.at(mFlightRecorderKey);
+      if (recorderObj.has_boolean_field(mFlightRecorderEnabledKey))
+         enabled = recorderObj.at(mFlightRecorderEnabledKey).as_bool();
+      if (recorderObj.has_integer_field(mFlightRecorderThresholdMsKey))
+         thresholdMs = recorderObj.at(mFlightRecorderThresholdMsKey).as_number().to_uint32();
+      if (recorderObj.has_integer_field(mFlightRecorderWindowSecKey))
+         windowSec = recorderObj.at(mFlightRecorderWindowSecKey).as_number().to_uint32();
+      if (recorderObj.has_integer_field(mFlightRecorderMinDumpIntervalSecKey))
+         minDumpIntervalSec = recorderObj.at(mFlightRecorderMinDumpIntervalSecKey).as_number().to_uint32();
+      if (recorderObj.has_string_field(mFlightRecorderFolderKey))
+         folder = Logger::w2s(recorderObj.at(mFlightRecorderFolderKey).as_string());
+   }
+   gFlightRecorder.reconfigure(enabled, thresholdMs, windowSec, minDumpIntervalSec, folder);
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s, thresholdMs: %u, windowSec: %u, minDumpIntervalSec: %u, folder: %s", Logger::w2s(mFlightRecorderKey).c_str(),
+      enabled ? "true" : "false", thresholdMs, windowSec, minDumpIntervalSec, folder.c_str());
 }
 
+void Configuration::readControlChannel(const wj::value& rootObj)
+{
+   bool enabled = false;
+   ut::string_t pipeName = sControlChannelPipeName;
+   if (rootObj.has_object_field(mControlChannelKey))
+   {
+      const wj::value& channelObj = rootObj.at(mControlChannelKey);
+      if (channelObj.has_boolean_field(mControlChannelEnabledKey))
+         enabled = channelObj.at(mControlChannelEnabledKey).as_bool();
+      if (channelObj.has_string_field(mControlChannelPipeNameKey))
+         pipeName = channelObj.at(mControlChannelPipeNameKey).as_string();
+   }
+   gControlChannel.reconfigure(enabled && gProcessRole.isLsass(), pipeName); // the pipe belongs to LSASS
+}
+
+/**
+* storeEffectiveConfig keeps the successfully loaded configuration for the control channel.
+* Secrets are replaced the same way as in the log.
+*/
+void Configuration::storeEffectiveConfig(wj::value rootObj)
+{
+   rootObj[mTokenKey] = wj::value::string(U("EXCLUDED FROM LOG"));
+   if (rootObj.has_object_field(mTokenAuthenticationKey) && rootObj.at(mTokenAuthenticationKey).has_field(TokenSettings::getPasswordKey()))
+      rootObj[mTokenAuthenticationKey][TokenSettings::getPasswordKey()] = wj::value::string(U("EXCLUDED FROM LOG"));
+   if (rootObj.has_object_field(mTrafficRecorderKey) && rootObj.at(mTrafficRecorderKey).has_field(mTrafficRecorderSaltKey))
+      rootObj[mTrafficRecorderKey][mTrafficRecorderSaltKey] = wj::value::string(U("EXCLUDED FROM LOG"));
+
+   std::lock_guard<std::mutex> lock(mEffectiveConfigMutex);
+   mEffectiveConfig = Logger::w2s(rootObj.serialize());
+}
+
+std::string Configuration::getEffectiveConfig()
+{
+   std::lock_guard<std::mutex> lock(mEffectiveConfigMutex);
+   return mEffectiveConfig;
+}
+
+/**
+* initConfigMonitor plans the periodic check of the configuration file and of the dictionary on the housekeeping thread.
+*/
 void Configuration::initConfigMonitor()
 {
-   pplx::task<void> monThread([this]()
+   gHousekeeper.schedule("configMonitor", std::chrono::seconds(mCfgFileCheckPeriodSec), [this]()
       {
          try
          {
-            std::fstream file{};
-            while (true)
-            {
-               readConfigFilePath();
-               
-               if (!isConfigFileChanged())
-               {
-                  std::this_thread::sleep_for(std::chrono::seconds(mCfgFileCheckPeriodSec));
-                  continue;
-               }
+            readConfigFilePath();
+            if (isConfigFileChanged())
                initConfigFile();
-            }
+            else
+               gDictionaryMonitor.checkFileChange(); // the dictionary is rebuilt independently of the configuration
          }
          catch (const std::exception& e)
          {
-            gLogger.log(Logger::ERROR(), "The task monitoring changes in configuration file encountered an exception: %s", e.what());
+            gLogger.log(Logger::ERROR(), "The monitoring of changes in configuration file encountered an exception: %s", e.what());
          }
+         return std::chrono::milliseconds(std::chrono::seconds(mCfgFileCheckPeriodSec));
       });
-     mMonitorThread = std::move(monThread);
-     gLogger.log(Logger::INFO(), "Configuration monitoring thread successfully started");
- }
+   gLogger.log(Logger::INFO(), "Configuration monitoring successfully started");
+}
 
 void Configuration::readConfigFilePath()
 {
@@ -195,7 +460,9 @@ void Configuration::printLogFileContent() const
    gLogger.log(Logger::DEBUG(), "%s: %s", Logger::w2s(mRestNotifyUrlKey).c_str(), Logger::w2s(mRestNotifyUrl).c_str());
    gLogger.log(Logger::DEBUG(), "%s: %u", Logger::w2s(mConnectionAttemptsKey).c_str(), mConnectionAttempts);
    gLogger.log(Logger::DEBUG(), "%s: %u", Logger::w2s(mConnectionTimeoutMsKey).c_str(), mConnectionTimeoutMs);
+   gLogger.log(Logger::DEBUG(), "%s: %s", Logger::w2s(mTransportKey).c_str(), getTransport()->describe().c_str());
    gLogger.log(Logger::DEBUG(), "%s: EXCLUDED FROM LOG", Logger::w2s(mTokenKey).c_str());
+   getTokenSettings()->printContent();
 
    std::string boolString = mIgnoreCertificate ? Logger::w2s(U("true")) : Logger::w2s(U("false"));
    gLogger.log(Logger::DEBUG(), "%s: %s", Logger::w2s(mIgnoreCertificateKey).c_str(), boolString.c_str());
@@ -217,5 +484,19 @@ void Configuration::printLogFileContent() const
 
    boolString = mPasswordFilterEnabled ? Logger::w2s(U("true")) : Logger::w2s(U("false"));
    gLogger.log(Logger::DEBUG(), "%s: %s", Logger::w2s(mPasswordFilterEnabledKey).c_str(), boolString.c_str());
+
+   auto routingTable = getRoutingTable();
+   if (routingTable)
+      routingTable->printContent();
+   getRetryPolicy()->printContent();
+   getOfflineModeSettings()->printContent();
+
+   auto passwordRules = getPasswordRules();
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s", Logger::w2s(mLocalRulesKey).c_str(), passwordRules->getEnabled() ? "true" : "false");
+   for (size_t i = 0; i < passwordRules->getRuleCount(); ++i)
+      gLogger.log(Logger::DEBUG(), "%s: %s - %s", Logger::w2s(mLocalRulesKey).c_str(), passwordRules->getRuleName(i).c_str(), passwordRules->getRuleDescription(i).c_str());
+
+   boolString = mTrafficRecorderEnabled ? Logger::w2s(U("true")) : Logger::w2s(U("false"));
+   gLogger.log(Logger::DEBUG(), "%s: enabled: %s, file: %s, salt: EXCLUDED FROM LOG", Logger::w2s(mTrafficRecorderKey).c_str(), boolString.c_str(), mTrafficRecorderFile.c_str());
 }
 
@@ -3,6 +3,12 @@
 #include <filesystem>
 #include <cpprest/json.h>
 #include <ppltasks.h>
+#include "idmRouting.h"
+#include "retryPolicy.h"
+#include "offlineMode.h"
+#include "passwordRules.h"
+#include "tokenProvider.h"
+#include "idmTransport.h"
 
 namespace ut = utility;
 namespace uc = utility::conversions;
@@ -13,7 +19,8 @@ namespace wj = web::json;
 /**
 * Configuration class takes care of maintaining and providing of the password filter configuration.
 * Configuration file is periodically checked for the change of its date of change. If a change is detected it is reloaded again.
-* The periodical check is serviced by a special thread which is started at the object creation.
+* The periodical check is serviced by a special thread which is started by init().
+* Nothing is done in the constructor because the global configuration is constructed under the loader lock.
 */
 class Configuration
 {
@@ -28,16 +35,61 @@ private:
    const ut::string_t mRestNotifyUrlKey{ U("restNotifyUrl") };
 
    const ut::string_t mTokenKey{ U("token") };
+   const ut::string_t mTokenAuthenticationKey{ U("tokenAuthentication") };
    const ut::string_t mSkippedAccPrefixKey{ U("skippedAccPrefix") };
 
    const ut::string_t mConnectionAttemptsKey{ U("connectionAttempts") };
    const ut::string_t mConnectionTimeoutMsKey{ U("connectionTimeoutMs") };
+   const ut::string_t mTransportKey{ U("transport") };
 
    const ut::string_t mIgnoreCertificateKey{ U("ignoreCertificate") };
    const ut::string_t mAllowChangeByDefaultKey{ U("allowChangeByDefault") };
    
    const ut::string_t mPasswordFilterEnabledKey{ U("passwordFilterEnabled") };
    const ut::string_t mLogLevelKey{ U("logLevel") };
+   const ut::string_t mRoutingKey{ U("routing") };
+   const ut::string_t mRetryPolicyKey{ U("retryPolicy") };
+   const ut::string_t mOfflineModeKey{ U("offlineMode") };
+   const ut::string_t mLocalRulesKey{ U("localRules") };
+   const ut::string_t mTrafficRecorderKey{ U("trafficRecorder") };
+   const ut::string_t mTrafficRecorderEnabledKey{ U("enabled") };
+   const ut::string_t mTrafficRecorderFileKey{ U("file") };
+   const ut::string_t mTrafficRecorderSaltKey{ U("salt") };
+   const ut::string_t mLogRateLimitKey{ U("logRateLimit") };
+   const ut::string_t mLogRateLimitWindowSecKey{ U("windowSec") };
+   const ut::string_t mLogRateLimitFileBurstKey{ U("fileBurst") };
+   const ut::string_t mLogRateLimitEventLogBurstKey{ U("eventLogBurst") };
+   const ut::string_t mLogStorageKey{ U("logStorage") };
+   const ut::string_t mLogStorageSegmentedKey{ U("segmented") };
+   const ut::string_t mLogStorageSegmentSizeMbKey{ U("segmentSizeMb") };
+   const ut::string_t mLogStorageMaxTotalMbKey{ U("maxTotalMb") };
+   const ut::string_t mLogStorageMaxAgeDaysKey{ U("maxAgeDays") };
+   const ut::string_t mNegativeCacheKey{ U("negativeCache") };
+   const ut::string_t mNegativeCacheEnabledKey{ U("enabled") };
+   const ut::string_t mNegativeCacheTtlSecKey{ U("ttlSec") };
+   const ut::string_t mNegativeCacheMaxEntriesKey{ U("maxEntries") };
+   const ut::string_t mForbiddenDictionaryKey{ U("forbiddenDictionary") };
+   const ut::string_t mForbiddenDictionaryEnabledKey{ U("enabled") };
+   const ut::string_t mForbiddenDictionaryFileKey{ U("file") };
+   const ut::string_t mForbiddenDictionaryMinMatchLengthKey{ U("minMatchLength") };
+   const constexpr static wchar_t* sForbiddenDictionaryFilePath = L"c:/CzechIdM/PasswordFilter/etc/PasswordFilterForbidden.dic";
+   const ut::string_t mFlightRecorderKey{ U("flightRecorder") };
+   const ut::string_t mFlightRecorderEnabledKey{ U("enabled") };
+   const ut::string_t mFlightRecorderThresholdMsKey{ U("thresholdMs") };
+   const ut::string_t mFlightRecorderWindowSecKey{ U("windowSec") };
+   const ut::string_t mFlightRecorderMinDumpIntervalSecKey{ U("minDumpIntervalSec") };
+   const ut::string_t mFlightRecorderFolderKey{ U("folder") };
+   const ut::string_t mDebugSamplingKey{ U("debugSampling") };
+   const ut::string_t mNetworkWorkerKey{ U("networkWorker") };
+   const ut::string_t mNetworkWorkerEnabledKey{ U("enabled") };
+   const ut::string_t mNetworkWorkerNameKey{ U("name") };
+   const ut::string_t mNetworkWorkerDeadlineMsKey{ U("deadlineMs") };
+   const ut::string_t mNetworkWorkerThreadsKey{ U("threads") };
+   const ut::string_t mControlChannelKey{ U("controlChannel") };
+   const ut::string_t mControlChannelEnabledKey{ U("enabled") };
+   const ut::string_t mControlChannelPipeNameKey{ U("pipeName") };
+   const constexpr static wchar_t* sControlChannelPipeName = L"\\\\.\\pipe\\CzechIdMPasswordFilter";
+   const constexpr static char* sTrafficRecorderFilePath = "c:/CzechIdM/PasswordFilter/log/PasswordFilterTraffic.bin";
 
    // value keepers
    ut::string_t mSystemId;
@@ -52,20 +104,31 @@ private:
    ut::string_t mLogLevel;
 
    ut::string_t mVersion;
+   std::shared_ptr<const RoutingTable> mRoutingTable; // accessed atomically, replaced as a whole on reload
+   std::shared_ptr<const RetryPolicy> mRetryPolicy = RetryPolicy::create(nullptr); // accessed atomically, replaced as a whole on reload
+   std::shared_ptr<const OfflineModeSettings> mOfflineModeSettings = OfflineModeSettings::create(nullptr, true); // accessed atomically, replaced as a whole on reload
+   std::shared_ptr<const PasswordRules> mPasswordRules = PasswordRules::create(nullptr); // accessed atomically, replaced as a whole on reload
+   std::shared_ptr<const TokenSettings> mTokenSettings = TokenSettings::create(nullptr); // accessed atomically, replaced as a whole on reload
+   std::shared_ptr<const IdmTransport> mTransport = IdmTransport::create(nullptr, mConnectionTimeoutMs, true); // accessed atomically, replaced as a whole on reload
    
    bool mPasswordFilterEnabled = true;
    bool mIgnoreCertificate = false;
    bool mAllowChangeByDefault = true;
+   bool mTrafficRecorderEnabled = false;
+   std::string mTrafficRecorderFile = sTrafficRecorderFilePath;
+   ut::string_t mTrafficRecorderSalt;
 
    std::atomic<bool> mConfigurationInitialized = false;
-   static std::mutex sMutex;
+   static std::mutex sMutex; // serializes (re)loads of the configuration file
+   std::mutex mEffectiveConfigMutex;
+   std::string mEffectiveConfig;
 
-   pplx::task<void> mMonitorThread;
    std::filesystem::file_time_type mLastFileChange;
    std::string mConfigFilePath;
 
 public:
-   Configuration();
+   Configuration() {};
+   void init();
    const bool getConfigurationInitialised() { return mConfigurationInitialized.load(); }
 
    const std::vector<ut::string_t>& getRestBaseUrlVec() { return mRestBaseUrlVec; }
@@ -80,8 +143,15 @@ public:
    const bool getAllowChangeByDefault() {return mAllowChangeByDefault; }
    const ut::string_t getLogLevel() { return mLogLevel; }
    const bool getPasswordFilterEnabled() { return mPasswordFilterEnabled; }
+   std::shared_ptr<const RoutingTable> getRoutingTable() const { return std::atomic_load(&mRoutingTable); }
+   std::shared_ptr<const RetryPolicy> getRetryPolicy() const { return std::atomic_load(&mRetryPolicy); }
+   std::shared_ptr<const OfflineModeSettings> getOfflineModeSettings() const { return std::atomic_load(&mOfflineModeSettings); }
+   std::shared_ptr<const PasswordRules> getPasswordRules() const { return std::atomic_load(&mPasswordRules); }
+   std::shared_ptr<const TokenSettings> getTokenSettings() const { return std::atomic_load(&mTokenSettings); }
+   std::shared_ptr<const IdmTransport> getTransport() const { return std::atomic_load(&mTransport); }
    
    const ut::string_t& getVersion() { return mVersion; }
+   std::string getEffectiveConfig();
 
    static bool proveKeyPresence(const wj::value& obj, const ut::string_t& key, bool (wj::value::* hasMethod)(const ut::string_t&) const, bool willThrow=false);
    void initConfigFile();
@@ -91,5 +161,15 @@ private:
    void readConfigFilePath();
    bool isConfigFileChanged();
    void printLogFileContent() const;
+   void readTrafficRecorder(const wj::value& rootObj);
+   void readControlChannel(const wj::value& rootObj);
+   void readLogRateLimit(const wj::value& rootObj);
+   void readLogStorage(const wj::value& rootObj);
+   void readNegativeCache(const wj::value& rootObj);
+   void readForbiddenDictionary(const wj::value& rootObj);
+   void readFlightRecorder(const wj::value& rootObj);
+   void readDebugSampling(const wj::value& rootObj);
+   void readNetworkWorker(const wj::value& rootObj);
+   void storeEffectiveConfig(wj::value rootObj);
 };
 
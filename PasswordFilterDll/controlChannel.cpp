@@ -0,0 +1,283 @@
+#include "pch.h"
+#include <sstream>
+#include <sddl.h>
+#include "controlChannel.h"
+#include "configuration.h"
+#include "inFlightRegistry.h"
+#include "offlineMode.h"
+#include "trafficRecorder.h"
+#include "negativeCache.h"
+#include "tokenProvider.h"
+#include "ioExecutor.h"
+#include "housekeeper.h"
+#include "networkWorker.h"
+#include "logger.h"
+
+#pragma comment(lib, "Advapi32.lib")
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Configuration gConfiguration;
+extern InFlightRegistry gInFlightRegistry;
+extern OfflineMode gOfflineMode;
+extern TrafficRecorder gTrafficRecorder;
+extern NegativeCache gNegativeCache;
+extern TokenProvider gTokenProvider;
+extern IoExecutor gIoExecutor;
+extern Housekeeper gHousekeeper;
+extern NetworkWorker gNetworkWorker;
+
+/**
+* reconfigure is called on every configuration (re)load.
+* The pipe is created with the first enabling, a change of its name takes effect after the restart.
+*/
+void ControlChannel::reconfigure(bool enabled, const std::wstring& pipeName)
+{
+   mEnabled.store(enabled);
+   if (!enabled)
+      return;
+
+   bool expected = false;
+   if (!mRunning.compare_exchange_strong(expected, true))
+   {
+      if (pipeName != mPipeName)
+         gLogger.log(Logger::WARN(), "The control channel pipe name change takes effect after the restart");
+      return;
+   }
+   mPipeName = pipeName;
+   gHousekeeper.schedule("controlChannel", std::chrono::milliseconds(0), [this]() { return poll(); });
+}
+
+/**
+* poll advances the connection by the operations which have completed, it never waits for the client.
+*/
+std::chrono::milliseconds ControlChannel::poll()
+{
+   if (mPipe == INVALID_HANDLE_VALUE && !listen())
+   {
+      mRunning.store(false); // the next reconfigure tries again
+      return Housekeeper::sDone;
+   }
+   while (true)
+   {
+      DWORD transferred = 0;
+      bool success = mCompletedSuccess;
+      if (!mCompleted)
+      {
+         success = GetOverlappedResult(mPipe, &mOverlapped, &transferred, FALSE) != FALSE;
+         if (!success && GetLastError() == ERROR_IO_INCOMPLETE)
+         {
+            if (mState == STATE_CONNECTING || std::chrono::steady_clock::now() < mDeadline)
+               return sPollInterval;
+            CancelIoEx(mPipe, &mOverlapped); // the client is stuck, it's disconnected
+            GetOverlappedResult(mPipe, &mOverlapped, &transferred, TRUE); // the cancelled operation completes at once
+         }
+      }
+      mCompleted = false;
+      if (!advance(success, transferred))
+      {
+         close();
+         return sPollInterval; // the pipe is created again by the next run
+      }
+   }
+}
+
+bool ControlChannel::listen()
+{
+   if (mDescriptor == nullptr && !ConvertStringSecurityDescriptorToSecurityDescriptorW(sPipeSddl, SDDL_REVISION_1, &mDescriptor, nullptr))
+   {
+      gLogger.log(Logger::ERROR(), "The control channel security descriptor can't be created, error %u", GetLastError());
+      return false;
+   }
+   if (mEvent == nullptr && (mEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr)) == nullptr)
+   {
+      gLogger.log(Logger::ERROR(), "The control channel event can't be created, error %u", GetLastError());
+      return false;
+   }
+   SECURITY_ATTRIBUTES sa{ sizeof(SECURITY_ATTRIBUTES), mDescriptor, FALSE };
+   mPipe = CreateNamedPipeW(mPipeName.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+      PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+      1, sBufferSize, sBufferSize, 0, &sa);
+   if (mPipe == INVALID_HANDLE_VALUE)
+   {
+      gLogger.log(Logger::ERROR(), "The control channel pipe can't be created, error %u", GetLastError());
+      return false;
+   }
+   mBuffer.resize(sBufferSize);
+   gLogger.log(Logger::INFO(), "Control channel is listening on %s", Logger::w2s(mPipeName).c_str());
+   start(STATE_CONNECTING);
+   return true;
+}
+
+void ControlChannel::close()
+{
+   if (mPipe == INVALID_HANDLE_VALUE)
+      return;
+   DWORD transferred = 0;
+   if (!mCompleted && CancelIoEx(mPipe, &mOverlapped))
+      GetOverlappedResult(mPipe, &mOverlapped, &transferred, TRUE); // mOverlapped is not written after the close
+   CloseHandle(mPipe);
+   mPipe = INVALID_HANDLE_VALUE;
+   mCompleted = false;
+}
+
+/**
+* start begins the overlapped operation of the state, its completion is picked up by poll.
+*/
+void ControlChannel::start(state next)
+{
+   mState = next;
+   mOverlapped = OVERLAPPED{};
+   mOverlapped.hEvent = mEvent;
+   ResetEvent(mEvent);
+   mDeadline = std::chrono::steady_clock::now() + sClientTimeout;
+   BOOL started = FALSE;
+   switch (next)
+   {
+   case STATE_CONNECTING:
+      started = ConnectNamedPipe(mPipe, &mOverlapped);
+      break;
+   case STATE_WRITING:
+      started = WriteFile(mPipe, mResponse.data(), static_cast<DWORD>(mResponse.size()), nullptr, &mOverlapped);
+      break;
+   default: // STATE_READING, STATE_DRAINING: the read fails when the client closes the connection
+      started = ReadFile(mPipe, mBuffer.data(), static_cast<DWORD>(mBuffer.size()), nullptr, &mOverlapped);
+      break;
+   }
+   DWORD error = started ? ERROR_SUCCESS : GetLastError();
+   mCompleted = error != ERROR_SUCCESS && error != ERROR_IO_PENDING; // a client connected before ConnectNamedPipe or a failure
+   mCompletedSuccess = error == ERROR_PIPE_CONNECTED;
+}
+
+/**
+* advance starts the next operation after the completed one, it returns false when the pipe is unusable.
+*/
+bool ControlChannel::advance(bool success, unsigned long transferred)
+{
+   switch (mState)
+   {
+   case STATE_CONNECTING:
+      if (!success)
+      {
+         gLogger.log(Logger::ERROR(), "The control channel can't accept a connection");
+         return false;
+      }
+      start(STATE_READING);
+      return true;
+   case STATE_READING:
+      if (success && transferred > 0)
+      {
+         std::string command(mBuffer.data(), transferred);
+         try
+         {
+            mResponse = handleCommand(Logger::removeNewLine(command));
+         }
+         catch (const std::exception& e)
+         {
+            mResponse = std::string("ERROR: ") + e.what() + "\n";
+         }
+         start(STATE_WRITING);
+         return true;
+      }
+      break;
+   case STATE_WRITING:
+      if (success)
+      {
+         start(STATE_DRAINING); // the response is not discarded by the disconnection before the client reads it
+         return true;
+      }
+      break;
+   default: // STATE_DRAINING
+      break;
+   }
+   DisconnectNamedPipe(mPipe);
+   start(STATE_CONNECTING);
+   return true;
+}
+
+std::string ControlChannel::handleCommand(const std::string& command)
+{
+   if (!mEnabled.load())
+      return "ERROR: the control channel is disabled\n";
+
+   gLogger.log(Logger::INFO(), "Control channel command: %s", command.c_str());
+   if (command == "inflight")
+      return describeInFlight();
+   if (command == "endpoints")
+      return describeEndpoints();
+   if (command == "config")
+      return gConfiguration.getEffectiveConfig() + "\n";
+   if (command == "status")
+   {
+      std::ostringstream out;
+      out << "version: " << Logger::w2s(gConfiguration.getVersion()) << "\n"
+         << "configuration initialized: " << (gConfiguration.getConfigurationInitialised() ? "true" : "false") << "\n"
+         << "password filter enabled: " << (gConfiguration.getPasswordFilterEnabled() ? "true" : "false") << "\n"
+         << "retry budget: " << RetryPolicy::getBudgetRetries() << " retries\n"
+         << "negative cache: " << gNegativeCache.getSize() << " accounts\n"
+         << "token: " << (gTokenProvider.isEnabled() ? "short-lived, expires in " + std::to_string(gTokenProvider.getSecondsToExpiration()) + " s" : std::string("static")) << "\n"
+         << gIoExecutor.describe() << gHousekeeper.describe() << gNetworkWorker.describe()
+         << describeEndpoints() << describeInFlight();
+      return out.str();
+   }
+   if (command == "reload")
+   {
+      gConfiguration.initConfigFile();
+      return gConfiguration.getConfigurationInitialised() ? "OK: configuration reloaded\n" : "ERROR: configuration reload failed, see the log\n";
+   }
+   if (command == "flush")
+   {
+      gLogger.flush();
+      gTrafficRecorder.flush();
+      return "OK: logs flushed\n";
+   }
+   if (command == "drain")
+   {
+      if (gOfflineMode.isOffline())
+         return "ERROR: IdM is offline, the journal is replayed automatically when it is back\n";
+      size_t queued = gOfflineMode.getJournalSize();
+      gOfflineMode.drainJournal();
+      return "OK: the replay of " + std::to_string(queued) + " notifications has started, see the log\n";
+   }
+   return "ERROR: unknown command, supported commands: status, inflight, endpoints, config, reload, flush, drain\n";
+}
+
+std::string ControlChannel::describeInFlight()
+{
+   auto now = std::chrono::steady_clock::now();
+   auto entries = gInFlightRegistry.getSnapshot();
+   std::ostringstream out;
+   out << "in flight: " << entries.size() << "\n";
+   for (const InFlightRegistry::Entry& entry : entries)
+   {
+      out << "  " << entry.mEntryPoint << " SessionId: " << entry.mSessionId << " Account: " << Logger::w2s(entry.mAccountName)
+         << " age: " << std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.mStart).count() << " ms\n";
+   }
+   return out.str();
+}
+
+std::string ControlChannel::describeEndpoints()
+{
+   std::ostringstream out;
+   out << "offline mode: " << (gOfflineMode.isOffline() ? "OFFLINE" : "online")
+      << ", consecutive failures: " << gOfflineMode.getConsecutiveFailures()
+      << ", journaled notifications: " << gOfflineMode.getJournalSize() << "\n";
+
+   auto routingTable = gConfiguration.getRoutingTable();
+   if (!routingTable)
+      return out.str();
+
+   std::vector<const EndpointGroup*> groups{ &routingTable->getDefaultGroup() };
+   for (const auto& group : routingTable->getGroups())
+      groups.push_back(group.get());
+   for (const EndpointGroup* group : groups)
+   {
+      out << "group " << Logger::w2s(group->getName()) << " (systemId: " << Logger::w2s(group->getSystemId())
+         << ", balancing: " << EndpointGroup::getBalancingName(group->getBalancing()) << ")\n";
+      const auto& urls = group->getRestBaseUrlVec();
+      for (size_t i = 0; i < urls.size(); ++i)
+         out << "  " << Logger::w2s(urls[i]) << " outstanding: " << group->getOutstanding(i) << "\n";
+   }
+   return out.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+/**
+* ControlChannel is a local named pipe which lets administrators inspect and control the running filter
+* (see "PasswordFilterApp control"). The pipe accepts local connections of SYSTEM and Administrators only.
+* One request is one line with a command, the response is a text which ends by closing the connection.
+* Commands:
+*   status    - summary of everything below
+*   inflight  - calls being processed and their age
+*   endpoints - endpoints with their requests in flight, offline mode state
+*   config    - effective configuration (secrets excluded)
+*   reload    - reloads the configuration file now
+*   flush     - flushes and reopens the log and recording files
+*   drain     - starts the replay of the journaled notifications to IdM
+* The channel is a Housekeeper job polling an overlapped pipe, so the commands never run in the entry points
+* and a client which doesn't send its command or doesn't read the response never holds the job.
+*/
+class ControlChannel
+{
+private:
+   enum state
+   {
+      STATE_CONNECTING, // waiting for a client
+      STATE_READING,    // reading the command
+      STATE_WRITING,    // writing the response
+      STATE_DRAINING    // waiting for the client to close the connection after reading the response
+   };
+
+   static constexpr const wchar_t* sPipeSddl = L"D:P(A;;GA;;;SY)(A;;GA;;;BA)"; // SYSTEM and Administrators only
+   static constexpr unsigned long sBufferSize = 64 * 1024;
+   static constexpr std::chrono::milliseconds sPollInterval{ 200 };
+   static constexpr std::chrono::seconds sClientTimeout{ 5 };
+
+   std::atomic<bool> mEnabled = false;
+   std::atomic<bool> mRunning = false;
+   // used by the job only
+   std::wstring mPipeName;
+   PSECURITY_DESCRIPTOR mDescriptor = nullptr;
+   HANDLE mPipe = INVALID_HANDLE_VALUE;
+   HANDLE mEvent = nullptr;
+   OVERLAPPED mOverlapped{};
+   state mState = STATE_CONNECTING;
+   bool mCompleted = false; // the operation completed at its start without using mOverlapped
+   bool mCompletedSuccess = false;
+   std::chrono::steady_clock::time_point mDeadline;
+   std::vector<char> mBuffer;
+   std::string mResponse;
+
+   std::chrono::milliseconds poll();
+   bool listen();
+   void close();
+   void start(state next);
+   bool advance(bool success, unsigned long transferred);
+   std::string handleCommand(const std::string& command);
+   std::string describeInFlight();
+   std::string describeEndpoints();
+
+public:
+   void reconfigure(bool enabled, const std::wstring& pipeName);
+};
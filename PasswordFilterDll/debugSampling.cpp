@@ -0,0 +1,121 @@
+#include "pch.h"
+#include <algorithm>
+#include <sstream>
+#include "debugSampling.h"
+
+
+///////////////// DebugSampling //////////////////////////////
+
+std::shared_ptr<const DebugSampling> DebugSampling::create(const wj::value* samplingObj)
+{
+   auto sampling = std::make_shared<DebugSampling>();
+   if (samplingObj == nullptr)
+      return sampling;
+
+   const wj::value& obj = *samplingObj;
+   if (obj.has_number_field(sSessionPercentKey))
+      sampling->mSessionBasisPoints = static_cast<uint32_t>(std::clamp(obj.at(sSessionPercentKey).as_double(), 0.0, 100.0) * 100 + 0.5);
+   if (obj.has_array_field(sAccountsKey))
+   {
+      for (const wj::value& account : obj.at(sAccountsKey).as_array())
+         sampling->mAccounts.push_back(toUpperCase(account.as_string().c_str(), account.as_string().size()));
+   }
+   if (obj.has_array_field(sAccountPrefixesKey))
+   {
+      for (const wj::value& prefix : obj.at(sAccountPrefixesKey).as_array())
+         sampling->mAccountPrefixes.push_back(toUpperCase(prefix.as_string().c_str(), prefix.as_string().size()));
+   }
+   if (obj.has_boolean_field(sOnErrorKey))
+      sampling->mOnError = obj.at(sOnErrorKey).as_bool();
+   if (obj.has_integer_field(sBufferLinesKey))
+      sampling->mBufferLines = std::max(1u, obj.at(sBufferLinesKey).as_number().to_uint32());
+   return sampling;
+}
+
+ut::string_t DebugSampling::toUpperCase(const wchar_t* str, size_t length)
+{
+   ut::string_t upper(str, length);
+   std::transform(upper.begin(), upper.end(), upper.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towupper(c)); });
+   return upper;
+}
+
+/**
+* decide selects the mode of a new session, the account rules are checked only when there are any.
+*/
+DebugSampling::mode DebugSampling::decide(unsigned long sessionId, const wchar_t* accountName, size_t length) const
+{
+   if (mSessionBasisPoints > 0 && sessionId % 10000 < mSessionBasisPoints)
+      return MODE_ON;
+
+   if (accountName != nullptr && length > 0 && (!mAccounts.empty() || !mAccountPrefixes.empty()))
+   {
+      ut::string_t account = toUpperCase(accountName, length);
+      if (std::find(mAccounts.begin(), mAccounts.end(), account) != mAccounts.end())
+         return MODE_ON;
+      for (const ut::string_t& prefix : mAccountPrefixes)
+      {
+         if (account.compare(0, prefix.size(), prefix) == 0)
+            return MODE_ON;
+      }
+   }
+   return mOnError ? MODE_ON_ERROR : MODE_OFF;
+}
+
+std::string DebugSampling::describe() const
+{
+   std::ostringstream out;
+   out << "sessionPercent: " << mSessionBasisPoints / 100.0 << ", accounts: " << mAccounts.size() << ", accountPrefixes: " << mAccountPrefixes.size()
+      << ", onError: " << (mOnError ? "true" : "false") << ", bufferLines: " << mBufferLines;
+   return out.str();
+}
+
+///////////////// SessionDebugBuffer //////////////////////////////
+
+void SessionDebugBuffer::open(unsigned long sessionId)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (!mSessions.emplace(sessionId, Entry()).second)
+      return;
+   mOrder.push_back(sessionId);
+   while (mOrder.size() > sMaxSessions)
+   {
+      mSessions.erase(mOrder.front());
+      mOrder.pop_front();
+   }
+}
+
+bool SessionDebugBuffer::keep(unsigned long sessionId, std::string line, size_t maxLines)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto it = mSessions.find(sessionId);
+   if (it == mSessions.end())
+      return true; // dropped, the session is too old to be interesting
+   if (it->second.mTriggered)
+      return false;
+   it->second.mLines.push_back(std::move(line));
+   while (it->second.mLines.size() > maxLines)
+      it->second.mLines.pop_front();
+   return true;
+}
+
+std::vector<std::string> SessionDebugBuffer::trigger(unsigned long sessionId)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto it = mSessions.find(sessionId);
+   if (it == mSessions.end() || it->second.mTriggered)
+      return std::vector<std::string>();
+   it->second.mTriggered = true;
+   std::vector<std::string> lines(std::make_move_iterator(it->second.mLines.begin()), std::make_move_iterator(it->second.mLines.end()));
+   it->second.mLines.clear();
+   return lines;
+}
+
+void SessionDebugBuffer::close(unsigned long sessionId)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mSessions.erase(sessionId) == 0)
+      return;
+   auto it = std::find(mOrder.begin(), mOrder.end(), sessionId);
+   if (it != mOrder.end())
+      mOrder.erase(it);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cpprest/json.h>
+
+namespace wj = web::json;
+namespace ut = utility;
+
+
+/**
+* DebugSampling selects the sessions which log on the DEBUG level whatever logLevel is, configured by "debugSampling":
+* - sessionPercent: the share of all sessions, decided by the session id
+* - accounts, accountPrefixes: the sessions of these accounts, case insensitive
+* - onError: the DEBUG lines of the other sessions are kept in memory (bufferLines per session) and written
+*   only when the session logs a WARN or an ERROR; formatting the kept lines is the price of it
+* The decision is made once per session in Logger::createSessionId, a session which is not selected doesn't format
+* any line below logLevel. The settings are immutable, a configuration reload replaces them as a whole.
+*/
+class DebugSampling
+{
+public:
+   enum mode : uint8_t
+   {
+      MODE_OFF,     // logLevel applies
+      MODE_ON,      // everything is written
+      MODE_ON_ERROR // the lines below logLevel are kept until the session logs a WARN or an ERROR
+   };
+
+private:
+   // JSON keys
+   static inline const ut::string_t sSessionPercentKey{ U("sessionPercent") };
+   static inline const ut::string_t sAccountsKey{ U("accounts") };
+   static inline const ut::string_t sAccountPrefixesKey{ U("accountPrefixes") };
+   static inline const ut::string_t sOnErrorKey{ U("onError") };
+   static inline const ut::string_t sBufferLinesKey{ U("bufferLines") };
+
+   uint32_t mSessionBasisPoints = 0; // sessionPercent * 100
+   std::vector<ut::string_t> mAccounts; // upper case
+   std::vector<ut::string_t> mAccountPrefixes; // upper case
+   bool mOnError = false;
+   uint32_t mBufferLines = 200;
+
+   static ut::string_t toUpperCase(const wchar_t* str, size_t length);
+
+public:
+   static std::shared_ptr<const DebugSampling> create(const wj::value* samplingObj);
+
+   mode decide(unsigned long sessionId, const wchar_t* accountName, size_t length) const;
+   uint32_t getBufferLines() const { return mBufferLines; }
+   std::string describe() const;
+};
+
+/**
+* SessionDebugBuffer keeps the lines of the sessions in DebugSampling::MODE_ON_ERROR until they log a WARN or an ERROR.
+* A session is closed when its entry point call returns. Only the sMaxSessions latest open sessions are kept,
+* an older session is dropped with its lines.
+*/
+class SessionDebugBuffer
+{
+private:
+   static constexpr size_t sMaxSessions = 256;
+
+   struct Entry
+   {
+      bool mTriggered = false; // the lines are written directly
+      std::deque<std::string> mLines;
+   };
+
+   std::mutex mMutex; // guards everything below
+   std::unordered_map<unsigned long, Entry> mSessions;
+   std::deque<unsigned long> mOrder; // by the opening
+
+public:
+   void open(unsigned long sessionId);
+   bool keep(unsigned long sessionId, std::string line, size_t maxLines); // false = the session has been triggered, write the line
+   std::vector<std::string> trigger(unsigned long sessionId); // returns the kept lines, the next lines are written directly
+   void close(unsigned long sessionId); // drops the kept lines, the later lines of the session are dropped too
+};
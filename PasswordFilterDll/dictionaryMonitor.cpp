@@ -0,0 +1,72 @@
+#include "pch.h"
+#include "dictionaryMonitor.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+/**
+* reconfigure is called on every configuration (re)load.
+*/
+void DictionaryMonitor::reconfigure(bool enabled, const std::wstring& path, uint32_t minMatchLength)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   mMinMatchLength.store(minMatchLength, std::memory_order_relaxed);
+   mEnabled.store(enabled);
+   if (!enabled)
+   {
+      mPath.clear();
+      std::atomic_store(&mDictionary, std::shared_ptr<const ForbiddenDictionary>());
+      return;
+   }
+   if (path != mPath)
+   {
+      mPath = path;
+      load();
+   }
+}
+
+void DictionaryMonitor::checkFileChange()
+{
+   if (!mEnabled.load())
+      return;
+
+   std::lock_guard<std::mutex> lock(mMutex);
+   std::error_code ec;
+   auto writeTime = fs::last_write_time(mPath, ec);
+   if (ec)
+      return;
+   auto size = fs::file_size(mPath, ec);
+   if (ec || (writeTime == mLastWriteTime && size == mLastSize))
+      return;
+   load();
+}
+
+std::shared_ptr<const ForbiddenDictionary> DictionaryMonitor::getDictionary() const
+{
+   if (!mEnabled.load(std::memory_order_relaxed))
+      return nullptr;
+   return std::atomic_load(&mDictionary);
+}
+
+void DictionaryMonitor::load()
+{
+   std::error_code ec;
+   mLastWriteTime = fs::last_write_time(mPath, ec);
+   mLastSize = fs::file_size(mPath, ec);
+   try
+   {
+      auto start = std::chrono::steady_clock::now();
+      auto dictionary = ForbiddenDictionary::open(mPath);
+      std::atomic_store(&mDictionary, dictionary);
+      gLogger.log(Logger::INFO(), "The forbidden word dictionary \"%s\" has been loaded: %u words, %u states, %lld ms",
+         Logger::w2s(mPath).c_str(), dictionary->getWordCount(), dictionary->getStateCount(),
+         static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::ERROR(), "The forbidden word dictionary \"%s\" can't be loaded: %s. The previous dictionary stays in use",
+         Logger::w2s(mPath).c_str(), e.what());
+   }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "forbiddenDictionary.h"
+
+
+/**
+* DictionaryMonitor owns the forbidden word dictionary used by PasswordFilter.
+* The configuration monitor calls checkFileChange periodically; a changed file is mapped
+* and swapped in atomically, calls in progress finish with the dictionary they started with.
+* A dictionary which fails to load is logged and the previous one stays in use.
+*/
+class DictionaryMonitor
+{
+private:
+   std::mutex mMutex; // serializes reconfigure and checkFileChange
+   std::atomic<bool> mEnabled = false;
+   std::atomic<uint32_t> mMinMatchLength = 4;
+   std::wstring mPath;
+   std::filesystem::file_time_type mLastWriteTime;
+   uintmax_t mLastSize = 0;
+   std::shared_ptr<const ForbiddenDictionary> mDictionary; // accessed atomically
+
+   void load();
+
+public:
+   void reconfigure(bool enabled, const std::wstring& path, uint32_t minMatchLength);
+   void checkFileChange();
+   std::shared_ptr<const ForbiddenDictionary> getDictionary() const;
+   uint32_t getMinMatchLength() const { return mMinMatchLength.load(std::memory_order_relaxed); }
+};
@@ -1,8 +1,10 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
 #include "pch.h"
 #include "logger.h"
+#include "tracing.h"
 
 extern Logger gLogger;
+extern std::chrono::steady_clock::time_point gDllAttachTime;
 
 
 BOOL APIENTRY DllMain( HMODULE hModule,
@@ -13,7 +15,8 @@ BOOL APIENTRY DllMain( HMODULE hModule,
     switch (ul_reason_for_call)
     {
     case DLL_PROCESS_ATTACH:
-       gLogger.log(Logger::INFO(), "Inside Dll main - DLL_PROCESS_ATTACH: PID %u", GetCurrentProcessId());
+       // runs under the loader lock - the initialization itself is deferred, see ensureInitialized()
+       gDllAttachTime = std::chrono::steady_clock::now();
        break;
     case DLL_THREAD_ATTACH:
        break;
@@ -21,6 +24,7 @@ BOOL APIENTRY DllMain( HMODULE hModule,
        break;
     case DLL_PROCESS_DETACH:
        gLogger.log(Logger::INFO(), "Inside Dll main - DLL_PROCESS_DETACH: PID %u", GetCurrentProcessId());
+       Tracing::unregisterProvider(); // required before the DLL is unloaded
        break;
     default:
        break;
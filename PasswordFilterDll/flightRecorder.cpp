@@ -0,0 +1,234 @@
+#include "pch.h"
+#include <algorithm>
+#include "flightRecorder.h"
+#include "housekeeper.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Housekeeper gHousekeeper;
+
+thread_local FlightRecorder::Scope* FlightRecorder::sCurrentScope = nullptr;
+
+namespace
+{
+   const char* getKindName(uint8_t kind)
+   {
+      return kind == FlightRecord::KIND_PASSWORD_CHANGE_NOTIFY ? "PasswordChangeNotify" : "PasswordFilter";
+   }
+
+   std::string formatTime(uint64_t unixMs, const char* format, bool withMs)
+   {
+      time_t seconds = static_cast<time_t>(unixMs / 1000);
+      tm local{};
+      localtime_s(&local, &seconds);
+      char text[64];
+      strftime(text, sizeof(text), format, &local);
+      return withMs ? Logger::formatMessage("%s.%03u", text, static_cast<unsigned>(unixMs % 1000)) : std::string(text);
+   }
+
+   void writeRecord(std::ostream& out, const FlightRecord& record, bool isTrigger)
+   {
+      static const char* phaseNames[FlightRecord::PHASE_COUNT] = { "prepared", "localRules", "dictionary", "idm" };
+      out << (isTrigger ? "* " : "  ") << formatTime(record.mStartMs, "%Y-%m-%d %H:%M:%S", true)
+         << Logger::formatMessage(" SessionId: %010u %s %.1f ms %s reason: %s", record.mSessionId, getKindName(record.mKind),
+            record.mDurationUs / 1000.0, record.mDecision ? "APPROVED" : "DISAPPROVED", record.mReason);
+      if (record.mDefaultDecision)
+         out << " (allowChangeByDefault)";
+      out << " phases:";
+      for (int phase = 0; phase < FlightRecord::PHASE_COUNT; ++phase)
+      {
+         if (record.mPhaseUs[phase] != 0)
+            out << Logger::formatMessage(" %s@%.1f", phaseNames[phase], record.mPhaseUs[phase] / 1000.0);
+      }
+      out << " attempts: " << static_cast<unsigned>(record.mAttemptCount);
+      for (size_t i = 0; i < std::min<size_t>(record.mAttemptCount, FlightRecord::sMaxAttempts); ++i)
+      {
+         const FlightRecord::Attempt& attempt = record.mAttempts[i];
+         std::string result = attempt.mOutcome == TrafficAttempt::OUTCOME_RESPONSE ? std::to_string(attempt.mStatus) :
+            (attempt.mOutcome == TrafficAttempt::OUTCOME_SECURITY_FAILURE ? "securityFailure" : "exception");
+         out << Logger::formatMessage(" [endpoint %u attempt %u @%.1f %s %.1f ms]", attempt.mEndpointIdx, attempt.mAttemptNo,
+            attempt.mStartUs / 1000.0, result.c_str(), attempt.mLatencyUs / 1000.0);
+      }
+      out << std::endl;
+   }
+}
+
+///////////////// FlightRecorder::Scope //////////////////////////////
+
+FlightRecorder::Scope::Scope(FlightRecorder& recorder, FlightRecord::kind kind, const Tracing::DecisionScope& decisionScope)
+   : mRecorder(recorder), mDecisionScope(decisionScope)
+{
+   if (!mRecorder.isEnabled())
+      return;
+
+   mActive = true;
+   mStart = std::chrono::steady_clock::now();
+   mRecord.mKind = kind;
+   mRecord.mSessionId = static_cast<uint32_t>(gLogger.getSessionIdValue());
+   mRecord.mStartMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+   sCurrentScope = this;
+}
+
+FlightRecorder::Scope::~Scope()
+{
+   if (!mActive)
+      return;
+
+   sCurrentScope = nullptr;
+   mRecord.mDurationUs = elapsedUs(std::chrono::steady_clock::now());
+   mRecord.mReason = mDecisionScope.getReason();
+   mRecord.mDecision = mDecisionScope.getDecision() ? 1 : 0;
+   mRecorder.push(mRecord);
+   if (mRecord.mDefaultDecision || mRecord.mDurationUs >= static_cast<uint64_t>(mRecorder.mThresholdMs.load(std::memory_order_relaxed)) * 1000)
+      mRecorder.trigger(mRecord);
+}
+
+uint32_t FlightRecorder::Scope::elapsedUs(std::chrono::steady_clock::time_point until) const
+{
+   auto us = std::chrono::duration_cast<std::chrono::microseconds>(until - mStart).count();
+   return static_cast<uint32_t>(std::clamp<long long>(us, 1, UINT32_MAX)); // 0 means "not reached"
+}
+
+void FlightRecorder::Scope::markPhase(FlightRecord::phase phase)
+{
+   if (mActive)
+      mRecord.mPhaseUs[phase] = elapsedUs(std::chrono::steady_clock::now());
+}
+
+/**
+* addAttempt is called by the continuations of IdmRestComm, one at a time.
+*/
+void FlightRecorder::Scope::addAttempt(size_t endpointIdx, uint32_t attemptNo, TrafficAttempt::outcome outcome, uint16_t status,
+   std::chrono::steady_clock::time_point attemptStart, std::chrono::steady_clock::time_point attemptEnd)
+{
+   if (!mActive)
+      return;
+
+   if (mRecord.mAttemptCount < FlightRecord::sMaxAttempts)
+   {
+      FlightRecord::Attempt& attempt = mRecord.mAttempts[mRecord.mAttemptCount];
+      attempt.mStartUs = elapsedUs(attemptStart);
+      attempt.mLatencyUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(attemptEnd - attemptStart).count());
+      attempt.mStatus = status;
+      attempt.mEndpointIdx = static_cast<uint8_t>(std::min<size_t>(endpointIdx, 255));
+      attempt.mAttemptNo = static_cast<uint8_t>(std::min<uint32_t>(attemptNo, 255));
+      attempt.mOutcome = outcome;
+   }
+   if (mRecord.mAttemptCount < UINT8_MAX)
+      ++mRecord.mAttemptCount;
+}
+
+///////////////// FlightRecorder //////////////////////////////
+
+/**
+* reconfigure is called on every configuration (re)load, the ring keeps its records.
+*/
+void FlightRecorder::reconfigure(bool enabled, uint32_t thresholdMs, uint32_t windowSec, uint32_t minDumpIntervalSec, const std::string& folder)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   mThresholdMs.store(thresholdMs, std::memory_order_relaxed);
+   mWindowSec = windowSec;
+   mMinDumpIntervalSec = minDumpIntervalSec;
+   mFolder = folder;
+   mEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+* push copies the record into the next slot of the ring. It never waits: the ticket is taken by one atomic increment
+* and the odd sequence number tells the readers the slot is being written.
+*/
+void FlightRecorder::push(const FlightRecord& record)
+{
+   uint64_t ticket = mNextTicket.fetch_add(1, std::memory_order_relaxed);
+   Slot& slot = mSlots[ticket & (sCapacity - 1)];
+   slot.mSequence.store(2 * ticket + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   slot.mRecord = record;
+   slot.mSequence.store(2 * ticket + 2, std::memory_order_release);
+}
+
+/**
+* trigger schedules a dump around the record unless the last dump was triggered less than minDumpIntervalSec ago.
+* It is reached by the slow calls only.
+*/
+void FlightRecorder::trigger(const FlightRecord& record)
+{
+   uint32_t windowSec;
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      auto now = std::chrono::steady_clock::now();
+      if (mPendingTriggerMs != 0 || (mLastTrigger.time_since_epoch().count() != 0 && now - mLastTrigger < std::chrono::seconds(mMinDumpIntervalSec)))
+         return;
+
+      mLastTrigger = now;
+      mPendingTriggerMs = record.mStartMs;
+      mPendingTriggerSessionId = record.mSessionId;
+      windowSec = mWindowSec;
+   }
+   gHousekeeper.schedule("flightDump", std::chrono::seconds(windowSec), [this]()
+      {
+         runDump();
+         return Housekeeper::sDone;
+      });
+}
+
+/**
+* getSnapshot copies the complete records of the ring, a slot rewritten during its copy is skipped.
+*/
+std::vector<FlightRecord> FlightRecorder::getSnapshot() const
+{
+   std::vector<FlightRecord> records;
+   records.reserve(sCapacity);
+   for (const Slot& slot : mSlots)
+   {
+      uint64_t before = slot.mSequence.load(std::memory_order_acquire);
+      if (before == 0 || (before & 1) != 0)
+         continue;
+      FlightRecord record = slot.mRecord;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.mSequence.load(std::memory_order_relaxed) == before)
+         records.push_back(record);
+   }
+   std::sort(records.begin(), records.end(), [](const FlightRecord& a, const FlightRecord& b) { return a.mStartMs < b.mStartMs; });
+   return records;
+}
+
+/**
+* runDump writes the dump of the pending trigger, the window after it has passed.
+*/
+void FlightRecorder::runDump()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   uint64_t triggerMs = mPendingTriggerMs;
+   uint32_t triggerSessionId = mPendingTriggerSessionId;
+   uint32_t windowSec = mWindowSec;
+   std::string folder = mFolder;
+   mPendingTriggerMs = 0;
+   lock.unlock();
+   writeDump(triggerMs, triggerSessionId, windowSec, folder);
+}
+
+void FlightRecorder::writeDump(uint64_t triggerMs, uint32_t triggerSessionId, uint32_t windowSec, const std::string& folder)
+{
+   std::vector<FlightRecord> records = getSnapshot();
+   const uint64_t windowMs = static_cast<uint64_t>(windowSec) * 1000;
+   records.erase(std::remove_if(records.begin(), records.end(), [&](const FlightRecord& record)
+      {
+         return record.mStartMs + windowMs < triggerMs || record.mStartMs > triggerMs + windowMs;
+      }), records.end());
+
+   fs::path path(folder);
+   path.append(sFileName + "." + formatTime(triggerMs, "%Y%m%d-%H%M%S", false) + "." + Logger::formatMessage("%010u", triggerSessionId) + ".txt");
+   std::ofstream out(path, std::ios_base::out | std::ios_base::trunc);
+   out << "Flight recorder dump triggered by SessionId " << Logger::formatMessage("%010u", triggerSessionId) << " at "
+      << formatTime(triggerMs, "%Y-%m-%d %H:%M:%S", true) << ", " << records.size() << " calls started within " << windowSec << " s around it" << std::endl;
+   for (const FlightRecord& record : records)
+      writeRecord(out, record, record.mSessionId == triggerSessionId && record.mStartMs == triggerMs);
+   out.close();
+   if (out.fail())
+      gLogger.log(Logger::ERROR(), "The flight recorder dump %s can't be written", path.string().c_str());
+   else
+      gLogger.log(Logger::WARN(), "A slow or unanswered call (SessionId: %010u) triggered the flight recorder dump %s", triggerSessionId, path.string().c_str());
+}
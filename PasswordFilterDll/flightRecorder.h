@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "trafficRecord.h"
+#include "tracing.h"
+
+
+/**
+* FlightRecord is the in-memory record of one entry point call kept by FlightRecorder.
+* It holds no account name or password, the SessionId joins it with the log file.
+*/
+struct FlightRecord
+{
+   enum kind : uint8_t
+   {
+      KIND_PASSWORD_FILTER,
+      KIND_PASSWORD_CHANGE_NOTIFY
+   };
+
+   enum phase
+   {
+      PHASE_PREPARED,    // the request is built and the endpoint group resolved
+      PHASE_LOCAL_RULES, // the local rules are evaluated
+      PHASE_DICTIONARY,  // the forbidden dictionary is checked
+      PHASE_IDM,         // IdM is being called
+      PHASE_COUNT
+   };
+
+   struct Attempt
+   {
+      uint32_t mStartUs;   // from the start of the call
+      uint32_t mLatencyUs;
+      uint16_t mStatus;
+      uint8_t mEndpointIdx;
+      uint8_t mAttemptNo;
+      uint8_t mOutcome;    // TrafficAttempt::outcome
+   };
+
+   static constexpr size_t sMaxAttempts = 6;
+
+   uint64_t mStartMs = 0; // unix time
+   uint32_t mSessionId = 0;
+   uint32_t mDurationUs = 0;
+   uint32_t mPhaseUs[PHASE_COUNT] = {}; // when the phase started, from the start of the call; 0 = not reached
+   const char* mReason = ""; // a string literal, see Tracing::DecisionScope
+   uint8_t mKind = KIND_PASSWORD_FILTER;
+   uint8_t mDecision = 0;
+   uint8_t mDefaultDecision = 0; // IdM gave no answer, allowChangeByDefault decided
+   uint8_t mAttemptCount = 0; // attempts made, only the first sMaxAttempts are kept
+   Attempt mAttempts[sMaxAttempts] = {};
+};
+
+/**
+* FlightRecorder keeps the records of the last sCapacity calls in a fixed ring in memory, always on.
+* - a call writes its record once when it ends: a ticket from one atomic counter and a copy into the slot,
+*   guarded by the sequence number of the slot (seqlock), so writers never wait and readers detect torn copies
+* - a call slower than thresholdMs or decided by allowChangeByDefault triggers a dump of the records started
+*   within windowSec around it into a text file in folder; the dump is a Housekeeper job planned windowSec later,
+*   so the calls which followed are in the dump too. Dumps are at least minDumpIntervalSec apart.
+*/
+class FlightRecorder
+{
+public:
+   static constexpr size_t sCapacity = 4096; // a power of two
+
+   /**
+   * Scope builds the record of one entry point call and hands it to the recorder at its end.
+   * The decision and its reason are taken from the DecisionScope of the call, which has to outlive the Scope.
+   */
+   class Scope
+   {
+   private:
+      FlightRecorder& mRecorder;
+      const Tracing::DecisionScope& mDecisionScope;
+      bool mActive = false;
+      std::chrono::steady_clock::time_point mStart;
+      FlightRecord mRecord;
+
+      uint32_t elapsedUs(std::chrono::steady_clock::time_point until) const;
+
+   public:
+      Scope(FlightRecorder& recorder, FlightRecord::kind kind, const Tracing::DecisionScope& decisionScope);
+      ~Scope();
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+      void markPhase(FlightRecord::phase phase);
+      void markDefaultDecision() { mRecord.mDefaultDecision = 1; }
+      void addAttempt(size_t endpointIdx, uint32_t attemptNo, TrafficAttempt::outcome outcome, uint16_t status,
+         std::chrono::steady_clock::time_point attemptStart, std::chrono::steady_clock::time_point attemptEnd);
+   };
+
+private:
+   struct Slot
+   {
+      std::atomic<uint64_t> mSequence = 0; // odd while written, 2 * (ticket + 1) when complete
+      FlightRecord mRecord;
+   };
+
+   static inline const std::string sFileName = "PasswordFilterFlight";
+   thread_local static Scope* sCurrentScope;
+
+   Slot mSlots[sCapacity];
+   std::atomic<uint64_t> mNextTicket = 0;
+   std::atomic<bool> mEnabled = true;
+   std::atomic<uint32_t> mThresholdMs = 5000;
+
+   std::mutex mMutex; // guards everything below
+   uint32_t mWindowSec = 30;
+   uint32_t mMinDumpIntervalSec = 300;
+   std::string mFolder;
+   std::chrono::steady_clock::time_point mLastTrigger;
+   uint64_t mPendingTriggerMs = 0; // start of the call which triggered the dump, 0 = none
+   uint32_t mPendingTriggerSessionId = 0;
+
+   void push(const FlightRecord& record);
+   void trigger(const FlightRecord& record);
+   std::vector<FlightRecord> getSnapshot() const;
+   void runDump();
+   void writeDump(uint64_t triggerMs, uint32_t triggerSessionId, uint32_t windowSec, const std::string& folder);
+
+public:
+   void reconfigure(bool enabled, uint32_t thresholdMs, uint32_t windowSec, uint32_t minDumpIntervalSec, const std::string& folder);
+   bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+   static Scope* getCurrentScope() { return sCurrentScope; }
+};
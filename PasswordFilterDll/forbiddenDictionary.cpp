@@ -0,0 +1,145 @@
+#include "pch.h"
+#include <stdexcept>
+#include "forbiddenDictionary.h"
+
+
+ForbiddenDictionary::~ForbiddenDictionary()
+{
+   if (mView != nullptr)
+      UnmapViewOfFile(mView);
+   if (mMapping != nullptr)
+      CloseHandle(mMapping);
+   if (mFile != nullptr && mFile != INVALID_HANDLE_VALUE)
+      CloseHandle(mFile);
+}
+
+/**
+* open maps the dictionary file. FILE_SHARE_DELETE lets the builder rename the mapped file away
+* when it publishes a new version.
+*/
+std::shared_ptr<const ForbiddenDictionary> ForbiddenDictionary::open(const std::wstring& path)
+{
+   auto dictionary = std::make_shared<ForbiddenDictionary>();
+   dictionary->mFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (dictionary->mFile == INVALID_HANDLE_VALUE)
+      throw std::runtime_error("the file can't be opened, error " + std::to_string(GetLastError()));
+
+   LARGE_INTEGER size{};
+   if (!GetFileSizeEx(dictionary->mFile, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+      throw std::runtime_error("the file is too short");
+
+   dictionary->mMapping = CreateFileMappingW(dictionary->mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+   if (dictionary->mMapping == nullptr)
+      throw std::runtime_error("the file can't be mapped, error " + std::to_string(GetLastError()));
+   dictionary->mView = MapViewOfFile(dictionary->mMapping, FILE_MAP_READ, 0, 0, 0);
+   if (dictionary->mView == nullptr)
+      throw std::runtime_error("the file view can't be mapped, error " + std::to_string(GetLastError()));
+
+   dictionary->validate(static_cast<uint64_t>(size.QuadPart));
+   return dictionary;
+}
+
+/**
+* validate checks the whole automaton once, so findMatch can't read out of the view whatever the file contains.
+*/
+void ForbiddenDictionary::validate(uint64_t fileSize)
+{
+   mHeader = static_cast<const Header*>(mView);
+   if (memcmp(mHeader->mMagic, sMagic, sizeof(sMagic)) != 0)
+      throw std::runtime_error("the file is not a forbidden word dictionary");
+   uint64_t expectedSize = sizeof(Header) + static_cast<uint64_t>(mHeader->mStateCount) * sizeof(State) + static_cast<uint64_t>(mHeader->mEdgeCount) * sizeof(Edge);
+   if (mHeader->mStateCount == 0 || fileSize != expectedSize)
+      throw std::runtime_error("the dictionary file is truncated or corrupted");
+
+   mStates = reinterpret_cast<const State*>(mHeader + 1);
+   mEdges = reinterpret_cast<const Edge*>(mStates + mHeader->mStateCount);
+   for (uint32_t i = 0; i < mHeader->mStateCount; ++i)
+   {
+      const State& state = mStates[i];
+      // states are stored in the breadth first order, a failure link always points to a shallower state
+      if ((i > 0 ? state.mFailure >= i : state.mFailure != 0) || static_cast<uint64_t>(state.mFirstEdge) + state.mEdgeCount > mHeader->mEdgeCount)
+         throw std::runtime_error("the dictionary state " + std::to_string(i) + " is corrupted");
+   }
+   for (uint32_t i = 0; i < mHeader->mEdgeCount; ++i)
+   {
+      if (mEdges[i].mTarget >= mHeader->mStateCount || mEdges[i].mSymbol == sSeparator || mEdges[i].mSymbol >= sSymbolCount)
+         throw std::runtime_error("the dictionary edge " + std::to_string(i) + " is corrupted");
+   }
+}
+
+uint8_t ForbiddenDictionary::normalize(ut::char_t ch)
+{
+   if (ch >= U('A') && ch <= U('Z'))
+      ch = static_cast<ut::char_t>(ch - U('A') + U('a'));
+   switch (ch)
+   {
+   // leet substitutions
+   case U('0'): ch = U('o'); break;
+   case U('1'): case U('!'): case U('|'): case U('l'): ch = U('i'); break;
+   case U('2'): ch = U('z'); break;
+   case U('3'): ch = U('e'); break;
+   case U('4'): case U('@'): ch = U('a'); break;
+   case U('5'): case U('$'): ch = U('s'); break;
+   case U('6'): case U('9'): ch = U('g'); break;
+   case U('7'): case U('+'): ch = U('t'); break;
+   case U('8'): ch = U('b'); break;
+   // Czech diacritics
+   case 0x00E1: case 0x00C1: ch = U('a'); break;
+   case 0x010D: case 0x010C: ch = U('c'); break;
+   case 0x010F: case 0x010E: ch = U('d'); break;
+   case 0x00E9: case 0x00C9: case 0x011B: case 0x011A: ch = U('e'); break;
+   case 0x00ED: case 0x00CD: ch = U('i'); break;
+   case 0x0148: case 0x0147: ch = U('n'); break;
+   case 0x00F3: case 0x00D3: ch = U('o'); break;
+   case 0x0159: case 0x0158: ch = U('r'); break;
+   case 0x0161: case 0x0160: ch = U('s'); break;
+   case 0x0165: case 0x0164: ch = U('t'); break;
+   case 0x00FA: case 0x00DA: case 0x016F: case 0x016E: ch = U('u'); break;
+   case 0x00FD: case 0x00DD: ch = U('y'); break;
+   case 0x017E: case 0x017D: ch = U('z'); break;
+   default: break;
+   }
+   if (ch >= U('a') && ch <= U('z'))
+      return static_cast<uint8_t>(ch - U('a') + 1);
+   return sSeparator;
+}
+
+/**
+* findMatch returns the length (in normalized characters) of a forbidden word of at least minMatchLength characters
+* found in the password, or 0 when there is none.
+*/
+uint32_t ForbiddenDictionary::findMatch(const ut::string_t& password, uint32_t minMatchLength) const
+{
+   uint32_t state = 0;
+   for (ut::char_t ch : password)
+   {
+      uint8_t symbol = normalize(ch);
+      if (symbol == sSeparator)
+      {
+         state = 0;
+         continue;
+      }
+
+      while (true)
+      {
+         const State& current = mStates[state];
+         const Edge* edge = mEdges + current.mFirstEdge;
+         const Edge* end = edge + current.mEdgeCount;
+         while (edge != end && edge->mSymbol < symbol)
+            ++edge;
+         if (edge != end && edge->mSymbol == symbol)
+         {
+            state = edge->mTarget;
+            break;
+         }
+         if (state == 0)
+            break;
+         state = current.mFailure;
+      }
+
+      uint32_t matchLength = mStates[state].mMatchLength;
+      if (matchLength != 0 && matchLength >= minMatchLength)
+         return matchLength;
+   }
+   return 0;
+}
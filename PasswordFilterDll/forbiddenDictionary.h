@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cpprest/asyncrt_utils.h>
+
+namespace ut = utility;
+
+
+/**
+* ForbiddenDictionary is an Aho-Corasick automaton over a forbidden word list, mapped read-only from a file
+* built by "PasswordFilterApp dictionary build". Nothing is copied or deserialized on load, the automaton is used
+* directly from the mapped view.
+* Both the words and the password are normalized to the same alphabet before matching:
+* case folding, Czech diacritics removal and leet substitutions (0->o, 1->i, 3->e, 4->a, @->a, 5->s, $->s, ...).
+* 'l' and 'i' share one symbol because '1' stands for both of them. Any other character is a separator.
+* findMatch makes a single linear pass over the password.
+*
+* File layout (little endian): Header, Header::mStateCount x State, Header::mEdgeCount x Edge.
+* States are in the breadth first order, state 0 is the root. Edges of a state are contiguous and sorted by the symbol.
+*/
+class ForbiddenDictionary
+{
+public:
+   static constexpr char sMagic[8] = { 'P', 'W', 'F', 'D', 'I', 'C', '0', '1' };
+   static constexpr uint8_t sSeparator = 0;
+   static constexpr uint8_t sSymbolCount = 27; // separator + a..z
+
+   struct Header
+   {
+      char mMagic[8];
+      uint32_t mStateCount;
+      uint32_t mEdgeCount;
+      uint32_t mWordCount;
+      uint32_t mReserved;
+   };
+
+   struct State
+   {
+      uint32_t mFirstEdge;
+      uint32_t mFailure;
+      uint8_t mEdgeCount;
+      uint8_t mMatchLength; // the longest word ending in this state (following the failure links), 0 = none
+      uint16_t mReserved;
+   };
+
+   struct Edge
+   {
+      uint8_t mSymbol;
+      uint8_t mReserved[3];
+      uint32_t mTarget;
+   };
+
+private:
+   void* mFile = nullptr; // HANDLE
+   void* mMapping = nullptr; // HANDLE
+   const void* mView = nullptr;
+   const Header* mHeader = nullptr;
+   const State* mStates = nullptr;
+   const Edge* mEdges = nullptr;
+
+   void validate(uint64_t fileSize);
+
+public:
+   ForbiddenDictionary() {};
+   ~ForbiddenDictionary();
+   ForbiddenDictionary(const ForbiddenDictionary&) = delete;
+   ForbiddenDictionary& operator=(const ForbiddenDictionary&) = delete;
+
+   static std::shared_ptr<const ForbiddenDictionary> open(const std::wstring& path); // throws std::runtime_error
+   static uint8_t normalize(ut::char_t ch);
+
+   uint32_t findMatch(const ut::string_t& password, uint32_t minMatchLength) const;
+   uint32_t getStateCount() const { return mHeader->mStateCount; }
+   uint32_t getWordCount() const { return mHeader->mWordCount; }
+};
+
+static_assert(sizeof(ForbiddenDictionary::Header) == 24, "the dictionary file layout must not change");
+static_assert(sizeof(ForbiddenDictionary::State) == 12, "the dictionary file layout must not change");
+static_assert(sizeof(ForbiddenDictionary::Edge) == 8, "the dictionary file layout must not change");
@@ -0,0 +1,101 @@
+#include "pch.h"
+#include <sstream>
+#include "housekeeper.h"
+#include "ioExecutor.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+Housekeeper::~Housekeeper()
+{
+   // the process is going down, the thread may be running a job
+   if (mThread.joinable())
+      mThread.detach();
+}
+
+/**
+* schedule plans the job to run after the delay, the thread is started by the first job.
+*/
+void Housekeeper::schedule(const char* name, std::chrono::milliseconds delay, job job)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   mJobs.emplace(std::chrono::steady_clock::now() + delay, Entry{ name, std::move(job) });
+   if (!mRunning)
+   {
+      mRunning = true;
+      mThread = std::thread([this]() { run(); });
+   }
+   mCondition.notify_all();
+}
+
+void Housekeeper::run()
+{
+   IoExecutor::nameCurrentThread(L"PasswordFilter housekeeping");
+   gLogger.createSessionId();
+   std::unique_lock<std::mutex> lock(mMutex);
+   while (true)
+   {
+      if (mJobs.empty())
+      {
+         mCondition.wait(lock);
+         continue;
+      }
+      auto due = mJobs.begin()->first;
+      if (std::chrono::steady_clock::now() < due)
+      {
+         mCondition.wait_until(lock, due); // woken sooner by a new job
+         continue;
+      }
+
+      auto next = mJobs.begin();
+      Entry entry = std::move(next->second);
+      mJobs.erase(next);
+      lock.unlock();
+
+      auto start = std::chrono::steady_clock::now();
+      std::chrono::milliseconds delay = sDone;
+      try
+      {
+         delay = entry.mJob();
+      }
+      catch (const std::exception& e)
+      {
+         gLogger.log(Logger::ERROR(), "The housekeeping job %s encountered an exception: %s", entry.mName, e.what());
+      }
+      uint64_t runUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+      lock.lock();
+      ++mRuns;
+      if (runUs > mMaxRunUs)
+      {
+         mMaxRunUs = runUs;
+         mMaxRunJob = entry.mName;
+      }
+      if (delay.count() >= 0)
+         mJobs.emplace(std::chrono::steady_clock::now() + delay, std::move(entry));
+   }
+}
+
+Housekeeper::Metrics Housekeeper::getMetrics()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   Metrics metrics;
+   metrics.mJobs = mJobs.size();
+   metrics.mRuns = mRuns;
+   metrics.mMaxRunUs = mMaxRunUs;
+   metrics.mMaxRunJob = mMaxRunJob;
+   return metrics;
+}
+
+std::string Housekeeper::describe()
+{
+   Metrics metrics = getMetrics();
+   std::ostringstream out;
+   out << "housekeeping: " << metrics.mJobs << " jobs planned, " << metrics.mRuns << " runs, longest run " << metrics.mMaxRunUs << " us";
+   if (!metrics.mMaxRunJob.empty())
+      out << " (" << metrics.mMaxRunJob << ")";
+   out << "\n";
+   return out.str();
+}
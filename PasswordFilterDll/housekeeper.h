@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+/**
+* Housekeeper runs the background jobs of the filter one after another on its own thread: the monitoring of the
+* configuration file and of the dictionary, the offline mode probe, the token renewal, the maintenance of the log
+* segments, the flight recorder dumps and the control channel. None of them takes a thread of the task pools or
+* a thread of its own then. A job returns the delay of its next run or sDone; a job never waits for the network,
+* it starts the request and its answer is handled by a continuation, so a slow IdM doesn't delay the other jobs.
+* The thread is started by the first job, not under the loader lock, and lives as long as the process.
+*/
+class Housekeeper
+{
+public:
+   using job = std::function<std::chrono::milliseconds()>;
+   static constexpr std::chrono::milliseconds sDone{ -1 };
+
+   struct Metrics
+   {
+      size_t mJobs = 0;
+      uint64_t mRuns = 0;
+      uint64_t mMaxRunUs = 0;
+      std::string mMaxRunJob;
+   };
+
+private:
+   struct Entry
+   {
+      const char* mName;
+      job mJob;
+   };
+
+   std::mutex mMutex; // guards everything below
+   std::condition_variable mCondition;
+   std::multimap<std::chrono::steady_clock::time_point, Entry> mJobs; // by the next run
+   std::thread mThread;
+   bool mRunning = false;
+   uint64_t mRuns = 0;
+   uint64_t mMaxRunUs = 0;
+   const char* mMaxRunJob = "";
+
+   void run();
+
+public:
+   ~Housekeeper();
+   void schedule(const char* name, std::chrono::milliseconds delay, job job);
+   Metrics getMetrics();
+   std::string describe();
+};
@@ -2,165 +2,473 @@
 #include "idmRestComm.h"
 #include "configuration.h"
 #include "logger.h"
-
+#include "retryPolicy.h"
+#include "trafficRecorder.h"
+#include "negativeCache.h"
+#include "tokenProvider.h"
+#include "tracing.h"
+#include "textCodec.h"
+#include "asyncDelay.h"
+#include "allocationAccounting.h"
+#include "ioExecutor.h"
+
+#include <functional>
 #include <winhttp.h>
 
 
 /****Global objects****/
 extern Logger gLogger;
 extern Configuration gConfiguration;
+extern NegativeCache gNegativeCache;
+extern TokenProvider gTokenProvider;
+extern IoExecutor gIoExecutor;
+
+/**
+* AttemptLoop is the state of one call walking the endpoints of the group in the balancing order
+* and the attempts of every endpoint. It is owned by the continuations of the call.
+*/
+struct IdmRestComm::AttemptLoop
+{
+   enum verdict
+   {
+      ATTEMPT_DONE,         // the call is finished
+      ATTEMPT_RETRY,        // the endpoint may be tried again
+      ATTEMPT_NEXT_ENDPOINT // the endpoint failed, the next one is tried
+   };
+
+   struct Outcome
+   {
+      verdict mVerdict = ATTEMPT_NEXT_ENDPOINT;
+      int64_t mRetryAfterMs = -1; // asked by IdM for the retry
+   };
+
+   std::function<cnc::task<Outcome>(size_t endpointIdx, uint32_t attemptNo)> mAttempt;
+   std::function<void()> mEndpointFailed;
+   std::shared_ptr<const RetryPolicy> mRetryPolicy;
+   std::vector<size_t> mEndpointOrder;
+   size_t mOrderPos = 0;
+   uint32_t mAttemptNo = 0;
+   int64_t mRetryAfterMs = -1;
+
+   void nextEndpoint()
+   {
+      if (mEndpointFailed)
+         mEndpointFailed();
+      ++mOrderPos;
+      mAttemptNo = 0;
+      mRetryAfterMs = -1;
+   }
+};
 
 /**
 * checkIdmPolicies method queries IdM whether the password supplied in the request body meets password policies  
 * returns TRUE if password is supposed to be changed on AD otherwise FALSE is returned
+* Endpoints of the group are tried in the order given by the group balancing.
 */
-bool IdmRestComm::checkIdmPolicies(const IdmRequestCont& body)
+cnc::task<bool> IdmRestComm::checkIdmPoliciesAsync(const IdmRequestCont& body, const EndpointGroup& endpoints)
 {
    gLogger.log(Logger::INFO(), "Account: %s - Starting password policy validation", Logger::w2s(body.getAccountName()).c_str());
-   bool result = gConfiguration.getAllowChangeByDefault(); // the default value is ovrriden based on respones from IdM
-   bool resolved = false;
-   bool securityFailure = false;
-   const auto& urlBaseVec = gConfiguration.getRestBaseUrlVec();
-   // iterate over alternative base urls if connection fails
-   for (const ut::string_t& baseUrl : urlBaseVec) 
-   {  // try as many attempts as set in case of failure
-      securityFailure = false;
-      for (uint32_t attemptCnt = gConfiguration.getConnectionAttempts(); attemptCnt > 0; --attemptCnt)
+   mSession = gLogger.getSession();
+   mTrafficRecord = TrafficRecorder::getCurrentRecord();
+   mFlightScope = FlightRecorder::getCurrentScope();
+   mAllocationCall = PWF_ALLOC_CURRENT_CALL();
+   mSecurityFailure = false;
+   struct Decision
+   {
+      bool mResult = false;
+      bool mResolved = false;
+      bool mSecurityFailure = false;
+   };
+   auto decision = std::make_shared<Decision>();
+   decision->mResult = gConfiguration.getAllowChangeByDefault(); // the default value is ovrriden based on respones from IdM
+   auto retryPolicy = gConfiguration.getRetryPolicy();
+   retryPolicy->recordRequest();
+   const wj::value requestBody = body.toJsonObject();
+
+   auto loop = std::make_shared<AttemptLoop>();
+   loop->mRetryPolicy = retryPolicy;
+   loop->mEndpointOrder = endpoints.getEndpointOrder(body.getAccountName());
+   loop->mAttempt = [this, &body, &endpoints, requestBody, retryPolicy, decision](size_t endpointIdx, uint32_t attemptNo)
+   {
+      auto attemptStart = std::chrono::steady_clock::now();
+      auto outstanding = std::make_shared<OutstandingRequestGuard>(endpoints, endpointIdx);
+      decision->mSecurityFailure = false;
+      cnc::task<wh::http_response> request;
+      try
       {
-         try
+         wh::uri_builder urlBuild(endpoints.getRestBaseUrlVec()[endpointIdx]);
+         urlBuild.append(gConfiguration.getRestCheckUrl());
+         request = sendRequest(wh::methods::PUT, urlBuild.to_uri(), requestBody);
+      }
+      catch (const std::exception&)
+      {
+         request = cnc::task_from_exception<wh::http_response>(std::current_exception());
+      }
+
+      return request.then([this, retryPolicy](wh::http_response response)
+         {
+            resumeSession();
+            return receiveResponse(response, retryPolicy);
+         }, gIoExecutor.getTaskOptions()).then([this, &body, retryPolicy, decision, outstanding, endpointIdx, attemptNo, attemptStart](cnc::task<IdmResponseCont> responseTask)
          {
-            wh::uri_builder urlBuild(baseUrl);
-            urlBuild.append(gConfiguration.getRestCheckUrl());
-            wh::uri destUrl = urlBuild.to_uri();
-            auto requestTask = createRequestTask(wh::methods::PUT, destUrl, body.toJsonObject());
-            wh::http_response response = requestTask.get();
-            IdmResponseCont responseCont(response);
-            IdmResponseCont::passFiltAction action = responseCont.getPassFiltAction();
-
-            switch (action)
+            resumeSession();
+            AttemptLoop::Outcome outcome;
+            try
             {
-            case IdmResponseCont::PF_ACT_TRUE:
-               resolved = true;
-               result = true;
-               break;
-            case IdmResponseCont::PF_ACT_FALSE:
-               resolved = true;
-               result = false;
-               break;
-            case IdmResponseCont::PF_ACT_CFG_DEFAULT:
-               resolved = true;
-               result = gConfiguration.getAllowChangeByDefault();
-               break;
-            case IdmResponseCont::PF_ACT_TRY_AGAIN:
-               continue;
-               //break;
-            default:
-               continue;
-               //break;
+               IdmResponseCont responseCont = responseTask.get();
+               recordAttempt(endpointIdx, attemptNo, TrafficAttempt::OUTCOME_RESPONSE, responseCont.getResultCode(), attemptStart);
+               IdmResponseCont::passFiltAction action = responseCont.getPassFiltAction();
+               PWF_TRACE("IdmPolicyAttempt",
+                  TraceLoggingUInt32(static_cast<uint32_t>(endpointIdx), "EndpointIdx"),
+                  TraceLoggingUInt32(attemptNo, "AttemptNo"),
+                  TraceLoggingUInt16(responseCont.getResultCode(), "Status"),
+                  TraceLoggingInt32(static_cast<int32_t>(action), "Action"),
+                  TraceLoggingUInt32(Tracing::elapsedUs(attemptStart), "DurationUs"));
+               if (responseCont.isAccountNotFound())
+                  gNegativeCache.insert(body.getAccountName(), body.getSystemName());
+               else if (responseCont.isSystemNotFound())
+                  gNegativeCache.invalidate();
+
+               switch (action)
+               {
+               case IdmResponseCont::PF_ACT_TRUE:
+                  decision->mResolved = true;
+                  decision->mResult = true;
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_DONE;
+                  break;
+               case IdmResponseCont::PF_ACT_FALSE:
+                  decision->mResolved = true;
+                  decision->mResult = false;
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_DONE;
+                  break;
+               case IdmResponseCont::PF_ACT_CFG_DEFAULT:
+                  decision->mResolved = true;
+                  if (mFlightScope != nullptr)
+                     mFlightScope->markDefaultDecision();
+                  decision->mResult = gConfiguration.getAllowChangeByDefault();
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_DONE;
+                  break;
+               case IdmResponseCont::PF_ACT_TRY_AGAIN:
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
+                  outcome.mRetryAfterMs = responseCont.getRetryAfterMs();
+                  break;
+               default:
+                  break;
+               }
             }
-            if (resolved)
-               break;
-         }
-         catch (const wj::json_exception& jsonEx)
-         {
-            gLogger.log(Logger::ERROR(), "An error occurred when parsing validation response: %s", jsonEx.what());
-         }
-         catch (const wh::http_exception& httpEx)
-         {
-            gLogger.log(Logger::ERROR(), "A WinHttp exception occurred: %s ", httpEx.what());
-            securityFailure = isSecurityFailure(httpEx);
-         }
-         catch (const std::exception& ex)
-         {
-            gLogger.log(Logger::ERROR(), "An unexpected error occurred in checkIdmPolicies: %s", ex.what());
-         }
-      }
-      if (resolved)
-         break;
-   }
-   if (securityFailure) // return false in case of secure connection troubles
-      result = false;
-   
-   gLogger.log(Logger::INFO(), "Account: %s - Password policy validation completed with the result: %s", Logger::w2s(body.getAccountName()).c_str(), Logger::w2s(getChangeDecisionText(result)).c_str());
-   return result;
+            catch (const wj::json_exception& jsonEx)
+            {
+               gLogger.log(Logger::ERROR(), "An error occurred when parsing validation response: %s", jsonEx.what());
+            }
+            catch (const wh::http_exception& httpEx)
+            {
+               gLogger.log(Logger::ERROR(), "A WinHttp exception occurred: %s ", httpEx.what());
+               decision->mSecurityFailure = isSecurityFailure(httpEx);
+               mSecurityFailure = mSecurityFailure || decision->mSecurityFailure;
+               PWF_TRACE("IdmPolicyAttemptFailed",
+                  TraceLoggingUInt32(static_cast<uint32_t>(endpointIdx), "EndpointIdx"),
+                  TraceLoggingUInt32(attemptNo, "AttemptNo"),
+                  TraceLoggingString(httpEx.what(), "Error"),
+                  TraceLoggingBoolean(decision->mSecurityFailure, "SecurityFailure"),
+                  TraceLoggingUInt32(Tracing::elapsedUs(attemptStart), "DurationUs"));
+               recordAttempt(endpointIdx, attemptNo, decision->mSecurityFailure ? TrafficAttempt::OUTCOME_SECURITY_FAILURE : TrafficAttempt::OUTCOME_EXCEPTION, 0, attemptStart);
+               if (!decision->mSecurityFailure && retryPolicy->getRetryOnException())
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
+            }
+            catch (const std::exception& ex)
+            {
+               gLogger.log(Logger::ERROR(), "An unexpected error occurred in checkIdmPolicies: %s", ex.what());
+               PWF_TRACE("IdmPolicyAttemptFailed",
+                  TraceLoggingUInt32(static_cast<uint32_t>(endpointIdx), "EndpointIdx"),
+                  TraceLoggingUInt32(attemptNo, "AttemptNo"),
+                  TraceLoggingString(ex.what(), "Error"),
+                  TraceLoggingBoolean(false, "SecurityFailure"),
+                  TraceLoggingUInt32(Tracing::elapsedUs(attemptStart), "DurationUs"));
+               recordAttempt(endpointIdx, attemptNo, TrafficAttempt::OUTCOME_EXCEPTION, 0, attemptStart);
+               if (retryPolicy->getRetryOnException())
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
+            }
+            return outcome;
+         }, gIoExecutor.getTaskOptions());
+   };
+
+   return runAttemptLoop(loop).then([this, &body, decision]()
+      {
+         resumeSession();
+         mIdmResolved = decision->mResolved;
+         if (!decision->mResolved && mFlightScope != nullptr) // allowChangeByDefault decides
+            mFlightScope->markDefaultDecision();
+         if (decision->mSecurityFailure) // return false in case of secure connection troubles
+            decision->mResult = false;
+
+         gLogger.log(Logger::INFO(), "Account: %s - Password policy validation completed with the result: %s", Logger::w2s(body.getAccountName()).c_str(), Logger::w2s(getChangeDecisionText(decision->mResult)).c_str());
+         return decision->mResult;
+      }, gIoExecutor.getTaskOptions());
 }
 
 
 /**
 * notifyIdm method informs IdM that password met all policies and has been changed on AD
-*
+* Every attempt carries the same idempotency key, so IdM can recognize a change it has already processed
+* (e.g. a timeout after the PUT was accepted followed by a retry on another endpoint).
+* The duplicates are suppressed by IdM, the filter keeps no record of the delivered changes.
 */
-void IdmRestComm::notifyIdm(const IdmRequestCont& body)
+cnc::task<void> IdmRestComm::notifyIdmAsync(const IdmRequestCont& body, const EndpointGroup& endpoints)
 {
    gLogger.log(Logger::INFO(), "Account: %s - Notifying IdM about password change", Logger::w2s(body.getAccountName()).c_str());
-   const auto& urlBaseVec = gConfiguration.getRestBaseUrlVec();
-   // iterate over alternative base urls if connection fails
-   for (const ut::string_t& baseUrl : urlBaseVec) 
-   {  // try as many attempts as set in case of failure
-      for (uint32_t attemptCnt = gConfiguration.getConnectionAttempts(); attemptCnt > 0; --attemptCnt)
+   mIdmResolved = false;
+   mSecurityFailure = false;
+   mSession = gLogger.getSession();
+   mTrafficRecord = TrafficRecorder::getCurrentRecord();
+   mFlightScope = FlightRecorder::getCurrentScope();
+   mAllocationCall = PWF_ALLOC_CURRENT_CALL();
+   const ut::string_t idempotencyKey = body.getIdempotencyKey();
+   const wj::value requestBody = body.toJsonObject(true);
+   auto retryPolicy = gConfiguration.getRetryPolicy();
+   retryPolicy->recordRequest();
+
+   auto loop = std::make_shared<AttemptLoop>();
+   loop->mRetryPolicy = retryPolicy;
+   loop->mEndpointOrder = endpoints.getEndpointOrder(body.getAccountName());
+   loop->mEndpointFailed = [&body]()
+   {
+      gLogger.log(Logger::INFO(), "Account: %s - IdM notification ended with an exception", Logger::w2s(body.getAccountName()).c_str());
+   };
+   loop->mAttempt = [this, &body, &endpoints, requestBody, idempotencyKey, retryPolicy](size_t endpointIdx, uint32_t attemptNo)
+   {
+      auto attemptStart = std::chrono::steady_clock::now();
+      auto outstanding = std::make_shared<OutstandingRequestGuard>(endpoints, endpointIdx);
+      cnc::task<wh::http_response> request;
+      try
       {
-         try
+         wh::uri_builder urlBuild(endpoints.getRestBaseUrlVec()[endpointIdx]);
+         urlBuild.append(gConfiguration.getRestNotifyUrl());
+         request = sendRequest(wh::methods::PUT, urlBuild.to_uri(), requestBody, idempotencyKey);
+      }
+      catch (const std::exception&)
+      {
+         request = cnc::task_from_exception<wh::http_response>(std::current_exception());
+      }
+
+      return request.then([this, &body, idempotencyKey, retryPolicy, outstanding, endpointIdx, attemptNo, attemptStart](cnc::task<wh::http_response> responseTask)
          {
-            wh::uri_builder urlBuild(baseUrl);
-            urlBuild.append(gConfiguration.getRestNotifyUrl());
-            wh::uri destUrl = urlBuild.to_uri();
-            auto requestTask = createRequestTask(wh::methods::PUT, destUrl, body.toJsonObject());
-            wh::http_response response = requestTask.get();
-            auto httpStatus = response.status_code();
-            if (httpStatus == wh::status_codes::OK)
+            resumeSession();
+            AttemptLoop::Outcome outcome;
+            try
             {
-               gLogger.log(Logger::INFO(), "Account: %s - IdM notification is successful", Logger::w2s(body.getAccountName()).c_str());
-               return;
+               wh::http_response response = responseTask.get();
+               auto httpStatus = response.status_code();
+               recordAttempt(endpointIdx, attemptNo, TrafficAttempt::OUTCOME_RESPONSE, httpStatus, attemptStart);
+               if (httpStatus == wh::status_codes::OK)
+               {
+                  gLogger.log(Logger::INFO(), "Account: %s - IdM notification is successful", Logger::w2s(body.getAccountName()).c_str());
+                  mIdmResolved = true;
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_DONE;
+                  return outcome;
+               }
+               gLogger.log(Logger::WARN(), "Account: %s - IdM notification response returned with the http status: %u", Logger::w2s(body.getAccountName()).c_str(), httpStatus);
+               if (!retryPolicy->isRetryableStatus(httpStatus))
+               {
+                  mIdmResolved = true; // IdM answered, repeating the notification won't change it
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_DONE;
+                  return outcome;
+               }
+               outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
+               outcome.mRetryAfterMs = RetryPolicy::parseRetryAfterMs(response.headers());
             }
-            else
+            catch (const wh::http_exception& httpEx)
             {
-               gLogger.log(Logger::WARN(), "Account: %s - IdM notification response returned with the http status: %u", Logger::w2s(body.getAccountName()).c_str(), httpStatus);
-               return;
+               gLogger.log(Logger::ERROR(), "A WinHttp exception occurred: %s ", httpEx.what());
+               bool securityFailure = isSecurityFailure(httpEx);
+               mSecurityFailure = mSecurityFailure || securityFailure;
+               recordAttempt(endpointIdx, attemptNo, securityFailure ? TrafficAttempt::OUTCOME_SECURITY_FAILURE : TrafficAttempt::OUTCOME_EXCEPTION, 0, attemptStart);
+               if (!securityFailure && retryPolicy->getRetryOnException())
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
             }
-         }
-         catch (const wh::http_exception& httpEx)
-         {
-            gLogger.log(Logger::ERROR(), "A WinHttp exception occurred: %s ", httpEx.what());
-         }
-         catch (const std::exception& ex)
-         {
-            gLogger.log(Logger::ERROR(), "An unexpected error occurred in notifyIdm: %s", ex.what());
-         }
+            catch (const std::exception& ex)
+            {
+               gLogger.log(Logger::ERROR(), "An unexpected error occurred in notifyIdm: %s", ex.what());
+               recordAttempt(endpointIdx, attemptNo, TrafficAttempt::OUTCOME_EXCEPTION, 0, attemptStart);
+               if (retryPolicy->getRetryOnException())
+                  outcome.mVerdict = AttemptLoop::ATTEMPT_RETRY;
+            }
+            return outcome;
+         }, gIoExecutor.getTaskOptions());
+   };
+
+   return runAttemptLoop(loop);
+}
+
+/**
+* runAttemptLoop starts the next attempt of the loop and continues with the loop when the attempt is finished.
+* The backoff before a retry is a thread pool timer, so a waiting call doesn't hold any thread.
+*/
+cnc::task<void> IdmRestComm::runAttemptLoop(std::shared_ptr<AttemptLoop> loop)
+{
+   while (loop->mOrderPos < loop->mEndpointOrder.size())
+   {
+      std::chrono::milliseconds delay(0);
+      if (loop->mAttemptNo >= gConfiguration.getConnectionAttempts() ||
+         (loop->mAttemptNo > 0 && !getRetryDelay(*loop->mRetryPolicy, loop->mAttemptNo, loop->mRetryAfterMs, delay)))
+      {
+         loop->nextEndpoint();
+         continue;
       }
-      gLogger.log(Logger::INFO(), "Account: %s - IdM notification ended with an exception", Logger::w2s(body.getAccountName()).c_str());
+
+      size_t endpointIdx = loop->mEndpointOrder[loop->mOrderPos];
+      uint32_t attemptNo = loop->mAttemptNo;
+      cnc::task<AttemptLoop::Outcome> attempt = delay.count() == 0 ? loop->mAttempt(endpointIdx, attemptNo) :
+         AsyncDelay::after(delay).then([this, loop, endpointIdx, attemptNo]()
+            {
+               resumeSession();
+               return loop->mAttempt(endpointIdx, attemptNo);
+            }, gIoExecutor.getTaskOptions());
+      return attempt.then([this, loop](AttemptLoop::Outcome outcome)
+         {
+            resumeSession();
+            if (outcome.mVerdict == AttemptLoop::ATTEMPT_DONE)
+               return cnc::task_from_result();
+            if (outcome.mVerdict == AttemptLoop::ATTEMPT_RETRY)
+            {
+               ++loop->mAttemptNo;
+               loop->mRetryAfterMs = outcome.mRetryAfterMs;
+            }
+            else
+               loop->nextEndpoint();
+            return runAttemptLoop(loop);
+         }, gIoExecutor.getTaskOptions());
+   }
+   return cnc::task_from_result();
+}
+
+/**
+* getRetryDelay returns the backoff delay given by the retry policy.
+* Returns false if the retry is not allowed - the retry budget is exhausted
+* or IdM asked (Retry-After) for a longer pause than the policy permits.
+*/
+bool IdmRestComm::getRetryDelay(const RetryPolicy& retryPolicy, uint32_t retryNo, int64_t retryAfterMs, std::chrono::milliseconds& delay)
+{
+   delay = retryPolicy.getBackoffDelay(retryNo, retryAfterMs);
+   if (delay.count() < 0)
+   {
+      gLogger.log(Logger::WARN(), "IdM asked to retry after %lld ms which exceeds the retry policy, the endpoint is skipped", static_cast<long long>(retryAfterMs));
+      return false;
+   }
+   if (!retryPolicy.tryAcquireRetry())
+   {
+      gLogger.log(Logger::WARN(), "The retry budget is exhausted, the endpoint is not retried");
+      return false;
    }
+   gLogger.log(Logger::DEBUG(), "Retrying in %lld ms", static_cast<long long>(delay.count()));
+   return true;
+}
+
+/**
+* recordAttempt adds the attempt to the traffic record and to the flight record of the call.
+*/
+void IdmRestComm::recordAttempt(size_t endpointIdx, uint32_t attemptNo, TrafficAttempt::outcome outcome, uint16_t status, std::chrono::steady_clock::time_point attemptStart) const
+{
+   auto attemptEnd = std::chrono::steady_clock::now();
+   TrafficRecorder::recordAttempt(mTrafficRecord, endpointIdx, outcome, status, attemptEnd - attemptStart);
+   if (mFlightScope != nullptr)
+      mFlightScope->addAttempt(endpointIdx, attemptNo, outcome, status, attemptStart, attemptEnd);
+}
+
+/**
+* resumeSession makes the log session of the call current on the pool thread running its continuation.
+*/
+void IdmRestComm::resumeSession() const
+{
+   gLogger.resumeSession(mSession);
+   PWF_ALLOC_RESUME(mAllocationCall, AllocationStats::PHASE_IDM_RESPONSE);
 }
 
 /**
 * createRequestTask method encapsulates creating of configured REST request. 
-* The request is run as a task in separate thread.
+* The request is sent by the configured transport (see IdmTransport).
 */
-cnc::task<wh::http_response> IdmRestComm::createRequestTask(const wh::method& method, const wh::uri& url, const wj::value& body)
+cnc::task<wh::http_response> IdmRestComm::createRequestTask(const wh::method& method, const wh::uri& url, const wj::value& body, const ut::string_t& idempotencyKey)
 {
    wh::http_request request(method);
    wh::http_headers& head = request.headers();
-   addTokenAuthentication(head);
+   mTokenGeneration = addTokenAuthentication(head);
    head.set_content_type(sIdmContentType);
+   if (!idempotencyKey.empty())
+      head.add(sIdempotencyKeyHeader, idempotencyKey);
 
-   // set request boody
+   // set request boody, transcoded by TextCodec instead of cpprest
    if (method != wh::methods::GET)
    {
-      request.set_body(body);
+      request.set_body(TextCodec::toUtf8(body.serialize()), uc::to_utf8string(sIdmContentType));
    }
-   
-   // client config options
-   wh::client::http_client_config clientConfig;
-   clientConfig.set_timeout(std::chrono::milliseconds(gConfiguration.getConnectionTimeoutMs()));
-   clientConfig.set_validate_certificates(!gConfiguration.getIgnoreCertificate());
-
-   wh::client::http_client client(url, clientConfig);
-   return client.request(request);
+
+   auto transport = gConfiguration.getTransport();
+   PWF_TRACE("IdmRequest",
+      TraceLoggingWideString(method.c_str(), "Method"),
+      TraceLoggingWideString(url.to_string().c_str(), "Url"),
+      TraceLoggingUInt64(mTokenGeneration, "TokenGeneration"),
+      TraceLoggingString(transport->getName(), "Transport"));
+   return transport->send(url, request);
+}
+
+/**
+* sendRequest sends the request, the returned task completes with the response headers.
+* When IdM refuses a short-lived token, the request is repeated once with the renewed token;
+* the refresh is shared by all requests refused with the same token.
+*/
+cnc::task<wh::http_response> IdmRestComm::sendRequest(const wh::method& method, const wh::uri& url, const wj::value& body, const ut::string_t& idempotencyKey)
+{
+   return createRequestTask(method, url, body, idempotencyKey).then([this, method, url, body, idempotencyKey](wh::http_response response)
+      {
+         resumeSession();
+         if (response.status_code() == wh::status_codes::Unauthorized && gTokenProvider.isEnabled() && gTokenProvider.refreshAfterUnauthorized(mTokenGeneration))
+         {
+            gLogger.log(Logger::INFO(), "The request is repeated with the renewed IdM token");
+            return createRequestTask(method, url, body, idempotencyKey);
+         }
+         return cnc::task_from_result(response);
+      }, gIoExecutor.getTaskOptions());
 }
 
-void IdmRestComm::addTokenAuthentication(web::http::http_headers& head) const
+/**
+* receiveResponse reads the body of the validation response and parses it.
+* A body which can't be read is parsed as empty, the decision is given by the http status then.
+* The response is classified by the retry policy captured when the call started, not by a reloaded one.
+*/
+cnc::task<IdmResponseCont> IdmRestComm::receiveResponse(const wh::http_response& response, std::shared_ptr<const RetryPolicy> retryPolicy)
 {
-   const ut::string_t& token = gConfiguration.getToken();
+   return response.extract_vector().then([this, response, retryPolicy](cnc::task<std::vector<unsigned char>> bodyTask)
+      {
+         resumeSession();
+         std::vector<unsigned char> body;
+         try
+         {
+            body = bodyTask.get();
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::WARN(), "An exception occurred during reading the validation response: %s", e.what());
+         }
+         return IdmResponseCont(response, body, *retryPolicy);
+      }, gIoExecutor.getTaskOptions());
+}
+
+/**
+* addTokenAuthentication returns the generation of the short-lived token sent, 0 for the static token.
+*/
+uint64_t IdmRestComm::addTokenAuthentication(web::http::http_headers& head) const
+{
+   if (!gTokenProvider.isEnabled())
+   {
+      head.add(U("CIDMST"), gConfiguration.getToken());
+      return 0;
+   }
+
+   uint64_t generation = 0;
+   ut::string_t token = gTokenProvider.getToken(generation);
    head.add(U("CIDMST"), token);
+   SecureZeroMemory(token.data(), token.size() * sizeof(token[0]));
+   return generation;
 }
 
 bool IdmRestComm::isSecurityFailure(const wh::http_exception& e)
@@ -210,10 +518,10 @@ ut::string_t IdmRequestCont::toJsonString16() const
 
 std::string IdmRequestCont::toJsonString8() const
 {
-   return uc::to_utf8string(toJsonString16());
+   return TextCodec::toUtf8(toJsonString16());
 }
 
-wj::value IdmRequestCont::toJsonObject() const
+wj::value IdmRequestCont::toJsonObject(bool withIdempotencyKey) const
 {
    wj::value obj;
    obj[mAccountKey] = wj::value::string(mAccountName);
@@ -221,9 +529,22 @@ wj::value IdmRequestCont::toJsonObject() const
    obj[mSystemKey] = wj::value::string(mSystemName);
    obj[mLogIdKey] = wj::value::string(mLogId);
    obj[mVersionKey] = wj::value::string(gConfiguration.getVersion());
+   if (withIdempotencyKey)
+      obj[mIdempotencyKeyKey] = wj::value::string(getIdempotencyKey());
    return obj;
 }
 
+/**
+* getIdempotencyKey derives the key of the change from its correlation id (logIdentifier) and the account.
+* The log id is kept in the offline journal, so a replayed change has the same key as the original one.
+*/
+ut::string_t IdmRequestCont::getIdempotencyKey() const
+{
+   ut::ostringstream_t key;
+   key << U("pwf-") << mLogId << U("-") << std::hex << std::setw(16) << std::setfill(U('0')) << EndpointGroup::hashString(mAccountName, true);
+   return key.str();
+}
+
 bool IdmRequestCont::accountStartsWithPrefix()
 {
    const std::vector<ut::string_t>& reserved = gConfiguration.getSkippedAccPrefixVec();
@@ -235,7 +556,8 @@ bool IdmRequestCont::accountStartsWithPrefix()
       ut::string_t::size_type pos = mAccountName.find(prefix);
       if (pos == 0) // has to be found at the beginning 
       {
-         gLogger.log(Logger::DEBUG(), "The account starts with reserved prefix: %s", Logger::w2s(prefix).c_str());
+         if (gLogger.isEnabled(Logger::DEBUG()))
+            gLogger.log(Logger::DEBUG(), "The account starts with reserved prefix: %s", Logger::w2s(prefix).c_str());
          return true;
       }
    }
@@ -245,7 +567,10 @@ bool IdmRequestCont::accountStartsWithPrefix()
 ut::string_t IdmRequestCont::pUnicode2String(const PUNICODE_STRING uniStr)
 {
    if (uniStr != nullptr && uniStr->Buffer != nullptr && uniStr->Length > 0 )
+   {
+      PWF_ALLOC_COPY(uniStr->Length);
       return ut::string_t(uniStr->Buffer, uniStr->Length / sizeof(uniStr->Buffer[0]));
+   }
    else
       return ut::string_t();
 }
@@ -253,21 +578,29 @@ ut::string_t IdmRequestCont::pUnicode2String(const PUNICODE_STRING uniStr)
 
 ///////////// IdmResponseCont /////////////////
 
-IdmResponseCont::IdmResponseCont(const wh::http_response& response)
+IdmResponseCont::IdmResponseCont(const wh::http_response& response, const std::vector<unsigned char>& body, const RetryPolicy& retryPolicy)
 {
+   auto start = Tracing::isEnabled() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
    try
    {
       const wh::http_headers& head = response.headers();
-      ut::string_t contentType = head.content_type();
       mResultCode = response.status_code();
-      const ut::string_t jsonStr = response.extract_utf16string(true).get();
+      mRetryAfterMs = RetryPolicy::parseRetryAfterMs(head);
+      const ut::string_t jsonStr = TextCodec::toUtf16(reinterpret_cast<const char*>(body.data()), body.size());
       mHasIdmContent = parseJson(jsonStr);
    }
    catch (const std::exception& e)
    {
       gLogger.log(Logger::WARN(), "An exception occurred during parsing the validation response: %s", e.what());
    }
-   mPassFiltAction = deducePassFiltAction();
+   mPassFiltAction = deducePassFiltAction(retryPolicy);
+   PWF_TRACE("IdmResponseParsed",
+      TraceLoggingUInt16(mResultCode, "Status"),
+      TraceLoggingBoolean(mHasIdmContent, "HasIdmContent"),
+      TraceLoggingWideString(mStatusEnum.c_str(), "StatusEnum"),
+      TraceLoggingInt32(static_cast<int32_t>(mPassFiltAction), "Action"),
+      TraceLoggingUInt32(static_cast<uint32_t>(body.size()), "BodyBytes"),
+      TraceLoggingUInt32(Tracing::elapsedUs(start), "DurationUs"));
 }
 
 bool IdmResponseCont::parseJson(const ut::string_t& jsonStr)
@@ -293,7 +626,21 @@ bool IdmResponseCont::parseJson(const ut::string_t& jsonStr)
    }
 }
 
-IdmResponseCont::passFiltAction IdmResponseCont::deducePassFiltAction() const
+/**
+* The identity or its account definition doesn't exist in IdM, the account is not managed.
+*/
+bool IdmResponseCont::isAccountNotFound() const
+{
+   return mResultCode == wh::status_codes::NotFound && mHasIdmContent &&
+      (mStatusEnum.compare(sIdentityNotFound) == 0 || mStatusEnum.compare(sDefinitionNotFound) == 0);
+}
+
+bool IdmResponseCont::isSystemNotFound() const
+{
+   return mResultCode == wh::status_codes::NotFound && mHasIdmContent && mStatusEnum.compare(sSystemNotFound) == 0;
+}
+
+IdmResponseCont::passFiltAction IdmResponseCont::deducePassFiltAction(const RetryPolicy& retryPolicy) const
 {
    // pass validation is OK
    if (mResultCode == wh::status_codes::OK)
@@ -332,10 +679,10 @@ IdmResponseCont::passFiltAction IdmResponseCont::deducePassFiltAction() const
       }
    }
 
-   if (mResultCode == wh::status_codes::RequestTimeout ||
-      mResultCode == wh::status_codes::GatewayTimeout)
+   // 408, 504 and other transient statuses listed in the retry policy
+   if (retryPolicy.isRetryableStatus(mResultCode))
    {
-      gLogger.log(Logger::INFO(), "Some kind of timeout response occurred. Http status: %u", mResultCode);
+      gLogger.log(Logger::INFO(), "A transient failure response occurred. Http status: %u", mResultCode);
       return PF_ACT_TRY_AGAIN;
    }
 
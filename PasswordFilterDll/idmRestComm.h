@@ -4,6 +4,11 @@
 #include <cpprest/filestream.h>
 #include <cpprest/json.h>
 #include <SubAuth.h>
+#include "idmRouting.h"
+#include "trafficRecord.h"
+#include "flightRecorder.h"
+
+class RetryPolicy;
 
 namespace wh = web::http;
 namespace wj = web::json;
@@ -23,6 +28,7 @@ private:
    const ut::string_t mSystemKey{U("resource")};
    const ut::string_t mLogIdKey{U("logIdentifier") };
    const ut::string_t mVersionKey{U("version") };
+   const ut::string_t mIdempotencyKeyKey{U("idempotencyKey") };
 
    ut::string_t mAccountName;
    ut::string_t mPassword;
@@ -47,7 +53,8 @@ public:
 
    ut::string_t toJsonString16() const;
    std::string toJsonString8() const;
-   wj::value toJsonObject() const;
+   wj::value toJsonObject(bool withIdempotencyKey = false) const;
+   ut::string_t getIdempotencyKey() const;
 
    static ut::string_t pUnicode2String(const PUNICODE_STRING);
    
@@ -83,36 +90,65 @@ private:
    bool mHasIdmContent = false;
    ut::string_t mStatusEnum;
    passFiltAction mPassFiltAction = PF_ACT_CFG_DEFAULT;
-   wh::status_code mResultCode;
+   wh::status_code mResultCode = 0;
+   int64_t mRetryAfterMs = -1;
 
 private:
    bool parseJson(const wj::value& rootObj);
    bool parseJson(const ut::string_t& jsonStr);
-   passFiltAction deducePassFiltAction() const;
+   passFiltAction deducePassFiltAction(const RetryPolicy& retryPolicy) const;
 
 public:
-   IdmResponseCont(const wh::http_response& response);
+   IdmResponseCont() {} // a task result holder needs the default instance
+   IdmResponseCont(const wh::http_response& response, const std::vector<unsigned char>& body, const RetryPolicy& retryPolicy); // the policy of the call
+   wh::status_code getResultCode() const { return mResultCode; }
    const bool hasIdmContent() const { return mHasIdmContent; }
    const ut::string_t& getStatusEnum() const { return mStatusEnum; }
    passFiltAction getPassFiltAction() const { return mPassFiltAction; }
+   int64_t getRetryAfterMs() const { return mRetryAfterMs; }
+   bool isAccountNotFound() const;
+   bool isSystemNotFound() const;
 };
 
 /**
 * IdmRestComm class implements underlying methods which invoke 
 * validation of password policies in Idm
 * and then notifies Idm of finished password change in AD
+* The endpoint/attempt loop runs as a chain of task continuations: no thread waits for a response
+* or a retry backoff, only the caller of the synchronous methods waits for the final decision.
+* The object, the request body and the endpoint group must outlive the returned tasks.
 */
 class IdmRestComm
 {
 private:
+   struct AttemptLoop;
+
    constexpr static wchar_t sIdmContentType[] = U("application/json");
-   void addTokenAuthentication(wh::http_headers& head) const;
+   constexpr static wchar_t sIdempotencyKeyHeader[] = U("Idempotency-Key");
+   uint64_t addTokenAuthentication(wh::http_headers& head) const;
+   cnc::task<wh::http_response> sendRequest(const wh::method& method, const wh::uri& url, const wj::value& body, const ut::string_t& idempotencyKey = ut::string_t());
+   cnc::task<IdmResponseCont> receiveResponse(const wh::http_response& response, std::shared_ptr<const RetryPolicy> retryPolicy);
+   cnc::task<void> runAttemptLoop(std::shared_ptr<AttemptLoop> loop);
    bool isSecurityFailure(const wh::http_exception& e);
    ut::string_t getChangeDecisionText(bool decision);
+   bool getRetryDelay(const RetryPolicy& retryPolicy, uint32_t retryNo, int64_t retryAfterMs, std::chrono::milliseconds& delay);
+   void resumeSession() const;
+   void recordAttempt(size_t endpointIdx, uint32_t attemptNo, TrafficAttempt::outcome outcome, uint16_t status, std::chrono::steady_clock::time_point attemptStart) const;
+   bool mIdmResolved = false; // IdM gave a final answer in the last call
+   bool mSecurityFailure = false; // an attempt of the last call failed on the secure connection (certificate, TLS)
+   uint64_t mTokenGeneration = 0; // generation of the token sent with the last request
+   Logger::Session mSession; // log session of the call, adopted by the continuations
+   TrafficRecord* mTrafficRecord = nullptr; // traffic record of the call, see TrafficRecorder
+   FlightRecorder::Scope* mFlightScope = nullptr; // flight record of the call, see FlightRecorder
+   uint64_t mAllocationCall = 0; // accounted call, see AllocationAccounting (instrumentation build only)
 
 public:
    IdmRestComm() {};
-   cnc::task<wh::http_response> createRequestTask(const wh::method& method, const wh::uri& url, const wj::value& body);
-   bool checkIdmPolicies(const IdmRequestCont& body);
-   void notifyIdm(const IdmRequestCont& body);
-};
\ No newline at end of file
+   cnc::task<wh::http_response> createRequestTask(const wh::method& method, const wh::uri& url, const wj::value& body, const ut::string_t& idempotencyKey = ut::string_t());
+   cnc::task<bool> checkIdmPoliciesAsync(const IdmRequestCont& body, const EndpointGroup& endpoints);
+   cnc::task<void> notifyIdmAsync(const IdmRequestCont& body, const EndpointGroup& endpoints);
+   bool checkIdmPolicies(const IdmRequestCont& body, const EndpointGroup& endpoints) { return checkIdmPoliciesAsync(body, endpoints).get(); }
+   void notifyIdm(const IdmRequestCont& body, const EndpointGroup& endpoints) { notifyIdmAsync(body, endpoints).get(); }
+   bool isIdmResolved() const { return mIdmResolved; }
+   bool hasSecurityFailure() const { return mSecurityFailure; }
+};
@@ -0,0 +1,265 @@
+#include "pch.h"
+#include <algorithm>
+#include <numeric>
+#include "idmRouting.h"
+#include "configuration.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+///////////////// EndpointGroup //////////////////////////////
+
+EndpointGroup::EndpointGroup(const ut::string_t& name, const ut::string_t& systemId, const std::vector<ut::string_t>& restBaseUrlVec, balancing balance)
+   : mName(name), mSystemId(systemId), mRestBaseUrlVec(restBaseUrlVec), mBalancing(balance)
+{
+   mOutstanding = std::make_unique<std::atomic<uint32_t>[]>(mRestBaseUrlVec.size());
+   for (size_t i = 0; i < mRestBaseUrlVec.size(); ++i)
+   {
+      mOutstanding[i].store(0);
+      mUrlHashVec.push_back(hashString(mRestBaseUrlVec[i], false));
+   }
+}
+
+/**
+* getEndpointOrder returns indexes of the group endpoints in the order in which they are supposed to be tried.
+* The first one takes the traffic, the following ones are used as failover.
+*/
+std::vector<size_t> EndpointGroup::getEndpointOrder(const ut::string_t& accountName) const
+{
+   std::vector<size_t> order(mRestBaseUrlVec.size());
+   std::iota(order.begin(), order.end(), 0);
+   if (mBalancing == BALANCE_FAILOVER || order.size() < 2)
+      return order;
+
+   // rendezvous hashing - every endpoint gets a score for the account, the highest score wins.
+   // Adding or removing an endpoint moves only the accounts which belonged to it.
+   const uint64_t accountHash = hashString(accountName, true);
+   std::vector<uint64_t> scores(order.size());
+   for (size_t i = 0; i < order.size(); ++i)
+   {
+      uint64_t x = accountHash ^ mUrlHashVec[i];
+      // splitmix64 finalizer
+      x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+      x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+      x ^= x >> 31;
+      scores[i] = x;
+   }
+
+   if (mBalancing == BALANCE_LEAST_OUTSTANDING)
+   {
+      // snapshot the counters, they change under our hands; the hash score breaks ties
+      std::vector<uint32_t> outstanding(order.size());
+      for (size_t i = 0; i < order.size(); ++i)
+         outstanding[i] = getOutstanding(i);
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+         {
+            if (outstanding[a] != outstanding[b])
+               return outstanding[a] < outstanding[b];
+            return scores[a] > scores[b];
+         });
+   }
+   else
+   {
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+         {
+            return scores[a] > scores[b];
+         });
+   }
+   return order;
+}
+
+void EndpointGroup::requestStarted(size_t endpointIdx) const
+{
+   if (endpointIdx < mRestBaseUrlVec.size())
+      mOutstanding[endpointIdx].fetch_add(1, std::memory_order_relaxed);
+}
+
+void EndpointGroup::requestFinished(size_t endpointIdx) const
+{
+   if (endpointIdx < mRestBaseUrlVec.size())
+      mOutstanding[endpointIdx].fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint32_t EndpointGroup::getOutstanding(size_t endpointIdx) const
+{
+   if (endpointIdx >= mRestBaseUrlVec.size())
+      return 0;
+   return mOutstanding[endpointIdx].load(std::memory_order_relaxed);
+}
+
+EndpointGroup::balancing EndpointGroup::parseBalancing(const ut::string_t& name)
+{
+   if (name == U("failover"))
+      return BALANCE_FAILOVER;
+   if (name == U("hash"))
+      return BALANCE_HASH;
+   if (name == U("leastOutstanding"))
+      return BALANCE_LEAST_OUTSTANDING;
+
+   std::string msg = Logger::formatMessage("Unknown balancing \"%s\". Supported values are: failover, hash, leastOutstanding", Logger::w2s(name).c_str());
+   throw wj::json_exception(msg.c_str());
+}
+
+const char* EndpointGroup::getBalancingName(balancing balance)
+{
+   switch (balance)
+   {
+   case BALANCE_HASH:
+      return "hash";
+   case BALANCE_LEAST_OUTSTANDING:
+      return "leastOutstanding";
+   default:
+      return "failover";
+   }
+}
+
+/**
+* FNV-1a hash. Account names are hashed case insensitively because AD account names are case insensitive.
+*/
+uint64_t EndpointGroup::hashString(const ut::string_t& str, bool caseInsensitive)
+{
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   for (auto ch : str)
+   {
+      uint32_t c = static_cast<uint32_t>(caseInsensitive ? std::towlower(ch) : ch);
+      hash ^= c & 0xff;
+      hash *= 0x100000001b3ULL;
+      hash ^= (c >> 8) & 0xff;
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+///////////////// RoutingTable //////////////////////////////
+
+/**
+* create builds the routing table from the "routing" configuration object.
+* When the object is missing (nullptr), the table contains just the default group.
+* Throws json_exception in case of an invalid routing configuration.
+*/
+std::shared_ptr<const RoutingTable> RoutingTable::create(const wj::value* routingObj, const ut::string_t& defaultSystemId, const std::vector<ut::string_t>& defaultRestBaseUrlVec)
+{
+   auto table = std::make_shared<RoutingTable>();
+   EndpointGroup::balancing defaultBalancing = EndpointGroup::BALANCE_FAILOVER;
+
+   if (routingObj != nullptr)
+   {
+      if (routingObj->has_string_field(sDefaultBalancingKey))
+         defaultBalancing = EndpointGroup::parseBalancing(routingObj->at(sDefaultBalancingKey).as_string());
+
+      if (routingObj->has_array_field(sGroupsKey))
+      {
+         for (const wj::value& groupObj : routingObj->at(sGroupsKey).as_array())
+         {
+            Configuration::proveKeyPresence(groupObj, sNameKey, &wj::value::has_string_field, true);
+            Configuration::proveKeyPresence(groupObj, sRestBaseUrlKey, &wj::value::has_array_field, true);
+            Configuration::proveKeyPresence(groupObj, sSystemIdKey, &wj::value::has_string_field, true);
+
+            std::vector<ut::string_t> urls;
+            for (const wj::value& url : groupObj.at(sRestBaseUrlKey).as_array())
+               urls.push_back(url.as_string());
+            if (urls.empty())
+               throw wj::json_exception("The routing group has to contain at least one restBaseUrl");
+
+            EndpointGroup::balancing balance = defaultBalancing;
+            if (groupObj.has_string_field(sBalancingKey))
+               balance = EndpointGroup::parseBalancing(groupObj.at(sBalancingKey).as_string());
+
+            table->mGroups.push_back(std::make_shared<EndpointGroup>(groupObj.at(sNameKey).as_string(), groupObj.at(sSystemIdKey).as_string(), urls, balance));
+         }
+      }
+
+      if (routingObj->has_array_field(sRoutesKey))
+      {
+         for (const wj::value& routeObj : routingObj->at(sRoutesKey).as_array())
+         {
+            Configuration::proveKeyPresence(routeObj, sAccountPatternKey, &wj::value::has_string_field, true);
+            Configuration::proveKeyPresence(routeObj, sGroupKey, &wj::value::has_string_field, true);
+            const ut::string_t& groupName = routeObj.at(sGroupKey).as_string();
+
+            auto it = std::find_if(table->mGroups.begin(), table->mGroups.end(), [&groupName](const std::shared_ptr<const EndpointGroup>& group)
+               {
+                  return group->getName() == groupName;
+               });
+            if (it == table->mGroups.end())
+            {
+               std::string msg = Logger::formatMessage("The route refers to an unknown group \"%s\"", Logger::w2s(groupName).c_str());
+               throw wj::json_exception(msg.c_str());
+            }
+            const ut::string_t& pattern = routeObj.at(sAccountPatternKey).as_string();
+            if (pattern.find_first_of(U("\\@")) != ut::string_t::npos)
+            {
+               std::string msg = Logger::formatMessage("The route pattern \"%s\" contains a domain, the filter gets the SAM account name only",
+                  Logger::w2s(pattern).c_str());
+               throw wj::json_exception(msg.c_str());
+            }
+            table->mRoutes.push_back(Route{ pattern, *it });
+         }
+      }
+   }
+
+   table->mDefaultGroup = std::make_shared<EndpointGroup>(U("default"), defaultSystemId, defaultRestBaseUrlVec, defaultBalancing);
+   return table;
+}
+
+const EndpointGroup& RoutingTable::resolve(const ut::string_t& accountName) const
+{
+   for (const Route& route : mRoutes)
+   {
+      if (matchPattern(route.mAccountPattern, accountName))
+         return *route.mGroup;
+   }
+   return *mDefaultGroup;
+}
+
+void RoutingTable::printContent() const
+{
+   auto printGroup = [](const EndpointGroup& group)
+   {
+      gLogger.log(Logger::DEBUG(), "routing group %s: systemId: %s, balancing: %s", Logger::w2s(group.getName()).c_str(),
+         Logger::w2s(group.getSystemId()).c_str(), EndpointGroup::getBalancingName(group.getBalancing()));
+      for (const ut::string_t& url : group.getRestBaseUrlVec())
+         gLogger.log(Logger::DEBUG(), "routing group %s: %s", Logger::w2s(group.getName()).c_str(), Logger::w2s(url).c_str());
+   };
+
+   printGroup(*mDefaultGroup);
+   for (const auto& group : mGroups)
+      printGroup(*group);
+   for (const Route& route : mRoutes)
+      gLogger.log(Logger::DEBUG(), "routing route: %s -> %s", Logger::w2s(route.mAccountPattern).c_str(), Logger::w2s(route.mGroup->getName()).c_str());
+}
+
+/**
+* matchPattern is a case insensitive wildcard match. '*' matches any sequence, '?' matches one character.
+* LSA passes the SAM account name only, so the patterns match e.g. "svc_*", never a domain or an UPN suffix.
+*/
+bool RoutingTable::matchPattern(const ut::string_t& pattern, const ut::string_t& str)
+{
+   size_t p = 0, s = 0;
+   size_t starP = ut::string_t::npos, starS = 0;
+   while (s < str.size())
+   {
+      if (p < pattern.size() && (pattern[p] == U('?') || std::towlower(pattern[p]) == std::towlower(str[s])))
+      {
+         ++p;
+         ++s;
+      }
+      else if (p < pattern.size() && pattern[p] == U('*'))
+      {
+         starP = p++;
+         starS = s;
+      }
+      else if (starP != ut::string_t::npos)
+      {
+         p = starP + 1;
+         s = ++starS;
+      }
+      else
+         return false;
+   }
+   while (p < pattern.size() && pattern[p] == U('*'))
+      ++p;
+   return p == pattern.size();
+}
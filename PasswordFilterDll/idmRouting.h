@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cpprest/json.h>
+
+namespace ut = utility;
+namespace wj = web::json;
+
+
+/**
+* EndpointGroup is a set of IdM base urls serving one IdM instance (cluster) together with its systemId.
+* The group decides in which order its endpoints are tried for the particular account.
+*/
+class EndpointGroup
+{
+public:
+   enum balancing
+   {
+      BALANCE_FAILOVER,          // endpoints are tried in the configured order
+      BALANCE_HASH,              // rendezvous (consistent) hashing on the account name
+      BALANCE_LEAST_OUTSTANDING  // endpoint with the least requests in flight goes first
+   };
+
+private:
+   ut::string_t mName;
+   ut::string_t mSystemId;
+   std::vector<ut::string_t> mRestBaseUrlVec;
+   std::vector<uint64_t> mUrlHashVec;
+   balancing mBalancing = BALANCE_FAILOVER;
+   std::unique_ptr<std::atomic<uint32_t>[]> mOutstanding;
+
+public:
+   EndpointGroup(const ut::string_t& name, const ut::string_t& systemId, const std::vector<ut::string_t>& restBaseUrlVec, balancing balance);
+
+   const ut::string_t& getName() const { return mName; }
+   const ut::string_t& getSystemId() const { return mSystemId; }
+   const std::vector<ut::string_t>& getRestBaseUrlVec() const { return mRestBaseUrlVec; }
+   balancing getBalancing() const { return mBalancing; }
+
+   std::vector<size_t> getEndpointOrder(const ut::string_t& accountName) const;
+   void requestStarted(size_t endpointIdx) const;
+   void requestFinished(size_t endpointIdx) const;
+   uint32_t getOutstanding(size_t endpointIdx) const;
+
+   static balancing parseBalancing(const ut::string_t& name);
+   static const char* getBalancingName(balancing balance);
+   static uint64_t hashString(const ut::string_t& str, bool caseInsensitive);
+};
+
+/**
+* OutstandingRequestGuard counts a request in flight to the endpoint for its whole lifetime.
+*/
+class OutstandingRequestGuard
+{
+private:
+   const EndpointGroup& mGroup;
+   size_t mEndpointIdx;
+
+public:
+   OutstandingRequestGuard(const EndpointGroup& group, size_t endpointIdx) : mGroup(group), mEndpointIdx(endpointIdx) { mGroup.requestStarted(mEndpointIdx); }
+   ~OutstandingRequestGuard() { mGroup.requestFinished(mEndpointIdx); }
+   OutstandingRequestGuard(const OutstandingRequestGuard&) = delete;
+   OutstandingRequestGuard& operator=(const OutstandingRequestGuard&) = delete;
+};
+
+/**
+* RoutingTable maps account names to endpoint groups.
+* Routes are evaluated in the configured order, the first matching pattern wins.
+* Accounts matching no route are served by the default group built from the top level
+* restBaseUrl and systemId configuration items.
+* The table is immutable once built, a configuration reload replaces it as a whole.
+*/
+class RoutingTable
+{
+private:
+   // JSON keys
+   static inline const ut::string_t sGroupsKey{ U("groups") };
+   static inline const ut::string_t sRoutesKey{ U("routes") };
+   static inline const ut::string_t sNameKey{ U("name") };
+   static inline const ut::string_t sRestBaseUrlKey{ U("restBaseUrl") };
+   static inline const ut::string_t sSystemIdKey{ U("systemId") };
+   static inline const ut::string_t sBalancingKey{ U("balancing") };
+   static inline const ut::string_t sDefaultBalancingKey{ U("defaultBalancing") };
+   static inline const ut::string_t sAccountPatternKey{ U("accountPattern") };
+   static inline const ut::string_t sGroupKey{ U("group") };
+
+   struct Route
+   {
+      ut::string_t mAccountPattern;
+      std::shared_ptr<const EndpointGroup> mGroup;
+   };
+
+   std::vector<std::shared_ptr<const EndpointGroup>> mGroups;
+   std::vector<Route> mRoutes;
+   std::shared_ptr<const EndpointGroup> mDefaultGroup;
+
+public:
+   static std::shared_ptr<const RoutingTable> create(const wj::value* routingObj, const ut::string_t& defaultSystemId, const std::vector<ut::string_t>& defaultRestBaseUrlVec);
+
+   const EndpointGroup& resolve(const ut::string_t& accountName) const;
+   const EndpointGroup& getDefaultGroup() const { return *mDefaultGroup; }
+   const std::vector<std::shared_ptr<const EndpointGroup>>& getGroups() const { return mGroups; }
+   void printContent() const;
+
+   static bool matchPattern(const ut::string_t& pattern, const ut::string_t& str);
+};
@@ -0,0 +1,90 @@
+#include "pch.h"
+#include <winhttp.h>
+#include "idmTransport.h"
+
+#pragma comment(lib, "Winhttp.lib")
+
+// WinHTTP of Windows 10 1607 and newer, older systems ignore the option and stay on HTTP/1.1
+#ifndef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+#define WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL 147
+#endif
+#ifndef WINHTTP_PROTOCOL_FLAG_HTTP2
+#define WINHTTP_PROTOCOL_FLAG_HTTP2 0x1
+#endif
+
+
+///////////////// IdmTransport //////////////////////////////
+
+IdmTransport::IdmTransport(uint32_t timeoutMs, bool validateCertificates, bool http2)
+   : mHttp2(http2)
+{
+   mClientConfig.set_timeout(std::chrono::milliseconds(timeoutMs));
+   mClientConfig.set_validate_certificates(validateCertificates);
+   if (mHttp2)
+   {
+      mClientConfig.set_nativehandle_options([](wh::client::native_handle handle)
+         {
+            DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+            WinHttpSetOption(handle, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols, sizeof(protocols));
+         });
+   }
+}
+
+/**
+* create builds the transport from the "transport" configuration object.
+* Missing object or missing items keep the cpprest backend, http2 is enabled by default for the shared backend.
+*/
+std::shared_ptr<const IdmTransport> IdmTransport::create(const wj::value* transportObj, uint32_t timeoutMs, bool validateCertificates)
+{
+   bool shared = false;
+   if (transportObj != nullptr && transportObj->has_string_field(sBackendKey))
+   {
+      const std::string name = ut::conversions::to_utf8string(transportObj->at(sBackendKey).as_string());
+      if (name == SharedClientTransport::sName)
+         shared = true;
+      else if (name != CpprestTransport::sName)
+         throw wj::json_exception("the transport backend has to be cpprest or shared");
+   }
+   bool http2 = shared;
+   if (transportObj != nullptr && transportObj->has_boolean_field(sHttp2Key))
+      http2 = transportObj->at(sHttp2Key).as_bool();
+
+   if (shared)
+      return std::make_shared<SharedClientTransport>(timeoutMs, validateCertificates, http2);
+   return std::make_shared<CpprestTransport>(timeoutMs, validateCertificates, http2);
+}
+
+std::string IdmTransport::describe() const
+{
+   return std::string("backend: ") + getName() + ", http2: " + (mHttp2 ? "true" : "false");
+}
+
+///////////////// CpprestTransport //////////////////////////////
+
+pplx::task<wh::http_response> CpprestTransport::send(const wh::uri& url, wh::http_request request) const
+{
+   wh::client::http_client client(url, mClientConfig);
+   return client.request(request);
+}
+
+///////////////// SharedClientTransport //////////////////////////////
+
+pplx::task<wh::http_response> SharedClientTransport::send(const wh::uri& url, wh::http_request request) const
+{
+   request.set_request_uri(url.resource());
+   return getClient(url)->request(request);
+}
+
+/**
+* getClient returns the client of the url authority, it is created by the first request.
+* A running request keeps its connection alive by itself, the map just keeps the clients for the next ones.
+*/
+std::shared_ptr<wh::client::http_client> SharedClientTransport::getClient(const wh::uri& url) const
+{
+   const ut::string_t authority = url.authority().to_string();
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto& client = mClients[authority];
+   if (!client)
+      client = std::make_shared<wh::client::http_client>(url.authority(), mClientConfig);
+   return client;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cpprest/http_client.h>
+#include <cpprest/json.h>
+
+namespace wh = web::http;
+namespace wj = web::json;
+namespace ut = utility;
+
+
+/**
+* IdmTransport sends the requests of IdmRestComm, the implementation is selected by "backend" of the "transport"
+* configuration object (see CpprestTransport and SharedClientTransport).
+* The transport is immutable, a configuration reload replaces it as a whole and drops the shared connections.
+* It doesn't depend on the logger, the App compiles it too.
+*/
+class IdmTransport
+{
+private:
+   // JSON keys
+   static inline const ut::string_t sBackendKey{ U("backend") };
+   static inline const ut::string_t sHttp2Key{ U("http2") };
+
+protected:
+   bool mHttp2 = false;
+   wh::client::http_client_config mClientConfig;
+
+   IdmTransport(uint32_t timeoutMs, bool validateCertificates, bool http2);
+
+public:
+   virtual ~IdmTransport() = default;
+   static std::shared_ptr<const IdmTransport> create(const wj::value* transportObj, uint32_t timeoutMs, bool validateCertificates); // throws wj::json_exception
+
+   /**
+   * send sends the request to the absolute url, the returned task completes with the response headers.
+   */
+   virtual pplx::task<wh::http_response> send(const wh::uri& url, wh::http_request request) const = 0;
+   virtual const char* getName() const = 0;
+   bool getHttp2() const { return mHttp2; }
+   std::string describe() const;
+};
+
+/**
+* CpprestTransport creates a new client for every request, so every attempt opens a new connection (the previous behavior).
+*/
+class CpprestTransport final : public IdmTransport
+{
+public:
+   static constexpr const char* sName = "cpprest";
+
+   CpprestTransport(uint32_t timeoutMs, bool validateCertificates, bool http2) : IdmTransport(timeoutMs, validateCertificates, http2) {}
+   pplx::task<wh::http_response> send(const wh::uri& url, wh::http_request request) const override;
+   const char* getName() const override { return sName; }
+};
+
+/**
+* SharedClientTransport keeps one client per endpoint for the life of the configuration. WinHTTP keeps its connections
+* alive and, with http2 enabled, negotiates HTTP/2 by ALPN, so the concurrent requests to the endpoint are multiplexed
+* over one TLS connection. A server without HTTP/2 is served by HTTP/1.1 keep-alive connections.
+*/
+class SharedClientTransport final : public IdmTransport
+{
+private:
+   mutable std::mutex mMutex; // guards mClients
+   mutable std::unordered_map<ut::string_t, std::shared_ptr<wh::client::http_client>> mClients; // by scheme://host:port
+
+   std::shared_ptr<wh::client::http_client> getClient(const wh::uri& url) const;
+
+public:
+   static constexpr const char* sName = "shared";
+
+   SharedClientTransport(uint32_t timeoutMs, bool validateCertificates, bool http2) : IdmTransport(timeoutMs, validateCertificates, http2) {}
+   pplx::task<wh::http_response> send(const wh::uri& url, wh::http_request request) const override;
+   const char* getName() const override { return sName; }
+};
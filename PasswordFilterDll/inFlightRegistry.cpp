@@ -0,0 +1,40 @@
+#include "pch.h"
+#include <algorithm>
+#include "inFlightRegistry.h"
+
+
+InFlightRegistry::Scope::Scope(InFlightRegistry& registry, const char* entryPoint, const std::string& sessionId, const ut::string_t& accountName)
+   : mRegistry(registry)
+{
+   Entry entry;
+   entry.mEntryPoint = entryPoint;
+   entry.mSessionId = sessionId;
+   entry.mAccountName = accountName;
+   entry.mStart = std::chrono::steady_clock::now();
+
+   std::lock_guard<std::mutex> lock(mRegistry.mMutex);
+   mId = mRegistry.mNextId++;
+   mRegistry.mEntries.emplace(mId, std::move(entry));
+}
+
+InFlightRegistry::Scope::~Scope()
+{
+   std::lock_guard<std::mutex> lock(mRegistry.mMutex);
+   mRegistry.mEntries.erase(mId);
+}
+
+/**
+* getSnapshot returns the calls in flight, the oldest first.
+*/
+std::vector<InFlightRegistry::Entry> InFlightRegistry::getSnapshot()
+{
+   std::vector<Entry> entries;
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      entries.reserve(mEntries.size());
+      for (const auto& item : mEntries)
+         entries.push_back(item.second);
+   }
+   std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mStart < b.mStart; });
+   return entries;
+}
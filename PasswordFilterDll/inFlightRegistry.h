@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cpprest/json.h>
+
+namespace ut = utility;
+
+
+/**
+* InFlightRegistry keeps the entry point calls which are currently being processed.
+* It is read by the control channel only, a call pays for one short uncontended lock at its start and end.
+*/
+class InFlightRegistry
+{
+public:
+   struct Entry
+   {
+      const char* mEntryPoint = "";
+      std::string mSessionId;
+      ut::string_t mAccountName;
+      std::chrono::steady_clock::time_point mStart;
+   };
+
+   /**
+   * Scope registers the call for its whole lifetime.
+   */
+   class Scope
+   {
+   private:
+      InFlightRegistry& mRegistry;
+      uint64_t mId;
+
+   public:
+      Scope(InFlightRegistry& registry, const char* entryPoint, const std::string& sessionId, const ut::string_t& accountName);
+      ~Scope();
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+   };
+
+private:
+   std::mutex mMutex;
+   uint64_t mNextId = 0;
+   std::unordered_map<uint64_t, Entry> mEntries;
+
+public:
+   std::vector<Entry> getSnapshot();
+};
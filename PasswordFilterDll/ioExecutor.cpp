@@ -0,0 +1,88 @@
+#include "pch.h"
+#include <algorithm>
+#include <sstream>
+#include "ioExecutor.h"
+
+
+IoExecutor::~IoExecutor()
+{
+   // the process is going down, the threads may be running a task
+   for (std::thread& thread : mThreads)
+   {
+      if (thread.joinable())
+         thread.detach();
+   }
+}
+
+/**
+* schedule queues the task for the pool, the pool is started by the first one.
+*/
+void IoExecutor::schedule(pplx::TaskProc_t proc, void* param)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mThreads.empty())
+   {
+      for (size_t i = 0; i < sThreadCount; ++i)
+         mThreads.emplace_back([this, i]() { run(i); });
+   }
+   mQueue.push_back(Item{ proc, param, std::chrono::steady_clock::now() });
+   mPeakQueueDepth = std::max(mPeakQueueDepth, mQueue.size());
+   mCondition.notify_one();
+}
+
+void IoExecutor::run(size_t threadNo)
+{
+   nameCurrentThread(L"PasswordFilter I/O #" + std::to_wstring(threadNo + 1));
+
+   std::unique_lock<std::mutex> lock(mMutex);
+   while (true)
+   {
+      mCondition.wait(lock, [this]() { return !mQueue.empty(); });
+      Item item = mQueue.front();
+      mQueue.pop_front();
+      uint64_t waitUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - item.mQueued).count());
+      mMaxQueueWaitUs = std::max(mMaxQueueWaitUs, waitUs);
+      ++mBusy;
+      lock.unlock();
+
+      item.mProc(item.mParam); // the task runtime catches the exceptions of the task itself
+
+      lock.lock();
+      --mBusy;
+      ++mExecuted;
+   }
+}
+
+/**
+* nameCurrentThread names the thread for debuggers and ETW. SetThreadDescription is looked up at run time,
+* the systems older than Windows 10 1607 don't have it.
+*/
+void IoExecutor::nameCurrentThread(const std::wstring& name)
+{
+   using setThreadDescription = HRESULT(WINAPI*)(HANDLE, PCWSTR);
+   static const auto setDescription = reinterpret_cast<setThreadDescription>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+   if (setDescription != nullptr)
+      setDescription(GetCurrentThread(), name.c_str());
+}
+
+IoExecutor::Metrics IoExecutor::getMetrics()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   Metrics metrics;
+   metrics.mThreads = mThreads.size();
+   metrics.mQueueDepth = mQueue.size();
+   metrics.mPeakQueueDepth = mPeakQueueDepth;
+   metrics.mBusy = mBusy;
+   metrics.mExecuted = mExecuted;
+   metrics.mMaxQueueWaitUs = mMaxQueueWaitUs;
+   return metrics;
+}
+
+std::string IoExecutor::describe()
+{
+   Metrics metrics = getMetrics();
+   std::ostringstream out;
+   out << "io executor: " << metrics.mThreads << " threads, " << metrics.mBusy << " busy, queue depth " << metrics.mQueueDepth
+      << " (peak " << metrics.mPeakQueueDepth << "), " << metrics.mExecuted << " tasks, longest queue wait " << metrics.mMaxQueueWaitUs << " us\n";
+   return out.str();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pplx/pplxtasks.h>
+
+
+/**
+* IoExecutor runs the continuations of the IdM requests (response reading and parsing, retries, the next attempt)
+* and the IdM probe of the offline mode on a small fixed pool of named threads owned by the filter,
+* so they neither wait for nor occupy the default task pool shared by everything else in LSASS.
+* The tasks get it by getTaskOptions(), a continuation without options inherits it from its antecedent.
+* The threads are started by the first task, not under the loader lock, and live as long as the process.
+*/
+class IoExecutor : public pplx::scheduler_interface
+{
+public:
+   static constexpr size_t sThreadCount = 4;
+
+   struct Metrics
+   {
+      size_t mThreads = 0;
+      size_t mQueueDepth = 0;
+      size_t mPeakQueueDepth = 0;
+      size_t mBusy = 0; // threads running a task
+      uint64_t mExecuted = 0;
+      uint64_t mMaxQueueWaitUs = 0;
+   };
+
+private:
+   struct Item
+   {
+      pplx::TaskProc_t mProc;
+      void* mParam;
+      std::chrono::steady_clock::time_point mQueued;
+   };
+
+   std::mutex mMutex; // guards everything below
+   std::condition_variable mCondition;
+   std::deque<Item> mQueue;
+   std::vector<std::thread> mThreads;
+   size_t mPeakQueueDepth = 0;
+   size_t mBusy = 0;
+   uint64_t mExecuted = 0;
+   uint64_t mMaxQueueWaitUs = 0;
+
+   void run(size_t threadNo);
+
+public:
+   IoExecutor() {}
+   ~IoExecutor();
+   IoExecutor(const IoExecutor&) = delete;
+   IoExecutor& operator=(const IoExecutor&) = delete;
+   void schedule(pplx::TaskProc_t proc, void* param) override;
+   pplx::task_options getTaskOptions() { return pplx::task_options(pplx::scheduler_ptr(this)); }
+   Metrics getMetrics();
+   std::string describe();
+   static void nameCurrentThread(const std::wstring& name);
+};
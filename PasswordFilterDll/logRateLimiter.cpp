@@ -0,0 +1,61 @@
+#include "pch.h"
+#include <algorithm>
+#include "logRateLimiter.h"
+
+
+void LogRateLimiter::reconfigure(uint32_t burst, uint32_t windowSec)
+{
+   mBurst.store(burst, std::memory_order_relaxed);
+   mWindowSec.store(std::max(1u, windowSec), std::memory_order_relaxed);
+}
+
+/**
+* admit decides whether the message may be written to the sink.
+* Summaries of the templates whose window has ended are appended to summaries, they are looked for
+* on every sweep period, so the summary comes even if the template is never logged again.
+*/
+bool LogRateLimiter::admit(const char* fmt, int level, std::chrono::steady_clock::time_point now, std::vector<Summary>& summaries)
+{
+   uint32_t burst = mBurst.load(std::memory_order_relaxed);
+   std::chrono::seconds window(mWindowSec.load(std::memory_order_relaxed));
+
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (now - mLastSweep >= sSweepPeriod)
+      sweep(now, window, summaries);
+
+   auto found = mStates.find(fmt);
+   if (found == mStates.end())
+      found = mStates.emplace(fmt, State()).first;
+   State& state = found->second;
+   state.mLevel = level;
+   if (state.mCount == 0 || now - state.mWindowStart >= window)
+   {
+      if (state.mSuppressed > 0)
+         summaries.push_back({ found->first, level, state.mSuppressed });
+      state.mWindowStart = now;
+      state.mCount = 0;
+      state.mSuppressed = 0;
+   }
+
+   ++state.mCount;
+   if (burst == 0 || state.mCount <= burst)
+      return true;
+
+   ++state.mSuppressed;
+   return false;
+}
+
+void LogRateLimiter::sweep(std::chrono::steady_clock::time_point now, std::chrono::seconds window, std::vector<Summary>& summaries)
+{
+   mLastSweep = now;
+   for (auto& item : mStates)
+   {
+      State& state = item.second;
+      if (state.mSuppressed == 0 || now - state.mWindowStart < window)
+         continue;
+
+      summaries.push_back({ item.first, state.mLevel, state.mSuppressed });
+      state.mCount = 0;
+      state.mSuppressed = 0;
+   }
+}
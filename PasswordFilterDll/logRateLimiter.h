@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+* LogRateLimiter limits how many messages of one template get to one log sink within a time window.
+* The template is the format string passed to Logger::log, so it identifies the call site; it's copied,
+* so a format built at run time works too, though every distinct text is its own template.
+* Messages over the budget are only counted. When the window of a template with suppressed messages ends,
+* admit() hands over a summary which has to be written instead.
+* A burst of 0 switches the limiting off.
+*/
+class LogRateLimiter
+{
+public:
+   struct Summary
+   {
+      std::string mTemplate;
+      int mLevel = 0;
+      uint64_t mSuppressed = 0;
+   };
+
+private:
+   struct State
+   {
+      std::chrono::steady_clock::time_point mWindowStart;
+      uint32_t mCount = 0;
+      uint64_t mSuppressed = 0;
+      int mLevel = 0;
+   };
+
+   static constexpr std::chrono::seconds sSweepPeriod{ 1 };
+
+   std::atomic<uint32_t> mBurst;
+   std::atomic<uint32_t> mWindowSec;
+   std::mutex mMutex;
+   std::unordered_map<std::string, State> mStates; // bounded by the number of call sites
+   std::chrono::steady_clock::time_point mLastSweep;
+
+   void sweep(std::chrono::steady_clock::time_point now, std::chrono::seconds window, std::vector<Summary>& summaries);
+
+public:
+   LogRateLimiter(uint32_t burst, uint32_t windowSec) : mBurst(burst), mWindowSec(windowSec) {}
+   void reconfigure(uint32_t burst, uint32_t windowSec);
+   bool admit(const char* fmt, int level, std::chrono::steady_clock::time_point now, std::vector<Summary>& summaries);
+   uint32_t getWindowSec() const { return mWindowSec.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,211 @@
+#include "pch.h"
+#include <algorithm>
+#include <stdexcept>
+#include <compressapi.h>
+#include "logSegment.h"
+
+#pragma comment(lib, "Cabinet.lib")
+
+namespace fs = std::filesystem;
+
+
+namespace
+{
+   /**
+   * FileHandle closes the handle when it goes out of scope.
+   */
+   class FileHandle
+   {
+   private:
+      HANDLE mHandle;
+   public:
+      FileHandle(HANDLE handle) : mHandle(handle) {}
+      ~FileHandle() { if (mHandle != INVALID_HANDLE_VALUE) CloseHandle(mHandle); }
+      FileHandle(const FileHandle&) = delete;
+      FileHandle& operator=(const FileHandle&) = delete;
+      HANDLE get() const { return mHandle; }
+   };
+
+   std::vector<unsigned char> readFile(const fs::path& path, uint64_t offset, uint64_t maxSize)
+   {
+      // the appender keeps the active segment open for writing
+      FileHandle file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+      if (file.get() == INVALID_HANDLE_VALUE)
+         throw std::runtime_error("the file " + path.string() + " can't be opened, error " + std::to_string(GetLastError()));
+
+      LARGE_INTEGER size{};
+      if (!GetFileSizeEx(file.get(), &size))
+         throw std::runtime_error("the size of the file " + path.string() + " can't be read, error " + std::to_string(GetLastError()));
+      uint64_t available = static_cast<uint64_t>(size.QuadPart) > offset ? static_cast<uint64_t>(size.QuadPart) - offset : 0;
+      std::vector<unsigned char> data(static_cast<size_t>(std::min(available, maxSize)));
+
+      LARGE_INTEGER position{};
+      position.QuadPart = static_cast<LONGLONG>(offset);
+      if (!SetFilePointerEx(file.get(), position, nullptr, FILE_BEGIN))
+         throw std::runtime_error("the file " + path.string() + " can't be read, error " + std::to_string(GetLastError()));
+      size_t done = 0;
+      while (done < data.size())
+      {
+         DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - done, 1 << 30));
+         DWORD read = 0;
+         if (!ReadFile(file.get(), data.data() + done, chunk, &read, nullptr) || read == 0)
+            break;
+         done += read;
+      }
+      data.resize(done);
+      return data;
+   }
+
+   LogSegment::Header readHeader(const fs::path& path)
+   {
+      std::vector<unsigned char> bytes = readFile(path, 0, LogSegment::sHeaderSize);
+      LogSegment::Header header{};
+      if (bytes.size() < LogSegment::sHeaderSize)
+         throw std::runtime_error("the segment " + path.string() + " is truncated");
+      memcpy(&header, bytes.data(), LogSegment::sHeaderSize);
+      if (memcmp(header.mMagic, LogSegment::sMagic, sizeof(LogSegment::sMagic)) != 0)
+         throw std::runtime_error("the file " + path.string() + " is not a log segment");
+      return header;
+   }
+}
+
+fs::path LogSegment::getPath(const fs::path& folder, const std::wstring& baseName, uint64_t sequence, bool compressed)
+{
+   wchar_t sequenceText[32];
+   swprintf_s(sequenceText, L"%010llu", static_cast<unsigned long long>(sequence));
+   fs::path path = folder;
+   path.append(baseName + L"." + sequenceText + (compressed ? sCompressedExtension : sActiveExtension));
+   return path;
+}
+
+/**
+* list returns the segments of the folder ordered by the sequence; a segment present in both forms
+* (the compression has been interrupted) is listed once, as the active one.
+*/
+std::vector<LogSegment::FileInfo> LogSegment::list(const fs::path& folder, const std::wstring& baseName)
+{
+   std::vector<FileInfo> segments;
+   std::error_code ec;
+   const std::wstring prefix = baseName + L".";
+   for (const auto& entry : fs::directory_iterator(folder, ec))
+   {
+      std::wstring name = entry.path().filename().native();
+      if (name.compare(0, prefix.size(), prefix) != 0)
+         continue;
+
+      FileInfo info;
+      std::wstring rest = name.substr(prefix.size());
+      size_t dot = rest.find(L'.');
+      if (dot == std::wstring::npos || dot == 0 || rest.find_first_not_of(L"0123456789") != dot)
+         continue;
+      std::wstring extension = rest.substr(dot);
+      if (extension == sCompressedExtension)
+         info.mCompressed = true;
+      else if (extension != sActiveExtension)
+         continue;
+      info.mPath = entry.path();
+      info.mSequence = std::stoull(rest.substr(0, dot));
+      segments.push_back(info);
+   }
+
+   std::sort(segments.begin(), segments.end(), [](const FileInfo& a, const FileInfo& b)
+      {
+         return a.mSequence != b.mSequence ? a.mSequence < b.mSequence : a.mCompressed < b.mCompressed;
+      });
+   segments.erase(std::unique(segments.begin(), segments.end(), [](const FileInfo& a, const FileInfo& b) { return a.mSequence == b.mSequence; }), segments.end());
+   return segments;
+}
+
+/**
+* read returns the log lines of the segment starting at fromOffset (relative to the lines).
+* An active segment is read only up to its valid size, it can be read while the filter writes it.
+*/
+std::string LogSegment::read(const FileInfo& info, uint64_t fromOffset)
+{
+   if (info.mCompressed)
+   {
+      std::string text = decompress(readFile(info.mPath, 0, UINT64_MAX));
+      return fromOffset < text.size() ? text.substr(static_cast<size_t>(fromOffset)) : std::string();
+   }
+
+   Header header = readHeader(info.mPath);
+   if (fromOffset >= header.mDataSize)
+      return std::string();
+   std::vector<unsigned char> data = readFile(info.mPath, sHeaderSize + fromOffset, header.mDataSize - fromOffset);
+   return std::string(data.begin(), data.end());
+}
+
+/**
+* seal compresses the valid lines of a closed segment next to it and removes the segment.
+* An empty segment is just removed.
+*/
+void LogSegment::seal(const fs::path& segmentPath)
+{
+   Header header = readHeader(segmentPath);
+   std::error_code ec;
+   if (header.mDataSize > 0)
+   {
+      std::vector<unsigned char> data = readFile(segmentPath, sHeaderSize, header.mDataSize);
+      std::vector<unsigned char> compressed = compress(reinterpret_cast<const char*>(data.data()), data.size());
+
+      fs::path compressedPath = segmentPath;
+      compressedPath += L".xpr";
+      fs::path tmpPath = compressedPath;
+      tmpPath += L".tmp";
+      {
+         std::ofstream output(tmpPath, std::ios_base::binary | std::ios_base::trunc);
+         output.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+         output.close();
+         if (output.fail())
+            throw std::runtime_error("the compressed segment " + tmpPath.string() + " can't be written");
+      }
+      fs::rename(tmpPath, compressedPath, ec);
+      if (ec)
+         throw std::runtime_error("the compressed segment " + compressedPath.string() + " can't be created: " + ec.message());
+   }
+   fs::remove(segmentPath, ec);
+}
+
+std::vector<unsigned char> LogSegment::compress(const char* data, size_t size)
+{
+   COMPRESSOR_HANDLE compressor = nullptr;
+   if (!CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &compressor))
+      throw std::runtime_error("the compressor can't be created, error " + std::to_string(GetLastError()));
+
+   SIZE_T needed = 0;
+   std::vector<unsigned char> out;
+   BOOL done = Compress(compressor, data, size, nullptr, 0, &needed);
+   if (!done && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+   {
+      out.resize(needed);
+      done = Compress(compressor, data, size, out.data(), out.size(), &needed);
+   }
+   DWORD error = GetLastError();
+   CloseCompressor(compressor);
+   if (!done)
+      throw std::runtime_error("the segment can't be compressed, error " + std::to_string(error));
+   out.resize(needed);
+   return out;
+}
+
+std::string LogSegment::decompress(const std::vector<unsigned char>& data)
+{
+   DECOMPRESSOR_HANDLE decompressor = nullptr;
+   if (!CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &decompressor))
+      throw std::runtime_error("the decompressor can't be created, error " + std::to_string(GetLastError()));
+
+   SIZE_T needed = 0;
+   std::string out;
+   BOOL done = Decompress(decompressor, data.data(), data.size(), nullptr, 0, &needed);
+   if (!done && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+   {
+      out.resize(needed);
+      done = Decompress(decompressor, data.data(), data.size(), out.data(), out.size(), &needed);
+   }
+   DWORD error = GetLastError();
+   CloseDecompressor(decompressor);
+   if (!done)
+      throw std::runtime_error("the segment can't be decompressed, error " + std::to_string(error));
+   out.resize(needed);
+   return out;
+}
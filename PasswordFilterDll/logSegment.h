@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+/**
+* LogSegment describes the files of the segmented log storage written by SegmentedLogAppender
+* and read by "PasswordFilterApp logs". It doesn't depend on the logger, the App compiles it too.
+*
+* <base>.<sequence>.seg     - a segment being written (or left by a crash): Header followed by the UTF-8 log lines,
+*                             pre-allocated to the segment size, Header::mDataSize bytes of the lines are valid
+* <base>.<sequence>.seg.xpr - a sealed segment: the valid lines compressed by the Windows Compression API (XPRESS Huffman)
+* The sequence is zero padded, so the files sort in the order they were written.
+*/
+class LogSegment
+{
+public:
+   static constexpr char sMagic[8] = { 'P', 'W', 'F', 'L', 'O', 'G', '0', '1' };
+   static constexpr size_t sHeaderSize = 64;
+   static constexpr const wchar_t* sActiveExtension = L".seg";
+   static constexpr const wchar_t* sCompressedExtension = L".seg.xpr";
+
+   struct Header
+   {
+      char mMagic[8];
+      uint64_t mSequence;
+      int64_t mCreatedMs; // unix time
+      uint64_t mDataSize; // updated after every append
+      uint8_t mReserved[sHeaderSize - 32];
+   };
+
+   struct FileInfo
+   {
+      std::filesystem::path mPath;
+      uint64_t mSequence = 0;
+      bool mCompressed = false;
+   };
+
+   static std::filesystem::path getPath(const std::filesystem::path& folder, const std::wstring& baseName, uint64_t sequence, bool compressed);
+   static std::vector<FileInfo> list(const std::filesystem::path& folder, const std::wstring& baseName);
+   static std::string read(const FileInfo& info, uint64_t fromOffset = 0); // throws std::runtime_error
+   static void seal(const std::filesystem::path& segmentPath); // throws std::runtime_error
+   static std::vector<unsigned char> compress(const char* data, size_t size); // throws std::runtime_error
+   static std::string decompress(const std::vector<unsigned char>& data); // throws std::runtime_error
+};
+
+static_assert(sizeof(LogSegment::Header) == LogSegment::sHeaderSize, "the segment file layout must not change");
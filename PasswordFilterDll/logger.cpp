@@ -1,11 +1,23 @@
 #include "pch.h"
 #include <algorithm>
 #include "logger.h"
+#include "textCodec.h"
+#include "allocationAccounting.h"
+#include "processRole.h"
 
 
+/****Global objects****/
+extern ProcessRole gProcessRole;
+
 thread_local unsigned long Logger::sSessionId = 0;
+thread_local DebugSampling::mode Logger::sSessionDebug = DebugSampling::MODE_OFF;
 
-Logger::Logger()
+/**
+* Opens the log file and registers the event log source.
+* It is not done in the constructor because the global logger is constructed under the loader lock.
+* Messages logged before init() are dropped.
+*/
+void Logger::init()
 {
    readLoggerFileLocation();
    fs::path path(mLogFileFolder);
@@ -14,15 +26,22 @@ Logger::Logger()
    {
       fs::create_directories(path, errCode); // returns always false -> maybe a bug
    }
-   path.append(sLogFileName);
+   const std::wstring baseName = gProcessRole.decorate(sLogFileBaseName);
+   path.append(baseName + L".log");
 
    mFileAppender = std::make_unique<log4cpp::RollingFileAppender>("RollFileAppender", w2s(path.native()).c_str());
    log4cpp::PatternLayout* fileLayout = new log4cpp::PatternLayout; // log4cpp forces us to alloc Layout this way because Appender takes over its ownership
-   fileLayout->setConversionPattern("%d{%d-%m-%Y %H:%M:%S,%l} %p %c %m%n");
+   fileLayout->setConversionPattern(sFileLayoutPattern);
    mFileAppender->setLayout(fileLayout);
+   mSegmentAppender = std::make_unique<SegmentedLogAppender>("SegmentedLogAppender", path.parent_path(), baseName, gProcessRole.isLsass());
+   log4cpp::PatternLayout* segmentLayout = new log4cpp::PatternLayout;
+   segmentLayout->setConversionPattern(sFileLayoutPattern);
+   mSegmentAppender->setLayout(segmentLayout);
+   mEventAppender = std::make_unique<log4cpp::NTEventLogAppender>("NTEventLogAppender", sEventSourceName);
    mCategory.get().setPriority(mDefaultPriority);
    mCategory.get().addAppender(*mEventAppender.get()); // important to pass by ref -> doesn't passes ownership which is required
    mCategory.get().addAppender(*mFileAppender.get()); // important to pass by ref -> doesn't passes ownership which is required
+   mInitialized.store(true, std::memory_order_release);
    log(INFO(), "Logging initialized");
 }
 
@@ -43,6 +62,37 @@ void Logger::reconfigurePriority(const ut::string_t& priority)
    mCategory.get().setPriority(mDefaultPriority);
 }
 
+void Logger::reconfigureRateLimit(uint32_t windowSec, uint32_t fileBurst, uint32_t eventLogBurst)
+{
+   mFileLimiter.reconfigure(fileBurst, windowSec);
+   mEventLogLimiter.reconfigure(eventLogBurst, windowSec);
+}
+
+/**
+* reconfigureStorage switches the log file lines between the rolling file and the segmented storage.
+* The rolling file is used also while no segment can be created.
+*/
+void Logger::reconfigureStorage(bool segmented, uint32_t segmentSizeMb, uint32_t maxTotalMb, uint32_t maxAgeDays)
+{
+   if (isInitialized())
+      mSegmentAppender->reconfigure(segmented, segmentSizeMb, maxTotalMb, maxAgeDays);
+}
+
+/**
+* flush reopens the log file, so everything written so far is on the disk
+* and the file can be moved away by an external tool. The active log segment is flushed too.
+*/
+void Logger::flush()
+{
+   if (!isInitialized())
+      return;
+   {
+      std::lock_guard<std::mutex> lock(mFileMutex);
+      mFileAppender->reopen();
+   }
+   mSegmentAppender->reopen();
+}
+
 ut::string_t Logger::toUpperCase(const ut::string_t& str) const
 {
    ut::string_t out;
@@ -57,12 +107,28 @@ ut::string_t Logger::toUpperCase(const ut::string_t& str) const
    return out;
 }
 
-void Logger::createSessionId() const
+/**
+* createSessionId starts a new log session of the thread and decides once whether it is sampled for debugging.
+*/
+void Logger::createSessionId(const wchar_t* accountName, size_t length) const
 {
    std::random_device rd;
    std::mt19937 gen(rd());
    std::uniform_int_distribution<unsigned long> dis;
    sSessionId = dis(gen);
+   sSessionDebug = std::atomic_load(&mSampling)->decide(sSessionId, accountName, length);
+   if (sSessionDebug == DebugSampling::MODE_ON_ERROR)
+      mDebugBuffer.open(sSessionId);
+}
+
+/**
+* closeSession releases the lines kept for the session of the thread, the thread logs without sampling until its next session.
+*/
+void Logger::closeSession() const
+{
+   if (sSessionDebug == DebugSampling::MODE_ON_ERROR)
+      mDebugBuffer.close(sSessionId);
+   sSessionDebug = DebugSampling::MODE_OFF;
 }
 
 unsigned long Logger::getSessionIdValue() const
@@ -82,16 +148,28 @@ ut::string_t Logger::getSessionIdWide() const
 
 const std::string Logger::w2s(const ut::string_t& str)
 {
-   return uc::utf16_to_utf8(uc::to_utf16string(str));
+   return TextCodec::toUtf8(str);
 }
 
 const ut::string_t Logger::s2w(const std::string& str)
 {
-   return uc::to_string_t(str);
+   return TextCodec::toUtf16(str);
 }
 
 void Logger::log(lpl level, const char* fmt, ...)
 {
+   if (!isInitialized())
+      return;
+
+   bool sampled = false; // below logLevel, written for the sampled session only
+   if (!mCategory.get().isPriorityEnabled(level))
+   {
+      if (sSessionDebug == DebugSampling::MODE_OFF)
+         return;
+      sampled = true;
+   }
+
+   PWF_ALLOC_PHASE_SCOPE(AllocationStats::PHASE_LOGGING);
    va_list va;
    va_start(va, fmt);
    std::string msg = formatMessage(fmt, va);
@@ -100,7 +178,82 @@ void Logger::log(lpl level, const char* fmt, ...)
    std::string out = std::string("\tSessionId: ") + fmtSessionId + " ";
    out += msg;
    removeNewLine(out);
-   mCategory.get().log(level, out.c_str());
+
+   // the appenders are called directly (not through the category) because each of them has its own budget
+   auto now = std::chrono::steady_clock::now();
+   log4cpp::Appender& fileAppender = mSegmentAppender->isWritable() ? static_cast<log4cpp::Appender&>(*mSegmentAppender) : *mFileAppender;
+   if (sampled)
+   {
+      if (sSessionDebug == DebugSampling::MODE_ON_ERROR && mDebugBuffer.keep(sSessionId, formatKeptLine(out), std::atomic_load(&mSampling)->getBufferLines()))
+         return;
+      append(fileAppender, mFileLimiter, level, fmt, out, now); // the event log gets logLevel only
+      return;
+   }
+   if (sSessionDebug == DebugSampling::MODE_ON_ERROR && level <= lpl::WARN)
+   {  // the lines which led to the problem go first
+      for (const std::string& kept : mDebugBuffer.trigger(sSessionId))
+         write(fileAppender, log4cpp::LoggingEvent(mCategory.get().getName(), kept, log4cpp::NDC::get(), lpl::DEBUG));
+   }
+   append(fileAppender, mFileLimiter, level, fmt, out, now);
+   append(*mEventAppender, mEventLogLimiter, level, fmt, out, now);
+}
+
+/**
+* append writes the message to one appender if its rate limiter admits it,
+* preceded by the summaries of messages suppressed in the ended windows.
+* Messages below WARN are not limited, they are the regular per call trace.
+*/
+void Logger::append(log4cpp::Appender& appender, LogRateLimiter& limiter, lpl level, const char* fmt, const std::string& msg, std::chrono::steady_clock::time_point now)
+{
+   const std::string& categoryName = mCategory.get().getName();
+   if (level > lpl::WARN) // lower priority has higher value in log4cpp
+   {
+      write(appender, log4cpp::LoggingEvent(categoryName, msg, log4cpp::NDC::get(), level));
+      return;
+   }
+
+   std::vector<LogRateLimiter::Summary> summaries;
+   bool admitted = limiter.admit(fmt, level, now, summaries);
+   for (const LogRateLimiter::Summary& summary : summaries)
+   {
+      std::string summaryMsg = formatMessage("\tSessionId: %010u Suppressed %llu similar messages within %u s: %s", getSessionIdValue(),
+         static_cast<unsigned long long>(summary.mSuppressed), limiter.getWindowSec(), summary.mTemplate.c_str());
+      removeNewLine(summaryMsg);
+      write(appender, log4cpp::LoggingEvent(categoryName, summaryMsg, log4cpp::NDC::get(), summary.mLevel));
+   }
+   if (admitted)
+      write(appender, log4cpp::LoggingEvent(categoryName, msg, log4cpp::NDC::get(), level));
+}
+
+/**
+* write hands the event over to the appender. The category would serialize its appenders but it's bypassed,
+* so the rolling file and the event log are written under their own mutex. The segmented storage locks itself
+* and must not be wrapped: it may wait for its maintenance job, which logs too. A line the segmented storage
+* can't take (no segment can be created) goes to the rolling file.
+*/
+void Logger::write(log4cpp::Appender& appender, const log4cpp::LoggingEvent& event)
+{
+   if (&appender == mSegmentAppender.get() && mSegmentAppender->write(event))
+      return;
+   std::mutex& mutex = &appender == mEventAppender.get() ? mEventMutex : mFileMutex;
+   log4cpp::Appender& target = &appender == mEventAppender.get() ? *mEventAppender : *mFileAppender;
+   std::lock_guard<std::mutex> lock(mutex);
+   target.doAppend(event);
+}
+
+/**
+* formatKeptLine marks a line kept by SessionDebugBuffer with the time it has been logged, it is written later.
+*/
+std::string Logger::formatKeptLine(const std::string& msg)
+{
+   auto now = std::chrono::system_clock::now();
+   time_t seconds = std::chrono::system_clock::to_time_t(now);
+   tm local{};
+   localtime_s(&local, &seconds);
+   char time[16];
+   strftime(time, sizeof(time), "%H:%M:%S", &local);
+   auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+   return formatMessage("%s (kept from %s,%03lld)", msg.c_str(), time, static_cast<long long>(ms));
 }
 
 std::string Logger::formatMessage(const char* fmt, va_list va)
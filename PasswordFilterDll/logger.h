@@ -1,6 +1,8 @@
 #pragma once
 
 #include <time.h>
+#include <atomic>
+#include <mutex>
 #include <cpprest/filestream.h>
 
 #include "log4cpp/Category.hh"
@@ -14,6 +16,9 @@
 #include "log4cpp/NDC.hh"
 #include "log4cpp/PropertyConfigurator.hh"
 #include "log4cpp/NTEventLogAppender.hh"
+#include "logRateLimiter.h"
+#include "segmentedLogAppender.h"
+#include "debugSampling.h"
 
 
 namespace ut = utility;
@@ -22,34 +27,89 @@ namespace fs = std::filesystem;
 
 /**
 * Logger class encapsulates log4cpp library used for logging password filter
-* 
+* WARN and ERROR messages are rate limited per message template, separately for the log file and the event log,
+* so an IdM outage doesn't flood the (slow, synchronous) event log. Suppressed messages are reported by a summary.
+* The log file lines go either to the rolling text file or, when logStorage.segmented is configured, to the segmented storage.
+* The sessions selected by DebugSampling write their lines below logLevel to the log file too.
 */
 class Logger
 {
 public:
    using lpl = log4cpp::Priority::PriorityLevel;
+   static constexpr uint32_t sDefaultRateLimitWindowSec = 60;
+   static constexpr uint32_t sDefaultFileBurst = 50;
+   static constexpr uint32_t sDefaultEventLogBurst = 5;
+
+   /**
+   * Session is the log session of the thread, a continuation adopts the session of the call it serves.
+   */
+   struct Session
+   {
+      unsigned long mId = 0;
+      DebugSampling::mode mDebug = DebugSampling::MODE_OFF;
+   };
+
+   /**
+   * SessionScope is the log session of an entry point call, the session is closed when the call returns.
+   */
+   class SessionScope
+   {
+   private:
+      const Logger& mLogger;
+
+   public:
+      SessionScope(const Logger& logger, const wchar_t* accountName, size_t length) : mLogger(logger) { logger.createSessionId(accountName, length); }
+      ~SessionScope() { mLogger.closeSession(); }
+      SessionScope(const SessionScope&) = delete;
+      SessionScope& operator=(const SessionScope&) = delete;
+   };
 private:
    static inline const char* sLogFileEnvVar = "BCV_PWF_LOG_FILE_FOLDER";
    static inline const char* sLogFileLoc = "c:/CzechIdM/PasswordFilter/log/";
-   static inline const char* sLogFileName = "PasswordFilterLog.log";
+   static inline const wchar_t* sLogFileBaseName = L"PasswordFilterLog"; // decorated by ProcessRole
+   static inline const char* sFileLayoutPattern = "%d{%d-%m-%Y %H:%M:%S,%l} %p %c %m%n";
    static constexpr const char* sEventSourceName = "CzechIdMPasswordFilter";
    const lpl mDefaultPriority = log4cpp::Priority::PriorityLevel::DEBUG;
 
    thread_local static unsigned long sSessionId;
+   thread_local static DebugSampling::mode sSessionDebug;
    lpl mLogLevel = mDefaultPriority;
    std::reference_wrapper<log4cpp::Category> mCategory = std::ref(log4cpp::Category::getRoot());
-   std::unique_ptr<log4cpp::Appender> mEventAppender = std::make_unique<log4cpp::NTEventLogAppender>("NTEventLogAppender", sEventSourceName);
+   std::unique_ptr<log4cpp::Appender> mEventAppender;
    std::unique_ptr<log4cpp::Appender> mFileAppender;
+   std::unique_ptr<SegmentedLogAppender> mSegmentAppender;
+   std::mutex mEventMutex; // the log4cpp appenders aren't thread safe, each one is written by one thread at a time
+   std::mutex mFileMutex;
    std::string mLogFileFolder;
+   std::atomic<bool> mInitialized = false;
+   LogRateLimiter mFileLimiter{ sDefaultFileBurst, sDefaultRateLimitWindowSec };
+   LogRateLimiter mEventLogLimiter{ sDefaultEventLogBurst, sDefaultRateLimitWindowSec };
+   std::shared_ptr<const DebugSampling> mSampling = DebugSampling::create(nullptr); // accessed atomically, replaced as a whole on reload
+   mutable SessionDebugBuffer mDebugBuffer;
 
    ut::string_t toUpperCase(const ut::string_t& str) const;
+   void append(log4cpp::Appender& appender, LogRateLimiter& limiter, lpl level, const char* fmt, const std::string& msg, std::chrono::steady_clock::time_point now);
+   void write(log4cpp::Appender& appender, const log4cpp::LoggingEvent& event);
    void readLoggerFileLocation();
+   static std::string formatKeptLine(const std::string& msg);
 
 public:
-   Logger();
+   Logger() {};
+   void init();
+   bool isInitialized() const { return mInitialized.load(std::memory_order_acquire); }
    log4cpp::Category& operator() () { return mCategory; }
    void reconfigurePriority(const ut::string_t& priority);
-   void createSessionId() const;
+   void reconfigureRateLimit(uint32_t windowSec, uint32_t fileBurst, uint32_t eventLogBurst);
+   void reconfigureStorage(bool segmented, uint32_t segmentSizeMb, uint32_t maxTotalMb, uint32_t maxAgeDays);
+   void reconfigureSampling(std::shared_ptr<const DebugSampling> sampling) { std::atomic_store(&mSampling, sampling); }
+   void flush();
+   const std::string& getLogFileFolder() const { return mLogFileFolder; }
+   void createSessionId() const { createSessionId(nullptr, 0); }
+   void createSessionId(const wchar_t* accountName, size_t length) const; // the account is matched by DebugSampling
+   void closeSession() const;
+   Session getSession() const { return Session{ sSessionId, sSessionDebug }; }
+   void resumeSession(const Session& session) const { sSessionId = session.mId; sSessionDebug = session.mDebug; }
+   bool isEnabled(lpl level) const { return mCategory.get().isPriorityEnabled(level) || sSessionDebug != DebugSampling::MODE_OFF; } // guards costly arguments
    std::string getSessionId() const;
    ut::string_t getSessionIdWide() const;
    unsigned long getSessionIdValue() const;
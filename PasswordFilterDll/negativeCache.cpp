@@ -0,0 +1,97 @@
+#include "pch.h"
+#include <algorithm>
+#include "negativeCache.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+/**
+* reconfigure is called on every configuration (re)load, the cached entries are always dropped.
+*/
+void NegativeCache::reconfigure(bool enabled, uint32_t ttlSec, uint32_t maxEntries)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   mEnabled = enabled;
+   mTtl = std::chrono::seconds(ttlSec);
+   mMaxEntries = std::max(1u, maxEntries);
+   mOrder.clear();
+   mEntries.clear();
+}
+
+bool NegativeCache::contains(const ut::string_t& accountName, const ut::string_t& systemId)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (!mEnabled || mEntries.empty())
+      return false;
+
+   auto now = std::chrono::steady_clock::now();
+   evictExpired(now);
+   return mEntries.find(createKey(accountName, systemId)) != mEntries.end();
+}
+
+void NegativeCache::insert(const ut::string_t& accountName, const ut::string_t& systemId)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (!mEnabled)
+      return;
+
+   auto now = std::chrono::steady_clock::now();
+   ut::string_t key = createKey(accountName, systemId);
+   auto found = mEntries.find(key);
+   if (found != mEntries.end())
+   {
+      mOrder.erase(found->second.mOrderIt);
+      mEntries.erase(found);
+   }
+   while (mEntries.size() >= mMaxEntries)
+   {
+      mEntries.erase(mOrder.front());
+      mOrder.pop_front();
+   }
+   auto orderIt = mOrder.insert(mOrder.end(), key);
+   mEntries.emplace(std::move(key), Entry{ now + mTtl, orderIt });
+}
+
+void NegativeCache::invalidate()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mEntries.empty())
+      return;
+
+   gLogger.log(Logger::INFO(), "The negative cache has been invalidated, %zu entries dropped", mEntries.size());
+   mOrder.clear();
+   mEntries.clear();
+}
+
+size_t NegativeCache::getSize() const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mEntries.size();
+}
+
+ut::string_t NegativeCache::createKey(const ut::string_t& accountName, const ut::string_t& systemId)
+{
+   // account names are case insensitive in AD
+   ut::string_t key;
+   key.reserve(accountName.size() + systemId.size() + 1);
+   for (auto ch : accountName)
+      key.push_back(std::towlower(ch));
+   key.push_back(U('\n'));
+   key.append(systemId);
+   return key;
+}
+
+void NegativeCache::evictExpired(std::chrono::steady_clock::time_point now)
+{
+   while (!mOrder.empty())
+   {
+      auto found = mEntries.find(mOrder.front());
+      if (found != mEntries.end() && found->second.mExpiration > now)
+         break;
+      if (found != mEntries.end())
+         mEntries.erase(found);
+      mOrder.pop_front();
+   }
+}
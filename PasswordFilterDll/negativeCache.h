@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cpprest/json.h>
+
+namespace ut = utility;
+
+
+/**
+* NegativeCache remembers accounts which IdM doesn't manage, so their next password change is answered locally.
+* An entry is created when IdM answers 404 with PASSWORD_FILTER_IDENTITY_NOT_FOUND or PASSWORD_FILTER_DEFINITION_NOT_FOUND
+* and it is keyed by the account name (case insensitive) and the systemId the request was sent with.
+* - entries expire after ttlSec, the oldest entries are evicted above maxEntries
+* - the whole cache is dropped on every configuration (re)load and when IdM answers PASSWORD_FILTER_SYSTEM_NOT_FOUND,
+*   because then the mapping of the system itself has changed
+*/
+class NegativeCache
+{
+private:
+   struct Entry
+   {
+      std::chrono::steady_clock::time_point mExpiration;
+      std::list<ut::string_t>::iterator mOrderIt;
+   };
+
+   mutable std::mutex mMutex;
+   bool mEnabled = false;
+   std::chrono::seconds mTtl{ 300 };
+   size_t mMaxEntries = 50000;
+   std::list<ut::string_t> mOrder; // keys from the oldest to the newest insertion, all entries have the same ttl
+   std::unordered_map<ut::string_t, Entry> mEntries;
+
+   static ut::string_t createKey(const ut::string_t& accountName, const ut::string_t& systemId);
+   void evictExpired(std::chrono::steady_clock::time_point now);
+
+public:
+   void reconfigure(bool enabled, uint32_t ttlSec, uint32_t maxEntries);
+   bool contains(const ut::string_t& accountName, const ut::string_t& systemId);
+   void insert(const ut::string_t& accountName, const ut::string_t& systemId);
+   void invalidate();
+   size_t getSize() const;
+};
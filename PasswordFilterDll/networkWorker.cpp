@@ -0,0 +1,174 @@
+#include "pch.h"
+#include <algorithm>
+#include <sstream>
+#include "networkWorker.h"
+#include "passwordFilter.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+namespace
+{
+   /**
+   * Copies the string into the request, false when it doesn't fit.
+   */
+   bool copyString(PUNICODE_STRING source, wchar_t* target, uint16_t& length)
+   {
+      length = 0;
+      if (source == nullptr || source->Buffer == nullptr)
+         return true;
+      size_t chars = source->Length / sizeof(wchar_t);
+      if (chars > WorkerRequest::sMaxChars)
+         return false;
+      std::copy(source->Buffer, source->Buffer + chars, target);
+      length = static_cast<uint16_t>(chars);
+      return true;
+   }
+
+   UNICODE_STRING toUnicodeString(const wchar_t* buffer, uint16_t length)
+   {
+      UNICODE_STRING str;
+      str.Buffer = const_cast<wchar_t*>(buffer); // the entry points don't modify their arguments
+      str.Length = static_cast<USHORT>(length * sizeof(wchar_t));
+      str.MaximumLength = str.Length;
+      return str;
+   }
+}
+
+/**
+* reconfigure is called on every configuration (re)load, a change of the name reconnects the callers.
+* The worker itself keeps its name and threads until it's restarted.
+*/
+void NetworkWorker::reconfigure(bool enabled, const std::wstring& name, uint32_t deadlineMs, uint32_t threads)
+{
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (!mClient || mClient->getName() != name)
+         mClient = std::make_shared<WorkerChannel::Client>(name, true); // LSASS and the worker run as LocalSystem
+   }
+   mDeadlineMs.store(std::max(1u, deadlineMs));
+   mThreads.store(std::max(1u, threads));
+   mEnabled.store(enabled);
+}
+
+std::shared_ptr<WorkerChannel::Client> NetworkWorker::getClient() const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mClient;
+}
+
+WorkerChannel::result NetworkWorker::forward(WorkerRequest& request, WorkerResponse& response)
+{
+   std::shared_ptr<WorkerChannel::Client> client = getClient();
+   WorkerChannel::result result = client ? client->call(request, response, std::chrono::milliseconds(mDeadlineMs.load())) : WorkerChannel::RESULT_NO_WORKER;
+   SecureZeroMemory(request.mPassword, sizeof(request.mPassword));
+   if (result == WorkerChannel::RESULT_OK)
+      ++mForwarded;
+   else
+      ++mFallbacks;
+   return result;
+}
+
+WorkerChannel::result NetworkWorker::forwardPasswordFilter(PUNICODE_STRING accountName, PUNICODE_STRING fullName, PUNICODE_STRING password, BOOLEAN setOperation, BOOLEAN& decision)
+{
+   WorkerRequest request;
+   request.mKind = WorkerRequest::KIND_PASSWORD_FILTER;
+   request.mSessionId = static_cast<uint32_t>(gLogger.getSessionIdValue());
+   request.mSetOperation = setOperation ? 1 : 0;
+   if (!copyString(accountName, request.mAccountName, request.mAccountLength) || !copyString(fullName, request.mFullName, request.mFullNameLength) ||
+      !copyString(password, request.mPassword, request.mPasswordLength))
+   {
+      SecureZeroMemory(request.mPassword, sizeof(request.mPassword));
+      ++mFallbacks;
+      return WorkerChannel::RESULT_TOO_LONG;
+   }
+
+   WorkerResponse response;
+   WorkerChannel::result result = forward(request, response);
+   if (result == WorkerChannel::RESULT_OK)
+      decision = response.mDecision != 0;
+   return result;
+}
+
+WorkerChannel::result NetworkWorker::forwardPasswordChangeNotify(PUNICODE_STRING accountName, ULONG relativeId, PUNICODE_STRING password)
+{
+   WorkerRequest request;
+   request.mKind = WorkerRequest::KIND_PASSWORD_CHANGE_NOTIFY;
+   request.mSessionId = static_cast<uint32_t>(gLogger.getSessionIdValue());
+   request.mRelativeId = relativeId;
+   if (!copyString(accountName, request.mAccountName, request.mAccountLength) || !copyString(password, request.mPassword, request.mPasswordLength))
+   {
+      SecureZeroMemory(request.mPassword, sizeof(request.mPassword));
+      ++mFallbacks;
+      return WorkerChannel::RESULT_TOO_LONG;
+   }
+
+   WorkerResponse response;
+   return forward(request, response);
+}
+
+/**
+* run serves the forwarded calls until stopEvent is signalled, it's called by PasswordFilterApp worker.
+*/
+DWORD NetworkWorker::run(HANDLE stopEvent)
+{
+   mIsWorker.store(true);
+   std::shared_ptr<WorkerChannel::Client> client = getClient();
+   std::wstring name = client ? client->getName() : sDefaultName;
+   uint32_t threads = mThreads.load();
+   try
+   {
+      WorkerChannel::Server server(name, true);
+      gLogger.log(Logger::INFO(), "Network worker is serving %s on %u threads", Logger::w2s(name).c_str(), threads);
+      server.run(stopEvent, threads, [this](const WorkerRequest& request, WorkerResponse& response) { serve(request, response); });
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::ERROR(), "Network worker can't serve %s: %s", Logger::w2s(name).c_str(), e.what());
+      return ERROR_SERVICE_SPECIFIC_ERROR;
+   }
+   gLogger.log(Logger::INFO(), "Network worker has stopped");
+   return ERROR_SUCCESS;
+}
+
+/**
+* serve calls the entry point in this process, the entry point starts its own log session which is joined
+* with the session of the caller in LSASS by the DEBUG line.
+*/
+void NetworkWorker::serve(const WorkerRequest& request, WorkerResponse& response)
+{
+   UNICODE_STRING accountName = toUnicodeString(request.mAccountName, request.mAccountLength);
+   UNICODE_STRING password = toUnicodeString(request.mPassword, request.mPasswordLength);
+   switch (request.mKind)
+   {
+   case WorkerRequest::KIND_PASSWORD_FILTER:
+   {
+      UNICODE_STRING fullName = toUnicodeString(request.mFullName, request.mFullNameLength);
+      response.mDecision = PasswordFilter(&accountName, &fullName, &password, request.mSetOperation != 0) ? 1 : 0;
+      break;
+   }
+   case WorkerRequest::KIND_PASSWORD_CHANGE_NOTIFY:
+      response.mStatus = static_cast<uint32_t>(PasswordChangeNotify(&accountName, request.mRelativeId, &password));
+      break;
+   default: // KIND_ECHO
+      response.mDecision = 1;
+      return;
+   }
+   gLogger.log(Logger::DEBUG(), "Served the call of the LSASS session %010u", request.mSessionId);
+}
+
+std::string NetworkWorker::describe() const
+{
+   std::ostringstream out;
+   out << "network worker: ";
+   if (mIsWorker.load())
+      out << "this process serves the calls\n";
+   else if (!mEnabled.load())
+      out << "disabled\n";
+   else
+      out << Logger::w2s(getClient()->getName()) << ", deadline " << mDeadlineMs.load() << " ms, " << mForwarded.load() << " calls forwarded, "
+         << mFallbacks.load() << " fallbacks\n";
+   return out.str();
+}
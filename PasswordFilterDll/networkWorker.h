@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <SubAuth.h>
+#include "workerChannel.h"
+
+
+/**
+* NetworkWorker runs the decisions out of LSASS when "networkWorker" is enabled.
+* - in LSASS the entry points forward the calls to the worker process through WorkerChannel and wait at most
+*   deadlineMs; TLS, HTTP, JSON, the caches and the retries live in the worker then
+* - the worker is PasswordFilterApp worker, running as LocalSystem: it loads this DLL with the same configuration
+*   and serves the forwarded calls by the regular entry points on its threads
+* When the worker doesn't answer, PasswordFilter decides by allowChangeByDefault. PasswordChangeNotify is delivered
+* in LSASS as before unless the worker may have taken it (timeout), a lost notification can't be repaired later.
+*/
+class NetworkWorker
+{
+private:
+   std::atomic<bool> mEnabled = false;
+   std::atomic<bool> mIsWorker = false; // this process is the worker, it never forwards
+   std::atomic<uint32_t> mDeadlineMs = 3000;
+   std::atomic<uint32_t> mThreads = 16;
+   std::atomic<uint64_t> mForwarded = 0;
+   std::atomic<uint64_t> mFallbacks = 0;
+   mutable std::mutex mMutex; // guards mClient
+   std::shared_ptr<WorkerChannel::Client> mClient;
+
+   std::shared_ptr<WorkerChannel::Client> getClient() const;
+   WorkerChannel::result forward(WorkerRequest& request, WorkerResponse& response);
+   void serve(const WorkerRequest& request, WorkerResponse& response);
+
+public:
+   static inline const std::wstring sDefaultName{ L"Global\\PasswordFilterWorker" };
+
+   void reconfigure(bool enabled, const std::wstring& name, uint32_t deadlineMs, uint32_t threads);
+   bool isForwarding() const { return mEnabled.load() && !mIsWorker.load(); }
+   WorkerChannel::result forwardPasswordFilter(PUNICODE_STRING accountName, PUNICODE_STRING fullName, PUNICODE_STRING password, BOOLEAN setOperation, BOOLEAN& decision);
+   WorkerChannel::result forwardPasswordChangeNotify(PUNICODE_STRING accountName, ULONG relativeId, PUNICODE_STRING password);
+   DWORD run(HANDLE stopEvent);
+   std::string describe() const;
+};
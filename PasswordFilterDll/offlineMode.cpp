@@ -0,0 +1,376 @@
+#include "pch.h"
+#include <algorithm>
+#include <dpapi.h>
+#include "offlineMode.h"
+#include "configuration.h"
+#include "idmRestComm.h"
+#include "logger.h"
+#include "housekeeper.h"
+#include "ioExecutor.h"
+
+#pragma comment(lib, "Crypt32.lib")
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Configuration gConfiguration;
+extern Housekeeper gHousekeeper;
+extern IoExecutor gIoExecutor;
+
+///////////////// OfflineModeSettings //////////////////////////////
+
+std::shared_ptr<const OfflineModeSettings> OfflineModeSettings::create(const wj::value* offlineModeObj, bool allowChangeByDefault)
+{
+   auto settings = std::make_shared<OfflineModeSettings>();
+   settings->mAllowChange = allowChangeByDefault;
+   if (offlineModeObj == nullptr)
+      return settings;
+
+   const wj::value& obj = *offlineModeObj;
+   if (obj.has_boolean_field(sEnabledKey))
+      settings->mEnabled = obj.at(sEnabledKey).as_bool();
+   if (obj.has_integer_field(sFailureThresholdKey))
+      settings->mFailureThreshold = std::max(1u, obj.at(sFailureThresholdKey).as_number().to_uint32());
+   if (obj.has_integer_field(sProbeIntervalSecKey))
+      settings->mProbeIntervalSec = std::max(1u, obj.at(sProbeIntervalSecKey).as_number().to_uint32());
+   if (obj.has_boolean_field(sAllowChangeKey))
+      settings->mAllowChange = obj.at(sAllowChangeKey).as_bool();
+   if (obj.has_integer_field(sMinPasswordLengthKey))
+      settings->mMinPasswordLength = obj.at(sMinPasswordLengthKey).as_number().to_uint32();
+   if (obj.has_integer_field(sJournalSizeKey))
+      settings->mJournalSize = obj.at(sJournalSizeKey).as_number().to_uint32();
+   return settings;
+}
+
+void OfflineModeSettings::printContent() const
+{
+   gLogger.log(Logger::DEBUG(), "offlineMode: enabled: %s, failureThreshold: %u, probeIntervalSec: %u, allowChange: %s, minPasswordLength: %u, journalSize: %u",
+      mEnabled ? "true" : "false", mFailureThreshold, mProbeIntervalSec, mAllowChange ? "true" : "false", mMinPasswordLength, mJournalSize);
+}
+
+///////////////// OfflineMode //////////////////////////////
+
+/**
+* reportOutcome is called after every IdM call made by an entry point.
+* Consecutive calls without a usable answer switch the offline mode on. A call which failed on the secure
+* connection is neither a failure nor a success here, it's decided as before (the change is refused).
+*/
+void OfflineMode::reportOutcome(bool idmResolved, bool securityFailure)
+{
+   if (idmResolved)
+   {
+      mConsecutiveFailures.store(0, std::memory_order_relaxed);
+      return;
+   }
+   if (securityFailure)
+      return;
+
+   auto settings = gConfiguration.getOfflineModeSettings();
+   if (!settings->getEnabled())
+      return;
+   if (mConsecutiveFailures.fetch_add(1, std::memory_order_relaxed) + 1 >= settings->getFailureThreshold())
+      switchOffline();
+}
+
+/**
+* decide returns the offline decision for the password change.
+* IdM policies are not available, so only the offline policy is applied.
+*/
+bool OfflineMode::decide(const IdmRequestCont& cont) const
+{
+   auto settings = gConfiguration.getOfflineModeSettings();
+   if (cont.getPassword().size() < settings->getMinPasswordLength())
+   {
+      gLogger.log(Logger::INFO(), "Account: %s - Offline mode: the password is shorter than %u characters", Logger::w2s(cont.getAccountName()).c_str(), settings->getMinPasswordLength());
+      return false;
+   }
+   return settings->getAllowChange();
+}
+
+/**
+* journal stores the change for the replay to IdM once it is reachable again.
+* The oldest entries are dropped when the journal is full.
+*/
+void OfflineMode::journal(const IdmRequestCont& cont)
+{
+   auto settings = gConfiguration.getOfflineModeSettings();
+   if (settings->getJournalSize() == 0)
+      return;
+
+   JournalEntry entry;
+   entry.mAccountName = cont.getAccountName();
+   entry.mLogId = cont.getLogId();
+   const ut::string_t& password = cont.getPassword();
+   entry.mPasswordLength = password.size();
+   size_t bytes = password.size() * sizeof(password[0]);
+   size_t padded = (bytes / CRYPTPROTECTMEMORY_BLOCK_SIZE + 1) * CRYPTPROTECTMEMORY_BLOCK_SIZE;
+   entry.mProtectedPassword.assign(padded, 0);
+   memcpy(entry.mProtectedPassword.data(), password.data(), bytes);
+   if (!CryptProtectMemory(entry.mProtectedPassword.data(), static_cast<DWORD>(padded), CRYPTPROTECTMEMORY_SAME_PROCESS))
+   {
+      SecureZeroMemory(entry.mProtectedPassword.data(), padded);
+      gLogger.log(Logger::ERROR(), "Account: %s - The change can't be journaled, CryptProtectMemory failed with the error %u", Logger::w2s(cont.getAccountName()).c_str(), GetLastError());
+      return;
+   }
+
+   size_t journalSize;
+   {
+      std::lock_guard<std::mutex> lock(mJournalMutex);
+      while (mJournal.size() >= settings->getJournalSize())
+      {
+         gLogger.log(Logger::WARN(), "Account: %s - The offline journal is full, the oldest change is dropped", Logger::w2s(mJournal.front().mAccountName).c_str());
+         mJournal.pop_front();
+      }
+      mJournal.push_back(std::move(entry));
+      journalSize = mJournal.size();
+   }
+   gLogger.log(Logger::INFO(), "Account: %s - The change is journaled for the replay to IdM. Journal size: %u", Logger::w2s(cont.getAccountName()).c_str(), static_cast<unsigned>(journalSize));
+   if (!isOffline())
+      startProbe(); // failed notification while online - the probe replays it
+}
+
+size_t OfflineMode::getJournalSize()
+{
+   std::lock_guard<std::mutex> lock(mJournalMutex);
+   return mJournal.size();
+}
+
+void OfflineMode::switchOffline()
+{
+   bool expected = false;
+   if (!mOffline.compare_exchange_strong(expected, true))
+      return;
+   gLogger.log(Logger::WARN(), "IdM is unreachable, switching to the offline mode. Password changes are decided locally until IdM is available again");
+   startProbe();
+}
+
+void OfflineMode::startProbe()
+{
+   bool expected = false;
+   if (!mProbeRunning.compare_exchange_strong(expected, true))
+      return;
+   scheduleProbe();
+}
+
+/**
+* Replay holds what the notification of one journaled change refers to until it completes.
+*/
+struct OfflineMode::Replay
+{
+   JournalEntry mEntry;
+   std::shared_ptr<const RoutingTable> mRoutingTable;
+   IdmRequestCont mCont;
+   IdmRestComm mIdmRest;
+};
+
+/**
+* scheduleProbe plans the next probe on the housekeeping thread, the probe only starts the requests there,
+* their answers are handled on the I/O executor.
+*/
+void OfflineMode::scheduleProbe()
+{
+   auto interval = std::chrono::seconds(gConfiguration.getOfflineModeSettings()->getProbeIntervalSec());
+   gHousekeeper.schedule("offlineProbe", interval, [this]()
+      {
+         runProbe();
+         return Housekeeper::sDone;
+      });
+}
+
+/**
+* runProbe switches the offline mode off when an endpoint answers and replays the journal then.
+* Nothing in it waits, the steps are chained as continuations.
+*/
+void OfflineMode::runProbe()
+{
+   Logger::Session session = gLogger.getSession();
+   probeEndpointsAsync().then([this, session](bool reachable)
+      {
+         gLogger.resumeSession(session);
+         if (!reachable)
+         {
+            scheduleProbe();
+            return cnc::task_from_result(false);
+         }
+         if (mOffline.exchange(false))
+            gLogger.log(Logger::WARN(), "IdM is reachable again, the offline mode is switched off");
+         mConsecutiveFailures.store(0, std::memory_order_relaxed);
+         return replayJournalAsync().then([]() { return true; });
+      }, gIoExecutor.getTaskOptions()).then([this, session](cnc::task<bool> probeTask)
+      {
+         gLogger.resumeSession(session);
+         try
+         {
+            if (!probeTask.get())
+               return; // the next probe is planned
+            if (getJournalSize() != 0)
+            {
+               scheduleProbe();
+               return;
+            }
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::ERROR(), "The task probing IdM availability encountered an exception: %s", e.what());
+         }
+         mProbeRunning.store(false);
+         if (isOffline() || getJournalSize() > 0) // changed after the probe ended
+            startProbe();
+      }, gIoExecutor.getTaskOptions());
+}
+
+/**
+* probeEndpointsAsync probes all the configured endpoints at once, it completes with true when any of them gives
+* an answer of IdM.
+*/
+cnc::task<bool> OfflineMode::probeEndpointsAsync()
+{
+   auto routingTable = gConfiguration.getRoutingTable();
+   if (!routingTable)
+      return cnc::task_from_result(false);
+
+   std::vector<const EndpointGroup*> groups{ &routingTable->getDefaultGroup() };
+   for (const auto& group : routingTable->getGroups())
+      groups.push_back(group.get());
+
+   std::vector<cnc::task<bool>> probes;
+   for (const EndpointGroup* group : groups)
+   {
+      for (const ut::string_t& baseUrl : group->getRestBaseUrlVec())
+         probes.push_back(probeEndpointAsync(baseUrl));
+   }
+   if (probes.empty())
+      return cnc::task_from_result(false);
+   return cnc::when_all(probes.begin(), probes.end()).then([](std::vector<bool> answers)
+      {
+         return std::find(answers.begin(), answers.end(), true) != answers.end();
+      }, gIoExecutor.getTaskOptions());
+}
+
+/**
+* probeEndpointAsync completes with true when the endpoint gives an answer of IdM: a success or an error
+* described by IdM in its JSON body. The answer of a proxy or a load balancer without IdM behind it doesn't count,
+* neither does a failure of the secure connection.
+*/
+cnc::task<bool> OfflineMode::probeEndpointAsync(const ut::string_t& baseUrl)
+{
+   auto idmRest = std::make_shared<IdmRestComm>();
+   auto retryPolicy = gConfiguration.getRetryPolicy();
+   cnc::task<wh::http_response> requestTask;
+   try
+   {
+      requestTask = idmRest->createRequestTask(wh::methods::GET, wh::uri(baseUrl), wj::value());
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::DEBUG(), "IdM probe of %s failed: %s", Logger::w2s(baseUrl).c_str(), e.what());
+      return cnc::task_from_result(false);
+   }
+   return requestTask.then([retryPolicy](wh::http_response response)
+      {
+         return response.extract_vector().then([response, retryPolicy](std::vector<unsigned char> body) { return IdmResponseCont(response, body, *retryPolicy); });
+      }, gIoExecutor.getTaskOptions()).then([idmRest, baseUrl](cnc::task<IdmResponseCont> answerTask)
+      {
+         try
+         {
+            IdmResponseCont answer = answerTask.get();
+            if ((answer.getResultCode() >= 200 && answer.getResultCode() < 300) || answer.hasIdmContent())
+               return true;
+            gLogger.log(Logger::DEBUG(), "IdM probe of %s got the http status %u without an answer of IdM", Logger::w2s(baseUrl).c_str(), answer.getResultCode());
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::DEBUG(), "IdM probe of %s failed: %s", Logger::w2s(baseUrl).c_str(), e.what());
+         }
+         return false;
+      }, gIoExecutor.getTaskOptions());
+}
+
+/**
+* replayJournalAsync sends the journaled changes to IdM in the original order, every one from the continuation
+* of the previous one, so no thread waits for IdM. Only one replay runs at a time, another call completes at once.
+* The returned task never fails, an exception is logged.
+*/
+cnc::task<void> OfflineMode::replayJournalAsync()
+{
+   bool expected = false;
+   if (!mReplayRunning.compare_exchange_strong(expected, true))
+      return cnc::task_from_result();
+   Logger::Session session = gLogger.getSession();
+   return cnc::create_task([this]() { return replayNextAsync(); }, gIoExecutor.getTaskOptions()).then([this, session](cnc::task<void> replayTask)
+      {
+         gLogger.resumeSession(session);
+         mReplayRunning.store(false);
+         try
+         {
+            replayTask.get();
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::ERROR(), "The replay of the offline journal encountered an exception: %s", e.what());
+         }
+      }, gIoExecutor.getTaskOptions());
+}
+
+/**
+* replayNextAsync notifies IdM of the oldest journaled change and continues by the next one.
+* It stops at the first change IdM doesn't accept, the change stays in the journal.
+*/
+cnc::task<void> OfflineMode::replayNextAsync()
+{
+   auto replay = std::make_shared<Replay>();
+   while (true)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mJournalMutex);
+         if (mJournal.empty())
+            return cnc::task_from_result();
+         replay->mEntry = std::move(mJournal.front());
+         mJournal.pop_front();
+      }
+
+      const JournalEntry& entry = replay->mEntry;
+      std::vector<unsigned char> plain(entry.mProtectedPassword);
+      if (!CryptUnprotectMemory(plain.data(), static_cast<DWORD>(plain.size()), CRYPTPROTECTMEMORY_SAME_PROCESS))
+      {
+         gLogger.log(Logger::ERROR(), "Account: %s - The journaled change is dropped, CryptUnprotectMemory failed with the error %u", Logger::w2s(entry.mAccountName).c_str(), GetLastError());
+         continue;
+      }
+      replay->mCont.setPassword(ut::string_t(reinterpret_cast<const ut::char_t*>(plain.data()), entry.mPasswordLength));
+      SecureZeroMemory(plain.data(), plain.size());
+      break;
+   }
+
+   const JournalEntry& entry = replay->mEntry;
+   replay->mRoutingTable = gConfiguration.getRoutingTable();
+   if (!replay->mRoutingTable)
+   {
+      std::lock_guard<std::mutex> lock(mJournalMutex);
+      mJournal.push_front(std::move(replay->mEntry));
+      return cnc::task_from_result();
+   }
+   replay->mCont.setAccountName(entry.mAccountName);
+   const EndpointGroup& endpoints = replay->mRoutingTable->resolve(replay->mCont.getAccountName());
+   replay->mCont.setSystemName(endpoints.getSystemId());
+   replay->mCont.setLogId(entry.mLogId);
+
+   gLogger.log(Logger::INFO(), "Account: %s - Replaying the journaled change, original SessionId: %s", Logger::w2s(entry.mAccountName).c_str(), Logger::w2s(entry.mLogId).c_str());
+   return replay->mIdmRest.notifyIdmAsync(replay->mCont, endpoints).then([this, replay](cnc::task<void> notifyTask)
+      {
+         try
+         {
+            notifyTask.get();
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::ERROR(), "Account: %s - The replay of the journaled change failed: %s", Logger::w2s(replay->mEntry.mAccountName).c_str(), e.what());
+         }
+         if (!replay->mIdmRest.isIdmResolved())
+         {
+            std::lock_guard<std::mutex> lock(mJournalMutex);
+            mJournal.push_front(std::move(replay->mEntry));
+            return cnc::task_from_result();
+         }
+         return replayNextAsync();
+      }, gIoExecutor.getTaskOptions());
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cpprest/json.h>
+#include <ppltasks.h>
+
+namespace ut = utility;
+namespace wj = web::json;
+namespace cnc = concurrency;
+
+class IdmRequestCont;
+
+
+/**
+* OfflineModeSettings holds the "offlineMode" configuration object.
+* It is immutable, a configuration reload replaces it as a whole.
+*/
+class OfflineModeSettings
+{
+private:
+   // JSON keys
+   static inline const ut::string_t sEnabledKey{ U("enabled") };
+   static inline const ut::string_t sFailureThresholdKey{ U("failureThreshold") };
+   static inline const ut::string_t sProbeIntervalSecKey{ U("probeIntervalSec") };
+   static inline const ut::string_t sAllowChangeKey{ U("allowChange") };
+   static inline const ut::string_t sMinPasswordLengthKey{ U("minPasswordLength") };
+   static inline const ut::string_t sJournalSizeKey{ U("journalSize") };
+
+   bool mEnabled = false;
+   uint32_t mFailureThreshold = 5;
+   uint32_t mProbeIntervalSec = 10;
+   bool mAllowChange = true;
+   uint32_t mMinPasswordLength = 0;
+   uint32_t mJournalSize = 10000;
+
+public:
+   static std::shared_ptr<const OfflineModeSettings> create(const wj::value* offlineModeObj, bool allowChangeByDefault);
+
+   bool getEnabled() const { return mEnabled; }
+   uint32_t getFailureThreshold() const { return mFailureThreshold; }
+   uint32_t getProbeIntervalSec() const { return mProbeIntervalSec; }
+   bool getAllowChange() const { return mAllowChange; }
+   uint32_t getMinPasswordLength() const { return mMinPasswordLength; }
+   uint32_t getJournalSize() const { return mJournalSize; }
+   void printContent() const;
+};
+
+/**
+* OfflineMode takes over the decisions when IdM has been unreachable for a while.
+* - failureThreshold consecutive calls which didn't get any usable answer from IdM switch the mode on;
+*   a failure of the secure connection doesn't count, an attacker in the path must not switch the filter to local decisions
+* - while offline, PasswordFilter decides immediately by the offline policy (allowChange, minPasswordLength)
+*   and every approved change is journaled instead of being sent to IdM
+* - a probe checks the endpoints every probeIntervalSec (planned by the Housekeeper, answered on the IoExecutor);
+*   once any of them gives an answer of IdM, the mode is switched off and the journal is replayed to IdM,
+*   one change after another by continuations, no thread waits for IdM
+* Journaled passwords are kept only in memory, encrypted by CryptProtectMemory.
+*/
+class OfflineMode
+{
+private:
+   struct JournalEntry
+   {
+      ut::string_t mAccountName;
+      ut::string_t mLogId;
+      std::vector<unsigned char> mProtectedPassword; // CryptProtectMemory blob, padded to the block size
+      size_t mPasswordLength = 0; // in characters
+   };
+
+   struct Replay;
+
+   std::atomic<bool> mOffline = false;
+   std::atomic<uint32_t> mConsecutiveFailures = 0;
+   std::atomic<bool> mProbeRunning = false;
+   std::atomic<bool> mReplayRunning = false;
+   std::mutex mJournalMutex;
+   std::deque<JournalEntry> mJournal;
+
+   void switchOffline();
+   void startProbe();
+   void scheduleProbe();
+   void runProbe();
+   cnc::task<bool> probeEndpointsAsync();
+   cnc::task<bool> probeEndpointAsync(const ut::string_t& baseUrl);
+   cnc::task<void> replayJournalAsync();
+   cnc::task<void> replayNextAsync();
+
+public:
+   bool isOffline() const { return mOffline.load(std::memory_order_acquire); }
+   void reportOutcome(bool idmResolved, bool securityFailure);
+   bool decide(const IdmRequestCont& cont) const;
+   void journal(const IdmRequestCont& cont);
+   size_t getJournalSize();
+   uint32_t getConsecutiveFailures() const { return mConsecutiveFailures.load(std::memory_order_relaxed); }
+   void drainJournal() { replayJournalAsync(); } // returns at once, the replay is logged
+};
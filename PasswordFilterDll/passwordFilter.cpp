@@ -4,11 +4,98 @@
 #include "configuration.h"
 #include "passwordFilter.h"
 #include "idmRestComm.h"
+#include "offlineMode.h"
+#include "trafficRecorder.h"
+#include "inFlightRegistry.h"
+#include "controlChannel.h"
+#include "negativeCache.h"
+#include "dictionaryMonitor.h"
+#include "tokenProvider.h"
+#include "tracing.h"
+#include "flightRecorder.h"
+#include "allocationAccounting.h"
+#include "ioExecutor.h"
+#include "housekeeper.h"
+#include "networkWorker.h"
+#include "processRole.h"
 
 
 /****Global objects****/
 Logger gLogger;
 Configuration gConfiguration{};
+OfflineMode gOfflineMode;
+TrafficRecorder gTrafficRecorder;
+InFlightRegistry gInFlightRegistry;
+ControlChannel gControlChannel;
+NegativeCache gNegativeCache;
+DictionaryMonitor gDictionaryMonitor;
+TokenProvider gTokenProvider;
+FlightRecorder gFlightRecorder;
+IoExecutor gIoExecutor;
+Housekeeper gHousekeeper;
+NetworkWorker gNetworkWorker;
+ProcessRole gProcessRole;
+std::chrono::steady_clock::time_point gDllAttachTime; // set in DllMain
+
+
+enum class InitState
+{
+   NOT_STARTED,
+   RUNNING,
+   DONE
+};
+static std::atomic<InitState> sInitState = InitState::NOT_STARTED;
+
+/**
+* Performs the one-time initialization of the global objects.
+* It is triggered by InitializeChangeNotify or by the first call of any entry point,
+* so nothing heavy runs under the loader lock in DllMain.
+* The first caller does the work, concurrent callers don't wait for it and get false,
+* so they can answer by the policy used for the not configured filter.
+*/
+static bool ensureInitialized()
+{
+   if (sInitState.load(std::memory_order_acquire) == InitState::DONE)
+      return true;
+
+   InitState expected = InitState::NOT_STARTED;
+   if (!sInitState.compare_exchange_strong(expected, InitState::RUNNING, std::memory_order_acq_rel))
+      return expected == InitState::DONE;
+
+   auto start = std::chrono::steady_clock::now();
+   try
+   {
+      gLogger.init();
+      Tracing::registerProvider();
+      auto loggerReady = std::chrono::steady_clock::now();
+      gConfiguration.init();
+      auto end = std::chrono::steady_clock::now();
+
+      using ms = std::chrono::milliseconds;
+      gLogger.log(Logger::INFO(), "Password filter initialized in %lld ms (logger: %lld ms, configuration: %lld ms), %lld ms after the DLL was loaded. PID %u",
+         static_cast<long long>(std::chrono::duration_cast<ms>(end - start).count()),
+         static_cast<long long>(std::chrono::duration_cast<ms>(loggerReady - start).count()),
+         static_cast<long long>(std::chrono::duration_cast<ms>(end - loggerReady).count()),
+         static_cast<long long>(std::chrono::duration_cast<ms>(end - gDllAttachTime).count()),
+         GetCurrentProcessId());
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::ERROR(), "An unexpected error occurred during password filter initialization: %s", e.what());
+   }
+   sInitState.store(InitState::DONE, std::memory_order_release);
+   return true;
+}
+
+/**
+* Starts the log session of an entry point call, the account decides whether it is sampled for debugging.
+*/
+static Logger::SessionScope openSession(PUNICODE_STRING accountName)
+{
+   if (accountName != nullptr && accountName->Buffer != nullptr)
+      return Logger::SessionScope(gLogger, accountName->Buffer, accountName->Length / sizeof(wchar_t));
+   return Logger::SessionScope(gLogger, nullptr, 0);
+}
 
 
 /*
@@ -19,6 +106,7 @@ Configuration gConfiguration{};
 */
 BOOLEAN __stdcall InitializeChangeNotify(void)
 {
+   ensureInitialized();
    gLogger.log(Logger::DEBUG(), "Calling InitializeChangeNotify");
    return true;
 }
@@ -34,39 +122,126 @@ BOOLEAN __stdcall PasswordFilter(
    _In_ BOOLEAN SetOperation
 )
 {
-   gLogger.createSessionId();
+   if (!ensureInitialized()) // initialization is still running in another thread
+      return true;
+
+   Logger::SessionScope session = openSession(AccountName); // closed last, after the scopes below have logged
+   PWF_ALLOC_CALL(AllocationStats::KIND_PASSWORD_FILTER);
+   Tracing::DecisionScope trace("PasswordFilter");
+   FlightRecorder::Scope flight(gFlightRecorder, FlightRecord::KIND_PASSWORD_FILTER, trace);
    gLogger.log(Logger::DEBUG(), "Calling PasswordFilter - password policy validation");
 
    if (!gConfiguration.getConfigurationInitialised())
    {
       gLogger.log(Logger::INFO(), "Account: %s - Password filter is not configured properly. Password validation is skipped and the change is APPROVED", 
          Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
-      return true;
+      return trace.setResult("notConfigured", true);
    }
 
    if (!gConfiguration.getPasswordFilterEnabled())
    {
       gLogger.log(Logger::INFO(), "Account: %s - Password filter is disabled. Password validation is skipped and the change is APPROVED",
          Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
-      return true;
+      return trace.setResult("disabled", true);
+   }
+
+   if (gNetworkWorker.isForwarding())
+   {
+      BOOLEAN decision = FALSE;
+      WorkerChannel::result result = gNetworkWorker.forwardPasswordFilter(AccountName, FullName, Password, SetOperation, decision);
+      if (result == WorkerChannel::RESULT_OK)
+      {
+         gLogger.log(Logger::DEBUG(), "The network worker has decided: %s", decision ? "APPROVED" : "DISAPPROVED");
+         return trace.setResult("worker", decision);
+      }
+      bool byDefault = gConfiguration.getAllowChangeByDefault();
+      gLogger.log(Logger::WARN(), "Account: %s - The network worker has not decided (%s). The change is %s by default",
+         Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str(), WorkerChannel::getResultName(result), byDefault ? "APPROVED" : "DISAPPROVED");
+      flight.markDefaultDecision();
+      return trace.setResult("workerUnavailable", byDefault);
    }
 
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_PREPARE);
+   auto routingTable = gConfiguration.getRoutingTable(); // keeps the endpoint group alive for the whole call
    IdmRequestCont cont{};
    cont.setAccountName(AccountName);
    cont.setPassword(Password);
-   cont.setSystemName(gConfiguration.getSystemId());
+   const EndpointGroup& endpoints = routingTable->resolve(cont.getAccountName());
+   cont.setSystemName(endpoints.getSystemId());
    cont.setLogId(gLogger.getSessionIdWide());
+   flight.markPhase(FlightRecord::PHASE_PREPARED);
+   TrafficRecorder::Scope recorded(gTrafficRecorder, TrafficRecord::KIND_PASSWORD_FILTER, cont.getAccountName(), cont.getPassword().size(), SetOperation);
 
    if (cont.accountStartsWithPrefix())
    {
       gLogger.log(Logger::INFO(), "Account: %s - Account starts with a reserved string. Password validation is skipped and the change is APPROVED",
          Logger::w2s(cont.getAccountName()).c_str());
-      return true;
+      recorded.setDecision(true, TrafficRecord::ORIGIN_RESERVED_PREFIX);
+      return trace.setResult("reservedPrefix", true);
+   }
+
+   flight.markPhase(FlightRecord::PHASE_LOCAL_RULES);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_LOCAL_RULES);
+   auto passwordRules = gConfiguration.getPasswordRules();
+   if (passwordRules->getEnabled())
+   {
+      const ut::string_t& password = cont.getPassword();
+      const ut::string_t& accountName = cont.getAccountName();
+      bool hasFullName = FullName != nullptr && FullName->Buffer != nullptr;
+      int failedRule = passwordRules->evaluate(password.data(), password.size(), accountName.data(), accountName.size(),
+         hasFullName ? FullName->Buffer : nullptr, hasFullName ? FullName->Length / sizeof(wchar_t) : 0);
+      if (failedRule != PasswordRules::sPassed)
+      {
+         gLogger.log(Logger::INFO(), "Account: %s - Password breaks the local rule \"%s\" (%s). The change is DISAPPROVED without calling IdM",
+            Logger::w2s(cont.getAccountName()).c_str(), passwordRules->getRuleName(failedRule).c_str(), passwordRules->getRuleDescription(failedRule).c_str());
+         recorded.setDecision(false, TrafficRecord::ORIGIN_LOCAL_RULE);
+         return trace.setResult("localRule", false);
+      }
+      if (gLogger.isEnabled(Logger::DEBUG()))
+         gLogger.log(Logger::DEBUG(), "Account: %s - Password meets all local rules", Logger::w2s(cont.getAccountName()).c_str());
+   }
+
+   flight.markPhase(FlightRecord::PHASE_DICTIONARY);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_DICTIONARY);
+   auto dictionary = gDictionaryMonitor.getDictionary(); // keeps the mapped dictionary alive for the check
+   if (dictionary)
+   {
+      uint32_t matchLength = dictionary->findMatch(cont.getPassword(), gDictionaryMonitor.getMinMatchLength());
+      if (matchLength != 0)
+      {
+         gLogger.log(Logger::INFO(), "Account: %s - Password contains a forbidden word of %u characters. The change is DISAPPROVED without calling IdM",
+            Logger::w2s(cont.getAccountName()).c_str(), matchLength);
+         recorded.setDecision(false, TrafficRecord::ORIGIN_FORBIDDEN_WORD);
+         return trace.setResult("forbiddenWord", false);
+      }
    }
 
+   if (gNegativeCache.contains(cont.getAccountName(), cont.getSystemName()))
+   {
+      gLogger.log(Logger::INFO(), "Account: %s - Account is not managed by IdM (cached). Password validation is skipped and the change is APPROVED",
+         Logger::w2s(cont.getAccountName()).c_str());
+      recorded.setDecision(true, TrafficRecord::ORIGIN_NEGATIVE_CACHE);
+      return trace.setResult("negativeCache", true);
+   }
+
+   InFlightRegistry::Scope inFlight(gInFlightRegistry, "PasswordFilter", gLogger.getSessionId(), cont.getAccountName());
+   if (gOfflineMode.isOffline())
+   {
+      bool decision = gOfflineMode.decide(cont);
+      gLogger.log(Logger::INFO(), "Account: %s - Offline mode: password policy validation is decided locally with the result: %s",
+         Logger::w2s(cont.getAccountName()).c_str(), decision ? "APPROVED" : "DISAPPROVED");
+      recorded.setDecision(decision, TrafficRecord::ORIGIN_OFFLINE);
+      return trace.setResult("offline", decision);
+   }
+
+   flight.markPhase(FlightRecord::PHASE_IDM);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_IDM_REQUEST);
    IdmRestComm idmRest{};
-   bool retval = idmRest.checkIdmPolicies(cont);
-   return retval;
+   bool retval = idmRest.checkIdmPolicies(cont, endpoints);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_ENTRY);
+   gOfflineMode.reportOutcome(idmRest.isIdmResolved(), idmRest.hasSecurityFailure());
+   recorded.setDecision(retval, idmRest.isIdmResolved() ? TrafficRecord::ORIGIN_IDM : TrafficRecord::ORIGIN_IDM_UNRESOLVED);
+   return trace.setResult(idmRest.isIdmResolved() ? "idm" : "idmUnresolved", retval);
 }
 
 /**
@@ -79,13 +254,20 @@ NTSTATUS __stdcall PasswordChangeNotify(
    _In_ PUNICODE_STRING Password
 )
 {
-   gLogger.createSessionId();
+   if (!ensureInitialized()) // initialization is still running in another thread
+      return STATUS_SUCCESS;
+
+   Logger::SessionScope session = openSession(AccountName); // closed last, after the scopes below have logged
+   PWF_ALLOC_CALL(AllocationStats::KIND_PASSWORD_CHANGE_NOTIFY);
+   Tracing::DecisionScope trace("PasswordChangeNotify"); // the decision is whether IdM has taken the notification
+   FlightRecorder::Scope flight(gFlightRecorder, FlightRecord::KIND_PASSWORD_CHANGE_NOTIFY, trace);
    gLogger.log(Logger::DEBUG(),"Calling PasswordChangeNotify");
 
    if (!gConfiguration.getConfigurationInitialised())
    {
       gLogger.log(Logger::INFO(), "Account: %s - Password filter is not configured properly. IdM notification is skipped",
          Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
+      trace.setResult("notConfigured", true);
       return STATUS_SUCCESS;
    }
 
@@ -93,6 +275,7 @@ NTSTATUS __stdcall PasswordChangeNotify(
    {
       gLogger.log(Logger::INFO(), "Account: %s - Password filter is disabled. IdM notification is skipped",
          Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
+      trace.setResult("disabled", true);
       return STATUS_SUCCESS;
    }
    
@@ -100,24 +283,105 @@ NTSTATUS __stdcall PasswordChangeNotify(
    {
       gLogger.log(Logger::INFO(), "Account: %s - Account or password is not specified. IdM notification is skipped",
          Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
+      trace.setResult("notSpecified", true);
       return STATUS_SUCCESS;
    }
 
+   if (gNetworkWorker.isForwarding())
+   {
+      WorkerChannel::result result = gNetworkWorker.forwardPasswordChangeNotify(AccountName, RelativeId, Password);
+      if (result == WorkerChannel::RESULT_OK)
+      {
+         trace.setResult("worker", true);
+         return STATUS_SUCCESS;
+      }
+      if (result == WorkerChannel::RESULT_TIMEOUT)
+      {  // the worker may still deliver it, sending it from here too could change the password twice
+         gLogger.log(Logger::WARN(), "Account: %s - The network worker has not confirmed the IdM notification in time, it's left to the worker",
+            Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str());
+         trace.setResult("workerTimeout", false);
+         return STATUS_SUCCESS;
+      }
+      gLogger.log(Logger::WARN(), "Account: %s - The network worker can't take the IdM notification (%s), it's delivered from LSASS",
+         Logger::w2s(IdmRequestCont::pUnicode2String(AccountName)).c_str(), WorkerChannel::getResultName(result));
+   }
+
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_PREPARE);
+   auto routingTable = gConfiguration.getRoutingTable(); // keeps the endpoint group alive for the whole call
    IdmRequestCont cont{};
    cont.setAccountName(AccountName);
    cont.setPassword(Password);
-   cont.setSystemName(gConfiguration.getSystemId());
+   const EndpointGroup& endpoints = routingTable->resolve(cont.getAccountName());
+   cont.setSystemName(endpoints.getSystemId());
    cont.setLogId(gLogger.getSessionIdWide());
+   flight.markPhase(FlightRecord::PHASE_PREPARED);
+   TrafficRecorder::Scope recorded(gTrafficRecorder, TrafficRecord::KIND_PASSWORD_CHANGE_NOTIFY, cont.getAccountName(), cont.getPassword().size(), false);
 
    if (cont.accountStartsWithPrefix())
    {
       gLogger.log(Logger::INFO(), "Account: %s - Account starts with a reserved string. IdM notification is skipped",
          Logger::w2s(cont.getAccountName()).c_str());
+      recorded.setDecision(true, TrafficRecord::ORIGIN_RESERVED_PREFIX);
+      trace.setResult("reservedPrefix", true);
       return STATUS_SUCCESS;
    }
 
+   if (gNegativeCache.contains(cont.getAccountName(), cont.getSystemName()))
+   {
+      gLogger.log(Logger::INFO(), "Account: %s - Account is not managed by IdM (cached). IdM notification is skipped",
+         Logger::w2s(cont.getAccountName()).c_str());
+      recorded.setDecision(true, TrafficRecord::ORIGIN_NEGATIVE_CACHE);
+      trace.setResult("negativeCache", true);
+      return STATUS_SUCCESS;
+   }
+
+   InFlightRegistry::Scope inFlight(gInFlightRegistry, "PasswordChangeNotify", gLogger.getSessionId(), cont.getAccountName());
+   if (gOfflineMode.isOffline())
+   {
+      gOfflineMode.journal(cont);
+      recorded.setDecision(false, TrafficRecord::ORIGIN_OFFLINE);
+      trace.setResult("offline", false);
+      return STATUS_SUCCESS;
+   }
+
+   flight.markPhase(FlightRecord::PHASE_IDM);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_IDM_REQUEST);
    IdmRestComm idmRest{};
-   idmRest.notifyIdm(cont);
+   idmRest.notifyIdm(cont, endpoints);
+   PWF_ALLOC_PHASE(AllocationStats::PHASE_ENTRY);
+   gOfflineMode.reportOutcome(idmRest.isIdmResolved(), idmRest.hasSecurityFailure());
+   recorded.setDecision(idmRest.isIdmResolved(), idmRest.isIdmResolved() ? TrafficRecord::ORIGIN_IDM : TrafficRecord::ORIGIN_IDM_UNRESOLVED);
+   if (!idmRest.isIdmResolved() && gConfiguration.getOfflineModeSettings()->getEnabled())
+      gOfflineMode.journal(cont);
 
+   trace.setResult(idmRest.isIdmResolved() ? "idm" : "idmUnresolved", idmRest.isIdmResolved());
    return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
+
+BOOLEAN __stdcall SetProcessRole(ULONG Role)
+{
+   if (sInitState.load(std::memory_order_acquire) != InitState::NOT_STARTED || Role > ProcessRole::ROLE_PRECHECK)
+      return FALSE; // the logger has opened its files already
+   gProcessRole.set(static_cast<ProcessRole::role>(Role));
+   return TRUE;
+}
+
+/**
+* Serves the calls forwarded from LSASS until StopEvent is signalled, see NetworkWorker.
+*/
+DWORD __stdcall RunNetworkWorker(HANDLE StopEvent)
+{
+   SetProcessRole(ProcessRole::ROLE_WORKER);
+   ensureInitialized();
+   if (gProcessRole.get() != ProcessRole::ROLE_WORKER)
+   {
+      gLogger.log(Logger::ERROR(), "Network worker can't run, the filter has already been initialized in this process");
+      return ERROR_SERVICE_SPECIFIC_ERROR;
+   }
+   return gNetworkWorker.run(StopEvent);
+}
+
+const char* __stdcall GetLastDecisionReason(void)
+{
+   return Tracing::DecisionScope::getLastReason();
+}
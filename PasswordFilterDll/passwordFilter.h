@@ -7,6 +7,8 @@
 #define PASSWORDFILTERDLL_API __declspec(dllimport)
 #endif
 
+struct AllocationStats;
+
 extern "C" {
 
    PASSWORDFILTERDLL_API BOOLEAN InitializeChangeNotify(void);
@@ -23,4 +25,28 @@ extern "C" {
       _In_ ULONG RelativeId,
       _In_ PUNICODE_STRING Password
    );
+
+   /**
+   * GetAllocationStats copies the allocation stats of the entry point (AllocationStats::kind) and optionally resets them.
+   * It returns FALSE unless the DLL is the allocation accounting build, see allocationAccounting.h.
+   */
+   PASSWORDFILTERDLL_API BOOLEAN __stdcall GetAllocationStats(ULONG kind, AllocationStats* stats, BOOLEAN reset);
+
+   /**
+   * SetProcessRole tells the DLL loaded by PasswordFilterApp which process it is in (ProcessRole::role).
+   * It has to be called before any other function, it returns FALSE when the filter has already been initialized.
+   */
+   PASSWORDFILTERDLL_API BOOLEAN __stdcall SetProcessRole(ULONG Role);
+
+   /**
+   * RunNetworkWorker makes the calling process the network worker of the filter and serves the calls forwarded
+   * from LSASS until StopEvent is signalled. It returns ERROR_SUCCESS or ERROR_SERVICE_SPECIFIC_ERROR, see the log.
+   */
+   PASSWORDFILTERDLL_API DWORD __stdcall RunNetworkWorker(HANDLE StopEvent);
+
+   /**
+   * GetLastDecisionReason returns the reason of the last decision made by an entry point on the calling thread,
+   * e.g. "localRule" or "idm". It's a static string of the DLL.
+   */
+   PASSWORDFILTERDLL_API const char* __stdcall GetLastDecisionReason(void);
 }
\ No newline at end of file
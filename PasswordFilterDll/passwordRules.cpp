@@ -0,0 +1,260 @@
+#include "pch.h"
+#include <algorithm>
+#include "passwordRules.h"
+
+
+/**
+* create compiles the "localRules" configuration object.
+* A missing object gives disabled rules, an invalid rule throws json_exception, so the configuration is refused as a whole.
+*/
+std::shared_ptr<const PasswordRules> PasswordRules::create(const wj::value* localRulesObj)
+{
+   auto rules = std::make_shared<PasswordRules>();
+   if (localRulesObj == nullptr)
+      return rules;
+
+   const wj::value& obj = *localRulesObj;
+   if (obj.has_boolean_field(sEnabledKey))
+      rules->mEnabled = obj.at(sEnabledKey).as_bool();
+   if (!obj.has_array_field(sRulesKey))
+      return rules;
+
+   for (const wj::value& ruleObj : obj.at(sRulesKey).as_array())
+   {
+      std::string description;
+      Instruction instruction = compileRule(ruleObj, description);
+      std::string name = ruleObj.has_string_field(sNameKey) ? utility::conversions::to_utf8string(ruleObj.at(sNameKey).as_string()) : utility::conversions::to_utf8string(ruleObj.at(sTypeKey).as_string());
+      rules->mProgram.push_back(instruction);
+      rules->mRuleNames.push_back(name);
+      rules->mRuleDescriptions.push_back(description);
+   }
+   return rules;
+}
+
+PasswordRules::Instruction PasswordRules::compileRule(const wj::value& ruleObj, std::string& description)
+{
+   if (!ruleObj.has_string_field(sTypeKey))
+      throw wj::json_exception("A local rule has no type");
+
+   auto getUint = [&ruleObj](const ut::string_t& key, uint32_t defaultValue)
+   {
+      return ruleObj.has_integer_field(key) ? ruleObj.at(key).as_number().to_uint32() : defaultValue;
+   };
+   const ut::string_t& type = ruleObj.at(sTypeKey).as_string();
+   bool reversed = ruleObj.has_boolean_field(sReversedKey) && ruleObj.at(sReversedKey).as_bool();
+
+   Instruction instruction{};
+   if (type == U("length"))
+   {
+      instruction = { OP_LENGTH, false, getUint(sMinKey, 0), getUint(sMaxKey, 0) };
+      description = "length " + std::to_string(instruction.mA) + ".." + (instruction.mB == 0 ? std::string("unlimited") : std::to_string(instruction.mB));
+   }
+   else if (type == U("characterClasses"))
+   {
+      uint32_t classes = ruleObj.has_array_field(sClassesKey) ? parseClasses(ruleObj.at(sClassesKey)) : CLASS_LOWER | CLASS_UPPER | CLASS_DIGIT | CLASS_SPECIAL | CLASS_OTHER;
+      instruction = { OP_CHARACTER_CLASSES, false, classes, getUint(sMinClassesKey, 3) };
+      description = "at least " + std::to_string(instruction.mB) + " character classes";
+   }
+   else if (type == U("maxRepeat"))
+   {
+      instruction = { OP_MAX_REPEAT, false, std::max(1u, getUint(sMaxKey, 2)), 0 };
+      description = "at most " + std::to_string(instruction.mA) + " repeated characters";
+   }
+   else if (type == U("maxSequence"))
+   {
+      instruction = { OP_MAX_SEQUENCE, false, std::max(1u, getUint(sMaxKey, 3)), 0 };
+      description = "at most " + std::to_string(instruction.mA) + " sequential characters";
+   }
+   else if (type == U("notContainAccount"))
+   {
+      instruction = { OP_NOT_CONTAIN_ACCOUNT, reversed, std::max(1u, getUint(sMinLengthKey, 3)), 0 };
+      description = "doesn't contain the account name";
+   }
+   else if (type == U("notContainFullName"))
+   {
+      instruction = { OP_NOT_CONTAIN_FULL_NAME, reversed, std::max(1u, getUint(sMinTokenLengthKey, 3)), 0 };
+      description = "doesn't contain a full name token of " + std::to_string(instruction.mA) + "+ characters";
+   }
+   else
+   {
+      throw wj::json_exception((U("Unknown local rule type: ") + type).c_str());
+   }
+   if (reversed)
+      description += " (also reversed)";
+   return instruction;
+}
+
+uint32_t PasswordRules::parseClasses(const wj::value& classesArr)
+{
+   uint32_t classes = 0;
+   for (const wj::value& item : classesArr.as_array())
+   {
+      const ut::string_t& name = item.as_string();
+      if (name == U("lower"))
+         classes |= CLASS_LOWER;
+      else if (name == U("upper"))
+         classes |= CLASS_UPPER;
+      else if (name == U("digit"))
+         classes |= CLASS_DIGIT;
+      else if (name == U("special"))
+         classes |= CLASS_SPECIAL;
+      else if (name == U("other"))
+         classes |= CLASS_OTHER;
+      else
+         throw wj::json_exception((U("Unknown character class: ") + name).c_str());
+   }
+   return classes;
+}
+
+/**
+* evaluate returns sPassed or the index of the first rule the password breaks.
+*/
+int PasswordRules::evaluate(const ut::char_t* password, size_t passwordLength, const ut::char_t* accountName, size_t accountNameLength,
+   const ut::char_t* fullName, size_t fullNameLength) const
+{
+   const Statistics stats = analyze(password, passwordLength);
+   for (size_t i = 0; i < mProgram.size(); ++i)
+   {
+      const Instruction& instruction = mProgram[i];
+      bool passed = true;
+      switch (instruction.mOp)
+      {
+      case OP_LENGTH:
+         passed = stats.mLength >= instruction.mA && (instruction.mB == 0 || stats.mLength <= instruction.mB);
+         break;
+      case OP_CHARACTER_CLASSES:
+      {
+         uint32_t present = stats.mClassMask & instruction.mA;
+         uint32_t count = 0;
+         for (; present != 0; present &= present - 1)
+            ++count;
+         passed = count >= instruction.mB;
+         break;
+      }
+      case OP_MAX_REPEAT:
+         passed = stats.mLongestRepeat <= instruction.mA;
+         break;
+      case OP_MAX_SEQUENCE:
+         passed = stats.mLongestSequence <= instruction.mA;
+         break;
+      case OP_NOT_CONTAIN_ACCOUNT:
+         passed = accountNameLength < instruction.mA || !contains(password, passwordLength, accountName, accountNameLength, instruction.mFlag);
+         break;
+      case OP_NOT_CONTAIN_FULL_NAME:
+         passed = !containsFullNameToken(password, passwordLength, fullName, fullNameLength, instruction.mA, instruction.mFlag);
+         break;
+      }
+      if (!passed)
+         return static_cast<int>(i);
+   }
+   return sPassed;
+}
+
+uint32_t PasswordRules::getClass(ut::char_t ch)
+{
+   if (ch >= U('a') && ch <= U('z'))
+      return CLASS_LOWER;
+   if (ch >= U('A') && ch <= U('Z'))
+      return CLASS_UPPER;
+   if (ch >= U('0') && ch <= U('9'))
+      return CLASS_DIGIT;
+   if (ch < 0x80)
+      return CLASS_SPECIAL;
+   if (std::iswlower(ch))
+      return CLASS_LOWER;
+   if (std::iswupper(ch))
+      return CLASS_UPPER;
+   return CLASS_OTHER;
+}
+
+ut::char_t PasswordRules::foldCase(ut::char_t ch)
+{
+   if (ch >= U('A') && ch <= U('Z'))
+      return ch + (U('a') - U('A'));
+   if (ch < 0x80)
+      return ch;
+   return static_cast<ut::char_t>(std::towlower(ch));
+}
+
+PasswordRules::Statistics PasswordRules::analyze(const ut::char_t* password, size_t passwordLength)
+{
+   Statistics stats;
+   stats.mLength = passwordLength;
+   uint32_t repeat = 0;
+   uint32_t sequence = 0;
+   int direction = 0;
+   ut::char_t previous = 0;
+   for (size_t i = 0; i < passwordLength; ++i)
+   {
+      ut::char_t ch = password[i];
+      stats.mClassMask |= getClass(ch);
+      ut::char_t folded = foldCase(ch);
+
+      repeat = (i > 0 && ch == password[i - 1]) ? repeat + 1 : 1;
+      stats.mLongestRepeat = std::max(stats.mLongestRepeat, repeat);
+
+      int step = i > 0 ? static_cast<int>(folded) - static_cast<int>(previous) : 0;
+      if ((step == 1 || step == -1) && step == direction)
+         ++sequence;
+      else if (step == 1 || step == -1)
+         sequence = 2; // a new run, possibly in the opposite direction
+      else
+         sequence = 1;
+      direction = step;
+      stats.mLongestSequence = std::max(stats.mLongestSequence, sequence);
+      previous = folded;
+   }
+   return stats;
+}
+
+/**
+* contains is a case insensitive search of the needle in the password, reversed searches the needle read backwards.
+* The strings are short (tens of characters), the naive search is faster than anything with a setup.
+*/
+bool PasswordRules::contains(const ut::char_t* password, size_t passwordLength, const ut::char_t* needle, size_t needleLength, bool reversed)
+{
+   if (needleLength == 0 || needleLength > passwordLength)
+      return false;
+
+   for (int pass = 0; pass < (reversed ? 2 : 1); ++pass)
+   {
+      for (size_t start = 0; start + needleLength <= passwordLength; ++start)
+      {
+         size_t k = 0;
+         for (; k < needleLength; ++k)
+         {
+            ut::char_t expected = pass == 0 ? needle[k] : needle[needleLength - 1 - k];
+            if (foldCase(password[start + k]) != foldCase(expected))
+               break;
+         }
+         if (k == needleLength)
+            return true;
+      }
+   }
+   return false;
+}
+
+/**
+* The full name is split to tokens the same way as by the AD complexity rule: by commas, periods, dashes,
+* underscores, number signs, spaces and tabs.
+*/
+bool PasswordRules::containsFullNameToken(const ut::char_t* password, size_t passwordLength, const ut::char_t* fullName, size_t fullNameLength,
+   uint32_t minTokenLength, bool reversed)
+{
+   auto isDelimiter = [](ut::char_t ch)
+   {
+      return ch == U(',') || ch == U('.') || ch == U('-') || ch == U('_') || ch == U('#') || ch == U(' ') || ch == U('\t');
+   };
+
+   size_t tokenStart = 0;
+   for (size_t i = 0; i <= fullNameLength; ++i)
+   {
+      if (i < fullNameLength && !isDelimiter(fullName[i]))
+         continue;
+      size_t tokenLength = i - tokenStart;
+      if (tokenLength >= minTokenLength && contains(password, passwordLength, fullName + tokenStart, tokenLength, reversed))
+         return true;
+      tokenStart = i + 1;
+   }
+   return false;
+}
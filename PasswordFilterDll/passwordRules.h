@@ -0,0 +1,104 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cpprest/json.h>
+
+namespace ut = utility;
+namespace wj = web::json;
+
+
+/**
+* PasswordRules holds the "localRules" configuration object compiled into a flat program.
+* The rules are checked in PasswordFilter before IdM is called (also in the offline mode), so a password
+* which breaks a local rule never costs a round trip. Supported rule types:
+*   length             - "min" and "max" (0 = unlimited) number of characters
+*   characterClasses   - at least "minClasses" of "classes" (lower, upper, digit, special, other) have to be present
+*   maxRepeat          - no character repeated more than "max" times in a row
+*   maxSequence        - no ascending or descending run (abcd, 4321) longer than "max" characters
+*   notContainAccount  - the password must not contain the account name (case insensitive) if it has at least "minLength" characters
+*   notContainFullName - the password must not contain any token of FullName which has at least "minTokenLength" characters
+* The containment rules check the reversed name too when "reversed" is true.
+* Evaluation makes a single pass over the password for the statistics and then runs the program,
+* it doesn't allocate. The strings are passed as pointers and lengths (in characters), so the UNICODE_STRING
+* arguments of the entry points are evaluated in place. The object is immutable, a configuration reload replaces it as a whole.
+*/
+class PasswordRules
+{
+public:
+   static constexpr int sPassed = -1;
+
+private:
+   enum opcode : uint8_t
+   {
+      OP_LENGTH,
+      OP_CHARACTER_CLASSES,
+      OP_MAX_REPEAT,
+      OP_MAX_SEQUENCE,
+      OP_NOT_CONTAIN_ACCOUNT,
+      OP_NOT_CONTAIN_FULL_NAME
+   };
+
+   enum characterClass : uint32_t
+   {
+      CLASS_LOWER = 1,
+      CLASS_UPPER = 2,
+      CLASS_DIGIT = 4,
+      CLASS_SPECIAL = 8,
+      CLASS_OTHER = 16
+   };
+
+   struct Instruction
+   {
+      opcode mOp;
+      bool mFlag;
+      uint32_t mA;
+      uint32_t mB;
+   };
+
+   struct Statistics
+   {
+      size_t mLength = 0;
+      uint32_t mClassMask = 0;
+      uint32_t mLongestRepeat = 0;
+      uint32_t mLongestSequence = 0;
+   };
+
+   // JSON keys
+   static inline const ut::string_t sEnabledKey{ U("enabled") };
+   static inline const ut::string_t sRulesKey{ U("rules") };
+   static inline const ut::string_t sNameKey{ U("name") };
+   static inline const ut::string_t sTypeKey{ U("type") };
+   static inline const ut::string_t sMinKey{ U("min") };
+   static inline const ut::string_t sMaxKey{ U("max") };
+   static inline const ut::string_t sClassesKey{ U("classes") };
+   static inline const ut::string_t sMinClassesKey{ U("minClasses") };
+   static inline const ut::string_t sMinLengthKey{ U("minLength") };
+   static inline const ut::string_t sMinTokenLengthKey{ U("minTokenLength") };
+   static inline const ut::string_t sReversedKey{ U("reversed") };
+
+   bool mEnabled = false;
+   std::vector<Instruction> mProgram;
+   std::vector<std::string> mRuleNames; // parallel to mProgram
+   std::vector<std::string> mRuleDescriptions; // parallel to mProgram
+
+   static Instruction compileRule(const wj::value& ruleObj, std::string& description);
+   static uint32_t parseClasses(const wj::value& classesArr);
+   static uint32_t getClass(ut::char_t ch);
+   static ut::char_t foldCase(ut::char_t ch);
+   static Statistics analyze(const ut::char_t* password, size_t passwordLength);
+   static bool contains(const ut::char_t* password, size_t passwordLength, const ut::char_t* needle, size_t needleLength, bool reversed);
+   static bool containsFullNameToken(const ut::char_t* password, size_t passwordLength, const ut::char_t* fullName, size_t fullNameLength,
+      uint32_t minTokenLength, bool reversed);
+
+public:
+   static std::shared_ptr<const PasswordRules> create(const wj::value* localRulesObj);
+
+   bool getEnabled() const { return mEnabled && !mProgram.empty(); }
+   int evaluate(const ut::char_t* password, size_t passwordLength, const ut::char_t* accountName, size_t accountNameLength,
+      const ut::char_t* fullName, size_t fullNameLength) const;
+   size_t getRuleCount() const { return mProgram.size(); }
+   const std::string& getRuleName(size_t idx) const { return mRuleNames[idx]; }
+   const std::string& getRuleDescription(size_t idx) const { return mRuleDescriptions[idx]; }
+};
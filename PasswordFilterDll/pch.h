@@ -20,6 +20,8 @@
 #include <cwctype>
 #include <iomanip>
 #include <filesystem>
+#include <chrono>
+#include <atomic>
 
 
 #endif //PCH_H
@@ -0,0 +1,36 @@
+#include "pch.h"
+#include "processRole.h"
+#include "textCodec.h"
+
+
+const wchar_t* ProcessRole::getSuffix() const
+{
+   switch (get())
+   {
+   case ROLE_WORKER:
+      return L".Worker";
+   case ROLE_PRECHECK:
+      return L".Precheck";
+   default:
+      return L"";
+   }
+}
+
+/**
+* decorate returns e.g. PasswordFilterLog.Worker for the worker, the base name itself in LSASS.
+*/
+std::wstring ProcessRole::decorate(const std::wstring& baseName) const
+{
+   return baseName + getSuffix();
+}
+
+std::string ProcessRole::decoratePath(const std::string& path) const
+{
+   std::string suffix = TextCodec::toUtf8(std::wstring(getSuffix()));
+   size_t nameStart = path.find_last_of("/\\");
+   nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+   size_t dot = path.find_last_of('.');
+   if (dot == std::string::npos || dot <= nameStart)
+      dot = path.size();
+   return path.substr(0, dot) + suffix + path.substr(dot);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+
+/**
+* ProcessRole tells which process has loaded the DLL. It is LSASS unless PasswordFilterApp sets another role
+* before the filter is initialized, the role is fixed then.
+* Another process must not touch the files of LSASS: its log file, log segments and traffic record get the name
+* of the role in their names, it leaves the segments of previous runs alone and it doesn't open the control channel.
+* The precheck decides every call itself: it never forwards to the network worker and never goes offline,
+* so its answers are the real decisions of the rules and IdM.
+*/
+class ProcessRole
+{
+public:
+   enum role : uint32_t
+   {
+      ROLE_LSASS = 0,
+      ROLE_WORKER = 1,
+      ROLE_PRECHECK = 2
+   };
+
+private:
+   std::atomic<role> mRole = ROLE_LSASS;
+
+   const wchar_t* getSuffix() const;
+
+public:
+   void set(role value) { mRole.store(value); }
+   role get() const { return mRole.load(); }
+   bool isLsass() const { return get() == ROLE_LSASS; }
+   bool isLocalOnly() const { return get() == ROLE_PRECHECK; }
+   std::wstring decorate(const std::wstring& baseName) const;
+   std::string decoratePath(const std::string& path) const; // the role goes before the extension
+};
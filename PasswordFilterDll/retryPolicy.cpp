@@ -0,0 +1,125 @@
+#include "pch.h"
+#include <algorithm>
+#include <random>
+#include "retryPolicy.h"
+#include "configuration.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+std::atomic<int64_t> RetryPolicy::sBudgetMilliTokens = 10 * RetryPolicy::sMilliTokensPerRetry; // static def
+
+/**
+* create builds the policy from the "retryPolicy" configuration object.
+* Missing object or missing items keep the defaults.
+*/
+std::shared_ptr<const RetryPolicy> RetryPolicy::create(const wj::value* retryPolicyObj)
+{
+   auto policy = std::make_shared<RetryPolicy>();
+   if (retryPolicyObj == nullptr)
+      return policy;
+
+   const wj::value& obj = *retryPolicyObj;
+   if (obj.has_array_field(sRetryStatusCodesKey))
+   {
+      policy->mRetryStatusCodes.clear();
+      for (const wj::value& code : obj.at(sRetryStatusCodesKey).as_array())
+         policy->mRetryStatusCodes.push_back(static_cast<wh::status_code>(code.as_number().to_uint32()));
+   }
+   if (obj.has_boolean_field(sRetryOnExceptionKey))
+      policy->mRetryOnException = obj.at(sRetryOnExceptionKey).as_bool();
+   if (obj.has_integer_field(sBaseDelayMsKey))
+      policy->mBaseDelayMs = obj.at(sBaseDelayMsKey).as_number().to_uint32();
+   if (obj.has_integer_field(sMaxDelayMsKey))
+      policy->mMaxDelayMs = obj.at(sMaxDelayMsKey).as_number().to_uint32();
+   if (obj.has_integer_field(sBudgetPercentKey))
+      policy->mBudgetPercent = obj.at(sBudgetPercentKey).as_number().to_uint32();
+   if (obj.has_integer_field(sBudgetMaxRetriesKey))
+      policy->mBudgetMaxRetries = obj.at(sBudgetMaxRetriesKey).as_number().to_uint32();
+
+   if (policy->mMaxDelayMs < policy->mBaseDelayMs)
+      policy->mMaxDelayMs = policy->mBaseDelayMs;
+   return policy;
+}
+
+bool RetryPolicy::isRetryableStatus(wh::status_code code) const
+{
+   return std::find(mRetryStatusCodes.begin(), mRetryStatusCodes.end(), code) != mRetryStatusCodes.end();
+}
+
+/**
+* getBackoffDelay returns how long to wait before the retryNo-th retry (counted from 1).
+* The delay is drawn uniformly from [0, min(maxDelayMs, baseDelayMs * 2^(retryNo-1))].
+* Retry-After from IdM (retryAfterMs >= 0) raises the delay; if it exceeds maxDelayMs
+* a negative value is returned which means the endpoint is not supposed to be retried.
+*/
+std::chrono::milliseconds RetryPolicy::getBackoffDelay(uint32_t retryNo, int64_t retryAfterMs) const
+{
+   thread_local std::mt19937 gen{ std::random_device{}() };
+
+   if (retryAfterMs > static_cast<int64_t>(mMaxDelayMs))
+      return std::chrono::milliseconds(-1);
+
+   uint32_t shift = std::min<uint32_t>(retryNo > 0 ? retryNo - 1 : 0, 20);
+   uint64_t ceiling = std::min<uint64_t>(static_cast<uint64_t>(mBaseDelayMs) << shift, mMaxDelayMs);
+   std::uniform_int_distribution<uint64_t> dis(0, ceiling);
+   int64_t delay = static_cast<int64_t>(dis(gen));
+   return std::chrono::milliseconds(std::max(delay, retryAfterMs));
+}
+
+void RetryPolicy::recordRequest() const
+{
+   const int64_t max = static_cast<int64_t>(mBudgetMaxRetries) * sMilliTokensPerRetry;
+   const int64_t deposit = static_cast<int64_t>(mBudgetPercent) * sMilliTokensPerRetry / 100;
+   int64_t current = sBudgetMilliTokens.load(std::memory_order_relaxed);
+   int64_t wanted;
+   do
+   {
+      wanted = std::min(current + deposit, max);
+      if (wanted <= current)
+         return;
+   } while (!sBudgetMilliTokens.compare_exchange_weak(current, wanted, std::memory_order_relaxed));
+}
+
+bool RetryPolicy::tryAcquireRetry() const
+{
+   int64_t current = sBudgetMilliTokens.load(std::memory_order_relaxed);
+   do
+   {
+      if (current < sMilliTokensPerRetry)
+         return false;
+   } while (!sBudgetMilliTokens.compare_exchange_weak(current, current - sMilliTokensPerRetry, std::memory_order_relaxed));
+   return true;
+}
+
+void RetryPolicy::printContent() const
+{
+   std::string codes;
+   for (wh::status_code code : mRetryStatusCodes)
+      codes += (codes.empty() ? "" : ", ") + std::to_string(code);
+   gLogger.log(Logger::DEBUG(), "retryPolicy: retryStatusCodes: [%s], retryOnException: %s, baseDelayMs: %u, maxDelayMs: %u, budgetPercent: %u, budgetMaxRetries: %u",
+      codes.c_str(), mRetryOnException ? "true" : "false", mBaseDelayMs, mMaxDelayMs, mBudgetPercent, mBudgetMaxRetries);
+}
+
+/**
+* parseRetryAfterMs reads the Retry-After header in both allowed forms - delay in seconds or HTTP date.
+* Returns -1 when the header is missing or can't be parsed.
+*/
+int64_t RetryPolicy::parseRetryAfterMs(const wh::http_headers& headers)
+{
+   ut::string_t value;
+   if (!headers.match(U("Retry-After"), value) || value.empty())
+      return -1;
+
+   if (std::all_of(value.begin(), value.end(), [](ut::char_t ch) { return ch >= U('0') && ch <= U('9'); }))
+      return value.size() > 9 ? -1 : std::stoll(value) * 1000;
+
+   ut::datetime date = ut::datetime::from_string(value, ut::datetime::RFC_1123);
+   if (!date.is_initialized())
+      return -1;
+   ut::datetime::interval_type retryAt = date.to_interval(); // 100ns ticks
+   ut::datetime::interval_type now = ut::datetime::utc_now().to_interval();
+   return retryAt > now ? static_cast<int64_t>((retryAt - now) / 10000) : 0;
+}
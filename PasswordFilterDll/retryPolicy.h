@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cpprest/http_client.h>
+#include <cpprest/json.h>
+
+namespace wh = web::http;
+namespace wj = web::json;
+namespace ut = utility;
+
+
+/**
+* RetryPolicy decides whether a failed attempt to reach IdM is worth repeating and how long to wait before it.
+* - classification: http status codes listed in retryStatusCodes and (optionally) connection exceptions are retryable,
+*   everything else is final for the endpoint
+* - backoff: exponential with full jitter, so many DCs don't retry in lockstep; Retry-After sent by IdM is honoured
+* - budget: retries on the same endpoint are allowed only while the process wide budget has tokens.
+*   Every new request deposits budgetPercent/100 of a token, every retry withdraws one token,
+*   so the retries can't multiply the load during an outage. Failover to the next endpoint is not a retry.
+* The policy is immutable, a configuration reload replaces it as a whole. The budget survives reloads.
+*/
+class RetryPolicy
+{
+private:
+   // JSON keys
+   static inline const ut::string_t sRetryStatusCodesKey{ U("retryStatusCodes") };
+   static inline const ut::string_t sRetryOnExceptionKey{ U("retryOnException") };
+   static inline const ut::string_t sBaseDelayMsKey{ U("baseDelayMs") };
+   static inline const ut::string_t sMaxDelayMsKey{ U("maxDelayMs") };
+   static inline const ut::string_t sBudgetPercentKey{ U("budgetPercent") };
+   static inline const ut::string_t sBudgetMaxRetriesKey{ U("budgetMaxRetries") };
+
+   static constexpr int64_t sMilliTokensPerRetry = 1000;
+   static std::atomic<int64_t> sBudgetMilliTokens;
+
+   std::vector<wh::status_code> mRetryStatusCodes{ 408, 429, 502, 503, 504 };
+   bool mRetryOnException = true;
+   uint32_t mBaseDelayMs = 200;
+   uint32_t mMaxDelayMs = 5000;
+   uint32_t mBudgetPercent = 20;
+   uint32_t mBudgetMaxRetries = 10;
+
+public:
+   static std::shared_ptr<const RetryPolicy> create(const wj::value* retryPolicyObj);
+
+   bool isRetryableStatus(wh::status_code code) const;
+   bool getRetryOnException() const { return mRetryOnException; }
+   std::chrono::milliseconds getBackoffDelay(uint32_t retryNo, int64_t retryAfterMs) const;
+
+   void recordRequest() const;
+   bool tryAcquireRetry() const;
+   void printContent() const;
+
+   static int64_t parseRetryAfterMs(const wh::http_headers& headers);
+   static double getBudgetRetries() { return static_cast<double>(sBudgetMilliTokens.load(std::memory_order_relaxed)) / sMilliTokensPerRetry; }
+};
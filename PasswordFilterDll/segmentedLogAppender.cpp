@@ -0,0 +1,294 @@
+#include "pch.h"
+#include <algorithm>
+#include "segmentedLogAppender.h"
+#include "housekeeper.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Housekeeper gHousekeeper;
+
+///////////////// SegmentedLogAppender::Segment //////////////////////////////
+
+SegmentedLogAppender::Segment::~Segment()
+{
+   if (mView != nullptr)
+      UnmapViewOfFile(mView);
+   if (mMapping != nullptr)
+      CloseHandle(mMapping);
+   if (mFile != INVALID_HANDLE_VALUE)
+      CloseHandle(mFile);
+}
+
+///////////////// SegmentedLogAppender //////////////////////////////
+
+SegmentedLogAppender::SegmentedLogAppender(const std::string& name, const fs::path& folder, const std::wstring& baseName, bool sealLeftovers)
+   : log4cpp::LayoutAppender(name), mFolder(folder), mBaseName(baseName), mSealLeftovers(sealLeftovers)
+{
+}
+
+/**
+* reconfigure is called on every configuration (re)load.
+* A change of the segment size retires the current segments, the next message starts a new one.
+* The first enabling queues the segments left by the previous run for sealing.
+*/
+void SegmentedLogAppender::reconfigure(bool enabled, uint32_t segmentSizeMb, uint32_t maxTotalMb, uint32_t maxAgeDays)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   size_t segmentSize = static_cast<size_t>(std::max(1u, segmentSizeMb)) << 20;
+   if (!enabled || segmentSize != mSegmentSize)
+   {
+      mWritable.store(false, std::memory_order_release);
+      retire(std::move(mActive));
+      retire(std::move(mSpare));
+   }
+   if (enabled && !mLeftoversQueued)
+   {
+      for (const LogSegment::FileInfo& info : LogSegment::list(mFolder, mBaseName))
+      {
+         mNextSequence = std::max(mNextSequence, info.mSequence + 1);
+         if (info.mCompressed || !mSealLeftovers)
+            continue;
+         auto leftover = std::make_unique<Segment>();
+         leftover->mPath = info.mPath;
+         mSealQueue.push_back(std::move(leftover));
+      }
+      mLeftoversQueued = true;
+   }
+
+   mEnabled = enabled;
+   mSegmentSize = segmentSize;
+   mMaxTotalBytes = static_cast<uint64_t>(maxTotalMb) << 20;
+   mMaxAge = std::chrono::hours(24) * maxAgeDays;
+   mSpareRetryAt = std::chrono::steady_clock::time_point();
+   if (enabled)
+   {
+      mWritable.store(true, std::memory_order_release);
+      if (!mMaintenanceScheduled)
+      {
+         mMaintenanceScheduled = true;
+         gHousekeeper.schedule("logSegments", std::chrono::milliseconds(0), [this]() { return maintain(); });
+      }
+      requestMaintenance();
+   }
+   mCondition.notify_all();
+}
+
+void SegmentedLogAppender::_append(const log4cpp::LoggingEvent& event)
+{
+   write(event);
+}
+
+/**
+* write copies the formatted message into the active segment. A message longer than a whole segment is cut.
+* It returns false when the storage is disabled or no segment can be created, the caller writes the message elsewhere.
+*/
+bool SegmentedLogAppender::write(const log4cpp::LoggingEvent& event)
+{
+   std::string message = _getLayout().format(event);
+   std::unique_lock<std::mutex> lock(mMutex);
+   if (!mEnabled)
+      return false;
+   if ((!mActive || mActive->mUsed + message.size() > mActive->mCapacity) && !roll(lock))
+      return false;
+
+   size_t size = static_cast<size_t>(std::min<uint64_t>(message.size(), mActive->mCapacity - mActive->mUsed));
+   memcpy(mActive->mView + LogSegment::sHeaderSize + mActive->mUsed, message.data(), size);
+   mActive->mUsed += size;
+   std::atomic_thread_fence(std::memory_order_release); // a reader never sees the size before the lines
+   mActive->getHeader()->mDataSize = mActive->mUsed;
+   return true;
+}
+
+/**
+* roll replaces the active segment by the spare prepared by the maintenance.
+* Only when there is no spare (the first message, a change of the size) the segment is created here.
+*/
+bool SegmentedLogAppender::roll(std::unique_lock<std::mutex>& lock)
+{
+   if (mActive && mActive->mUsed == 0)
+      return true; // an empty segment is not replaced, the message is cut instead
+
+   retire(std::move(mActive));
+   mCondition.wait(lock, [this]() { return !mSparePending; });
+   if (mSpare)
+   {
+      mActive = std::move(mSpare);
+      requestMaintenance(); // the next spare
+   }
+   else if (std::chrono::steady_clock::now() >= mSpareRetryAt)
+   {
+      uint64_t sequence = mNextSequence++;
+      mActive = createSegment(LogSegment::getPath(mFolder, mBaseName, sequence), sequence, mSegmentSize);
+      if (!mActive)
+         mSpareRetryAt = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+   }
+   mWritable.store(mActive != nullptr, std::memory_order_release); // the rolling file takes over until a segment is created
+   mCondition.notify_all();
+   return mActive != nullptr;
+}
+
+void SegmentedLogAppender::retire(std::unique_ptr<Segment> segment)
+{
+   if (!segment)
+      return;
+   mSealQueue.push_back(std::move(segment));
+   requestMaintenance();
+}
+
+/**
+* requestMaintenance plans an immediate maintenance run unless one is planned already, it's called with mMutex locked.
+*/
+void SegmentedLogAppender::requestMaintenance()
+{
+   if (!mMaintenanceScheduled || mMaintenanceRequested)
+      return;
+   mMaintenanceRequested = true;
+   gHousekeeper.schedule("logSegmentsNow", std::chrono::milliseconds(0), [this]()
+      {
+         maintain();
+         return Housekeeper::sDone;
+      });
+}
+
+std::unique_ptr<SegmentedLogAppender::Segment> SegmentedLogAppender::createSegment(const fs::path& path, uint64_t sequence, size_t size)
+{
+   auto segment = std::make_unique<Segment>();
+   segment->mPath = path;
+   segment->mFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (segment->mFile == INVALID_HANDLE_VALUE)
+      return nullptr;
+
+   // the mapping extends the file to its full size, so appends never grow it
+   uint64_t fileSize = LogSegment::sHeaderSize + static_cast<uint64_t>(size);
+   segment->mMapping = CreateFileMappingW(segment->mFile, nullptr, PAGE_READWRITE, static_cast<DWORD>(fileSize >> 32), static_cast<DWORD>(fileSize), nullptr);
+   if (segment->mMapping == nullptr)
+      return nullptr;
+   segment->mView = static_cast<char*>(MapViewOfFile(segment->mMapping, FILE_MAP_WRITE, 0, 0, 0));
+   if (segment->mView == nullptr)
+      return nullptr;
+
+   LogSegment::Header* header = segment->getHeader();
+   memcpy(header->mMagic, LogSegment::sMagic, sizeof(header->mMagic));
+   header->mSequence = sequence;
+   header->mCreatedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+   header->mDataSize = 0;
+   segment->mCapacity = size;
+   return segment;
+}
+
+/**
+* maintain seals the retired segments, keeps a spare segment ready and applies the retention, it returns the delay
+* of the next periodic run. The lock is never held during the file operations.
+*/
+std::chrono::milliseconds SegmentedLogAppender::maintain()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   mMaintenanceRequested = false;
+   while (true)
+   {
+      auto now = std::chrono::steady_clock::now();
+      if (!mSealQueue.empty())
+      {
+         std::unique_ptr<Segment> segment = std::move(mSealQueue.front());
+         mSealQueue.pop_front();
+         lock.unlock();
+         fs::path path = segment->mPath;
+         segment.reset(); // unmaps and closes the segment
+         try
+         {
+            LogSegment::seal(path);
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::WARN(), "The log segment %s can't be compressed: %s", path.string().c_str(), e.what());
+         }
+         lock.lock();
+         continue;
+      }
+
+      if (mEnabled && !mSpare && now >= mSpareRetryAt)
+      {
+         mSparePending = true;
+         uint64_t sequence = mNextSequence++;
+         size_t size = mSegmentSize;
+         lock.unlock();
+         std::unique_ptr<Segment> spare = createSegment(LogSegment::getPath(mFolder, mBaseName, sequence), sequence, size);
+         DWORD error = GetLastError();
+         lock.lock();
+         mSparePending = false;
+         if (!spare)
+         {
+            mSpareRetryAt = now + std::chrono::seconds(10);
+            lock.unlock();
+            gLogger.log(Logger::ERROR(), "The log segment %010llu can't be created in %s, error %u", static_cast<unsigned long long>(sequence), mFolder.string().c_str(), error);
+            lock.lock();
+         }
+         else if (!mEnabled || size != mSegmentSize)
+            mSealQueue.push_back(std::move(spare)); // reconfigured in the meantime, sealed by this run
+         else
+         {
+            mSpare = std::move(spare);
+            mWritable.store(true, std::memory_order_release);
+         }
+         mCondition.notify_all();
+         continue;
+      }
+
+      if (now >= mNextRetention)
+      {
+         uint64_t maxTotalBytes = mMaxTotalBytes;
+         std::chrono::seconds maxAge = mMaxAge;
+         lock.unlock();
+         applyRetention(maxTotalBytes, maxAge);
+         lock.lock();
+         mNextRetention = now + sRetentionPeriod;
+         continue;
+      }
+
+      auto wakeUp = mNextRetention;
+      if (mEnabled && !mSpare)
+         wakeUp = std::min(wakeUp, mSpareRetryAt);
+      return std::chrono::ceil<std::chrono::milliseconds>(std::max<std::chrono::steady_clock::duration>(wakeUp - now, std::chrono::steady_clock::duration::zero()));
+   }
+}
+
+/**
+* applyRetention removes the oldest compressed segments over maxTotalBytes and those older than maxAge (0 = no limit).
+*/
+void SegmentedLogAppender::applyRetention(uint64_t maxTotalBytes, std::chrono::seconds maxAge)
+{
+   std::vector<LogSegment::FileInfo> segments = LogSegment::list(mFolder, mBaseName);
+   auto now = fs::file_time_type::clock::now();
+   uint64_t total = 0;
+   for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+   {
+      if (!it->mCompressed)
+         continue;
+      std::error_code ec;
+      total += fs::file_size(it->mPath, ec);
+      bool tooOld = maxAge.count() > 0 && now - fs::last_write_time(it->mPath, ec) > maxAge;
+      if ((maxTotalBytes > 0 && total > maxTotalBytes) || tooOld)
+      {
+         if (fs::remove(it->mPath, ec))
+            gLogger.log(Logger::INFO(), "The log segment %s has been removed by the retention", it->mPath.string().c_str());
+      }
+   }
+}
+
+/**
+* reopen writes the dirty pages of the active segment to the disk.
+*/
+bool SegmentedLogAppender::reopen()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mActive)
+      FlushViewOfFile(mActive->mView, 0);
+   return true;
+}
+
+void SegmentedLogAppender::close()
+{
+   reopen();
+}
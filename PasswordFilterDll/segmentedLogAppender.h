@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include "log4cpp/LayoutAppender.hh"
+#include "logSegment.h"
+
+
+/**
+* SegmentedLogAppender writes the log file lines into memory-mapped segments (see LogSegment) instead of a rolling text file.
+* - an append is a copy into the mapped view, the memory manager writes the pages to the disk lazily
+* - segments are pre-allocated by the maintenance, so a full segment is replaced by a ready one without any I/O
+* - full segments are compressed by the maintenance, which also removes the oldest compressed segments
+*   when they exceed maxTotalMb or are older than maxAgeDays
+* The maintenance is a Housekeeper job, run periodically and as soon as a segment is retired or the spare is taken.
+* Segments left by a previous run are sealed when the storage is enabled, unless sealLeftovers is off (a process
+* other than LSASS never knows whether another instance of it still writes them).
+*/
+class SegmentedLogAppender : public log4cpp::LayoutAppender
+{
+private:
+   struct Segment
+   {
+      HANDLE mFile = INVALID_HANDLE_VALUE;
+      HANDLE mMapping = nullptr;
+      char* mView = nullptr;
+      size_t mCapacity = 0; // bytes available for the lines
+      uint64_t mUsed = 0;
+      std::filesystem::path mPath;
+
+      ~Segment();
+      LogSegment::Header* getHeader() const { return reinterpret_cast<LogSegment::Header*>(mView); }
+   };
+
+   static constexpr std::chrono::seconds sRetentionPeriod{ 60 };
+
+   const std::filesystem::path mFolder;
+   const std::wstring mBaseName;
+   const bool mSealLeftovers;
+   std::mutex mMutex; // guards everything below
+   std::condition_variable mCondition;
+   bool mEnabled = false;
+   size_t mSegmentSize = 0;
+   uint64_t mMaxTotalBytes = 0;
+   std::chrono::seconds mMaxAge{ 0 };
+   uint64_t mNextSequence = 1;
+   std::unique_ptr<Segment> mActive;
+   std::unique_ptr<Segment> mSpare;
+   bool mSparePending = false; // the maintenance is creating the spare segment
+   std::chrono::steady_clock::time_point mSpareRetryAt;
+   std::deque<std::unique_ptr<Segment>> mSealQueue; // retired segments and segments left by a previous run
+   bool mLeftoversQueued = false;
+   std::atomic<bool> mWritable = false; // enabled and a segment is (or will be) available
+   bool mMaintenanceScheduled = false;
+   bool mMaintenanceRequested = false; // an immediate run is planned
+   std::chrono::steady_clock::time_point mNextRetention;
+
+   static std::unique_ptr<Segment> createSegment(const std::filesystem::path& path, uint64_t sequence, size_t size);
+   void retire(std::unique_ptr<Segment> segment);
+   bool roll(std::unique_lock<std::mutex>& lock);
+   void requestMaintenance();
+   std::chrono::milliseconds maintain();
+   void applyRetention(uint64_t maxTotalBytes, std::chrono::seconds maxAge);
+
+protected:
+   void _append(const log4cpp::LoggingEvent& event) override;
+
+public:
+   SegmentedLogAppender(const std::string& name, const std::filesystem::path& folder, const std::wstring& baseName, bool sealLeftovers);
+   void reconfigure(bool enabled, uint32_t segmentSizeMb, uint32_t maxTotalMb, uint32_t maxAgeDays);
+   bool isWritable() const { return mWritable.load(std::memory_order_acquire); }
+   bool write(const log4cpp::LoggingEvent& event); // false = not written, no segment is available
+   bool reopen() override;
+   void close() override;
+};
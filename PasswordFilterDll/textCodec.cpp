@@ -0,0 +1,299 @@
+#include "pch.h"
+#include <algorithm>
+#include <immintrin.h>
+#include "textCodec.h"
+#include "allocationAccounting.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PWF_TARGET_AVX2
+#else
+#define PWF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static_assert(sizeof(ut::char_t) == sizeof(char16_t), "ut::string_t is expected to be UTF-16");
+
+namespace
+{
+   const char16_t sReplacementChar = 0xFFFD;
+   const size_t sScalarRun = 32; // code units converted by the scalar loop before the fast path is tried again
+
+   ///////////////// ASCII fast paths //////////////////////////////
+   // Each of them converts whole blocks while the block is pure ASCII and returns the number of converted code units.
+
+   size_t asciiUtf16ToUtf8Sse2(const char16_t* src, size_t length, char* dst)
+   {
+      const __m128i nonAsciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+      const __m128i zero = _mm_setzero_si128();
+      size_t i = 0;
+      for (; i + 16 <= length; i += 16)
+      {
+         __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+         __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+         __m128i nonAscii = _mm_and_si128(_mm_or_si128(lo, hi), nonAsciiMask);
+         if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, zero)) != 0xFFFF)
+            break;
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+      }
+      return i;
+   }
+
+   PWF_TARGET_AVX2 size_t asciiUtf16ToUtf8Avx2(const char16_t* src, size_t length, char* dst)
+   {
+      const __m256i nonAsciiMask = _mm256_set1_epi16(static_cast<short>(0xFF80));
+      size_t i = 0;
+      for (; i + 32 <= length; i += 32)
+      {
+         __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+         __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+         if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), nonAsciiMask))
+            break;
+         // packus works within 128 bit lanes, the permutation puts the quadwords back in order
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+      }
+      return i;
+   }
+
+   size_t asciiUtf8ToUtf16Sse2(const char* src, size_t length, char16_t* dst)
+   {
+      const __m128i zero = _mm_setzero_si128();
+      size_t i = 0;
+      for (; i + 16 <= length; i += 16)
+      {
+         __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+         if (_mm_movemask_epi8(bytes) != 0)
+            break;
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(bytes, zero));
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(bytes, zero));
+      }
+      return i;
+   }
+
+   PWF_TARGET_AVX2 size_t asciiUtf8ToUtf16Avx2(const char* src, size_t length, char16_t* dst)
+   {
+      size_t i = 0;
+      for (; i + 32 <= length; i += 32)
+      {
+         __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+         if (_mm256_movemask_epi8(bytes) != 0)
+            break;
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+      }
+      return i;
+   }
+
+   ///////////////// scalar conversion of one code point //////////////////////////////
+
+   /**
+   * Converts the code point starting at src[i], returns the number of consumed UTF-16 code units.
+   */
+   size_t codePointUtf16ToUtf8(const char16_t* src, size_t length, size_t i, char* dst, size_t& out)
+   {
+      uint32_t cp = src[i];
+      size_t consumed = 1;
+      if (cp >= 0xD800 && cp <= 0xDFFF)
+      {
+         if (cp <= 0xDBFF && i + 1 < length && src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF)
+         {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+            consumed = 2;
+         }
+         else
+         {
+            cp = sReplacementChar; // unpaired surrogate
+         }
+      }
+
+      if (cp < 0x80)
+      {
+         dst[out++] = static_cast<char>(cp);
+      }
+      else if (cp < 0x800)
+      {
+         dst[out++] = static_cast<char>(0xC0 | (cp >> 6));
+         dst[out++] = static_cast<char>(0x80 | (cp & 0x3F));
+      }
+      else if (cp < 0x10000)
+      {
+         dst[out++] = static_cast<char>(0xE0 | (cp >> 12));
+         dst[out++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+         dst[out++] = static_cast<char>(0x80 | (cp & 0x3F));
+      }
+      else
+      {
+         dst[out++] = static_cast<char>(0xF0 | (cp >> 18));
+         dst[out++] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+         dst[out++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+         dst[out++] = static_cast<char>(0x80 | (cp & 0x3F));
+      }
+      return consumed;
+   }
+
+   /**
+   * Converts the UTF-8 sequence starting at src[i], returns the number of consumed bytes.
+   * A malformed sequence (overlong, surrogate, out of range, truncated) consumes its lead byte only
+   * and produces one U+FFFD.
+   */
+   size_t codePointUtf8ToUtf16(const char* src, size_t length, size_t i, char16_t* dst, size_t& out)
+   {
+      const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+      uint32_t lead = s[i];
+      if (lead < 0x80)
+      {
+         dst[out++] = static_cast<char16_t>(lead);
+         return 1;
+      }
+
+      size_t size = 0;
+      uint32_t cp = 0;
+      uint32_t minimum = 0;
+      if ((lead & 0xE0) == 0xC0) { size = 2; cp = lead & 0x1F; minimum = 0x80; }
+      else if ((lead & 0xF0) == 0xE0) { size = 3; cp = lead & 0x0F; minimum = 0x800; }
+      else if ((lead & 0xF8) == 0xF0) { size = 4; cp = lead & 0x07; minimum = 0x10000; }
+
+      bool valid = size != 0 && i + size <= length;
+      for (size_t k = 1; valid && k < size; ++k)
+      {
+         if ((s[i + k] & 0xC0) != 0x80)
+            valid = false;
+         else
+            cp = (cp << 6) | (s[i + k] & 0x3F);
+      }
+      if (!valid || cp < minimum || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+      {
+         dst[out++] = sReplacementChar;
+         return 1;
+      }
+
+      if (cp < 0x10000)
+      {
+         dst[out++] = static_cast<char16_t>(cp);
+      }
+      else
+      {
+         cp -= 0x10000;
+         dst[out++] = static_cast<char16_t>(0xD800 + (cp >> 10));
+         dst[out++] = static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+      }
+      return size;
+   }
+
+   TextCodec::simdLevel detectSimdLevel()
+   {
+#if defined(_M_X64) || defined(__x86_64__)
+#ifdef _MSC_VER
+      int info[4] = {};
+      __cpuid(info, 0);
+      if (info[0] >= 7)
+      {
+         __cpuid(info, 1);
+         bool osxsave = (info[2] & (1 << 27)) != 0;
+         bool avx = (info[2] & (1 << 28)) != 0;
+         __cpuidex(info, 7, 0);
+         bool avx2 = (info[1] & (1 << 5)) != 0;
+         // the OS has to save the YMM registers on context switches
+         if (osxsave && avx && avx2 && (_xgetbv(0) & 0x6) == 0x6)
+            return TextCodec::SIMD_AVX2;
+      }
+#else
+      if (__builtin_cpu_supports("avx2"))
+         return TextCodec::SIMD_AVX2;
+#endif
+      return TextCodec::SIMD_SSE2; // SSE2 is a part of x64
+#else
+      return TextCodec::SIMD_NONE;
+#endif
+   }
+}
+
+TextCodec::simdLevel TextCodec::getSimdLevel()
+{
+   static const simdLevel sLevel = detectSimdLevel();
+   return sLevel;
+}
+
+const char* TextCodec::getSimdLevelName(simdLevel level)
+{
+   switch (level)
+   {
+   case SIMD_AVX2:
+      return "AVX2";
+   case SIMD_SSE2:
+      return "SSE2";
+   default:
+      return "scalar";
+   }
+}
+
+size_t TextCodec::utf16ToUtf8(const char16_t* src, size_t length, char* dst)
+{
+   return utf16ToUtf8(src, length, dst, getSimdLevel());
+}
+
+size_t TextCodec::utf8ToUtf16(const char* src, size_t length, char16_t* dst)
+{
+   return utf8ToUtf16(src, length, dst, getSimdLevel());
+}
+
+size_t TextCodec::utf16ToUtf8(const char16_t* src, size_t length, char* dst, simdLevel level)
+{
+   size_t in = 0;
+   size_t out = 0;
+   while (in < length)
+   {
+      size_t ascii = 0;
+      if (level == SIMD_AVX2)
+         ascii = asciiUtf16ToUtf8Avx2(src + in, length - in, dst + out);
+      else if (level == SIMD_SSE2)
+         ascii = asciiUtf16ToUtf8Sse2(src + in, length - in, dst + out);
+      in += ascii;
+      out += ascii;
+      size_t scalarEnd = std::min(length, in + sScalarRun);
+      while (in < scalarEnd)
+         in += codePointUtf16ToUtf8(src, length, in, dst, out);
+   }
+   return out;
+}
+
+size_t TextCodec::utf8ToUtf16(const char* src, size_t length, char16_t* dst, simdLevel level)
+{
+   size_t in = 0;
+   size_t out = 0;
+   while (in < length)
+   {
+      size_t ascii = 0;
+      if (level == SIMD_AVX2)
+         ascii = asciiUtf8ToUtf16Avx2(src + in, length - in, dst + out);
+      else if (level == SIMD_SSE2)
+         ascii = asciiUtf8ToUtf16Sse2(src + in, length - in, dst + out);
+      in += ascii;
+      out += ascii;
+      size_t scalarEnd = std::min(length, in + sScalarRun);
+      while (in < scalarEnd)
+         in += codePointUtf8ToUtf16(src, length, in, dst, out);
+   }
+   return out;
+}
+
+std::string TextCodec::toUtf8(const ut::string_t& str)
+{
+   PWF_ALLOC_COPY(str.size() * sizeof(str[0]));
+   std::string out(getMaxUtf8Size(str.size()), '\0');
+   out.resize(utf16ToUtf8(reinterpret_cast<const char16_t*>(str.data()), str.size(), &out[0]));
+   return out;
+}
+
+ut::string_t TextCodec::toUtf16(const std::string& str)
+{
+   return toUtf16(str.data(), str.size());
+}
+
+ut::string_t TextCodec::toUtf16(const char* src, size_t length)
+{
+   PWF_ALLOC_COPY(length);
+   ut::string_t out(getMaxUtf16Size(length), U('\0'));
+   out.resize(utf8ToUtf16(src, length, reinterpret_cast<char16_t*>(&out[0])));
+   return out;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <cpprest/asyncrt_utils.h>
+
+namespace ut = utility;
+
+
+/**
+* TextCodec converts between UTF-16 (ut::string_t) and UTF-8 in a single pass.
+* Runs of ASCII characters are converted by AVX2 (32 code units per step) or SSE2 (16 code units per step),
+* depending on the CPU, the rest by the scalar loop. Account names, URLs, status enums and JSON bodies
+* are ASCII almost always, so the scalar loop is the exception.
+* Invalid input (an unpaired surrogate, malformed UTF-8) is replaced by U+FFFD instead of throwing,
+* so a broken account name can't break the logging.
+* The buffer functions write into a caller provided buffer of at least getMaxUtf8Size / getMaxUtf16Size code units
+* and return the number of code units written.
+*/
+class TextCodec
+{
+public:
+   enum simdLevel
+   {
+      SIMD_NONE,
+      SIMD_SSE2,
+      SIMD_AVX2
+   };
+
+   static constexpr size_t getMaxUtf8Size(size_t utf16Length) { return utf16Length * 3; }
+   static constexpr size_t getMaxUtf16Size(size_t utf8Length) { return utf8Length; }
+
+   static size_t utf16ToUtf8(const char16_t* src, size_t length, char* dst);
+   static size_t utf8ToUtf16(const char* src, size_t length, char16_t* dst);
+   static size_t utf16ToUtf8(const char16_t* src, size_t length, char* dst, simdLevel level); // for the benchmark and tests
+   static size_t utf8ToUtf16(const char* src, size_t length, char16_t* dst, simdLevel level); // for the benchmark and tests
+
+   static std::string toUtf8(const ut::string_t& str);
+   static ut::string_t toUtf16(const std::string& str);
+   static ut::string_t toUtf16(const char* src, size_t length);
+
+   static simdLevel getSimdLevel();
+   static const char* getSimdLevelName(simdLevel level);
+};
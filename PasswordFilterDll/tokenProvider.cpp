@@ -0,0 +1,349 @@
+#include "pch.h"
+#include <algorithm>
+#include <dpapi.h>
+#include <cpprest/http_client.h>
+#include "tokenProvider.h"
+#include "configuration.h"
+#include "housekeeper.h"
+#include "logger.h"
+#include "textCodec.h"
+
+#pragma comment(lib, "Crypt32.lib")
+
+namespace wh = web::http;
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Configuration gConfiguration;
+extern Housekeeper gHousekeeper;
+
+///////////////// TokenSettings //////////////////////////////
+
+TokenSettings::~TokenSettings()
+{
+   SecureZeroMemory(mPassword.data(), mPassword.size() * sizeof(mPassword[0]));
+}
+
+/**
+* A missing object gives disabled settings, the static token of the configuration is used then.
+*/
+std::shared_ptr<const TokenSettings> TokenSettings::create(const wj::value* tokenObj)
+{
+   auto settings = std::make_shared<TokenSettings>();
+   if (tokenObj == nullptr)
+      return settings;
+
+   const wj::value& obj = *tokenObj;
+   if (obj.has_boolean_field(sEnabledKey))
+      settings->mEnabled = obj.at(sEnabledKey).as_bool();
+   if (obj.has_string_field(sUrlKey))
+      settings->mUrl = obj.at(sUrlKey).as_string();
+   if (obj.has_string_field(sUsernameKey))
+      settings->mUsername = obj.at(sUsernameKey).as_string();
+   if (obj.has_string_field(sPasswordKey))
+      settings->mPassword = obj.at(sPasswordKey).as_string();
+   if (obj.has_string_field(sTokenFieldKey))
+      settings->mTokenField = obj.at(sTokenFieldKey).as_string();
+   if (obj.has_integer_field(sLifetimeSecKey))
+      settings->mLifetimeSec = std::max(1u, obj.at(sLifetimeSecKey).as_number().to_uint32());
+   if (obj.has_integer_field(sRenewBeforeSecKey))
+      settings->mRenewBeforeSec = obj.at(sRenewBeforeSecKey).as_number().to_uint32();
+
+   if (settings->mEnabled && (settings->mUrl.empty() || settings->mUsername.empty()))
+      throw wj::json_exception("The tokenAuthentication requires url and username");
+   return settings;
+}
+
+void TokenSettings::printContent() const
+{
+   gLogger.log(Logger::DEBUG(), "tokenAuthentication: enabled: %s, url: %s, username: %s, password: EXCLUDED FROM LOG, tokenField: %s, lifetimeSec: %u, renewBeforeSec: %u",
+      mEnabled ? "true" : "false", Logger::w2s(mUrl).c_str(), Logger::w2s(mUsername).c_str(), Logger::w2s(mTokenField).c_str(), mLifetimeSec, mRenewBeforeSec);
+}
+
+///////////////// TokenProvider //////////////////////////////
+
+TokenProvider::Fetch::~Fetch()
+{
+   SecureZeroMemory(mToken.data(), mToken.size() * sizeof(mToken[0]));
+}
+
+/**
+* reconfigure is called on every configuration (re)load.
+* A change of the auth endpoint or of the credentials drops the current token.
+* The renewal job is planned on the enabling, it ends when the provider is disabled.
+*/
+void TokenProvider::reconfigure(std::shared_ptr<const TokenSettings> settings)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   bool changed = !mSettings || mSettings->getUrl() != settings->getUrl() || mSettings->getUsername() != settings->getUsername()
+      || mSettings->getPassword() != settings->getPassword() || mSettings->getTokenField() != settings->getTokenField();
+   if (changed || !settings->getEnabled())
+      clear();
+   mSettings = settings;
+   mLastFailure = std::chrono::steady_clock::time_point();
+   mEnabled.store(settings->getEnabled(), std::memory_order_release);
+   if (settings->getEnabled() && !mRenewalScheduled)
+   {
+      mRenewalScheduled = true;
+      gHousekeeper.schedule("tokenRenewal", std::chrono::milliseconds(0), [this]() { return renew(); });
+   }
+}
+
+/**
+* getToken returns the current token and its generation, it waits only when there is no valid token at all.
+* The generation is passed back to refreshAfterUnauthorized when IdM refuses the token.
+*/
+ut::string_t TokenProvider::getToken(uint64_t& generation)
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   auto now = std::chrono::steady_clock::now();
+   if ((mGeneration == 0 || now >= mExpiration) && !isFailureRecent(now))
+      fetch(lock);
+   generation = mGeneration;
+   return load();
+}
+
+/**
+* refreshAfterUnauthorized returns true when a token newer than the refused generation is available,
+* the caller repeats its request then. Concurrent callers refused with the same token share one fetch.
+*/
+bool TokenProvider::refreshAfterUnauthorized(uint64_t generation)
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   if (!isEnabled())
+      return false;
+   if (mGeneration != generation)
+      return mGeneration != 0;
+
+   auto now = std::chrono::steady_clock::now();
+   if (isFailureRecent(now) || (mGeneration != 0 && now - mObtained < sRetryAfterFailure))
+      return false; // IdM refuses even a fresh token, another fetch won't help
+   gLogger.log(Logger::WARN(), "IdM refused the token of the generation %llu, a new one is requested", static_cast<unsigned long long>(generation));
+   return fetch(lock) && mGeneration != generation;
+}
+
+int64_t TokenProvider::getSecondsToExpiration()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mGeneration == 0)
+      return -1;
+   return std::chrono::duration_cast<std::chrono::seconds>(mExpiration - std::chrono::steady_clock::now()).count();
+}
+
+/**
+* fetch obtains a new token, the lock is released during the request, so callers holding a valid token aren't blocked.
+* A caller which finds another fetch running waits for its result instead of starting its own.
+* Returns true when a token is available after the call.
+*/
+bool TokenProvider::fetch(std::unique_lock<std::mutex>& lock)
+{
+   if (mFetching)
+   {
+      mFetchCondition.wait(lock, [this]() { return !mFetching; });
+      return mGeneration != 0;
+   }
+
+   std::shared_ptr<Fetch> fetch = beginFetch();
+   if (!fetch)
+      return false;
+   lock.unlock();
+   bool success = requestTokenAsync(fetch).get();
+   lock.lock();
+   return completeFetch(*fetch, success);
+}
+
+/**
+* beginFetch marks a fetch as running, it's called with mMutex locked. Returns nullptr when the provider is disabled.
+*/
+std::shared_ptr<TokenProvider::Fetch> TokenProvider::beginFetch()
+{
+   if (!mSettings || !mSettings->getEnabled())
+      return nullptr;
+   auto fetch = std::make_shared<Fetch>();
+   fetch->mSettings = mSettings;
+   fetch->mLifetimeSec = mSettings->getLifetimeSec();
+   mFetching = true;
+   return fetch;
+}
+
+/**
+* completeFetch stores the fetched token and wakes the callers waiting for it, it's called with mMutex locked.
+*/
+bool TokenProvider::completeFetch(const Fetch& fetch, bool success)
+{
+   mFetching = false;
+   auto now = std::chrono::steady_clock::now();
+   if (success && mSettings == fetch.mSettings) // not reconfigured in the meantime
+   {
+      store(fetch.mToken);
+      ++mGeneration;
+      mObtained = now;
+      mExpiration = now + std::chrono::seconds(fetch.mLifetimeSec);
+      mLastFailure = std::chrono::steady_clock::time_point();
+      gLogger.log(Logger::INFO(), "A new IdM token of the generation %llu has been obtained, it expires in %u s", static_cast<unsigned long long>(mGeneration), fetch.mLifetimeSec);
+   }
+   else if (!success)
+      mLastFailure = now;
+
+   mFetchCondition.notify_all();
+   return success && mGeneration != 0;
+}
+
+/**
+* requestTokenAsync posts the credentials to the auth endpoint and reads the token from the configured field of the answer.
+* The lifetime is taken from the "expiresIn" field when IdM sends it. The task never fails, a failure is logged.
+* The continuations run on the threads of cpprest, a caller on the IoExecutor may wait for the task.
+*/
+cnc::task<bool> TokenProvider::requestTokenAsync(std::shared_ptr<Fetch> fetch)
+{
+   const TokenSettings& settings = *fetch->mSettings;
+   cnc::task<wh::http_response> requestTask;
+   try
+   {
+      wj::value body;
+      body[U("username")] = wj::value::string(settings.getUsername());
+      body[U("password")] = wj::value::string(settings.getPassword());
+      wh::http_request request(wh::methods::POST);
+      request.set_body(TextCodec::toUtf8(body.serialize()), "application/json");
+
+      wh::client::http_client_config clientConfig;
+      clientConfig.set_timeout(std::chrono::milliseconds(gConfiguration.getConnectionTimeoutMs()));
+      clientConfig.set_validate_certificates(!gConfiguration.getIgnoreCertificate());
+      auto client = std::make_shared<wh::client::http_client>(wh::uri(settings.getUrl()), clientConfig);
+      requestTask = client->request(request).then([client](wh::http_response response) { return response; });
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::ERROR(), "The IdM token request to %s failed: %s", Logger::w2s(settings.getUrl()).c_str(), e.what());
+      return cnc::task_from_result(false);
+   }
+
+   return requestTask.then([fetch](wh::http_response response)
+      {
+         const TokenSettings& settings = *fetch->mSettings;
+         if (response.status_code() != wh::status_codes::OK)
+         {
+            gLogger.log(Logger::ERROR(), "The IdM token request to %s returned with the http status: %u", Logger::w2s(settings.getUrl()).c_str(), response.status_code());
+            return cnc::task_from_result(false);
+         }
+         return response.extract_vector().then([fetch](std::vector<unsigned char> bytes)
+            {
+               const ut::string_t expiresInKey = U("expiresIn");
+               const TokenSettings& settings = *fetch->mSettings;
+               wj::value rootObj = wj::value::parse(TextCodec::toUtf16(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+               if (!rootObj.has_string_field(settings.getTokenField()) || rootObj.at(settings.getTokenField()).as_string().empty())
+               {
+                  gLogger.log(Logger::ERROR(), "The IdM token response doesn't contain the field %s", Logger::w2s(settings.getTokenField()).c_str());
+                  return false;
+               }
+               fetch->mToken = rootObj.at(settings.getTokenField()).as_string();
+               if (rootObj.has_integer_field(expiresInKey))
+                  fetch->mLifetimeSec = std::max(1u, rootObj.at(expiresInKey).as_number().to_uint32());
+               return true;
+            });
+      }).then([fetch](cnc::task<bool> responseTask)
+      {
+         try
+         {
+            return responseTask.get();
+         }
+         catch (const std::exception& e)
+         {
+            gLogger.log(Logger::ERROR(), "The IdM token request to %s failed: %s", Logger::w2s(fetch->mSettings->getUrl()).c_str(), e.what());
+            return false;
+         }
+      });
+}
+
+/**
+* renew is the Housekeeper job which fetches a new token renewBeforeSec (at most a half of the lifetime) before the
+* current one expires. It only starts the request and returns, so the other jobs don't wait for the auth endpoint.
+*/
+std::chrono::milliseconds TokenProvider::renew()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   if (!isEnabled() || !mSettings)
+   {
+      mRenewalScheduled = false;
+      return Housekeeper::sDone;
+   }
+
+   auto now = std::chrono::steady_clock::now();
+   auto due = now;
+   if (mGeneration != 0)
+   {
+      auto lifetime = mExpiration - mObtained;
+      auto renewBefore = std::min<std::chrono::steady_clock::duration>(std::chrono::seconds(mSettings->getRenewBeforeSec()), lifetime / 2);
+      due = mExpiration - renewBefore;
+   }
+   if (isFailureRecent(now))
+      due = std::max(due, mLastFailure + sRetryAfterFailure);
+   if (now < due)
+      return std::chrono::ceil<std::chrono::milliseconds>(due - now);
+   if (mFetching)
+      return sRenewalCheckInterval; // a caller is fetching, its token is checked by the next run
+
+   std::shared_ptr<Fetch> fetch = beginFetch();
+   if (!fetch)
+      return sRenewalCheckInterval;
+   lock.unlock();
+   Logger::Session session = gLogger.getSession();
+   requestTokenAsync(fetch).then([this, fetch, session](bool success)
+      {
+         gLogger.resumeSession(session);
+         std::lock_guard<std::mutex> completionLock(mMutex);
+         completeFetch(*fetch, success);
+      });
+   return sRenewalCheckInterval;
+}
+
+bool TokenProvider::isFailureRecent(std::chrono::steady_clock::time_point now) const
+{
+   return mLastFailure != std::chrono::steady_clock::time_point() && now - mLastFailure < sRetryAfterFailure;
+}
+
+/**
+* The token is kept encrypted, it is decrypted only for building a request.
+*/
+void TokenProvider::store(const ut::string_t& token)
+{
+   clear();
+   size_t bytes = token.size() * sizeof(token[0]);
+   size_t padded = (bytes / CRYPTPROTECTMEMORY_BLOCK_SIZE + 1) * CRYPTPROTECTMEMORY_BLOCK_SIZE;
+   std::vector<unsigned char> blob(padded, 0);
+   memcpy(blob.data(), token.data(), bytes);
+   if (!CryptProtectMemory(blob.data(), static_cast<DWORD>(padded), CRYPTPROTECTMEMORY_SAME_PROCESS))
+   {
+      SecureZeroMemory(blob.data(), padded);
+      gLogger.log(Logger::ERROR(), "The IdM token can't be stored, CryptProtectMemory failed with the error %u", GetLastError());
+      return;
+   }
+   mProtectedToken = std::move(blob);
+   mTokenLength = token.size();
+}
+
+ut::string_t TokenProvider::load() const
+{
+   if (mProtectedToken.empty())
+      return ut::string_t();
+
+   std::vector<unsigned char> plain(mProtectedToken);
+   if (!CryptUnprotectMemory(plain.data(), static_cast<DWORD>(plain.size()), CRYPTPROTECTMEMORY_SAME_PROCESS))
+   {
+      gLogger.log(Logger::ERROR(), "The IdM token can't be read, CryptUnprotectMemory failed with the error %u", GetLastError());
+      return ut::string_t();
+   }
+   ut::string_t token(reinterpret_cast<const ut::char_t*>(plain.data()), mTokenLength);
+   SecureZeroMemory(plain.data(), plain.size());
+   return token;
+}
+
+void TokenProvider::clear()
+{
+   SecureZeroMemory(mProtectedToken.data(), mProtectedToken.size());
+   mProtectedToken.clear();
+   mTokenLength = 0;
+   mObtained = std::chrono::steady_clock::time_point();
+   mExpiration = std::chrono::steady_clock::time_point();
+}
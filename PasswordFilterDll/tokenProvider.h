@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cpprest/json.h>
+#include <ppltasks.h>
+
+namespace ut = utility;
+namespace wj = web::json;
+namespace cnc = concurrency;
+
+
+/**
+* TokenSettings holds the "tokenAuthentication" configuration object.
+* It is immutable, a configuration reload replaces it as a whole.
+*/
+class TokenSettings
+{
+private:
+   // JSON keys
+   static inline const ut::string_t sEnabledKey{ U("enabled") };
+   static inline const ut::string_t sUrlKey{ U("url") };
+   static inline const ut::string_t sUsernameKey{ U("username") };
+   static inline const ut::string_t sPasswordKey{ U("password") };
+   static inline const ut::string_t sTokenFieldKey{ U("tokenField") };
+   static inline const ut::string_t sLifetimeSecKey{ U("lifetimeSec") };
+   static inline const ut::string_t sRenewBeforeSecKey{ U("renewBeforeSec") };
+
+   bool mEnabled = false;
+   ut::string_t mUrl;
+   ut::string_t mUsername;
+   ut::string_t mPassword;
+   ut::string_t mTokenField{ U("token") };
+   uint32_t mLifetimeSec = 600;
+   uint32_t mRenewBeforeSec = 60;
+
+public:
+   ~TokenSettings();
+   static std::shared_ptr<const TokenSettings> create(const wj::value* tokenObj); // throws wj::json_exception
+   static const ut::string_t& getPasswordKey() { return sPasswordKey; }
+
+   bool getEnabled() const { return mEnabled; }
+   const ut::string_t& getUrl() const { return mUrl; }
+   const ut::string_t& getUsername() const { return mUsername; }
+   const ut::string_t& getPassword() const { return mPassword; }
+   const ut::string_t& getTokenField() const { return mTokenField; }
+   uint32_t getLifetimeSec() const { return mLifetimeSec; }
+   uint32_t getRenewBeforeSec() const { return mRenewBeforeSec; }
+   void printContent() const;
+};
+
+/**
+* TokenProvider supplies the CIDMST token sent with every IdM request.
+* Without tokenAuthentication it is the static token of the configuration file.
+* With it, a short-lived token is obtained from the auth endpoint and kept encrypted by CryptProtectMemory:
+* - a Housekeeper job renews the token renewBeforeSec before it expires, so calls don't wait for it;
+*   the job only starts the request, its answer is handled by a continuation
+* - a 401 answered to a request triggers one refresh shared by all concurrent requests which used the same token;
+*   every token has a generation number and only the first caller reporting the current generation fetches a new one
+* - a failed fetch is not repeated sooner than sRetryAfterFailure, an unreachable auth endpoint isn't hammered
+*/
+class TokenProvider
+{
+private:
+   static constexpr std::chrono::seconds sRetryAfterFailure{ 10 };
+   static constexpr std::chrono::seconds sRenewalCheckInterval{ 1 }; // while a fetch is running
+
+   /**
+   * Fetch is the state of one token request, the token is wiped with it.
+   */
+   struct Fetch
+   {
+      std::shared_ptr<const TokenSettings> mSettings;
+      ut::string_t mToken;
+      uint32_t mLifetimeSec = 0;
+
+      ~Fetch();
+   };
+
+   std::atomic<bool> mEnabled = false;
+   std::shared_ptr<const TokenSettings> mSettings; // guarded by mMutex
+   std::mutex mMutex; // guards everything below
+   std::condition_variable mFetchCondition;
+   bool mFetching = false; // a fetch is running with mMutex unlocked
+   std::vector<unsigned char> mProtectedToken; // CryptProtectMemory blob, padded to the block size
+   size_t mTokenLength = 0; // in characters
+   uint64_t mGeneration = 0; // 0 = no token obtained yet
+   std::chrono::steady_clock::time_point mObtained;
+   std::chrono::steady_clock::time_point mExpiration;
+   std::chrono::steady_clock::time_point mLastFailure;
+   bool mRenewalScheduled = false;
+
+   bool fetch(std::unique_lock<std::mutex>& lock);
+   std::shared_ptr<Fetch> beginFetch();
+   bool completeFetch(const Fetch& fetch, bool success);
+   static cnc::task<bool> requestTokenAsync(std::shared_ptr<Fetch> fetch);
+   void store(const ut::string_t& token);
+   ut::string_t load() const;
+   void clear();
+   bool isFailureRecent(std::chrono::steady_clock::time_point now) const;
+   std::chrono::milliseconds renew();
+
+public:
+   void reconfigure(std::shared_ptr<const TokenSettings> settings);
+   bool isEnabled() const { return mEnabled.load(std::memory_order_acquire); }
+   ut::string_t getToken(uint64_t& generation);
+   bool refreshAfterUnauthorized(uint64_t generation);
+   int64_t getSecondsToExpiration();
+};
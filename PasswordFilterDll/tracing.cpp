@@ -0,0 +1,60 @@
+#include "pch.h"
+#include "tracing.h"
+#include "logger.h"
+
+
+/****Global objects****/
+extern Logger gLogger;
+
+// {7c4f2b9e-1d3a-4e6b-8f25-9a0c3d5e7b41}
+TRACELOGGING_DEFINE_PROVIDER(gTraceProvider, "CzechIdM-PasswordFilter",
+   (0x7c4f2b9e, 0x1d3a, 0x4e6b, 0x8f, 0x25, 0x9a, 0x0c, 0x3d, 0x5e, 0x7b, 0x41));
+
+/**
+* registerProvider is called once by the initialization of the filter, not in DllMain.
+* A failed registration leaves the tracepoints disabled.
+*/
+void Tracing::registerProvider()
+{
+   HRESULT result = TraceLoggingRegister(gTraceProvider);
+   if (FAILED(result))
+      gLogger.log(Logger::WARN(), "The ETW provider can't be registered, error 0x%08x. Tracing is not available", static_cast<unsigned>(result));
+}
+
+void Tracing::unregisterProvider()
+{
+   TraceLoggingUnregister(gTraceProvider); // no-op when not registered
+}
+
+uint32_t Tracing::getSessionId()
+{
+   return static_cast<uint32_t>(gLogger.getSessionIdValue());
+}
+
+///////////////// Tracing::DecisionScope //////////////////////////////
+
+thread_local const char* Tracing::DecisionScope::sLastReason = "";
+
+Tracing::DecisionScope::DecisionScope(const char* entryPoint)
+   : mEntryPoint(entryPoint)
+{
+   if (!isEnabled())
+      return;
+
+   mActive = true;
+   mStart = std::chrono::steady_clock::now();
+   PWF_TRACE("EntryPointStart", TraceLoggingString(mEntryPoint, "EntryPoint"));
+}
+
+Tracing::DecisionScope::~DecisionScope()
+{
+   sLastReason = mReason;
+   if (!mActive)
+      return;
+
+   PWF_TRACE("EntryPointStop",
+      TraceLoggingString(mEntryPoint, "EntryPoint"),
+      TraceLoggingString(mReason, "Reason"),
+      TraceLoggingBoolean(mDecision, "Decision"),
+      TraceLoggingUInt32(elapsedUs(mStart), "DurationUs"));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(gTraceProvider);
+
+/**
+* PWF_TRACE writes an ETW TraceLogging event of the "CzechIdM-PasswordFilter" provider
+* {7c4f2b9e-1d3a-4e6b-8f25-9a0c3d5e7b41}. TraceLoggingWrite tests the enable flag of the provider first,
+* so a tracepoint nobody listens to costs a single branch and its arguments are not evaluated.
+* Every event carries the SessionId of the log, so a trace can be joined with the log file.
+* Collect with standard tools, e.g.:
+*   wpr -start Resources\PasswordFilterTrace.wprp  ...  wpr -stop pwf.etl
+*   tracelog -start pwf -guid #7c4f2b9e-1d3a-4e6b-8f25-9a0c3d5e7b41 -f pwf.etl
+*/
+#define PWF_TRACE(eventName, ...) TraceLoggingWrite(gTraceProvider, eventName, TraceLoggingUInt32(Tracing::getSessionId(), "SessionId"), __VA_ARGS__)
+
+/**
+* Tracing registers the provider and provides helpers for tracepoints which span several statements.
+*/
+class Tracing
+{
+public:
+   static void registerProvider();
+   static void unregisterProvider();
+   static bool isEnabled() { return TraceLoggingProviderEnabled(gTraceProvider, 0, 0); }
+   static uint32_t getSessionId();
+   static uint32_t elapsedUs(std::chrono::steady_clock::time_point start)
+   {
+      return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+   }
+
+   /**
+   * DecisionScope traces the end of an entry point with its decision, the reason of the decision and the duration.
+   * Nothing is measured when the provider is disabled. The reason is kept for the thread, see GetLastDecisionReason.
+   */
+   class DecisionScope
+   {
+   private:
+      thread_local static const char* sLastReason;
+
+      const char* mEntryPoint;
+      const char* mReason = "exception";
+      bool mDecision = true;
+      bool mActive = false;
+      std::chrono::steady_clock::time_point mStart;
+
+   public:
+      DecisionScope(const char* entryPoint);
+      ~DecisionScope();
+      DecisionScope(const DecisionScope&) = delete;
+      DecisionScope& operator=(const DecisionScope&) = delete;
+      bool setResult(const char* reason, bool decision) { mReason = reason; mDecision = decision; return decision; }
+      const char* getReason() const { return mReason; }
+      bool getDecision() const { return mDecision; }
+      static const char* getLastReason() { return sLastReason; }
+   };
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+
+/**
+* TrafficAttempt describes one request sent to IdM within a recorded call.
+*/
+struct TrafficAttempt
+{
+   enum outcome : uint8_t
+   {
+      OUTCOME_RESPONSE = 0,         // http response received, mStatus holds its status
+      OUTCOME_EXCEPTION = 1,        // connection failure or timeout
+      OUTCOME_SECURITY_FAILURE = 2  // certificate / TLS failure
+   };
+
+   uint8_t mEndpointIdx = 0; // index within the endpoint group
+   uint8_t mOutcome = OUTCOME_RESPONSE;
+   uint16_t mStatus = 0;
+   uint32_t mLatencyUs = 0;
+};
+
+/**
+* TrafficRecord is one recorded PasswordFilter or PasswordChangeNotify call.
+* It is shared by the recorder in the DLL and the replay tool in PasswordFilterApp,
+* therefore it is header only.
+*
+* File layout: 8 bytes of sMagic followed by records. A record is
+*   u16 size of the rest of the record, u8 kind, u8 setOperation, u8 decision, u8 passwordLengthClass, u8 origin,
+*   u64 startUs (since epoch), u32 durationUs, u64 accountHash, u8 attemptCount,
+*   attemptCount * (u8 endpointIdx, u8 outcome, u16 status, u32 latencyUs)
+* All integers are little endian. No account name or password is stored, the account is a keyed hash
+* and the password only contributes its length class.
+*/
+struct TrafficRecord
+{
+   static constexpr char sMagic[8] = { 'P', 'W', 'F', 'T', 'R', 'C', '0', '2' };
+   static constexpr size_t sMaxAttempts = 255;
+
+   enum kind : uint8_t
+   {
+      KIND_PASSWORD_FILTER = 1,
+      KIND_PASSWORD_CHANGE_NOTIFY = 2
+   };
+
+   /**
+   * What decided the call, only the calls decided by IdM have attempts.
+   */
+   enum origin : uint8_t
+   {
+      ORIGIN_IDM = 0,
+      ORIGIN_IDM_UNRESOLVED = 1, // no endpoint answered, decided by allowChangeByDefault
+      ORIGIN_RESERVED_PREFIX = 2,
+      ORIGIN_LOCAL_RULE = 3,
+      ORIGIN_FORBIDDEN_WORD = 4,
+      ORIGIN_NEGATIVE_CACHE = 5,
+      ORIGIN_OFFLINE = 6
+   };
+
+   uint8_t mKind = KIND_PASSWORD_FILTER;
+   uint8_t mSetOperation = 0;
+   uint8_t mDecision = 0;
+   uint8_t mPasswordLengthClass = 0;
+   uint8_t mOrigin = ORIGIN_IDM;
+   uint64_t mStartUs = 0;
+   uint32_t mDurationUs = 0;
+   uint64_t mAccountHash = 0;
+   std::vector<TrafficAttempt> mAttempts;
+
+   /**
+   * Password lengths are stored only as classes: <8, 8-11, 12-15, 16-23, 24+
+   */
+   static uint8_t getPasswordLengthClass(size_t length)
+   {
+      if (length < 8) return 0;
+      if (length < 12) return 1;
+      if (length < 16) return 2;
+      if (length < 24) return 3;
+      return 4;
+   }
+
+   static size_t getPasswordLengthFromClass(uint8_t lengthClass)
+   {
+      static const size_t lengths[] = { 6, 10, 14, 20, 28 };
+      return lengths[lengthClass < 5 ? lengthClass : 4];
+   }
+
+   static void writeMagic(std::ostream& out)
+   {
+      out.write(sMagic, sizeof(sMagic));
+   }
+
+   static bool readMagic(std::istream& in)
+   {
+      char magic[sizeof(sMagic)] = {};
+      in.read(magic, sizeof(magic));
+      return in.good() && std::equal(magic, magic + sizeof(magic), sMagic);
+   }
+
+   void write(std::ostream& out) const
+   {
+      std::vector<uint8_t> buf;
+      append(buf);
+      out.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+   }
+
+   /**
+   * append serializes the record at the end of buf, the bytes are the ones written by write.
+   */
+   void append(std::vector<uint8_t>& buf) const
+   {
+      size_t begin = buf.size();
+      auto put = [&buf](uint64_t value, size_t bytes)
+      {
+         for (size_t i = 0; i < bytes; ++i)
+            buf.push_back(static_cast<uint8_t>(value >> (8 * i)));
+      };
+      size_t attemptCount = mAttempts.size() < sMaxAttempts ? mAttempts.size() : sMaxAttempts;
+      put(0, 2); // size placeholder
+      put(mKind, 1);
+      put(mSetOperation, 1);
+      put(mDecision, 1);
+      put(mPasswordLengthClass, 1);
+      put(mOrigin, 1);
+      put(mStartUs, 8);
+      put(mDurationUs, 4);
+      put(mAccountHash, 8);
+      put(attemptCount, 1);
+      for (size_t i = 0; i < attemptCount; ++i)
+      {
+         const TrafficAttempt& attempt = mAttempts[i];
+         put(attempt.mEndpointIdx, 1);
+         put(attempt.mOutcome, 1);
+         put(attempt.mStatus, 2);
+         put(attempt.mLatencyUs, 4);
+      }
+      size_t size = buf.size() - begin - 2;
+      buf[begin] = static_cast<uint8_t>(size);
+      buf[begin + 1] = static_cast<uint8_t>(size >> 8);
+   }
+
+   bool read(std::istream& in)
+   {
+      uint8_t sizeBuf[2];
+      if (!in.read(reinterpret_cast<char*>(sizeBuf), 2))
+         return false;
+      size_t size = sizeBuf[0] | (sizeBuf[1] << 8);
+      std::vector<uint8_t> buf(size);
+      if (size < 26 || !in.read(reinterpret_cast<char*>(buf.data()), size))
+         return false;
+
+      size_t pos = 0;
+      auto get = [&buf, &pos](size_t bytes)
+      {
+         uint64_t value = 0;
+         for (size_t i = 0; i < bytes; ++i)
+            value |= static_cast<uint64_t>(buf[pos++]) << (8 * i);
+         return value;
+      };
+      mKind = static_cast<uint8_t>(get(1));
+      mSetOperation = static_cast<uint8_t>(get(1));
+      mDecision = static_cast<uint8_t>(get(1));
+      mPasswordLengthClass = static_cast<uint8_t>(get(1));
+      mOrigin = static_cast<uint8_t>(get(1));
+      mStartUs = get(8);
+      mDurationUs = static_cast<uint32_t>(get(4));
+      mAccountHash = get(8);
+      size_t attemptCount = static_cast<size_t>(get(1));
+      if (size != 26 + attemptCount * 8)
+         return false;
+      mAttempts.resize(attemptCount);
+      for (TrafficAttempt& attempt : mAttempts)
+      {
+         attempt.mEndpointIdx = static_cast<uint8_t>(get(1));
+         attempt.mOutcome = static_cast<uint8_t>(get(1));
+         attempt.mStatus = static_cast<uint16_t>(get(2));
+         attempt.mLatencyUs = static_cast<uint32_t>(get(4));
+      }
+      return true;
+   }
+};
@@ -0,0 +1,209 @@
+#include "pch.h"
+#include <bcrypt.h>
+#include "trafficRecorder.h"
+#include "housekeeper.h"
+#include "logger.h"
+
+#pragma comment(lib, "Bcrypt.lib")
+
+
+/****Global objects****/
+extern Logger gLogger;
+extern Housekeeper gHousekeeper;
+
+thread_local TrafficRecord* TrafficRecorder::sCurrentRecord = nullptr;
+
+///////////////// TrafficRecorder::Scope //////////////////////////////
+
+TrafficRecorder::Scope::Scope(TrafficRecorder& recorder, TrafficRecord::kind kind, const ut::string_t& accountName, size_t passwordLength, bool setOperation)
+   : mRecorder(recorder)
+{
+   if (!mRecorder.isEnabled())
+      return;
+
+   mActive = true;
+   mStart = std::chrono::steady_clock::now();
+   mRecord.mKind = kind;
+   mRecord.mSetOperation = setOperation ? 1 : 0;
+   mRecord.mPasswordLengthClass = TrafficRecord::getPasswordLengthClass(passwordLength);
+   mRecord.mStartUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+   mRecord.mAccountHash = mRecorder.hashAccount(accountName);
+   sCurrentRecord = &mRecord;
+}
+
+TrafficRecorder::Scope::~Scope()
+{
+   if (!mActive)
+      return;
+
+   sCurrentRecord = nullptr;
+   mRecord.mDurationUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStart).count());
+   try
+   {
+      mRecorder.write(mRecord);
+   }
+   catch (const std::exception& e)
+   {
+      gLogger.log(Logger::ERROR(), "Writing of the traffic record failed: %s", e.what());
+   }
+}
+
+///////////////// TrafficRecorder //////////////////////////////
+
+TrafficRecorder::~TrafficRecorder()
+{
+   // the records of the last flush interval, the tools exit right after their calls
+   std::lock_guard<std::mutex> lock(mFileMutex);
+   writePending();
+}
+
+/**
+* reconfigure is called on every configuration (re)load.
+* The salt is the HMAC key of the account hash, so the recording can't be joined with account names
+* by anybody who doesn't know it.
+*/
+void TrafficRecorder::reconfigure(bool enabled, const std::string& filePath, const ut::string_t& salt)
+{
+   std::lock_guard<std::mutex> lock(mFileMutex);
+   if (!enabled)
+   {
+      mEnabled.store(false);
+      writePending();
+      if (mFile.is_open())
+         mFile.close();
+      return;
+   }
+
+   std::string saltUtf8 = Logger::w2s(salt);
+   auto hashKey = std::make_shared<std::vector<unsigned char>>(saltUtf8.begin(), saltUtf8.end());
+   if (hashKey->empty())
+      hashKey->push_back(0);
+   std::atomic_store(&mHashKey, std::shared_ptr<const std::vector<unsigned char>>(std::move(hashKey)));
+
+   if (!mFile.is_open() || filePath != mFilePath)
+   {
+      writePending(); // to the previous file
+      if (mFile.is_open())
+         mFile.close();
+      std::error_code ec;
+      bool isNew = !fs::exists(filePath, ec) || fs::file_size(filePath, ec) == 0;
+      if (!isNew && !hasCurrentFormat(filePath))
+      {
+         // records of another format can't be appended, the recording is kept aside
+         fs::rename(filePath, filePath + ".old", ec);
+         isNew = !ec;
+         gLogger.log(Logger::WARN(), "The traffic recording file \"%s\" has an older format, it %s", filePath.c_str(),
+            ec ? "can't be renamed, the recording is disabled" : "is renamed to .old");
+         if (ec)
+         {
+            mEnabled.store(false);
+            return;
+         }
+      }
+      mFile.open(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+      if (mFile.fail())
+      {
+         mEnabled.store(false);
+         gLogger.log(Logger::ERROR(), "The traffic recording file \"%s\" can't be opened", filePath.c_str());
+         return;
+      }
+      if (isNew)
+         TrafficRecord::writeMagic(mFile);
+      mFilePath = filePath;
+      gLogger.log(Logger::INFO(), "Traffic is recorded to the file \"%s\"", filePath.c_str());
+   }
+   mEnabled.store(true);
+   if (!mFlushScheduled)
+   {
+      mFlushScheduled = true;
+      gHousekeeper.schedule("trafficFlush", sFlushInterval, [this]()
+         {
+            flush();
+            return sFlushInterval;
+         });
+   }
+}
+
+bool TrafficRecorder::hasCurrentFormat(const std::string& filePath)
+{
+   std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
+   return !in.fail() && TrafficRecord::readMagic(in);
+}
+
+void TrafficRecorder::recordAttempt(TrafficRecord* record, size_t endpointIdx, TrafficAttempt::outcome outcome, uint16_t status, std::chrono::steady_clock::duration latency)
+{
+   if (record == nullptr)
+      return;
+
+   TrafficAttempt attempt;
+   attempt.mEndpointIdx = static_cast<uint8_t>(endpointIdx < 255 ? endpointIdx : 255);
+   attempt.mOutcome = outcome;
+   attempt.mStatus = status;
+   attempt.mLatencyUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+   record->mAttempts.push_back(attempt);
+}
+
+/**
+* write only appends the record to the buffer, the calling thread never waits for the file.
+*/
+void TrafficRecorder::write(const TrafficRecord& record)
+{
+   std::lock_guard<std::mutex> lock(mPendingMutex);
+   if (mPending.size() >= sMaxPendingBytes)
+   {
+      ++mDropped;
+      return;
+   }
+   record.append(mPending);
+}
+
+/**
+* flush writes the buffered records to the file, it's run by the "trafficFlush" job and by the control channel.
+*/
+void TrafficRecorder::flush()
+{
+   std::lock_guard<std::mutex> lock(mFileMutex);
+   writePending();
+}
+
+/**
+* writePending is called with mFileMutex locked, the buffer is taken over so the callers aren't blocked by the file.
+*/
+void TrafficRecorder::writePending()
+{
+   std::vector<uint8_t> pending;
+   uint64_t dropped = 0;
+   {
+      std::lock_guard<std::mutex> lock(mPendingMutex);
+      pending.swap(mPending);
+      std::swap(dropped, mDropped);
+   }
+   if (dropped != 0)
+      gLogger.log(Logger::WARN(), "%llu traffic records were dropped, the recording file doesn't keep up", static_cast<unsigned long long>(dropped));
+   if (pending.empty() || !mFile.is_open())
+      return;
+   mFile.write(reinterpret_cast<const char*>(pending.data()), pending.size());
+   mFile.flush();
+}
+
+uint64_t TrafficRecorder::hashAccount(const ut::string_t& accountName)
+{
+   // account names are case insensitive in AD
+   ut::string_t lower;
+   lower.reserve(accountName.size());
+   for (auto ch : accountName)
+      lower.push_back(std::towlower(ch));
+   std::string input = Logger::w2s(lower);
+
+   unsigned char digest[32] = {};
+   std::shared_ptr<const std::vector<unsigned char>> key = std::atomic_load(&mHashKey);
+   NTSTATUS status = BCryptHash(BCRYPT_HMAC_SHA256_ALG_HANDLE, const_cast<PUCHAR>(key->data()), static_cast<ULONG>(key->size()),
+      reinterpret_cast<PUCHAR>(input.data()), static_cast<ULONG>(input.size()), digest, sizeof(digest));
+   if (!BCRYPT_SUCCESS(status))
+      return 0;
+
+   uint64_t hash = 0;
+   for (size_t i = 0; i < sizeof(hash); ++i)
+      hash |= static_cast<uint64_t>(digest[i]) << (8 * i);
+   return hash;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cpprest/json.h>
+#include "trafficRecord.h"
+
+namespace ut = utility;
+
+
+/**
+* TrafficRecorder writes an anonymized binary record (see TrafficRecord) of every PasswordFilter
+* and PasswordChangeNotify call when it is enabled by the "trafficRecorder" configuration object.
+* The records are used by "PasswordFilterApp replay" to re-drive the real traffic against a mock IdM.
+* The record being built belongs to the calling thread, attempts are added by IdmRestComm;
+* its continuations run on pool threads, so they take the record of the call when it starts.
+* A finished record is only appended to a buffer in memory, the "trafficFlush" housekeeping job writes the buffer
+* to the file every sFlushInterval. The records beyond sMaxPendingBytes are dropped and counted.
+*/
+class TrafficRecorder
+{
+private:
+   static constexpr std::chrono::milliseconds sFlushInterval{ 1000 };
+   static constexpr size_t sMaxPendingBytes = 1 << 20;
+
+   std::atomic<bool> mEnabled = false;
+   std::mutex mFileMutex; // guards the file and mFlushScheduled
+   std::ofstream mFile;
+   std::string mFilePath;
+   bool mFlushScheduled = false;
+   std::mutex mPendingMutex; // guards mPending and mDropped
+   std::vector<uint8_t> mPending; // serialized records not written yet
+   uint64_t mDropped = 0;
+   std::shared_ptr<const std::vector<unsigned char>> mHashKey = std::make_shared<const std::vector<unsigned char>>(1, 0);
+
+   thread_local static TrafficRecord* sCurrentRecord;
+
+   void write(const TrafficRecord& record);
+   void writePending();
+   static bool hasCurrentFormat(const std::string& filePath);
+   uint64_t hashAccount(const ut::string_t& accountName);
+
+public:
+   /**
+   * Scope records one entry point call. Nothing is recorded when the recorder is disabled.
+   */
+   class Scope
+   {
+   private:
+      TrafficRecorder& mRecorder;
+      bool mActive = false;
+      TrafficRecord mRecord;
+      std::chrono::steady_clock::time_point mStart;
+
+   public:
+      Scope(TrafficRecorder& recorder, TrafficRecord::kind kind, const ut::string_t& accountName, size_t passwordLength, bool setOperation);
+      ~Scope();
+      void setDecision(bool decision, TrafficRecord::origin origin)
+      {
+         mRecord.mDecision = decision ? 1 : 0;
+         mRecord.mOrigin = origin;
+      }
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+   };
+
+   ~TrafficRecorder();
+   void reconfigure(bool enabled, const std::string& filePath, const ut::string_t& salt);
+   void flush();
+   bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+   static TrafficRecord* getCurrentRecord() { return sCurrentRecord; }
+   static void recordAttempt(TrafficRecord* record, size_t endpointIdx, TrafficAttempt::outcome outcome, uint16_t status, std::chrono::steady_clock::duration latency);
+};
@@ -0,0 +1,526 @@
+#include "pch.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <aclapi.h>
+#include <sddl.h>
+#include "workerChannel.h"
+
+#pragma comment(lib, "Advapi32.lib")
+
+
+namespace
+{
+   constexpr uint32_t sMagic = 0x50574643; // "PWFC"
+   constexpr uint32_t sVersion = 1;
+   constexpr uint32_t sSlotMask = WorkerChannel::sSlotCount - 1;
+   constexpr DWORD sIdleWaitMs = 100; // the worker looks at the ring at least this often
+   constexpr const wchar_t* sSystemOnlySddl = L"O:SYD:P(A;;GA;;;SY)"; // owned by and accessible to LocalSystem only
+
+   enum slotState : uint32_t
+   {
+      STATE_FREE,
+      STATE_OWNED,     // the caller is writing the request
+      STATE_QUEUED,    // published into the ring
+      STATE_SERVING,   // taken by a worker thread
+      STATE_ANSWERED,  // the response is written
+      STATE_ABANDONED  // given up by one side, the other one frees it
+   };
+
+   uint32_t makeWord(uint32_t generation, slotState state) { return (generation << 8) | state; }
+   slotState getState(uint32_t word) { return static_cast<slotState>(word & 0xff); }
+   uint32_t getGeneration(uint32_t word) { return (word >> 8) & 0xffffff; }
+
+   struct SharedSlot
+   {
+      std::atomic<uint32_t> mWord; // generation << 8 | slotState
+      WorkerRequest mRequest;
+      WorkerResponse mResponse;
+   };
+
+   /**
+   * SharedLayout is the content of the shared memory, a new mapping is zero filled.
+   */
+   struct SharedLayout
+   {
+      uint32_t mMagic;
+      uint32_t mVersion;
+      std::atomic<uint32_t> mWorkerProcessId; // 0 = no worker
+      std::atomic<uint32_t> mTail; // next ticket of the callers
+      std::atomic<uint32_t> mHead; // next ticket of the worker, kept here for a restarted worker
+      std::atomic<uint32_t> mRing[WorkerChannel::sSlotCount]; // slot index + 1, 0 = not published yet
+      SharedSlot mSlots[WorkerChannel::sSlotCount];
+   };
+
+   static_assert(std::atomic<uint32_t>::is_always_lock_free, "the shared memory needs lock free atomics");
+
+   std::wstring getObjectName(const std::wstring& name, const wchar_t* suffix)
+   {
+      return name + L"." + suffix;
+   }
+
+   std::wstring getResponseEventName(const std::wstring& name, uint32_t slotIdx)
+   {
+      return name + L".Response." + std::to_wstring(slotIdx);
+   }
+
+   void wipe(WorkerRequest& request)
+   {
+      SecureZeroMemory(request.mPassword, sizeof(request.mPassword));
+      request.mPasswordLength = 0;
+   }
+
+   void freeSlot(SharedSlot& slot, uint32_t generation)
+   {
+      wipe(slot.mRequest);
+      slot.mWord.store(makeWord(generation, STATE_FREE));
+   }
+
+   bool isLocalSystem(PSID sid)
+   {
+      return sid != nullptr && IsValidSid(sid) && IsWellKnownSid(sid, WinLocalSystemSid);
+   }
+
+   /**
+   * Only a LocalSystem process can make LocalSystem the owner of the object it creates,
+   * the handle needs READ_CONTROL.
+   */
+   bool isOwnedBySystem(HANDLE object)
+   {
+      PSID owner = nullptr;
+      PSECURITY_DESCRIPTOR descriptor = nullptr;
+      if (GetSecurityInfo(object, SE_KERNEL_OBJECT, OWNER_SECURITY_INFORMATION, &owner, nullptr, nullptr, nullptr, &descriptor) != ERROR_SUCCESS)
+         return false;
+      bool system = isLocalSystem(owner);
+      LocalFree(descriptor);
+      return system;
+   }
+
+   /**
+   * The handle needs PROCESS_QUERY_LIMITED_INFORMATION.
+   */
+   bool isSystemProcess(HANDLE process)
+   {
+      HANDLE token = nullptr;
+      if (!OpenProcessToken(process, TOKEN_QUERY, &token))
+         return false;
+      DWORD size = 0;
+      GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+      std::vector<BYTE> buffer(size);
+      bool system = size > 0 && GetTokenInformation(token, TokenUser, buffer.data(), size, &size) &&
+         isLocalSystem(reinterpret_cast<TOKEN_USER*>(buffer.data())->User.Sid);
+      CloseHandle(token);
+      return system;
+   }
+}
+
+const char* WorkerChannel::getResultName(result value)
+{
+   switch (value)
+   {
+   case RESULT_OK: return "ok";
+   case RESULT_NO_WORKER: return "no worker";
+   case RESULT_BUSY: return "busy";
+   case RESULT_TIMEOUT: return "timeout";
+   case RESULT_FAILED: return "failed";
+   case RESULT_TOO_LONG: return "too long";
+   }
+   return "unknown";
+}
+
+///////////////// Client //////////////////////////////
+
+struct WorkerChannel::Client::Connection
+{
+   HANDLE mMapping = nullptr;
+   SharedLayout* mLayout = nullptr;
+   HANDLE mRequestEvent = nullptr;
+   HANDLE mResponseEvents[sSlotCount] = {};
+   HANDLE mWorkerProcess = nullptr;
+   uint32_t mWorkerProcessId = 0;
+   std::atomic<uint32_t> mNextSlot = 0; // where the search for a free slot starts
+
+   ~Connection()
+   {
+      for (HANDLE event : mResponseEvents)
+      {
+         if (event != nullptr)
+            CloseHandle(event);
+      }
+      if (mRequestEvent != nullptr)
+         CloseHandle(mRequestEvent);
+      if (mWorkerProcess != nullptr)
+         CloseHandle(mWorkerProcess);
+      if (mLayout != nullptr)
+         UnmapViewOfFile(mLayout);
+      if (mMapping != nullptr)
+         CloseHandle(mMapping);
+   }
+
+   bool isWorkerAlive() const
+   {
+      return mLayout->mWorkerProcessId.load() == mWorkerProcessId && WaitForSingleObject(mWorkerProcess, 0) == WAIT_TIMEOUT;
+   }
+};
+
+WorkerChannel::Client::Client(const std::wstring& name, bool systemOnly)
+   : mName(name), mSystemOnly(systemOnly)
+{
+}
+
+WorkerChannel::Client::~Client() = default;
+
+/**
+* connect returns the connection to the running worker or nullptr. A connection to a worker which has exited is
+* dropped; the objects are opened again at most once per sReconnectInterval, so a missing worker costs little.
+* With mSystemOnly nothing is written into the memory before its owner, the owners of the events and the account
+* of the worker process are checked.
+*/
+std::shared_ptr<WorkerChannel::Client::Connection> WorkerChannel::Client::connect()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   if (mConnection)
+   {
+      if (mConnection->isWorkerAlive())
+         return mConnection;
+      mConnection.reset(); // the calls in progress keep their copy until they end
+   }
+
+   auto now = std::chrono::steady_clock::now();
+   if (mAttempted && now - mLastAttempt < sReconnectInterval)
+      return nullptr;
+   mAttempted = true;
+   mLastAttempt = now;
+
+   auto connection = std::make_shared<Connection>();
+   connection->mMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE | READ_CONTROL, FALSE, getObjectName(mName, L"Map").c_str());
+   if (connection->mMapping == nullptr || (mSystemOnly && !isOwnedBySystem(connection->mMapping)))
+      return nullptr;
+   connection->mLayout = static_cast<SharedLayout*>(MapViewOfFile(connection->mMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(SharedLayout)));
+   if (connection->mLayout == nullptr || connection->mLayout->mMagic != sMagic || connection->mLayout->mVersion != sVersion)
+      return nullptr;
+
+   connection->mWorkerProcessId = connection->mLayout->mWorkerProcessId.load();
+   if (connection->mWorkerProcessId == 0)
+      return nullptr;
+   connection->mWorkerProcess = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, connection->mWorkerProcessId);
+   connection->mRequestEvent = OpenEventW(EVENT_MODIFY_STATE | READ_CONTROL, FALSE, getObjectName(mName, L"Request").c_str());
+   if (connection->mWorkerProcess == nullptr || connection->mRequestEvent == nullptr)
+      return nullptr;
+   if (mSystemOnly && (!isSystemProcess(connection->mWorkerProcess) || !isOwnedBySystem(connection->mRequestEvent)))
+      return nullptr;
+   for (uint32_t i = 0; i < sSlotCount; ++i)
+   {
+      connection->mResponseEvents[i] = OpenEventW(SYNCHRONIZE | READ_CONTROL, FALSE, getResponseEventName(mName, i).c_str());
+      if (connection->mResponseEvents[i] == nullptr || (mSystemOnly && !isOwnedBySystem(connection->mResponseEvents[i])))
+         return nullptr;
+   }
+   if (!connection->isWorkerAlive())
+      return nullptr;
+
+   mConnection = connection;
+   return connection;
+}
+
+/**
+* call hands the request over to the worker and waits for its response at most deadline.
+* It never blocks on the worker otherwise: no free slot or no worker is reported at once.
+*/
+WorkerChannel::result WorkerChannel::Client::call(const WorkerRequest& request, WorkerResponse& response, std::chrono::milliseconds deadline)
+{
+   if (request.mAccountLength > WorkerRequest::sMaxChars || request.mFullNameLength > WorkerRequest::sMaxChars ||
+      request.mPasswordLength > WorkerRequest::sMaxChars)
+      return RESULT_TOO_LONG;
+
+   std::shared_ptr<Connection> connection = connect();
+   if (!connection)
+      return RESULT_NO_WORKER;
+   SharedLayout& layout = *connection->mLayout;
+
+   uint32_t slotIdx = 0;
+   uint32_t generation = 0;
+   bool claimed = false;
+   uint32_t start = connection->mNextSlot.fetch_add(1);
+   for (uint32_t i = 0; i < sSlotCount && !claimed; ++i)
+   {
+      slotIdx = (start + i) & sSlotMask;
+      uint32_t word = layout.mSlots[slotIdx].mWord.load();
+      if (getState(word) != STATE_FREE)
+         continue;
+      generation = (getGeneration(word) + 1) & 0xffffff;
+      claimed = layout.mSlots[slotIdx].mWord.compare_exchange_strong(word, makeWord(generation, STATE_OWNED));
+   }
+   if (!claimed)
+      return RESULT_BUSY;
+
+   SharedSlot& slot = layout.mSlots[slotIdx];
+   slot.mRequest = request;
+   slot.mWord.store(makeWord(generation, STATE_QUEUED));
+   uint32_t ticket = layout.mTail.fetch_add(1);
+   layout.mRing[ticket & sSlotMask].store(slotIdx + 1);
+   SetEvent(connection->mRequestEvent);
+
+   auto until = std::chrono::steady_clock::now() + deadline;
+   while (true)
+   {
+      uint32_t word = slot.mWord.load();
+      if (getGeneration(word) != generation || getState(word) == STATE_FREE)
+         return RESULT_FAILED; // taken over, can't happen while the protocol is kept
+      if (getState(word) == STATE_ANSWERED)
+      {
+         response = slot.mResponse;
+         freeSlot(slot, generation);
+         return RESULT_OK;
+      }
+      if (getState(word) == STATE_ABANDONED)
+      {
+         freeSlot(slot, generation);
+         return RESULT_FAILED;
+      }
+
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(until - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0)
+         break;
+      WaitForSingleObject(connection->mResponseEvents[slotIdx], static_cast<DWORD>(remaining.count())); // a stale signal just loops
+   }
+
+   uint32_t word = slot.mWord.load();
+   while (getGeneration(word) == generation)
+   {
+      slotState state = getState(word);
+      if (state == STATE_ANSWERED)
+      {  // answered just in time
+         response = slot.mResponse;
+         freeSlot(slot, generation);
+         return RESULT_OK;
+      }
+      if (state == STATE_ABANDONED)
+      {
+         freeSlot(slot, generation);
+         break;
+      }
+      if (state == STATE_FREE || slot.mWord.compare_exchange_strong(word, makeWord(generation, STATE_ABANDONED)))
+         break;
+   }
+   return RESULT_TIMEOUT;
+}
+
+///////////////// Server //////////////////////////////
+
+struct WorkerChannel::Server::Objects
+{
+   HANDLE mMapping = nullptr;
+   SharedLayout* mLayout = nullptr;
+   HANDLE mRequestEvent = nullptr;
+   HANDLE mResponseEvents[sSlotCount] = {};
+
+   ~Objects()
+   {
+      if (mLayout != nullptr)
+      {
+         mLayout->mWorkerProcessId.store(0); // the callers stop at once
+         UnmapViewOfFile(mLayout);
+      }
+      for (HANDLE event : mResponseEvents)
+      {
+         if (event != nullptr)
+            CloseHandle(event);
+      }
+      if (mRequestEvent != nullptr)
+         CloseHandle(mRequestEvent);
+      if (mMapping != nullptr)
+         CloseHandle(mMapping);
+   }
+};
+
+WorkerChannel::Server::Server(const std::wstring& name, bool systemOnly)
+   : mName(name), mObjects(std::make_unique<Objects>())
+{
+   PSECURITY_DESCRIPTOR descriptor = nullptr;
+   if (systemOnly && !ConvertStringSecurityDescriptorToSecurityDescriptorW(sSystemOnlySddl, SDDL_REVISION_1, &descriptor, nullptr))
+      throw std::runtime_error("the security descriptor can't be created, error " + std::to_string(GetLastError()));
+   SECURITY_ATTRIBUTES sa{ sizeof(SECURITY_ATTRIBUTES), descriptor, FALSE };
+   LPSECURITY_ATTRIBUTES attributes = descriptor != nullptr ? &sa : nullptr;
+
+   mObjects->mMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, attributes, PAGE_READWRITE, 0, sizeof(SharedLayout), getObjectName(mName, L"Map").c_str());
+   DWORD mappingError = GetLastError();
+   mObjects->mRequestEvent = CreateEventW(attributes, FALSE, FALSE, getObjectName(mName, L"Request").c_str());
+   for (uint32_t i = 0; i < sSlotCount && mObjects->mRequestEvent != nullptr; ++i)
+   {
+      mObjects->mResponseEvents[i] = CreateEventW(attributes, FALSE, FALSE, getResponseEventName(mName, i).c_str());
+      if (mObjects->mResponseEvents[i] == nullptr)
+         break;
+   }
+   DWORD eventError = GetLastError();
+   if (descriptor != nullptr)
+      LocalFree(descriptor);
+   if (mObjects->mMapping == nullptr)
+      throw std::runtime_error("the shared memory can't be created, error " + std::to_string(mappingError));
+   if (mObjects->mRequestEvent == nullptr || mObjects->mResponseEvents[sSlotCount - 1] == nullptr)
+      throw std::runtime_error("the events can't be created, error " + std::to_string(eventError));
+   if (systemOnly)
+   {  // an existing object created by another account is never used
+      bool owned = isOwnedBySystem(mObjects->mMapping) && isOwnedBySystem(mObjects->mRequestEvent);
+      for (uint32_t i = 0; i < sSlotCount && owned; ++i)
+         owned = isOwnedBySystem(mObjects->mResponseEvents[i]);
+      if (!owned)
+         throw std::runtime_error("the shared objects exist and are not owned by LocalSystem");
+   }
+
+   mObjects->mLayout = static_cast<SharedLayout*>(MapViewOfFile(mObjects->mMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(SharedLayout)));
+   if (mObjects->mLayout == nullptr)
+      throw std::runtime_error("the shared memory can't be mapped, error " + std::to_string(GetLastError()));
+   SharedLayout& layout = *mObjects->mLayout;
+
+   if (mappingError == ERROR_ALREADY_EXISTS && layout.mMagic == sMagic && layout.mVersion == sVersion)
+   {  // the callers have kept the memory of the previous worker
+      uint32_t previousId = layout.mWorkerProcessId.load();
+      HANDLE previous = previousId != 0 ? OpenProcess(SYNCHRONIZE, FALSE, previousId) : nullptr;
+      bool running = previous != nullptr && WaitForSingleObject(previous, 0) == WAIT_TIMEOUT;
+      if (previous != nullptr)
+         CloseHandle(previous);
+      if (running)
+      {
+         mObjects->mLayout = nullptr; // leaves the running worker its process id
+         UnmapViewOfFile(&layout);
+         throw std::runtime_error("another worker is running, process " + std::to_string(previousId));
+      }
+
+      // the slots being served by the previous worker are given up, the abandoned ones not in the ring are freed
+      bool queued[sSlotCount] = {};
+      for (uint32_t ticket = layout.mHead.load(); ticket != layout.mTail.load(); ++ticket)
+      {
+         uint32_t entry = layout.mRing[ticket & sSlotMask].load();
+         if (entry != 0)
+            queued[entry - 1] = true;
+      }
+      for (uint32_t i = 0; i < sSlotCount; ++i)
+      {
+         SharedSlot& slot = layout.mSlots[i];
+         uint32_t word = slot.mWord.load();
+         if (getState(word) == STATE_SERVING)
+            slot.mWord.compare_exchange_strong(word, makeWord(getGeneration(word), STATE_ABANDONED));
+         else if (getState(word) == STATE_ABANDONED && !queued[i] && slot.mWord.compare_exchange_strong(word, makeWord(getGeneration(word), STATE_FREE)))
+            wipe(slot.mRequest);
+      }
+   }
+   else if (mappingError != ERROR_ALREADY_EXISTS)
+   {
+      layout.mMagic = sMagic;
+      layout.mVersion = sVersion;
+   }
+   else
+   {
+      mObjects->mLayout = nullptr;
+      UnmapViewOfFile(&layout);
+      throw std::runtime_error("the shared memory has an unknown layout");
+   }
+   layout.mWorkerProcessId.store(GetCurrentProcessId());
+}
+
+WorkerChannel::Server::~Server() = default;
+
+/**
+* run reads the ring on the calling thread and serves the requests on threads, until stopEvent is signalled.
+* The requests already taken from the ring are served before it returns.
+*/
+void WorkerChannel::Server::run(HANDLE stopEvent, size_t threads, const handler& serve)
+{
+   std::mutex mutex;
+   std::condition_variable condition;
+   std::deque<uint32_t> pending; // slot indexes
+   bool stopping = false;
+
+   std::vector<std::thread> servers;
+   for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+   {
+      servers.emplace_back([&]()
+         {
+            while (true)
+            {
+               uint32_t slotIdx;
+               {
+                  std::unique_lock<std::mutex> lock(mutex);
+                  condition.wait(lock, [&]() { return stopping || !pending.empty(); });
+                  if (pending.empty())
+                     return;
+                  slotIdx = pending.front();
+                  pending.pop_front();
+               }
+               serveSlot(slotIdx, serve);
+            }
+         });
+   }
+
+   SharedLayout& layout = *mObjects->mLayout;
+   HANDLE events[] = { stopEvent, mObjects->mRequestEvent };
+   while (true)
+   {
+      uint32_t head = layout.mHead.load();
+      uint32_t entry = head != layout.mTail.load() ? layout.mRing[head & sSlotMask].exchange(0) : 0;
+      if (entry != 0)
+      {
+         layout.mHead.store(head + 1);
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(entry - 1);
+         }
+         condition.notify_one();
+         continue;
+      }
+      // the ring is empty or the next caller has its ticket but hasn't published yet, it signals then
+      if (WaitForMultipleObjects(2, events, FALSE, sIdleWaitMs) == WAIT_OBJECT_0)
+         break;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   condition.notify_all();
+   for (std::thread& server : servers)
+      server.join();
+}
+
+void WorkerChannel::Server::serveSlot(uint32_t slotIdx, const handler& serve)
+{
+   SharedSlot& slot = mObjects->mLayout->mSlots[slotIdx];
+   uint32_t word = slot.mWord.load();
+   while (true)
+   {
+      if (getState(word) == STATE_QUEUED)
+      {
+         if (slot.mWord.compare_exchange_strong(word, makeWord(getGeneration(word), STATE_SERVING)))
+            break;
+         continue;
+      }
+      if (getState(word) == STATE_ABANDONED)
+         freeSlot(slot, getGeneration(word)); // the caller has given up while it was queued
+      return;
+   }
+   const uint32_t generation = getGeneration(word);
+
+   WorkerRequest request = slot.mRequest;
+   wipe(slot.mRequest);
+   WorkerResponse response;
+   bool served = false;
+   try
+   {
+      serve(request, response);
+      served = true;
+   }
+   catch (...)
+   {
+      // the caller gets RESULT_FAILED
+   }
+   wipe(request);
+
+   slot.mResponse = response;
+   word = makeWord(generation, STATE_SERVING);
+   if (slot.mWord.compare_exchange_strong(word, makeWord(generation, served ? STATE_ANSWERED : STATE_ABANDONED)))
+      SetEvent(mObjects->mResponseEvents[slotIdx]);
+   else
+      freeSlot(slot, generation); // abandoned by the caller, the response is dropped
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+* WorkerRequest is one entry point call handed over to the network worker, the strings are in UTF-16 as LSA passes them.
+*/
+struct WorkerRequest
+{
+   enum kind : uint32_t
+   {
+      KIND_PASSWORD_FILTER,
+      KIND_PASSWORD_CHANGE_NOTIFY,
+      KIND_ECHO // answered by the channel benchmark only
+   };
+
+   static constexpr size_t sMaxChars = 512; // per string, the longer calls are not forwarded
+
+   uint32_t mKind = KIND_PASSWORD_FILTER;
+   uint32_t mSessionId = 0; // log session of the caller, joins the logs of both processes
+   uint32_t mRelativeId = 0;
+   uint8_t mSetOperation = 0;
+   uint16_t mAccountLength = 0; // in characters
+   uint16_t mFullNameLength = 0;
+   uint16_t mPasswordLength = 0;
+   wchar_t mAccountName[sMaxChars];
+   wchar_t mFullName[sMaxChars];
+   wchar_t mPassword[sMaxChars];
+};
+
+struct WorkerResponse
+{
+   uint32_t mDecision = 0; // BOOLEAN of PasswordFilter
+   uint32_t mStatus = 0;   // NTSTATUS of PasswordChangeNotify
+};
+
+/**
+* WorkerChannel connects the filter in LSASS with the network worker process through shared memory, named
+* <name>.Map, and named events: one for the requests and one for the response of every slot.
+* - a caller claims a free slot, writes its request there and publishes the slot index into a ring of indexes
+*   (a ticket from one atomic counter, the ring has as many entries as there are slots so it can't overflow)
+* - the worker reads the ring in order, serves the request on one of its threads, writes the response into the slot
+*   and signals the event of the slot
+* - a caller waits for the response until its deadline and abandons the slot then; whoever finds the slot abandoned
+*   frees it, so a late response is dropped and a dead worker leaks no slot
+* The state and the generation of a slot are one atomic word, a caller never touches a slot reused in the meantime.
+* The password is wiped from the slot as soon as the worker has read it.
+* A restarted worker reopens the same memory while the callers hold it and serves the requests left in the ring.
+* With systemOnly both sides trust the objects only when LocalSystem owns them, which no other account can fake:
+* a process which has created the names first gets neither the passwords nor a say in the decisions.
+* The caller also checks that the worker process runs as LocalSystem.
+* It doesn't depend on the logger, the App compiles it too.
+*/
+class WorkerChannel
+{
+public:
+   static constexpr uint32_t sSlotCount = 64; // a power of two
+
+   enum result
+   {
+      RESULT_OK,
+      RESULT_NO_WORKER, // the worker is not running
+      RESULT_BUSY,      // all the slots are taken
+      RESULT_TIMEOUT,   // no response until the deadline
+      RESULT_FAILED,    // the worker has given up the request or has been restarted
+      RESULT_TOO_LONG   // the call doesn't fit into a request
+   };
+
+   static const char* getResultName(result value);
+
+   using handler = std::function<void(const WorkerRequest& request, WorkerResponse& response)>;
+
+   /**
+   * Client is the side of the callers, it connects to the worker lazily and reconnects when the worker restarts.
+   */
+   class Client
+   {
+   private:
+      struct Connection;
+
+      static constexpr std::chrono::seconds sReconnectInterval{ 1 };
+
+      std::wstring mName;
+      bool mSystemOnly;
+      std::mutex mMutex; // guards everything below
+      std::shared_ptr<Connection> mConnection;
+      std::chrono::steady_clock::time_point mLastAttempt;
+      bool mAttempted = false;
+
+      std::shared_ptr<Connection> connect();
+
+   public:
+      Client(const std::wstring& name, bool systemOnly);
+      ~Client();
+      Client(const Client&) = delete;
+      Client& operator=(const Client&) = delete;
+      const std::wstring& getName() const { return mName; }
+      result call(const WorkerRequest& request, WorkerResponse& response, std::chrono::milliseconds deadline);
+   };
+
+   /**
+   * Server is the side of the worker, it creates the shared objects and serves the requests on its threads until
+   * the stop event is signalled. With systemOnly the objects are owned by and accessible to LocalSystem only,
+   * existing objects of another owner are refused; otherwise they get the default security.
+   */
+   class Server
+   {
+   private:
+      struct Objects;
+
+      std::wstring mName;
+      std::unique_ptr<Objects> mObjects;
+
+      void serveSlot(uint32_t slotIdx, const handler& serve);
+
+   public:
+      Server(const std::wstring& name, bool systemOnly); // throws std::runtime_error
+      ~Server();
+      Server(const Server&) = delete;
+      Server& operator=(const Server&) = delete;
+      void run(HANDLE stopEvent, size_t threads, const handler& serve);
+   };
+};